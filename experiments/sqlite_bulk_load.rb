@@ -0,0 +1,32 @@
+#!/usr/bin/env ruby
+
+require 'benchmark'
+require 'tmpdir'
+require 'redleaf'
+require 'redleaf/store/sqlite'
+
+# Benchmark of loading statements into a Redleaf::SQLiteStore one at a time versus with
+# Redleaf::SQLiteStore#bulk_load. Pass the number of statements to load as the first
+# argument (default: 10000).
+
+EX = Redleaf::Namespace.new( 'http://example.org/bench#' )
+
+count = Integer( ARGV.shift || 10_000 )
+triples = (0...count).collect {|i| [ EX["item#{i}"], EX[:value], i ] }
+
+Benchmark.bm( 12 ) do |bench|
+	bench.report( "append:" ) do
+		store = Redleaf::SQLiteStore.new( File.join(Dir.tmpdir, "redleaf-bench-append.db") )
+		graph = Redleaf::Graph.new( store )
+		triples.each {|triple| graph << triple }
+		store.sync
+	end
+
+	bench.report( "bulk_load:" ) do
+		store = Redleaf::SQLiteStore.new( File.join(Dir.tmpdir, "redleaf-bench-bulk.db") )
+		store.bulk_load do |graph|
+			graph.append( *triples )
+		end
+	end
+end
+
@@ -0,0 +1,1183 @@
+/*
+ * Redleaf read-through caching storage
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#include "redleaf.h"
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ * -------------------------------------------------------------- */
+
+VALUE rleaf_cRedleafCachingStore;
+
+#define RLEAF_CACHE_NAME                "caching"
+#define RLEAF_CACHE_LABEL               "Read-through cache in front of another storage"
+
+/* How many results to cache by default, and the largest result that's cached */
+#define RLEAF_CACHE_DEFAULT_CAPACITY    1024
+#define RLEAF_CACHE_DEFAULT_MAX_RESULTS 1000
+
+/* The kinds of cached answers, which are the first byte of their keys */
+#define RLEAF_CACHE_FIND                'f'
+#define RLEAF_CACHE_CONTAINS            'c'
+
+/*
+ * A cached answer: the statements (and their contexts) that matched a find_statements
+ * +pattern+, or whether the storage contains the +pattern+ statement, in which case
+ * +count+ is 1 or 0 and there are no +statements+. Entries are shared with the streams
+ * reading them, so one can be evicted while it's being read.
+ */
+typedef struct rleaf_cache_entry {
+	unsigned char				*key;
+	size_t						keylen;
+	unsigned long				hash;
+	librdf_statement			*pattern;
+	long						count;
+	librdf_statement			**statements;
+	librdf_node					**contexts;
+	unsigned long				refs;
+	struct rleaf_cache_entry	*next;
+	struct rleaf_cache_entry	*newer, *older;
+} rleaf_CACHEENTRY;
+
+/*
+ * A caching storage's state. Entries are kept in a chained hash table keyed on their
+ * patterns, and in a list from the most to the least recently used. The +generation+ is
+ * bumped every time an entry is invalidated, so results read from the base while the
+ * storage was being changed aren't cached.
+ *
+ * +base_store+ is the Redleaf::Store of the base, whose cached size and fingerprint are
+ * forgotten whenever the cache writes through to it. It's only set while the
+ * Redleaf::CachingStore that created the cache is alive, since that's what keeps the base
+ * store from being garbage-collected.
+ */
+typedef struct rleaf_cache {
+	librdf_storage		*base;
+	rleaf_STORE			*base_store;
+	rleaf_CACHEENTRY	**buckets;
+	long				bucket_count;
+	rleaf_CACHEENTRY	*newest, *oldest;
+	long				entries, capacity, max_results;
+	unsigned long		generation;
+	unsigned long		hits, misses, evictions, invalidations;
+} rleaf_CACHE;
+
+/* A stream over a cached answer */
+typedef struct rleaf_cache_cursor {
+	librdf_storage		*storage;
+	rleaf_CACHEENTRY	*entry;
+	long				index;
+} rleaf_CACHECURSOR;
+
+/* A stream over the base that records what it reads, and caches it when it's done */
+typedef struct rleaf_cache_recorder {
+	librdf_storage		*storage;
+	rleaf_CACHE			*cache;
+	librdf_stream		*stream;
+	rleaf_CACHEENTRY	*entry;
+	long				capacity;
+	unsigned long		generation;
+} rleaf_CACHERECORDER;
+
+
+/* --------------------------------------------------------------
+ * Cache functions
+ * -------------------------------------------------------------- */
+
+/*
+ * Make the key for a cached answer of the given +kind+ about +pattern+, setting +keylen+
+ * to its length. Wildcard nodes are encoded as a zero length.
+ */
+static unsigned char *
+rleaf_cache_make_key( char kind, librdf_statement *pattern, size_t *keylen ) {
+	librdf_node *nodes[ 3 ];
+	size_t lengths[ 3 ], length = 1, offset = 1;
+	unsigned char *key;
+	int i;
+
+	nodes[0] = librdf_statement_get_subject( pattern );
+	nodes[1] = librdf_statement_get_predicate( pattern );
+	nodes[2] = librdf_statement_get_object( pattern );
+
+	for ( i = 0; i < 3; i++ ) {
+		lengths[i] = nodes[i] ? librdf_node_encode( nodes[i], NULL, 0 ) : 0;
+		length += sizeof(size_t) + lengths[i];
+	}
+
+	key = ALLOC_N( unsigned char, length );
+	key[0] = (unsigned char)kind;
+
+	for ( i = 0; i < 3; i++ ) {
+		MEMCPY( key + offset, &lengths[i], unsigned char, sizeof(size_t) );
+		offset += sizeof(size_t);
+		if ( lengths[i] ) librdf_node_encode( nodes[i], key + offset, lengths[i] );
+		offset += lengths[i];
+	}
+
+	*keylen = length;
+	return key;
+}
+
+
+/*
+ * FNV-1a hash of a cache key.
+ */
+static unsigned long
+rleaf_cache_hash_key( const unsigned char *key, size_t keylen ) {
+	unsigned long hash = 2166136261UL;
+	size_t i;
+
+	for ( i = 0; i < keylen; i++ ) {
+		hash ^= key[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+
+/*
+ * Create a new (unlinked) cache entry of the given +kind+ for +pattern+. The pattern is
+ * copied.
+ */
+static rleaf_CACHEENTRY *
+rleaf_cache_new_entry( char kind, librdf_statement *pattern ) {
+	rleaf_CACHEENTRY *entry = ALLOC( rleaf_CACHEENTRY );
+
+	entry->key        = rleaf_cache_make_key( kind, pattern, &entry->keylen );
+	entry->hash       = rleaf_cache_hash_key( entry->key, entry->keylen );
+	entry->pattern    = librdf_new_statement_from_statement( pattern );
+	entry->count      = 0;
+	entry->statements = NULL;
+	entry->contexts   = NULL;
+	entry->refs       = 1;
+	entry->next = entry->newer = entry->older = NULL;
+
+	return entry;
+}
+
+
+/*
+ * Release a reference to the given cache +entry+, freeing it if it was the last one.
+ */
+static void
+rleaf_cache_release_entry( rleaf_CACHEENTRY *entry ) {
+	long i;
+
+	if ( --entry->refs > 0 ) return;
+
+	if ( entry->statements ) {
+		for ( i = 0; i < entry->count; i++ ) {
+			librdf_free_statement( entry->statements[i] );
+			if ( entry->contexts[i] ) librdf_free_node( entry->contexts[i] );
+		}
+		xfree( entry->statements );
+		xfree( entry->contexts );
+	}
+
+	librdf_free_statement( entry->pattern );
+	xfree( entry->key );
+	xfree( entry );
+}
+
+
+/*
+ * Unlink the given +entry+ from the +cache+ and release the cache's reference to it.
+ */
+static void
+rleaf_cache_unlink( rleaf_CACHE *cache, rleaf_CACHEENTRY *entry ) {
+	rleaf_CACHEENTRY **link = &cache->buckets[ entry->hash % cache->bucket_count ];
+
+	while ( *link != entry ) link = &(*link)->next;
+	*link = entry->next;
+
+	if ( entry->newer ) entry->newer->older = entry->older;
+	else cache->newest = entry->older;
+	if ( entry->older ) entry->older->newer = entry->newer;
+	else cache->oldest = entry->newer;
+
+	cache->entries--;
+	rleaf_cache_release_entry( entry );
+}
+
+
+/*
+ * Make the given +entry+ the most recently used one in the +cache+.
+ */
+static void
+rleaf_cache_touch( rleaf_CACHE *cache, rleaf_CACHEENTRY *entry ) {
+	if ( cache->newest == entry ) return;
+
+	/* Unlink it from the LRU list... */
+	entry->newer->older = entry->older;
+	if ( entry->older ) entry->older->newer = entry->newer;
+	else cache->oldest = entry->newer;
+
+	/* ...and put it at the front */
+	entry->newer = NULL;
+	entry->older = cache->newest;
+	cache->newest->newer = entry;
+	cache->newest = entry;
+}
+
+
+/*
+ * Find the cached answer of the given +kind+ about +pattern+, and count it as a hit or a
+ * miss.
+ */
+static rleaf_CACHEENTRY *
+rleaf_cache_lookup( rleaf_CACHE *cache, char kind, librdf_statement *pattern ) {
+	rleaf_CACHEENTRY *entry;
+	unsigned char *key;
+	unsigned long hash;
+	size_t keylen;
+
+	if ( cache->capacity <= 0 ) {
+		cache->misses++;
+		return NULL;
+	}
+
+	key  = rleaf_cache_make_key( kind, pattern, &keylen );
+	hash = rleaf_cache_hash_key( key, keylen );
+
+	for ( entry = cache->buckets[hash % cache->bucket_count]; entry; entry = entry->next ) {
+		if ( entry->hash == hash && entry->keylen == keylen &&
+		     memcmp(entry->key, key, keylen) == 0 )
+			break;
+	}
+	xfree( key );
+
+	if ( entry ) {
+		cache->hits++;
+		rleaf_cache_touch( cache, entry );
+	} else {
+		cache->misses++;
+	}
+
+	return entry;
+}
+
+
+/*
+ * Add the given +entry+ to the +cache+, which takes over the caller's reference to it,
+ * evicting the least recently used entries to make room if necessary.
+ */
+static void
+rleaf_cache_insert( rleaf_CACHE *cache, rleaf_CACHEENTRY *entry ) {
+	rleaf_CACHEENTRY **bucket;
+
+	if ( cache->capacity <= 0 ) {
+		rleaf_cache_release_entry( entry );
+		return;
+	}
+
+	while ( cache->entries >= cache->capacity ) {
+		rleaf_cache_unlink( cache, cache->oldest );
+		cache->evictions++;
+	}
+
+	bucket = &cache->buckets[ entry->hash % cache->bucket_count ];
+	entry->next = *bucket;
+	*bucket = entry;
+
+	entry->newer = NULL;
+	entry->older = cache->newest;
+	if ( cache->newest ) cache->newest->newer = entry;
+	else cache->oldest = entry;
+	cache->newest = entry;
+
+	cache->entries++;
+}
+
+
+/*
+ * Drop every cached answer that +statement+ being added or removed could change.
+ */
+static void
+rleaf_cache_invalidate( rleaf_CACHE *cache, librdf_statement *statement ) {
+	rleaf_CACHEENTRY *entry = cache->newest, *older;
+
+	cache->generation++;
+
+	while ( entry ) {
+		older = entry->older;
+		if ( librdf_statement_match(statement, entry->pattern) ) {
+			rleaf_cache_unlink( cache, entry );
+			cache->invalidations++;
+		}
+		entry = older;
+	}
+}
+
+
+/*
+ * Drop every cached answer.
+ */
+static void
+rleaf_cache_clear( rleaf_CACHE *cache ) {
+	cache->generation++;
+	cache->invalidations += cache->entries;
+	while ( cache->newest ) rleaf_cache_unlink( cache, cache->newest );
+}
+
+
+/*
+ * Forget the cached size and fingerprint of the cache's base store, if it has one, before
+ * writing through to it.
+ */
+static void
+rleaf_cache_base_changing( rleaf_CACHE *cache ) {
+	if ( !cache->base_store ) return;
+
+	cache->base_store->fingerprint_valid = 0;
+	cache->base_store->size_valid        = 0;
+	cache->base_store->context_sizes     = Qnil;
+}
+
+
+/*
+ * Set the +base+ storage of the given caching +storage+.
+ */
+static void
+rleaf_cache_set_base( librdf_storage *storage, librdf_storage *base ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_clear( cache );
+	if ( base ) librdf_storage_add_reference( base );
+	if ( cache->base ) librdf_free_storage( cache->base );
+	cache->base = base;
+}
+
+
+/* --------------------------------------------------------------
+ * Cached-answer streams
+ * -------------------------------------------------------------- */
+
+/*
+ * librdf_stream is_end method.
+ */
+static int
+rleaf_cachecursor_is_end( void *context ) {
+	rleaf_CACHECURSOR *cursor = (rleaf_CACHECURSOR *)context;
+	return cursor->index >= cursor->entry->count;
+}
+
+
+/*
+ * librdf_stream next method.
+ */
+static int
+rleaf_cachecursor_next( void *context ) {
+	rleaf_CACHECURSOR *cursor = (rleaf_CACHECURSOR *)context;
+
+	if ( cursor->index < cursor->entry->count ) cursor->index++;
+	return cursor->index >= cursor->entry->count;
+}
+
+
+/*
+ * librdf_stream get method.
+ */
+static void *
+rleaf_cachecursor_get( void *context, int flags ) {
+	rleaf_CACHECURSOR *cursor = (rleaf_CACHECURSOR *)context;
+
+	if ( cursor->index >= cursor->entry->count ) return NULL;
+
+	switch ( flags ) {
+		case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+		return cursor->entry->statements[ cursor->index ];
+
+		case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+		return cursor->entry->contexts[ cursor->index ];
+
+		default:
+		return NULL;
+	}
+}
+
+
+/*
+ * librdf_stream finished method.
+ */
+static void
+rleaf_cachecursor_finished( void *context ) {
+	rleaf_CACHECURSOR *cursor = (rleaf_CACHECURSOR *)context;
+
+	rleaf_cache_release_entry( cursor->entry );
+	librdf_storage_remove_reference( cursor->storage );
+	xfree( cursor );
+}
+
+
+/*
+ * Return a new stream over the statements in the cached +entry+.
+ */
+static librdf_stream *
+rleaf_cachecursor_new_stream( librdf_storage *storage, rleaf_CACHEENTRY *entry ) {
+	rleaf_CACHECURSOR *cursor = ALLOC( rleaf_CACHECURSOR );
+	librdf_stream *stream;
+
+	cursor->storage = storage;
+	cursor->entry   = entry;
+	cursor->index   = 0;
+
+	entry->refs++;
+	librdf_storage_add_reference( storage );
+
+	stream = librdf_new_stream( librdf_storage_get_world(storage), cursor,
+		rleaf_cachecursor_is_end, rleaf_cachecursor_next, rleaf_cachecursor_get,
+		rleaf_cachecursor_finished );
+
+	if ( !stream ) rleaf_cachecursor_finished( cursor );
+	return stream;
+}
+
+
+/* --------------------------------------------------------------
+ * Recording streams
+ * -------------------------------------------------------------- */
+
+/*
+ * Record the statement the recorder's base stream is on, or stop recording if the answer
+ * has got too big to cache.
+ */
+static void
+rleaf_cacherecorder_record( rleaf_CACHERECORDER *recorder ) {
+	rleaf_CACHEENTRY *entry = recorder->entry;
+	librdf_statement *statement;
+	librdf_node *context;
+
+	if ( !entry || librdf_stream_end(recorder->stream) ) return;
+
+	if ( entry->count >= recorder->cache->max_results ) {
+		rleaf_cache_release_entry( entry );
+		recorder->entry = NULL;
+		return;
+	}
+
+	if ( !(statement = librdf_stream_get_object(recorder->stream)) ) return;
+	context = (librdf_node *)librdf_stream_get_context( recorder->stream );
+
+	if ( entry->count == recorder->capacity ) {
+		recorder->capacity = recorder->capacity ? recorder->capacity * 2 : 16;
+		REALLOC_N( entry->statements, librdf_statement *, recorder->capacity );
+		REALLOC_N( entry->contexts, librdf_node *, recorder->capacity );
+	}
+
+	entry->statements[ entry->count ] = librdf_new_statement_from_statement( statement );
+	entry->contexts[ entry->count ]   = context ? librdf_new_node_from_node( context ) : NULL;
+	entry->count++;
+}
+
+
+/*
+ * librdf_stream is_end method.
+ */
+static int
+rleaf_cacherecorder_is_end( void *context ) {
+	rleaf_CACHERECORDER *recorder = (rleaf_CACHERECORDER *)context;
+	return librdf_stream_end( recorder->stream );
+}
+
+
+/*
+ * librdf_stream next method.
+ */
+static int
+rleaf_cacherecorder_next( void *context ) {
+	rleaf_CACHERECORDER *recorder = (rleaf_CACHERECORDER *)context;
+	int rval = librdf_stream_next( recorder->stream );
+
+	rleaf_cacherecorder_record( recorder );
+	return rval;
+}
+
+
+/*
+ * librdf_stream get method.
+ */
+static void *
+rleaf_cacherecorder_get( void *context, int flags ) {
+	rleaf_CACHERECORDER *recorder = (rleaf_CACHERECORDER *)context;
+
+	switch ( flags ) {
+		case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+		return librdf_stream_get_object( recorder->stream );
+
+		case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+		return librdf_stream_get_context( recorder->stream );
+
+		default:
+		return NULL;
+	}
+}
+
+
+/*
+ * librdf_stream finished method. The recorded answer is cached if the whole of it was
+ * read, and the storage wasn't changed while it was being read.
+ */
+static void
+rleaf_cacherecorder_finished( void *context ) {
+	rleaf_CACHERECORDER *recorder = (rleaf_CACHERECORDER *)context;
+
+	if ( recorder->entry ) {
+		if ( librdf_stream_end(recorder->stream) &&
+		     recorder->generation == recorder->cache->generation )
+			rleaf_cache_insert( recorder->cache, recorder->entry );
+		else
+			rleaf_cache_release_entry( recorder->entry );
+	}
+
+	librdf_free_stream( recorder->stream );
+	librdf_storage_remove_reference( recorder->storage );
+	xfree( recorder );
+}
+
+
+/*
+ * Return a new stream over the statements in the base of the caching +storage+ that match
+ * +pattern+, which caches them as they're read.
+ */
+static librdf_stream *
+rleaf_cacherecorder_new_stream( librdf_storage *storage, librdf_statement *pattern ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	rleaf_CACHERECORDER *recorder;
+	librdf_stream *base_stream, *stream;
+
+	if ( !(base_stream = librdf_storage_find_statements(cache->base, pattern)) ) return NULL;
+
+	recorder = ALLOC( rleaf_CACHERECORDER );
+	recorder->storage    = storage;
+	recorder->cache      = cache;
+	recorder->stream     = base_stream;
+	recorder->capacity   = 0;
+	recorder->generation = cache->generation;
+	recorder->entry      = cache->capacity > 0 ?
+		rleaf_cache_new_entry( RLEAF_CACHE_FIND, pattern ) : NULL;
+
+	librdf_storage_add_reference( storage );
+	rleaf_cacherecorder_record( recorder );
+
+	stream = librdf_new_stream( librdf_storage_get_world(storage), recorder,
+		rleaf_cacherecorder_is_end, rleaf_cacherecorder_next, rleaf_cacherecorder_get,
+		rleaf_cacherecorder_finished );
+
+	if ( !stream ) rleaf_cacherecorder_finished( recorder );
+	return stream;
+}
+
+
+/* --------------------------------------------------------------
+ * Storage module methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Storage init method. Caches start out without a base; Redleaf::CachingStore sets the
+ * real one after the storage is created. The 'capacity' option sets how many answers are
+ * cached, and 'max-results' the most statements a cached answer can have.
+ */
+static int
+rleaf_cache_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	rleaf_CACHE *cache = ALLOC( rleaf_CACHE );
+	long value;
+
+	_UNUSED( name );
+
+	cache->base        = NULL;
+	cache->base_store  = NULL;
+	cache->capacity    = RLEAF_CACHE_DEFAULT_CAPACITY;
+	cache->max_results = RLEAF_CACHE_DEFAULT_MAX_RESULTS;
+
+	if ( options ) {
+		if ( (value = librdf_hash_get_as_long(options, "capacity")) >= 0 )
+			cache->capacity = value;
+		if ( (value = librdf_hash_get_as_long(options, "max-results")) >= 0 )
+			cache->max_results = value;
+		librdf_free_hash( options );
+	}
+
+	cache->bucket_count = cache->capacity > 16 ? cache->capacity : 16;
+	cache->buckets = ALLOC_N( rleaf_CACHEENTRY *, cache->bucket_count );
+	MEMZERO( cache->buckets, rleaf_CACHEENTRY *, cache->bucket_count );
+
+	cache->newest = cache->oldest = NULL;
+	cache->entries    = 0;
+	cache->generation = 0;
+	cache->hits = cache->misses = cache->evictions = cache->invalidations = 0;
+
+	librdf_storage_set_instance( storage, cache );
+	return 0;
+}
+
+
+/*
+ * Storage clone method. The clone caches a clone of the base, and starts out empty.
+ */
+static int
+rleaf_cache_clone( librdf_storage *new_storage, librdf_storage *old_storage ) {
+	rleaf_CACHE *old = librdf_storage_get_instance( old_storage ), *cache;
+	librdf_storage *base;
+
+	if ( rleaf_cache_init(new_storage, NULL, NULL) != 0 ) return 1;
+	cache = librdf_storage_get_instance( new_storage );
+
+	/* Re-size the new cache's table to the old one's capacity */
+	xfree( cache->buckets );
+	cache->capacity     = old->capacity;
+	cache->max_results  = old->max_results;
+	cache->bucket_count = old->bucket_count;
+	cache->buckets = ALLOC_N( rleaf_CACHEENTRY *, cache->bucket_count );
+	MEMZERO( cache->buckets, rleaf_CACHEENTRY *, cache->bucket_count );
+
+	if ( old->base ) {
+		if ( !(base = librdf_new_storage_from_storage(old->base)) ) return 1;
+		if ( librdf_storage_open(base, NULL) != 0 ) {
+			librdf_free_storage( base );
+			return 1;
+		}
+
+		/* The cache takes its own reference to the base */
+		rleaf_cache_set_base( new_storage, base );
+		librdf_free_storage( base );
+	}
+
+	return 0;
+}
+
+
+/*
+ * Storage terminate method.
+ */
+static void
+rleaf_cache_terminate( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	if ( !cache ) return;
+
+	rleaf_cache_clear( cache );
+	xfree( cache->buckets );
+	if ( cache->base ) librdf_free_storage( cache->base );
+
+	xfree( cache );
+	librdf_storage_set_instance( storage, NULL );
+}
+
+
+/*
+ * Storage open method. The base storage is opened by its own store.
+ */
+static int
+rleaf_cache_open( librdf_storage *storage, librdf_model *model ) {
+	_UNUSED( storage );
+	_UNUSED( model );
+	return 0;
+}
+
+
+/*
+ * Storage close method.
+ */
+static int
+rleaf_cache_close( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage size method.
+ */
+static int
+rleaf_cache_size( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return cache->base ? librdf_storage_size( cache->base ) : 0;
+}
+
+
+/*
+ * Storage add_statement method.
+ */
+static int
+rleaf_cache_add_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_invalidate( cache, statement );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_add_statement( cache->base, statement );
+}
+
+
+/*
+ * Storage add_statements method. Adding a stream of statements drops every cached answer
+ * rather than checking them against each statement.
+ */
+static int
+rleaf_cache_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_clear( cache );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_add_statements( cache->base, stream );
+}
+
+
+/*
+ * Storage remove_statement method.
+ */
+static int
+rleaf_cache_remove_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_invalidate( cache, statement );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_remove_statement( cache->base, statement );
+}
+
+
+/*
+ * Storage contains_statement method.
+ */
+static int
+rleaf_cache_contains_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	rleaf_CACHEENTRY *entry;
+	int rval;
+
+	if ( (entry = rleaf_cache_lookup(cache, RLEAF_CACHE_CONTAINS, statement)) )
+		return entry->count;
+
+	rval = librdf_storage_contains_statement( cache->base, statement );
+
+	if ( cache->capacity > 0 ) {
+		entry = rleaf_cache_new_entry( RLEAF_CACHE_CONTAINS, statement );
+		entry->count = rval ? 1 : 0;
+		rleaf_cache_insert( cache, entry );
+	}
+
+	return rval;
+}
+
+
+/*
+ * Storage serialise method. Whole-storage streams aren't cached.
+ */
+static librdf_stream *
+rleaf_cache_serialise( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_serialise( cache->base );
+}
+
+
+/*
+ * Storage find_statements method.
+ */
+static librdf_stream *
+rleaf_cache_find_statements( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	rleaf_CACHEENTRY *entry;
+
+	if ( (entry = rleaf_cache_lookup(cache, RLEAF_CACHE_FIND, statement)) )
+		return rleaf_cachecursor_new_stream( storage, entry );
+
+	return rleaf_cacherecorder_new_stream( storage, statement );
+}
+
+
+/*
+ * Storage context_add_statement method.
+ */
+static int
+rleaf_cache_context_add_statement( librdf_storage *storage, librdf_node *context,
+	librdf_statement *statement )
+{
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_invalidate( cache, statement );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_context_add_statement( cache->base, context, statement );
+}
+
+
+/*
+ * Storage context_add_statements method.
+ */
+static int
+rleaf_cache_context_add_statements( librdf_storage *storage, librdf_node *context,
+	librdf_stream *stream )
+{
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_clear( cache );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_context_add_statements( cache->base, context, stream );
+}
+
+
+/*
+ * Storage context_remove_statement method.
+ */
+static int
+rleaf_cache_context_remove_statement( librdf_storage *storage, librdf_node *context,
+	librdf_statement *statement )
+{
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_invalidate( cache, statement );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_context_remove_statement( cache->base, context, statement );
+}
+
+
+/*
+ * Storage context_remove_statements method.
+ */
+static int
+rleaf_cache_context_remove_statements( librdf_storage *storage, librdf_node *context ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_clear( cache );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_context_remove_statements( cache->base, context );
+}
+
+
+/*
+ * Storage context_serialise method.
+ */
+static librdf_stream *
+rleaf_cache_context_serialise( librdf_storage *storage, librdf_node *context ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_context_as_stream( cache->base, context );
+}
+
+
+/*
+ * Storage find_statements_in_context method. Answers about single contexts aren't cached.
+ */
+static librdf_stream *
+rleaf_cache_find_statements_in_context( librdf_storage *storage, librdf_statement *statement,
+	librdf_node *context )
+{
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_find_statements_in_context( cache->base, statement, context );
+}
+
+
+/*
+ * Storage get_contexts method.
+ */
+static librdf_iterator *
+rleaf_cache_get_contexts( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_get_contexts( cache->base );
+}
+
+
+/*
+ * Storage get_feature method; the cache has the same features as its base.
+ */
+static librdf_node *
+rleaf_cache_get_feature( librdf_storage *storage, librdf_uri *feature ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return cache->base ? librdf_storage_get_feature( cache->base, feature ) : NULL;
+}
+
+
+/*
+ * Storage sync method.
+ */
+static int
+rleaf_cache_sync( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_sync( cache->base );
+}
+
+
+/*
+ * Storage transaction_start method.
+ */
+static int
+rleaf_cache_transaction_start( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_transaction_start( cache->base );
+}
+
+
+/*
+ * Storage transaction_commit method.
+ */
+static int
+rleaf_cache_transaction_commit( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+	return librdf_storage_transaction_commit( cache->base );
+}
+
+
+/*
+ * Storage transaction_rollback method. Answers cached during the transaction might
+ * include its changes, so they're all dropped.
+ */
+static int
+rleaf_cache_transaction_rollback( librdf_storage *storage ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( storage );
+
+	rleaf_cache_clear( cache );
+	rleaf_cache_base_changing( cache );
+	return librdf_storage_transaction_rollback( cache->base );
+}
+
+
+/*
+ * Storage factory registration function.
+ */
+static void
+rleaf_cache_register_factory( librdf_storage_factory *factory ) {
+	factory->version                    = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init                       = rleaf_cache_init;
+	factory->clone                      = rleaf_cache_clone;
+	factory->terminate                  = rleaf_cache_terminate;
+	factory->open                       = rleaf_cache_open;
+	factory->close                      = rleaf_cache_close;
+	factory->size                       = rleaf_cache_size;
+	factory->add_statement              = rleaf_cache_add_statement;
+	factory->add_statements             = rleaf_cache_add_statements;
+	factory->remove_statement           = rleaf_cache_remove_statement;
+	factory->contains_statement         = rleaf_cache_contains_statement;
+	factory->serialise                  = rleaf_cache_serialise;
+	factory->find_statements            = rleaf_cache_find_statements;
+	factory->context_add_statement      = rleaf_cache_context_add_statement;
+	factory->context_add_statements     = rleaf_cache_context_add_statements;
+	factory->context_remove_statement   = rleaf_cache_context_remove_statement;
+	factory->context_remove_statements  = rleaf_cache_context_remove_statements;
+	factory->context_serialise          = rleaf_cache_context_serialise;
+	factory->find_statements_in_context = rleaf_cache_find_statements_in_context;
+	factory->get_contexts               = rleaf_cache_get_contexts;
+	factory->get_feature                = rleaf_cache_get_feature;
+	factory->sync                       = rleaf_cache_sync;
+	factory->transaction_start          = rleaf_cache_transaction_start;
+	factory->transaction_commit         = rleaf_cache_transaction_commit;
+	factory->transaction_rollback       = rleaf_cache_transaction_rollback;
+}
+
+
+/*
+ * Register the 'caching' storage module with the Redland world.
+ */
+void
+rleaf_register_caching_storage_module( void ) {
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_CACHE_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_CACHE_NAME,
+		RLEAF_CACHE_LABEL, rleaf_cache_register_factory );
+}
+
+
+/* --------------------------------------------------------------
+ * Memory-management functions
+ * -------------------------------------------------------------- */
+
+/*
+ * GC Free function. The cache's storage can outlive the store object (in a stream that's
+ * still open, for instance), but its base store might not, so the cache stops forgetting
+ * the base store's caches when it writes through.
+ */
+static void
+rleaf_cachingstore_gc_free( rleaf_STORE *ptr ) {
+	rleaf_CACHE *cache;
+
+	if ( ptr && ptr->storage && (cache = librdf_storage_get_instance(ptr->storage)) )
+		cache->base_store = NULL;
+
+	rleaf_store_gc_free( ptr );
+}
+
+
+/*
+ * Set up the given +copy+ of the caching store +orig+, made around a clone of its storage:
+ * the clone's base is a clone of +orig+'s base, which is wrapped in a new store of its own.
+ */
+void
+rleaf_caching_store_init_copy( VALUE copy, VALUE orig ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( rleaf_get_store(copy)->storage );
+	VALUE base;
+
+	if ( !cache->base ) return;
+
+	base = rleaf_new_store_from_storage( rb_iv_get(orig, "@base"), cache->base );
+	rb_iv_set( copy, "@base", base );
+	cache->base_store = rleaf_get_store( base );
+}
+
+
+/* --------------------------------------------------------------
+ * Class methods
+ * -------------------------------------------------------------- */
+
+/*
+ *  call-seq:
+ *     Redleaf::CachingStore.allocate   -> store
+ *
+ *  Allocate a new Redleaf::CachingStore object.
+ *
+ */
+static VALUE
+rleaf_redleaf_cachingstore_s_allocate( VALUE klass ) {
+	return Data_Wrap_Struct( klass, rleaf_store_gc_mark, rleaf_cachingstore_gc_free, 0 );
+}
+
+
+/* --------------------------------------------------------------
+ * Instance methods
+ * -------------------------------------------------------------- */
+
+/*
+ *  call-seq:
+ *     Redleaf::CachingStore.new( base, name=nil, config={} )   -> store
+ *
+ *  Create a new store that reads through to +base+ (a Redleaf::Store, or a Redleaf::Graph
+ *  whose store to use), keeping the answers to recent searches and statement lookups in
+ *  memory. Writes go straight through to +base+, dropping any cached answers they affect.
+ *  Changes made to +base+ other than through the caching store aren't seen until the
+ *  answers are evicted or #clear_cache is called.
+ *
+ *  Valid config options are:
+ *  [:capacity]
+ *    The number of answers to keep (default: 1024).
+ *  [:max_results]
+ *    The largest number of statements an answer can have and still be cached (default: 1000).
+ *
+ */
+static VALUE
+rleaf_redleaf_cachingstore_initialize( int argc, VALUE *argv, VALUE self ) {
+	VALUE base = Qnil, name = Qnil, opthash = Qnil;
+	rleaf_STORE *base_store;
+	rleaf_CACHE *cache;
+
+	rb_scan_args( argc, argv, "12", &base, &name, &opthash );
+
+	if ( IsGraph(base) ) base = rleaf_get_graph( base )->store;
+	if ( !IsStore(base) )
+		rb_raise( rb_eTypeError, "wrong argument type %s (expected a Redleaf::Store)",
+			rb_obj_classname(base) );
+	base_store = rleaf_get_store( base );
+
+	rb_call_super( argc - 1, argv + 1 );
+
+	rleaf_log_with_context( self, "debug", "caching %s", rb_obj_classname(base) );
+	rleaf_cache_set_base( rleaf_get_store(self)->storage, base_store->storage );
+	cache = librdf_storage_get_instance( rleaf_get_store(self)->storage );
+	cache->base_store = base_store;
+	rb_iv_set( self, "@base", base );
+
+	return self;
+}
+
+
+/*
+ *  call-seq:
+ *     store.cache_stats   -> hash
+ *
+ *  Return a Hash of statistics about the store's cache: the number of +:hits+ and
+ *  +:misses+, the +:hit_rate+ (as a Float between 0 and 1), the number of cached
+ *  +:entries+ and the +:capacity+, and the number of +:evictions+ and +:invalidations+.
+ *
+ */
+static VALUE
+rleaf_redleaf_cachingstore_cache_stats( VALUE self ) {
+	rleaf_CACHE *cache = librdf_storage_get_instance( rleaf_get_store(self)->storage );
+	unsigned long lookups = cache->hits + cache->misses;
+	VALUE stats = rb_hash_new();
+
+	rb_hash_aset( stats, ID2SYM(rb_intern("hits")), ULONG2NUM(cache->hits) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("misses")), ULONG2NUM(cache->misses) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("hit_rate")),
+		rb_float_new(lookups ? (double)cache->hits / lookups : 0.0) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("entries")), LONG2NUM(cache->entries) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("capacity")), LONG2NUM(cache->capacity) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("evictions")), ULONG2NUM(cache->evictions) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("invalidations")), ULONG2NUM(cache->invalidations) );
+
+	return stats;
+}
+
+
+/*
+ *  call-seq:
+ *     store.clear_cache   -> store
+ *
+ *  Drop all of the store's cached answers, e.g., after its base has been changed by
+ *  something other than the caching store.
+ *
+ */
+static VALUE
+rleaf_redleaf_cachingstore_clear_cache( VALUE self ) {
+	rleaf_cache_clear( librdf_storage_get_instance(rleaf_get_store(self)->storage) );
+	return self;
+}
+
+
+/*
+ * Redleaf::CachingStore class
+ */
+void
+rleaf_init_redleaf_caching_store( void ) {
+	rleaf_log( "debug", "Initializing Redleaf::CachingStore" );
+
+#ifdef FOR_RDOC
+	rleaf_mRedleaf = rb_define_module( "Redleaf" );
+	rleaf_cRedleafStore = rb_define_class_under( rleaf_mRedleaf, "Store", rb_cObject );
+#endif
+
+	rb_require( "redleaf/store/caching" );
+	rleaf_cRedleafCachingStore =
+		rb_define_class_under( rleaf_mRedleaf, "CachingStore", rleaf_cRedleafStore );
+
+	rb_define_alloc_func( rleaf_cRedleafCachingStore, rleaf_redleaf_cachingstore_s_allocate );
+
+	rb_define_method( rleaf_cRedleafCachingStore, "initialize",
+		rleaf_redleaf_cachingstore_initialize, -1 );
+	rb_define_method( rleaf_cRedleafCachingStore, "cache_stats",
+		rleaf_redleaf_cachingstore_cache_stats, 0 );
+	rb_define_method( rleaf_cRedleafCachingStore, "clear_cache",
+		rleaf_redleaf_cachingstore_clear_cache, 0 );
+}
+
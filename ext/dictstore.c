@@ -0,0 +1,1666 @@
+/*
+ * Redleaf::DictionaryStore -- a dictionary-encoded, triple-indexed Redland storage module
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#include "redleaf.h"
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#	include <sys/mman.h>
+#endif
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ * -------------------------------------------------------------- */
+
+VALUE rleaf_cRedleafDictionaryStore;
+VALUE rleaf_cRedleafSnapshotStore;
+
+#define RLEAF_DICTSTORE_NAME        "dictionary"
+#define RLEAF_DICTSTORE_LABEL       "Dictionary-encoded triple indexes in memory"
+#define RLEAF_SNAPSHOT_NAME         "snapshot"
+#define RLEAF_SNAPSHOT_LABEL        "Read-only memory-mapped graph snapshot"
+
+#define RLEAF_SNAPSHOT_MAGIC        "RLEAFSNP"
+#define RLEAF_SNAPSHOT_VERSION      1
+#define RLEAF_SNAPSHOT_BYTE_ORDER   0x01020304
+
+/* Number of triples in each leaf block of an index */
+#define RLEAF_INDEX_BLOCK_SIZE      512
+
+/* The three orderings the store keeps an index in */
+enum {
+	RLEAF_INDEX_SPO,
+	RLEAF_INDEX_POS,
+	RLEAF_INDEX_OSP,
+	RLEAF_INDEX_COUNT
+};
+
+/* The position of the subject, predicate, and object ids in each index's keys */
+static const int rleaf_index_orders[ RLEAF_INDEX_COUNT ][ 3 ] = {
+	{ 0, 1, 2 },
+	{ 2, 0, 1 },
+	{ 1, 2, 0 },
+};
+
+/* An index key: the subject, predicate, and object ids in the index's order */
+typedef uint32_t rleaf_INDEXKEY[ 3 ];
+
+/* A leaf block of sorted index keys */
+typedef struct rleaf_index_block {
+	uint32_t		count;
+	rleaf_INDEXKEY	keys[ RLEAF_INDEX_BLOCK_SIZE ];
+} rleaf_INDEXBLOCK;
+
+/* An allocated leaf block, and the number of index directories that share it. Blocks
+   shared by more than one directory are copied before they're changed. Blocks mapped
+   from a snapshot file don't have a reference count. */
+typedef struct rleaf_shared_index_block {
+	unsigned long		refs;
+	rleaf_INDEXBLOCK	block;
+} rleaf_SHAREDBLOCK;
+
+#define RLEAF_SHARED_BLOCK( ptr ) \
+	( (rleaf_SHAREDBLOCK *)((char *)(ptr) - offsetof(rleaf_SHAREDBLOCK, block)) )
+#define RLEAF_BLOCK_REFS( ptr ) ( RLEAF_SHARED_BLOCK(ptr)->refs )
+
+/* A sorted index of id triples: a directory of sorted leaf blocks */
+typedef struct rleaf_triple_index {
+	rleaf_INDEXBLOCK	**blocks;
+	size_t				block_count, block_capa;
+} rleaf_TRIPLEINDEX;
+
+/* A position in a triple index */
+typedef struct rleaf_index_position {
+	size_t block, offset;
+} rleaf_INDEXPOS;
+
+/* A frozen version of a store's indexes, shared by the streams that were reading the store
+   when it was changed. It's freed along with any blocks only it uses when the last of them
+   finishes. */
+typedef struct rleaf_dictstore_version {
+	rleaf_TRIPLEINDEX	indexes[ RLEAF_INDEX_COUNT ];
+	unsigned long		refs;
+} rleaf_DICTVERSION;
+
+typedef struct rleaf_dictstore_cursor rleaf_DICTCURSOR;
+
+/* The instance data of a 'dictionary' or 'snapshot' librdf_storage. A snapshot's dictionary
+   arrays and index blocks point into its mapped file instead of being allocated. +readers+
+   is a list of the streams reading the current indexes. */
+typedef struct rleaf_dictstore_object {
+	rleaf_TERMDICT		*dict;
+	rleaf_TRIPLEINDEX	indexes[ RLEAF_INDEX_COUNT ];
+	size_t				size;
+	int					read_only;
+	rleaf_DICTCURSOR	*readers;
+	void				*mapping;
+	size_t				mapping_len;
+} rleaf_DICTSTORE;
+
+/* The header of a snapshot file. It's followed by the sections of the term dictionary, each
+   padded to a multiple of 8 bytes: offsets, lengths, hashes, flags, hash buckets, and the
+   arena of encoded terms. After that come the SPO, POS, and OSP indexes, each as
+   +block_count+ index blocks in their in-memory layout. */
+typedef struct rleaf_snapshot_header {
+	char		magic[ 8 ];
+	uint32_t	version;
+	uint32_t	byte_order;
+	uint32_t	block_size;
+	uint32_t	term_count;
+	uint32_t	bucket_count;
+	uint32_t	reserved;
+	uint64_t	arena_len;
+	uint64_t	statement_count;
+	uint64_t	block_count;
+} rleaf_SNAPSHOTHEADER;
+
+#define RLEAF_PAD8( len ) ( ((len) + 7) & ~(size_t)7 )
+
+/* The state of a stream of statements from a dictionary store. A stream reads the store's
+   current indexes until the store is changed, and the version frozen at that point after. */
+struct rleaf_dictstore_cursor {
+	librdf_storage		*storage;
+	rleaf_DICTSTORE		*store;
+	rleaf_DICTVERSION	*version;
+	rleaf_DICTCURSOR	*prev_reader, *next_reader;
+	int					index;
+	uint32_t			prefix[ 3 ];
+	int					prefix_len;
+	rleaf_INDEXPOS		pos;
+	int					finished;
+	librdf_statement	*statement;
+};
+
+
+static void rleaf_snapshot_unmap( void *, size_t );
+
+
+/* --------------------------------------------------------------
+ * Triple indexes
+ * -------------------------------------------------------------- */
+
+/*
+ * Compare two index keys.
+ */
+static inline int
+rleaf_index_key_cmp( const uint32_t *a, const uint32_t *b ) {
+	if ( a[0] != b[0] ) return a[0] < b[0] ? -1 : 1;
+	if ( a[1] != b[1] ) return a[1] < b[1] ? -1 : 1;
+	if ( a[2] != b[2] ) return a[2] < b[2] ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * Allocate a new, empty index block with a single reference.
+ */
+static rleaf_INDEXBLOCK *
+rleaf_index_new_block( void ) {
+	rleaf_SHAREDBLOCK *shared = ALLOC( rleaf_SHAREDBLOCK );
+
+	shared->refs = 1;
+	shared->block.count = 0;
+
+	return &shared->block;
+}
+
+
+/*
+ * Drop a reference to the given +block+, freeing it if it was the last one.
+ */
+static void
+rleaf_index_release_block( rleaf_INDEXBLOCK *block ) {
+	rleaf_SHAREDBLOCK *shared = RLEAF_SHARED_BLOCK( block );
+
+	if ( --shared->refs == 0 ) xfree( shared );
+}
+
+
+/*
+ * Return the block at position +i+ of the +index+ after making sure it can be changed
+ * without affecting any other index that shares it.
+ */
+static rleaf_INDEXBLOCK *
+rleaf_index_writable_block( rleaf_TRIPLEINDEX *index, size_t i ) {
+	rleaf_INDEXBLOCK *block = index->blocks[ i ], *copy;
+
+	if ( RLEAF_BLOCK_REFS(block) == 1 ) return block;
+
+	copy = rleaf_index_new_block();
+	copy->count = block->count;
+	MEMCPY( copy->keys, block->keys, uint32_t, block->count * 3 );
+	rleaf_index_release_block( block );
+
+	return index->blocks[ i ] = copy;
+}
+
+
+/*
+ * Release the blocks of the given +index+ and reset it to empty.
+ */
+static void
+rleaf_index_clear( rleaf_TRIPLEINDEX *index ) {
+	size_t i;
+
+	for ( i = 0; i < index->block_count; i++ ) rleaf_index_release_block( index->blocks[i] );
+	if ( index->blocks ) xfree( index->blocks );
+
+	index->blocks = NULL;
+	index->block_count = index->block_capa = 0;
+}
+
+
+/*
+ * Return the position of the first key in the +index+ which is greater than (if +after+ is
+ * non-zero) or greater than or equal to (if +after+ is zero) the given +key+. If there is no
+ * such key, the position's block is the index's block count.
+ */
+static rleaf_INDEXPOS
+rleaf_index_seek( rleaf_TRIPLEINDEX *index, const uint32_t *key, int after ) {
+	rleaf_INDEXPOS pos = { 0, 0 };
+	rleaf_INDEXBLOCK *block;
+	size_t low = 0, high = index->block_count, mid;
+	int limit = after ? 0 : -1;
+
+	/* Find the last block whose first key precedes the target */
+	while ( low < high ) {
+		mid = low + ( high - low ) / 2;
+		if ( rleaf_index_key_cmp(index->blocks[mid]->keys[0], key) <= limit )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ( low == 0 ) return pos;
+
+	pos.block = low - 1;
+	block = index->blocks[ pos.block ];
+
+	low = 0;
+	high = block->count;
+	while ( low < high ) {
+		mid = low + ( high - low ) / 2;
+		if ( rleaf_index_key_cmp(block->keys[mid], key) <= limit )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	pos.offset = low;
+	if ( pos.offset == block->count ) {
+		pos.block++;
+		pos.offset = 0;
+	}
+
+	return pos;
+}
+
+
+/*
+ * Returns non-zero if the +index+ contains the given +key+.
+ */
+static int
+rleaf_index_contains( rleaf_TRIPLEINDEX *index, const uint32_t *key ) {
+	rleaf_INDEXPOS pos = rleaf_index_seek( index, key, 0 );
+
+	if ( pos.block == index->block_count ) return 0;
+	return rleaf_index_key_cmp( index->blocks[pos.block]->keys[pos.offset], key ) == 0;
+}
+
+
+/*
+ * Insert a new block into the +index+'s directory at position +i+.
+ */
+static rleaf_INDEXBLOCK *
+rleaf_index_insert_block( rleaf_TRIPLEINDEX *index, size_t i ) {
+	rleaf_INDEXBLOCK *block = rleaf_index_new_block();
+
+	if ( index->block_count == index->block_capa ) {
+		index->block_capa = index->block_capa ? index->block_capa * 2 : 16;
+		REALLOC_N( index->blocks, rleaf_INDEXBLOCK *, index->block_capa );
+	}
+
+	MEMMOVE( index->blocks + i + 1, index->blocks + i, rleaf_INDEXBLOCK *,
+		index->block_count - i );
+	index->blocks[ i ] = block;
+	index->block_count++;
+
+	return block;
+}
+
+
+/*
+ * Remove the block at position +i+ from the +index+'s directory and release it.
+ */
+static void
+rleaf_index_remove_block( rleaf_TRIPLEINDEX *index, size_t i ) {
+	rleaf_index_release_block( index->blocks[i] );
+	MEMMOVE( index->blocks + i, index->blocks + i + 1, rleaf_INDEXBLOCK *,
+		index->block_count - i - 1 );
+	index->block_count--;
+}
+
+
+/*
+ * Make room in the full block at position +i+ of the +index+. If the next block has room, the
+ * tail of the full one is shifted into it; if it's full too, the two are spread over three
+ * blocks. This keeps blocks about 2/3 full or better, instead of the 1/2 that splitting a
+ * single block would leave.
+ */
+static void
+rleaf_index_make_room( rleaf_TRIPLEINDEX *index, size_t i ) {
+	rleaf_INDEXBLOCK *block = rleaf_index_writable_block( index, i ), *sibling, *middle;
+	size_t moved, third;
+
+	if ( i + 1 == index->block_count ) {
+		sibling = rleaf_index_insert_block( index, i + 1 );
+		moved = block->count / 2;
+		MEMCPY( sibling->keys, block->keys + block->count - moved, uint32_t, moved * 3 );
+		sibling->count = moved;
+		block->count -= moved;
+		return;
+	}
+
+	sibling = rleaf_index_writable_block( index, i + 1 );
+
+	if ( sibling->count < RLEAF_INDEX_BLOCK_SIZE - 1 ) {
+		moved = ( RLEAF_INDEX_BLOCK_SIZE - sibling->count ) / 2;
+		MEMMOVE( sibling->keys + moved, sibling->keys, uint32_t, sibling->count * 3 );
+		MEMCPY( sibling->keys, block->keys + block->count - moved, uint32_t, moved * 3 );
+		sibling->count += moved;
+		block->count -= moved;
+		return;
+	}
+
+	third  = ( block->count + sibling->count ) / 3;
+	middle = rleaf_index_insert_block( index, i + 1 );
+
+	moved = block->count - third;
+	MEMCPY( middle->keys, block->keys + third, uint32_t, moved * 3 );
+	block->count = third;
+
+	MEMCPY( middle->keys + moved, sibling->keys, uint32_t, (third - moved) * 3 );
+	MEMMOVE( sibling->keys, sibling->keys + (third - moved), uint32_t,
+		(sibling->count - (third - moved)) * 3 );
+	sibling->count -= third - moved;
+	middle->count = third;
+}
+
+
+/*
+ * Insert the given +key+, which must not already be present, into the +index+. Appending
+ * in key order fills blocks completely.
+ */
+static void
+rleaf_index_insert( rleaf_TRIPLEINDEX *index, const uint32_t *key ) {
+	rleaf_INDEXPOS pos = rleaf_index_seek( index, key, 0 );
+	rleaf_INDEXBLOCK *block;
+
+	if ( index->block_count == 0 ) {
+		block = rleaf_index_insert_block( index, 0 );
+	}
+
+	/* Prefer the end of the preceding block to the start of the next one */
+	else if ( pos.offset == 0 && pos.block > 0 ) {
+		pos.block--;
+		block = rleaf_index_writable_block( index, pos.block );
+		pos.offset = block->count;
+	}
+
+	else {
+		block = rleaf_index_writable_block( index, pos.block );
+	}
+
+	if ( block->count == RLEAF_INDEX_BLOCK_SIZE ) {
+		if ( pos.offset == block->count ) {
+			block = rleaf_index_insert_block( index, pos.block + 1 );
+			pos.offset = 0;
+		} else {
+			rleaf_index_make_room( index, pos.block );
+			rleaf_index_insert( index, key );
+			return;
+		}
+	}
+
+	MEMMOVE( block->keys + pos.offset + 1, block->keys + pos.offset, uint32_t,
+		(block->count - pos.offset) * 3 );
+	MEMCPY( block->keys[pos.offset], key, uint32_t, 3 );
+	block->count++;
+}
+
+
+/*
+ * Remove the given +key+ from the +index+. Returns non-zero if it was present.
+ */
+static int
+rleaf_index_delete( rleaf_TRIPLEINDEX *index, const uint32_t *key ) {
+	rleaf_INDEXPOS pos = rleaf_index_seek( index, key, 0 );
+	rleaf_INDEXBLOCK *block, *next;
+
+	if ( pos.block == index->block_count ) return 0;
+	if ( rleaf_index_key_cmp(index->blocks[pos.block]->keys[pos.offset], key) != 0 ) return 0;
+
+	block = rleaf_index_writable_block( index, pos.block );
+	MEMMOVE( block->keys + pos.offset, block->keys + pos.offset + 1, uint32_t,
+		(block->count - pos.offset - 1) * 3 );
+	block->count--;
+
+	if ( block->count == 0 ) {
+		rleaf_index_remove_block( index, pos.block );
+	}
+
+	/* Fold a sparse block into its successor if they fit together */
+	else if ( block->count < RLEAF_INDEX_BLOCK_SIZE / 4 && pos.block + 1 < index->block_count ) {
+		next = index->blocks[ pos.block + 1 ];
+		if ( block->count + next->count <= RLEAF_INDEX_BLOCK_SIZE ) {
+			MEMCPY( block->keys + block->count, next->keys, uint32_t, next->count * 3 );
+			block->count += next->count;
+			rleaf_index_remove_block( index, pos.block + 1 );
+		}
+	}
+
+	return 1;
+}
+
+
+/*
+ * Rewrite the +index+, which holds +count+ keys, into completely full blocks.
+ */
+static void
+rleaf_index_pack( rleaf_TRIPLEINDEX *index, size_t count ) {
+	rleaf_TRIPLEINDEX packed = { NULL, 0, 0 };
+	rleaf_INDEXBLOCK *block = NULL, *src;
+	size_t i, j;
+
+	if ( index->block_count * RLEAF_INDEX_BLOCK_SIZE == count ) return;
+
+	packed.block_capa = ( count + RLEAF_INDEX_BLOCK_SIZE - 1 ) / RLEAF_INDEX_BLOCK_SIZE;
+	if ( packed.block_capa == 0 ) packed.block_capa = 1;
+	packed.blocks = ALLOC_N( rleaf_INDEXBLOCK *, packed.block_capa );
+
+	for ( i = 0; i < index->block_count; i++ ) {
+		src = index->blocks[ i ];
+		for ( j = 0; j < src->count; j++ ) {
+			if ( !block || block->count == RLEAF_INDEX_BLOCK_SIZE )
+				block = rleaf_index_insert_block( &packed, packed.block_count );
+			MEMCPY( block->keys[block->count++], src->keys[j], uint32_t, 3 );
+		}
+	}
+
+	rleaf_index_clear( index );
+	*index = packed;
+}
+
+
+/*
+ * Return the number of bytes of memory used by the given +index+.
+ */
+static size_t
+rleaf_index_memsize( rleaf_TRIPLEINDEX *index ) {
+	return index->block_capa * sizeof(rleaf_INDEXBLOCK *) +
+		index->block_count * sizeof(rleaf_SHAREDBLOCK);
+}
+
+
+/*
+ * Make the empty index +copy+ share the blocks of the index +orig+, which will be copied
+ * when either index changes them.
+ */
+static void
+rleaf_index_copy( rleaf_TRIPLEINDEX *copy, rleaf_TRIPLEINDEX *orig ) {
+	size_t i;
+
+	copy->block_count = copy->block_capa = orig->block_count;
+	copy->blocks = copy->block_capa ? ALLOC_N( rleaf_INDEXBLOCK *, copy->block_capa ) : NULL;
+
+	for ( i = 0; i < orig->block_count; i++ ) {
+		copy->blocks[i] = orig->blocks[i];
+		RLEAF_BLOCK_REFS( copy->blocks[i] )++;
+	}
+}
+
+
+/*
+ * Fill the empty +index+ with the +count+ given +keys+, which must be sorted and unique.
+ */
+static void
+rleaf_index_build( rleaf_TRIPLEINDEX *index, const rleaf_INDEXKEY *keys, size_t count ) {
+	rleaf_INDEXBLOCK *block;
+	size_t i, n;
+
+	for ( i = 0; i < count; i += n ) {
+		n = count - i < RLEAF_INDEX_BLOCK_SIZE ? count - i : RLEAF_INDEX_BLOCK_SIZE;
+		block = rleaf_index_insert_block( index, index->block_count );
+		MEMCPY( block->keys, keys + i, uint32_t, n * 3 );
+		block->count = (uint32_t)n;
+	}
+}
+
+
+/* --------------------------------------------------------------
+ * Store functions
+ * -------------------------------------------------------------- */
+
+/*
+ * Allocate and return a new, empty dictionary store.
+ */
+static rleaf_DICTSTORE *
+rleaf_new_dictstore( void ) {
+	rleaf_DICTSTORE *store = ALLOC( rleaf_DICTSTORE );
+	int i;
+
+	store->dict = rleaf_new_termdict();
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ ) {
+		store->indexes[i].blocks = NULL;
+		store->indexes[i].block_count = store->indexes[i].block_capa = 0;
+	}
+	store->size = 0;
+	store->read_only = 0;
+	store->readers = NULL;
+	store->mapping = NULL;
+	store->mapping_len = 0;
+
+	return store;
+}
+
+
+/*
+ * Free the given dictionary +store+.
+ */
+static void
+rleaf_free_dictstore( rleaf_DICTSTORE *store ) {
+	int i;
+
+	if ( !store ) return;
+
+	if ( store->mapping ) {
+		for ( i = 0; i < RLEAF_INDEX_COUNT; i++ )
+			if ( store->indexes[i].blocks ) xfree( store->indexes[i].blocks );
+		xfree( store->dict );
+		rleaf_snapshot_unmap( store->mapping, store->mapping_len );
+	} else {
+		for ( i = 0; i < RLEAF_INDEX_COUNT; i++ ) rleaf_index_clear( &store->indexes[i] );
+		if ( --store->dict->refs == 0 ) rleaf_free_termdict( store->dict );
+	}
+
+	xfree( store );
+}
+
+
+/*
+ * Drop a reference to the given frozen +version+, freeing it if it was the last one.
+ */
+static void
+rleaf_release_dictversion( rleaf_DICTVERSION *version ) {
+	int i;
+
+	if ( --version->refs ) return;
+
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ ) rleaf_index_clear( &version->indexes[i] );
+	xfree( version );
+}
+
+
+/*
+ * Get the +store+ ready to change its indexes. If any streams are reading them, the current
+ * indexes are frozen into a version that those streams carry on reading from, so they see
+ * the statements as they were when they started. Freezing only copies the indexes'
+ * directories; the blocks are shared until the store changes them.
+ */
+static void
+rleaf_dictstore_detach_readers( rleaf_DICTSTORE *store ) {
+	rleaf_DICTVERSION *version;
+	rleaf_DICTCURSOR *cursor, *next;
+	int i;
+
+	if ( !store->readers ) return;
+
+	version = ALLOC( rleaf_DICTVERSION );
+	version->refs = 0;
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ )
+		rleaf_index_copy( &version->indexes[i], &store->indexes[i] );
+
+	for ( cursor = store->readers; cursor; cursor = next ) {
+		next = cursor->next_reader;
+		cursor->version = version;
+		cursor->prev_reader = cursor->next_reader = NULL;
+		version->refs++;
+	}
+	store->readers = NULL;
+}
+
+
+/*
+ * Convert the subject, predicate, object +ids+ into the key for the index +i+.
+ */
+static inline void
+rleaf_dictstore_make_key( int i, const uint32_t *ids, uint32_t *key ) {
+	key[ rleaf_index_orders[i][0] ] = ids[0];
+	key[ rleaf_index_orders[i][1] ] = ids[1];
+	key[ rleaf_index_orders[i][2] ] = ids[2];
+}
+
+
+/*
+ * Convert the +key+ from the index +i+ back into subject, predicate, object +ids+.
+ */
+static inline void
+rleaf_dictstore_key_ids( int i, const uint32_t *key, uint32_t *ids ) {
+	ids[0] = key[ rleaf_index_orders[i][0] ];
+	ids[1] = key[ rleaf_index_orders[i][1] ];
+	ids[2] = key[ rleaf_index_orders[i][2] ];
+}
+
+
+/*
+ * Look up the ids of the nodes of the given +statement+ without interning them. Returns
+ * zero if any of them isn't in the dictionary, in which case the store can't contain the
+ * statement.
+ */
+static int
+rleaf_dictstore_statement_ids( rleaf_DICTSTORE *store, librdf_statement *statement,
+	uint32_t *ids )
+{
+	ids[0] = rleaf_termdict_lookup_node( store->dict, librdf_statement_get_subject(statement), 0 );
+	ids[1] = rleaf_termdict_lookup_node( store->dict, librdf_statement_get_predicate(statement), 0 );
+	ids[2] = rleaf_termdict_lookup_node( store->dict, librdf_statement_get_object(statement), 0 );
+
+	return ids[0] != RLEAF_NO_TERM && ids[1] != RLEAF_NO_TERM && ids[2] != RLEAF_NO_TERM;
+}
+
+
+/*
+ * Add the triple with the given +ids+ to the store. Returns non-zero if it was added.
+ */
+static int
+rleaf_dictstore_add_ids( rleaf_DICTSTORE *store, const uint32_t *ids ) {
+	uint32_t key[ 3 ];
+	int i;
+
+	if ( rleaf_index_contains(&store->indexes[RLEAF_INDEX_SPO], ids) ) return 0;
+	rleaf_dictstore_detach_readers( store );
+
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ ) {
+		rleaf_dictstore_make_key( i, ids, key );
+		rleaf_index_insert( &store->indexes[i], key );
+	}
+
+	store->size++;
+
+	return 1;
+}
+
+
+/*
+ * Remove the triple with the given +ids+ from the store. Returns non-zero if it was removed.
+ */
+static int
+rleaf_dictstore_remove_ids( rleaf_DICTSTORE *store, const uint32_t *ids ) {
+	uint32_t key[ 3 ];
+	int i;
+
+	if ( !rleaf_index_contains(&store->indexes[RLEAF_INDEX_SPO], ids) ) return 0;
+	rleaf_dictstore_detach_readers( store );
+	rleaf_index_delete( &store->indexes[RLEAF_INDEX_SPO], ids );
+
+	for ( i = 1; i < RLEAF_INDEX_COUNT; i++ ) {
+		rleaf_dictstore_make_key( i, ids, key );
+		rleaf_index_delete( &store->indexes[i], key );
+	}
+
+	store->size--;
+
+	return 1;
+}
+
+
+/* --------------------------------------------------------------
+ * Statement streams
+ * -------------------------------------------------------------- */
+
+/*
+ * Return the index the cursor is reading: the store's current one, or the one in the
+ * version it was frozen into.
+ */
+static inline rleaf_TRIPLEINDEX *
+rleaf_dictcursor_index( rleaf_DICTCURSOR *cursor ) {
+	if ( cursor->version ) return &cursor->version->indexes[ cursor->index ];
+	return &cursor->store->indexes[ cursor->index ];
+}
+
+
+/*
+ * Returns non-zero if the key at the cursor's position doesn't match its prefix.
+ */
+static int
+rleaf_dictcursor_past_prefix( rleaf_DICTCURSOR *cursor ) {
+	rleaf_TRIPLEINDEX *index = rleaf_dictcursor_index( cursor );
+	uint32_t *key;
+	int i;
+
+	if ( cursor->pos.block >= index->block_count ) return 1;
+	key = index->blocks[ cursor->pos.block ]->keys[ cursor->pos.offset ];
+
+	for ( i = 0; i < cursor->prefix_len; i++ )
+		if ( key[i] != cursor->prefix[i] ) return 1;
+
+	return 0;
+}
+
+
+/*
+ * Load the statement at the cursor's position, or mark it finished if there isn't one.
+ */
+static void
+rleaf_dictcursor_load( rleaf_DICTCURSOR *cursor ) {
+	rleaf_TRIPLEINDEX *index = rleaf_dictcursor_index( cursor );
+	rleaf_TERMDICT *dict = cursor->store->dict;
+	uint32_t *key, ids[ 3 ];
+
+	if ( cursor->statement ) {
+		librdf_free_statement( cursor->statement );
+		cursor->statement = NULL;
+	}
+
+	if ( rleaf_dictcursor_past_prefix(cursor) ) {
+		cursor->finished = 1;
+		return;
+	}
+
+	key = index->blocks[ cursor->pos.block ]->keys[ cursor->pos.offset ];
+	rleaf_dictstore_key_ids( cursor->index, key, ids );
+
+	cursor->statement = librdf_new_statement_from_nodes( rleaf_rdf_world,
+		rleaf_termdict_get_node(dict, ids[0]),
+		rleaf_termdict_get_node(dict, ids[1]),
+		rleaf_termdict_get_node(dict, ids[2]) );
+}
+
+
+/*
+ * librdf_stream is_end method.
+ */
+static int
+rleaf_dictcursor_is_end( void *context ) {
+	return ((rleaf_DICTCURSOR *)context)->finished;
+}
+
+
+/*
+ * librdf_stream next method. Statements added to or removed from the store while the
+ * stream is open don't change what it returns.
+ */
+static int
+rleaf_dictcursor_next( void *context ) {
+	rleaf_DICTCURSOR *cursor = (rleaf_DICTCURSOR *)context;
+	rleaf_TRIPLEINDEX *index = rleaf_dictcursor_index( cursor );
+
+	if ( cursor->finished ) return 1;
+
+	if ( ++cursor->pos.offset == index->blocks[cursor->pos.block]->count ) {
+		cursor->pos.block++;
+		cursor->pos.offset = 0;
+	}
+
+	rleaf_dictcursor_load( cursor );
+	return cursor->finished;
+}
+
+
+/*
+ * librdf_stream get method.
+ */
+static void *
+rleaf_dictcursor_get( void *context, int flags ) {
+	rleaf_DICTCURSOR *cursor = (rleaf_DICTCURSOR *)context;
+
+	if ( flags == LIBRDF_STREAM_GET_METHOD_GET_OBJECT ) return cursor->statement;
+	return NULL;
+}
+
+
+/*
+ * librdf_stream finished method.
+ */
+static void
+rleaf_dictcursor_finished( void *context ) {
+	rleaf_DICTCURSOR *cursor = (rleaf_DICTCURSOR *)context;
+
+	if ( cursor->statement ) librdf_free_statement( cursor->statement );
+
+	if ( cursor->version ) {
+		rleaf_release_dictversion( cursor->version );
+	} else {
+		if ( cursor->prev_reader ) cursor->prev_reader->next_reader = cursor->next_reader;
+		else cursor->store->readers = cursor->next_reader;
+		if ( cursor->next_reader ) cursor->next_reader->prev_reader = cursor->prev_reader;
+	}
+
+	librdf_storage_remove_reference( cursor->storage );
+	xfree( cursor );
+}
+
+
+/*
+ * Return a new stream over the statements in the +storage+ which match the given +ids+, any
+ * of which may be RLEAF_NO_TERM to match anything. The index whose ordering puts the bound
+ * ids first is used, so the matches are a single contiguous range of it.
+ */
+static librdf_stream *
+rleaf_dictstore_new_stream( librdf_storage *storage, const uint32_t *ids, int empty ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	rleaf_DICTCURSOR *cursor = ALLOC( rleaf_DICTCURSOR );
+	librdf_stream *stream;
+	uint32_t start[ 3 ];
+	int bound = ( ids[0] != RLEAF_NO_TERM ? 1 : 0 ) |
+	            ( ids[1] != RLEAF_NO_TERM ? 2 : 0 ) |
+	            ( ids[2] != RLEAF_NO_TERM ? 4 : 0 );
+	int i;
+
+	switch ( bound ) {
+		case 2: case 6:
+		cursor->index = RLEAF_INDEX_POS;
+		break;
+
+		case 4: case 5:
+		cursor->index = RLEAF_INDEX_OSP;
+		break;
+
+		default:
+		cursor->index = RLEAF_INDEX_SPO;
+	}
+
+	rleaf_dictstore_make_key( cursor->index, ids, cursor->prefix );
+	for ( i = 0; i < 3 && cursor->prefix[i] != RLEAF_NO_TERM; i++ ) start[i] = cursor->prefix[i];
+	cursor->prefix_len = i;
+	for ( ; i < 3; i++ ) start[i] = 0;
+
+	cursor->storage    = storage;
+	cursor->store      = store;
+	cursor->version    = NULL;
+	cursor->finished   = empty;
+	cursor->statement  = NULL;
+	cursor->pos        = rleaf_index_seek( &store->indexes[cursor->index], start, 0 );
+	if ( !empty ) rleaf_dictcursor_load( cursor );
+
+	/* Snapshots never change, so their streams don't need to be told when they do */
+	cursor->prev_reader = cursor->next_reader = NULL;
+	if ( !store->mapping ) {
+		cursor->next_reader = store->readers;
+		if ( store->readers ) store->readers->prev_reader = cursor;
+		store->readers = cursor;
+	}
+
+	librdf_storage_add_reference( storage );
+	stream = librdf_new_stream( librdf_storage_get_world(storage), cursor,
+		rleaf_dictcursor_is_end, rleaf_dictcursor_next, rleaf_dictcursor_get,
+		rleaf_dictcursor_finished );
+
+	if ( !stream ) rleaf_dictcursor_finished( cursor );
+	return stream;
+}
+
+
+/* --------------------------------------------------------------
+ * Storage module methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Storage init method.
+ */
+static int
+rleaf_dictstore_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	_UNUSED( name );
+
+	librdf_storage_set_instance( storage, rleaf_new_dictstore() );
+	if ( options ) librdf_free_hash( options );
+
+	return 0;
+}
+
+
+/*
+ * Create a new store with the same statements as +orig+, sharing its index blocks until
+ * either of them changes. A +read_only+ copy also shares its term dictionary, which is
+ * safe because the original only ever appends to it.
+ */
+static rleaf_DICTSTORE *
+rleaf_copy_dictstore( rleaf_DICTSTORE *orig, int read_only ) {
+	rleaf_DICTSTORE *store = ALLOC( rleaf_DICTSTORE );
+	int i;
+
+	if ( read_only ) {
+		store->dict = orig->dict;
+		store->dict->refs++;
+	} else {
+		store->dict = rleaf_copy_termdict( orig->dict );
+	}
+
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ )
+		rleaf_index_copy( &store->indexes[i], &orig->indexes[i] );
+	store->size = orig->size;
+	store->read_only = read_only;
+	store->readers = NULL;
+	store->mapping = NULL;
+	store->mapping_len = 0;
+
+	return store;
+}
+
+
+/*
+ * Storage clone method.
+ */
+static int
+rleaf_dictstore_clone( librdf_storage *new_storage, librdf_storage *old_storage ) {
+	rleaf_DICTSTORE *old = librdf_storage_get_instance( old_storage );
+
+	librdf_storage_set_instance( new_storage, rleaf_copy_dictstore(old, 0) );
+	return 0;
+}
+
+
+/*
+ * Storage terminate method.
+ */
+static void
+rleaf_dictstore_terminate( librdf_storage *storage ) {
+	rleaf_free_dictstore( librdf_storage_get_instance(storage) );
+	librdf_storage_set_instance( storage, NULL );
+}
+
+
+/*
+ * Storage open method.
+ */
+static int
+rleaf_dictstore_open( librdf_storage *storage, librdf_model *model ) {
+	_UNUSED( storage );
+	_UNUSED( model );
+	return 0;
+}
+
+
+/*
+ * Storage close method.
+ */
+static int
+rleaf_dictstore_close( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage size method.
+ */
+static int
+rleaf_dictstore_size( librdf_storage *storage ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	return (int)store->size;
+}
+
+
+/*
+ * Storage add_statement method.
+ */
+static int
+rleaf_dictstore_add_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	uint32_t ids[ 3 ];
+
+	if ( store->read_only ) {
+		rleaf_log( "error", "can't modify a read-only version of a store" );
+		return 1;
+	}
+
+	ids[0] = rleaf_termdict_intern_node( store->dict, librdf_statement_get_subject(statement), 0 );
+	ids[1] = rleaf_termdict_intern_node( store->dict, librdf_statement_get_predicate(statement), 0 );
+	ids[2] = rleaf_termdict_intern_node( store->dict, librdf_statement_get_object(statement), 0 );
+
+	rleaf_dictstore_add_ids( store, ids );
+	return 0;
+}
+
+
+/*
+ * Storage add_statements method. Large batches leave the indexes' blocks partly empty, so
+ * they're repacked afterwards if the batch was big compared to what was already there.
+ */
+static int
+rleaf_dictstore_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	librdf_statement *statement;
+	size_t before = store->size;
+	int i;
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+		if ( rleaf_dictstore_add_statement(storage, statement) != 0 ) return 1;
+		librdf_stream_next( stream );
+	}
+
+	if ( ( store->size - before ) * 8 > store->size ) {
+		rleaf_dictstore_detach_readers( store );
+		for ( i = 0; i < RLEAF_INDEX_COUNT; i++ )
+			rleaf_index_pack( &store->indexes[i], store->size );
+	}
+
+	return 0;
+}
+
+
+/*
+ * Storage remove_statement method.
+ */
+static int
+rleaf_dictstore_remove_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	uint32_t ids[ 3 ];
+
+	if ( store->read_only ) {
+		rleaf_log( "error", "can't modify a read-only version of a store" );
+		return 1;
+	}
+
+	if ( rleaf_dictstore_statement_ids(store, statement, ids) )
+		rleaf_dictstore_remove_ids( store, ids );
+
+	return 0;
+}
+
+
+/*
+ * Storage contains_statement method.
+ */
+static int
+rleaf_dictstore_contains_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	uint32_t ids[ 3 ];
+
+	if ( !rleaf_dictstore_statement_ids(store, statement, ids) ) return 0;
+	return rleaf_index_contains( &store->indexes[RLEAF_INDEX_SPO], ids );
+}
+
+
+/*
+ * Storage serialise method.
+ */
+static librdf_stream *
+rleaf_dictstore_serialise( librdf_storage *storage ) {
+	uint32_t ids[ 3 ] = { RLEAF_NO_TERM, RLEAF_NO_TERM, RLEAF_NO_TERM };
+	return rleaf_dictstore_new_stream( storage, ids, 0 );
+}
+
+
+/*
+ * Storage find_statements method.
+ */
+static librdf_stream *
+rleaf_dictstore_find_statements( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_DICTSTORE *store = librdf_storage_get_instance( storage );
+	librdf_node *nodes[ 3 ];
+	uint32_t ids[ 3 ];
+	int i, empty = 0;
+
+	nodes[0] = librdf_statement_get_subject( statement );
+	nodes[1] = librdf_statement_get_predicate( statement );
+	nodes[2] = librdf_statement_get_object( statement );
+
+	for ( i = 0; i < 3; i++ ) {
+		ids[i] = RLEAF_NO_TERM;
+		if ( !nodes[i] ) continue;
+		if ( (ids[i] = rleaf_termdict_lookup_node(store->dict, nodes[i], 0)) == RLEAF_NO_TERM )
+			empty = 1;
+	}
+
+	return rleaf_dictstore_new_stream( storage, ids, empty );
+}
+
+
+/*
+ * Storage sync method.
+ */
+static int
+rleaf_dictstore_sync( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage factory registration function.
+ */
+static void
+rleaf_dictstore_register_factory( librdf_storage_factory *factory ) {
+	factory->version            = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init               = rleaf_dictstore_init;
+	factory->clone              = rleaf_dictstore_clone;
+	factory->terminate          = rleaf_dictstore_terminate;
+	factory->open               = rleaf_dictstore_open;
+	factory->close              = rleaf_dictstore_close;
+	factory->size               = rleaf_dictstore_size;
+	factory->add_statement      = rleaf_dictstore_add_statement;
+	factory->add_statements     = rleaf_dictstore_add_statements;
+	factory->remove_statement   = rleaf_dictstore_remove_statement;
+	factory->contains_statement = rleaf_dictstore_contains_statement;
+	factory->serialise          = rleaf_dictstore_serialise;
+	factory->find_statements    = rleaf_dictstore_find_statements;
+	factory->sync               = rleaf_dictstore_sync;
+}
+
+
+/* --------------------------------------------------------------
+ * Snapshots
+ * -------------------------------------------------------------- */
+
+/*
+ * Map the file at +path+ into memory read-only, setting +len+ to its length. Returns NULL
+ * and leaves errno set if it can't be mapped. On platforms without mmap(), the file is
+ * read into memory instead.
+ */
+static void *
+rleaf_snapshot_map( const char *path, size_t *len ) {
+	struct stat st;
+	void *mapping;
+	int fd, saved_errno;
+
+	if ( (fd = open(path, O_RDONLY)) < 0 ) return NULL;
+	if ( fstat(fd, &st) != 0 ) goto failed;
+	*len = (size_t)st.st_size;
+
+#ifdef HAVE_SYS_MMAN_H
+	if ( (mapping = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ) goto failed;
+#else
+	{
+		size_t done = 0;
+		ssize_t nread;
+
+		mapping = ALLOC_N( char, *len );
+		while ( done < *len ) {
+			if ( (nread = read(fd, (char *)mapping + done, *len - done)) <= 0 ) {
+				saved_errno = nread == 0 ? EINVAL : errno;
+				xfree( mapping );
+				close( fd );
+				errno = saved_errno;
+				return NULL;
+			}
+			done += (size_t)nread;
+		}
+	}
+#endif
+
+	close( fd );
+	return mapping;
+
+  failed:
+	saved_errno = errno;
+	close( fd );
+	errno = saved_errno;
+	return NULL;
+}
+
+
+/*
+ * Release a +mapping+ of +len+ bytes made by rleaf_snapshot_map().
+ */
+static void
+rleaf_snapshot_unmap( void *mapping, size_t len ) {
+#ifdef HAVE_SYS_MMAN_H
+	munmap( mapping, len );
+#else
+	_UNUSED( len );
+	xfree( mapping );
+#endif
+}
+
+
+/*
+ * Return a read-only dictionary store whose dictionary and indexes point into the
+ * snapshot +mapping+ of +len+ bytes, or NULL if the mapping isn't a valid snapshot.
+ */
+static rleaf_DICTSTORE *
+rleaf_snapshot_open_store( void *mapping, size_t len ) {
+	rleaf_SNAPSHOTHEADER *header = (rleaf_SNAPSHOTHEADER *)mapping;
+	rleaf_DICTSTORE *store;
+	rleaf_TERMDICT *dict;
+	unsigned char *base = (unsigned char *)mapping, *pos;
+	uint64_t terms, expected;
+	size_t i, j;
+
+	if ( len < sizeof(rleaf_SNAPSHOTHEADER) ||
+	     memcmp(header->magic, RLEAF_SNAPSHOT_MAGIC, 8) != 0 ||
+	     header->version    != RLEAF_SNAPSHOT_VERSION ||
+	     header->byte_order != RLEAF_SNAPSHOT_BYTE_ORDER ||
+	     header->block_size != RLEAF_INDEX_BLOCK_SIZE )
+		return NULL;
+
+	terms = header->term_count;
+	expected = RLEAF_PAD8( sizeof(rleaf_SNAPSHOTHEADER) ) +
+		RLEAF_PAD8( terms * sizeof(uint64_t) ) +
+		RLEAF_PAD8( terms * sizeof(uint32_t) ) +
+		RLEAF_PAD8( terms * sizeof(uint64_t) ) +
+		RLEAF_PAD8( terms ) +
+		RLEAF_PAD8( (uint64_t)header->bucket_count * sizeof(uint32_t) ) +
+		RLEAF_PAD8( header->arena_len ) +
+		RLEAF_INDEX_COUNT * header->block_count * sizeof(rleaf_INDEXBLOCK);
+	if ( expected != len ) return NULL;
+
+	store = ALLOC( rleaf_DICTSTORE );
+	dict = store->dict = ALLOC( rleaf_TERMDICT );
+	dict->refs = 1;
+	pos = base + RLEAF_PAD8( sizeof(rleaf_SNAPSHOTHEADER) );
+
+	dict->count = dict->capa = header->term_count;
+	dict->bucket_count = header->bucket_count;
+	dict->arena_len = dict->arena_capa = (size_t)header->arena_len;
+
+	dict->offsets = (uint64_t *)pos;       pos += RLEAF_PAD8( terms * sizeof(uint64_t) );
+	dict->lengths = (uint32_t *)pos;       pos += RLEAF_PAD8( terms * sizeof(uint32_t) );
+	dict->hashes  = (uint64_t *)pos;       pos += RLEAF_PAD8( terms * sizeof(uint64_t) );
+	dict->flags   = pos;                   pos += RLEAF_PAD8( terms );
+	dict->buckets = (uint32_t *)pos;
+	pos += RLEAF_PAD8( (uint64_t)header->bucket_count * sizeof(uint32_t) );
+	dict->arena   = pos;                   pos += RLEAF_PAD8( header->arena_len );
+
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ ) {
+		rleaf_TRIPLEINDEX *index = &store->indexes[ i ];
+
+		index->block_count = index->block_capa = (size_t)header->block_count;
+		index->blocks = index->block_capa ? ALLOC_N( rleaf_INDEXBLOCK *, index->block_capa ) : NULL;
+		for ( j = 0; j < index->block_count; j++ ) {
+			index->blocks[ j ] = (rleaf_INDEXBLOCK *)pos;
+			pos += sizeof( rleaf_INDEXBLOCK );
+		}
+	}
+
+	store->size = (size_t)header->statement_count;
+	store->read_only = 1;
+	store->readers = NULL;
+	store->mapping = mapping;
+	store->mapping_len = len;
+
+	return store;
+}
+
+
+/*
+ * Snapshot storage init method; the storage name is the path of the snapshot file.
+ */
+static int
+rleaf_snapshot_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	rleaf_DICTSTORE *store;
+	void *mapping;
+	size_t len = 0;
+
+	if ( options ) librdf_free_hash( options );
+
+	if ( !name || !(mapping = rleaf_snapshot_map(name, &len)) ) {
+		rleaf_log( "error", "couldn't map snapshot %s: %s", name ? name : "(null)",
+			strerror(errno) );
+		return 1;
+	}
+
+	if ( !(store = rleaf_snapshot_open_store(mapping, len)) ) {
+		rleaf_log( "error", "%s isn't a valid snapshot for this version of Redleaf", name );
+		rleaf_snapshot_unmap( mapping, len );
+		return 1;
+	}
+
+	rleaf_log( "debug", "mapped snapshot %s: %lu statements, %u terms",
+		name, (unsigned long)store->size, store->dict->count );
+	librdf_storage_set_instance( storage, store );
+
+	return 0;
+}
+
+
+/*
+ * Snapshot storage add_statement and remove_statement method.
+ */
+static int
+rleaf_snapshot_modify_statement( librdf_storage *storage, librdf_statement *statement ) {
+	_UNUSED( storage );
+	_UNUSED( statement );
+	rleaf_log( "error", "can't modify a read-only snapshot" );
+	return 1;
+}
+
+
+/*
+ * Snapshot storage add_statements method.
+ */
+static int
+rleaf_snapshot_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	_UNUSED( storage );
+	_UNUSED( stream );
+	rleaf_log( "error", "can't modify a read-only snapshot" );
+	return 1;
+}
+
+
+/*
+ * Snapshot storage factory registration function.
+ */
+static void
+rleaf_snapshot_register_factory( librdf_storage_factory *factory ) {
+	factory->version            = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init               = rleaf_snapshot_init;
+	factory->terminate          = rleaf_dictstore_terminate;
+	factory->open               = rleaf_dictstore_open;
+	factory->close              = rleaf_dictstore_close;
+	factory->size               = rleaf_dictstore_size;
+	factory->add_statement      = rleaf_snapshot_modify_statement;
+	factory->add_statements     = rleaf_snapshot_add_statements;
+	factory->remove_statement   = rleaf_snapshot_modify_statement;
+	factory->contains_statement = rleaf_dictstore_contains_statement;
+	factory->serialise          = rleaf_dictstore_serialise;
+	factory->find_statements    = rleaf_dictstore_find_statements;
+	factory->sync               = rleaf_dictstore_sync;
+}
+
+
+/*
+ * Write +len+ bytes from +ptr+ to +fh+ followed by zeroes up to the next multiple of 8.
+ */
+static void
+rleaf_snapshot_write_section( FILE *fh, const void *ptr, size_t len ) {
+	static const char zeroes[ 8 ] = { 0 };
+
+	if ( len ) fwrite( ptr, 1, len, fh );
+	if ( RLEAF_PAD8(len) != len ) fwrite( zeroes, 1, RLEAF_PAD8(len) - len, fh );
+}
+
+
+/*
+ * Write the dictionary store +store+, whose indexes must be packed, to +fh+ as a snapshot.
+ */
+static void
+rleaf_snapshot_write_store( FILE *fh, rleaf_DICTSTORE *store ) {
+	rleaf_SNAPSHOTHEADER header;
+	rleaf_TERMDICT *dict = store->dict;
+	size_t i, j;
+
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, RLEAF_SNAPSHOT_MAGIC, 8 );
+	header.version         = RLEAF_SNAPSHOT_VERSION;
+	header.byte_order      = RLEAF_SNAPSHOT_BYTE_ORDER;
+	header.block_size      = RLEAF_INDEX_BLOCK_SIZE;
+	header.term_count      = dict->count;
+	header.bucket_count    = dict->bucket_count;
+	header.arena_len       = dict->arena_len;
+	header.statement_count = store->size;
+	header.block_count     = store->indexes[ RLEAF_INDEX_SPO ].block_count;
+
+	rleaf_snapshot_write_section( fh, &header, sizeof(header) );
+	rleaf_snapshot_write_section( fh, dict->offsets, dict->count * sizeof(uint64_t) );
+	rleaf_snapshot_write_section( fh, dict->lengths, dict->count * sizeof(uint32_t) );
+	rleaf_snapshot_write_section( fh, dict->hashes, dict->count * sizeof(uint64_t) );
+	rleaf_snapshot_write_section( fh, dict->flags, dict->count );
+	rleaf_snapshot_write_section( fh, dict->buckets, dict->bucket_count * sizeof(uint32_t) );
+	rleaf_snapshot_write_section( fh, dict->arena, dict->arena_len );
+
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ ) {
+		rleaf_TRIPLEINDEX *index = &store->indexes[ i ];
+
+		for ( j = 0; j < index->block_count; j++ ) {
+			rleaf_INDEXBLOCK *block = index->blocks[ j ];
+
+			/* Zero the unused tail of a partial block so snapshots are reproducible */
+			if ( block->count < RLEAF_INDEX_BLOCK_SIZE )
+				memset( block->keys + block->count, 0,
+					(RLEAF_INDEX_BLOCK_SIZE - block->count) * 3 * sizeof(uint32_t) );
+			fwrite( block, sizeof(rleaf_INDEXBLOCK), 1, fh );
+		}
+	}
+}
+
+
+/*
+ * Build a packed dictionary store from the statements of the given +model+.
+ */
+static rleaf_DICTSTORE *
+rleaf_snapshot_build_store( librdf_model *model ) {
+	rleaf_DICTSTORE *store = rleaf_new_dictstore();
+	librdf_stream *stream = librdf_model_as_stream( model );
+	rleaf_TRIPLESET set;
+	rleaf_INDEXKEY *keys;
+	size_t i;
+	int index;
+
+	if ( !stream ) {
+		rleaf_free_dictstore( store );
+		rb_raise( rleaf_eRedleafError, "could not create a stream for the snapshot" );
+	}
+
+	rleaf_init_tripleset( &set );
+	rleaf_tripleset_add_stream( &set, store->dict, stream, 0 );
+	librdf_free_stream( stream );
+	rleaf_tripleset_sort( &set );
+
+	store->size = set.count;
+	keys = ALLOC_N( rleaf_INDEXKEY, set.count ? set.count : 1 );
+
+	for ( index = 0; index < RLEAF_INDEX_COUNT; index++ ) {
+		for ( i = 0; i < set.count; i++ ) {
+			uint32_t ids[ 3 ] = { set.triples[i].s, set.triples[i].p, set.triples[i].o };
+			rleaf_dictstore_make_key( index, ids, keys[i] );
+		}
+
+		/* The triple set is already in SPO order */
+		if ( index != RLEAF_INDEX_SPO )
+			qsort( keys, set.count, sizeof(rleaf_INDEXKEY), rleaf_triple_cmp );
+		rleaf_index_build( &store->indexes[index], (const rleaf_INDEXKEY *)keys, set.count );
+	}
+
+	xfree( keys );
+	rleaf_clear_tripleset( &set );
+
+	return store;
+}
+
+
+/*
+ * Write the statements of the given +model+ to a snapshot file at +path+. The snapshot is
+ * written to a temporary file first and then renamed, so processes mapping the old one
+ * never see a partial file.
+ */
+void
+rleaf_write_snapshot( librdf_model *model, const char *path ) {
+	rleaf_DICTSTORE *store = rleaf_snapshot_build_store( model );
+	size_t pathlen = strlen( path );
+	char *tmppath = ALLOCA_N( char, pathlen + 5 );
+	FILE *fh;
+	int failed, saved_errno;
+
+	memcpy( tmppath, path, pathlen );
+	memcpy( tmppath + pathlen, ".tmp", 5 );
+
+	if ( !(fh = fopen(tmppath, "wb")) ) {
+		saved_errno = errno;
+		rleaf_free_dictstore( store );
+		errno = saved_errno;
+		rb_sys_fail( tmppath );
+	}
+
+	rleaf_snapshot_write_store( fh, store );
+	failed = ferror( fh );
+	if ( fclose(fh) != 0 ) failed = 1;
+	saved_errno = errno;
+	rleaf_free_dictstore( store );
+
+	if ( failed || rename(tmppath, path) != 0 ) {
+		if ( !failed ) saved_errno = errno;
+		unlink( tmppath );
+		errno = saved_errno;
+		rb_sys_fail( path );
+	}
+}
+
+
+/*
+ * Register Redleaf's storage modules with the Redland world. This has to happen before the
+ * registry of backends is built.
+ */
+void
+rleaf_register_storage_modules( void ) {
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_DICTSTORE_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_DICTSTORE_NAME,
+		RLEAF_DICTSTORE_LABEL, rleaf_dictstore_register_factory );
+
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_SNAPSHOT_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_SNAPSHOT_NAME,
+		RLEAF_SNAPSHOT_LABEL, rleaf_snapshot_register_factory );
+}
+
+
+/* --------------------------------------------------------------
+ * Instance methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Fetch the dictionary store instance behind the given Redleaf::DictionaryStore.
+ */
+static rleaf_DICTSTORE *
+rleaf_get_dictstore( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self );
+	rleaf_DICTSTORE *dictstore;
+
+	if ( !rb_obj_is_kind_of(self, rleaf_cRedleafDictionaryStore) ||
+	     !(dictstore = librdf_storage_get_instance(store->storage)) )
+		rb_raise( rleaf_eRedleafError, "%s isn't backed by '%s' storage",
+			RSTRING_PTR(rb_inspect(self)), RLEAF_DICTSTORE_NAME );
+
+	return dictstore;
+}
+
+
+/*
+ *  call-seq:
+ *     store.statistics   -> hash
+ *
+ *  Return a Hash describing the store's memory use: the number of :statements and
+ *  :terms it holds, the number of bytes used by the term dictionary (:dictionary_bytes)
+ *  and by the three triple indexes (:index_bytes), and the average number of bytes used per
+ *  statement, both in all (:bytes_per_statement, which includes the dictionary) and in the
+ *  indexes alone (:index_bytes_per_statement).
+ *
+ */
+static VALUE
+rleaf_redleaf_dictionarystore_statistics( VALUE self ) {
+	rleaf_DICTSTORE *store = rleaf_get_dictstore( self );
+	VALUE stats = rb_hash_new();
+	size_t index_bytes = 0, dictionary_bytes = rleaf_termdict_memsize( store->dict );
+	int i;
+
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ )
+		index_bytes += rleaf_index_memsize( &store->indexes[i] );
+
+	rb_hash_aset( stats, ID2SYM(rb_intern("statements")), SIZET2NUM(store->size) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("terms")), UINT2NUM(store->dict->count) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("dictionary_bytes")), SIZET2NUM(dictionary_bytes) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("index_bytes")), SIZET2NUM(index_bytes) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("bytes_per_statement")),
+		rb_float_new(store->size ? (double)(index_bytes + dictionary_bytes) / store->size : 0.0) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("index_bytes_per_statement")),
+		rb_float_new(store->size ? (double)index_bytes / store->size : 0.0) );
+
+	return stats;
+}
+
+
+/*
+ *  call-seq:
+ *     store.compact   -> store
+ *
+ *  Rewrite the store's triple indexes into completely full blocks, returning memory left
+ *  free by removals and out-of-order appends.
+ *
+ */
+static VALUE
+rleaf_redleaf_dictionarystore_compact( VALUE self ) {
+	rleaf_DICTSTORE *store = rleaf_get_dictstore( self );
+	int i;
+
+	if ( store->read_only )
+		rb_raise( rleaf_eRedleafError, "can't compact a read-only version of a store" );
+
+	rleaf_dictstore_detach_readers( store );
+	for ( i = 0; i < RLEAF_INDEX_COUNT; i++ )
+		rleaf_index_pack( &store->indexes[i], store->size );
+
+	return self;
+}
+
+
+/*
+ *  call-seq:
+ *     store.version   -> store
+ *
+ *  Return a read-only store with the statements the receiver has now. The version shares
+ *  the receiver's term dictionary and index blocks, and the receiver copies a block before
+ *  changing one that's shared, so making a version only costs a copy of the indexes'
+ *  directories (about one pointer per 512 statements), and a version's memory is reclaimed
+ *  once it's garbage-collected. Graph#version wraps this in a Redleaf::Graph.
+ *
+ */
+static VALUE
+rleaf_redleaf_dictionarystore_version( VALUE self ) {
+	rleaf_DICTSTORE *store = rleaf_get_dictstore( self );
+	VALUE version = rb_class_new_instance( 0, NULL, CLASS_OF(self) );
+	librdf_storage *storage = rleaf_get_store( version )->storage;
+
+	rleaf_free_dictstore( librdf_storage_get_instance(storage) );
+	librdf_storage_set_instance( storage, rleaf_copy_dictstore(store, 1) );
+
+	return version;
+}
+
+
+/*
+ *  call-seq:
+ *     store.read_only?   -> true or false
+ *
+ *  Returns +true+ if the store is a read-only version of another one.
+ *
+ */
+static VALUE
+rleaf_redleaf_dictionarystore_read_only_p( VALUE self ) {
+	return rleaf_get_dictstore( self )->read_only ? Qtrue : Qfalse;
+}
+
+
+/*
+ * Redleaf::DictionaryStore and Redleaf::SnapshotStore classes
+ */
+void
+rleaf_init_redleaf_dictionary_store( void ) {
+	rleaf_log( "debug", "Initializing Redleaf::DictionaryStore" );
+
+#ifdef FOR_RDOC
+	rleaf_mRedleaf = rb_define_module( "Redleaf" );
+	rleaf_cRedleafStore = rb_define_class_under( rleaf_mRedleaf, "Store", rb_cObject );
+#endif
+
+	rb_require( "redleaf/store/dictionary" );
+	rleaf_cRedleafDictionaryStore =
+		rb_define_class_under( rleaf_mRedleaf, "DictionaryStore", rleaf_cRedleafStore );
+
+	rb_define_method( rleaf_cRedleafDictionaryStore, "statistics",
+		rleaf_redleaf_dictionarystore_statistics, 0 );
+	rb_define_method( rleaf_cRedleafDictionaryStore, "compact",
+		rleaf_redleaf_dictionarystore_compact, 0 );
+	rb_define_method( rleaf_cRedleafDictionaryStore, "version",
+		rleaf_redleaf_dictionarystore_version, 0 );
+	rb_define_method( rleaf_cRedleafDictionaryStore, "read_only?",
+		rleaf_redleaf_dictionarystore_read_only_p, 0 );
+
+	/* Redleaf::SnapshotStore -- read-only stores mapped from snapshot files */
+	rb_require( "redleaf/store/snapshot" );
+	rleaf_cRedleafSnapshotStore =
+		rb_define_class_under( rleaf_mRedleaf, "SnapshotStore", rleaf_cRedleafStore );
+}
+
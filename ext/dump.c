@@ -0,0 +1,569 @@
+/*
+ * Redleaf binary graph dumps
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#include "redleaf.h"
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ *
+ * A dump is:
+ *
+ *   "RLEAFDMP"                      magic
+ *   varint version                  currently 1
+ *   varint flags                    RLEAF_DUMP_CONTEXTS if statements carry contexts
+ *   varint term_count
+ *   term_count x (varint length, librdf_node_encode() bytes)
+ *   varint statement_count
+ *   statement_count x record
+ *
+ * Records are term ids sorted by (context, subject, predicate, object), where the context
+ * field is only present if the dump has contexts, and is 0 for no context or the term id + 1.
+ * In each record, the fields up to and including the first one that differs from the
+ * previous record are written as varint deltas from it; the rest are written as varints.
+ * -------------------------------------------------------------- */
+
+#define RLEAF_DUMP_MAGIC       "RLEAFDMP"
+#define RLEAF_DUMP_VERSION     1
+#define RLEAF_DUMP_CONTEXTS    0x01
+
+#define RLEAF_DUMP_CHUNK_SIZE  65536
+
+/* A statement as term ids: context + 1 (or 0), subject, predicate, object */
+typedef uint32_t rleaf_QUAD[ 4 ];
+
+/* Reading state for loading a dump */
+typedef struct rleaf_dump_reader {
+	VALUE				source;        /* A String, or an IO to read() chunks from */
+	VALUE				chunk;
+	const unsigned char	*ptr;
+	long				len, pos;
+
+	librdf_model		*model;
+	int					with_contexts;
+	librdf_node			**nodes;
+	uint64_t			node_count, node_capa;
+	rleaf_QUAD			*quads;
+	uint64_t			quad_count, quad_capa;
+	unsigned char		*term;         /* The encoded term being read */
+	size_t				term_capa;
+} rleaf_DUMPREADER;
+
+/* A stream over a run of loaded statements */
+typedef struct rleaf_dump_cursor {
+	rleaf_DUMPREADER	*reader;
+	uint64_t			pos, end;
+	librdf_statement	*statement;
+} rleaf_DUMPCURSOR;
+
+
+/* --------------------------------------------------------------
+ * Writing
+ * -------------------------------------------------------------- */
+
+/*
+ * Write +value+ to the +iostream+ as an unsigned LEB128 varint.
+ */
+static void
+rleaf_dump_write_varint( raptor_iostream *iostream, uint64_t value ) {
+	unsigned char buf[ 10 ];
+	size_t len = 0;
+
+	do {
+		buf[ len ] = value & 0x7f;
+		value >>= 7;
+		if ( value ) buf[ len ] |= 0x80;
+		len++;
+	} while ( value );
+
+	raptor_iostream_write_bytes( buf, 1, len, iostream );
+}
+
+
+/*
+ * qsort comparison function for rleaf_QUADs.
+ */
+static int
+rleaf_quad_cmp( const void *a, const void *b ) {
+	const uint32_t *x = (const uint32_t *)a, *y = (const uint32_t *)b;
+	int i;
+
+	for ( i = 0; i < 4; i++ )
+		if ( x[i] != y[i] ) return x[i] < y[i] ? -1 : 1;
+
+	return 0;
+}
+
+
+/*
+ * Write the statements of the given +model+ to +target+ (a String or an object that
+ * responds to #write) in Redleaf's binary dump format. If +with_contexts+ is non-zero,
+ * the context of each statement is dumped too.
+ */
+void
+rleaf_dump_model( librdf_model *model, int with_contexts, VALUE target ) {
+	rleaf_TERMDICT *dict;
+	librdf_stream *stream;
+	librdf_statement *stmt;
+	librdf_node *context;
+	rleaf_QUAD *quads = NULL, prev = { 0, 0, 0, 0 };
+	size_t i, count = 0, capa = 0, unique = 0;
+	uint32_t id;
+	int field, differs;
+	rleaf_RUBYIO rubyio;
+	raptor_iostream *iostream;
+
+	if ( TYPE(target) != T_STRING && !rb_respond_to(target, rb_intern("write")) )
+		rb_raise( rb_eArgError, "can't write a dump to a %s", rb_obj_classname(target) );
+
+	dict = rleaf_new_termdict();
+	if ( !(stream = librdf_model_as_stream(model)) ) {
+		rleaf_free_termdict( dict );
+		rb_raise( rleaf_eRedleafError, "could not create a stream to dump the graph" );
+	}
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+
+		if ( count == capa ) {
+			capa = capa ? capa * 2 : 1024;
+			REALLOC_N( quads, rleaf_QUAD, capa );
+		}
+
+		context = with_contexts ? (librdf_node *)librdf_stream_get_context( stream ) : NULL;
+		quads[count][0] = context ? rleaf_termdict_intern_node( dict, context, 0 ) + 1 : 0;
+		quads[count][1] = rleaf_termdict_intern_node( dict, librdf_statement_get_subject(stmt), 0 );
+		quads[count][2] = rleaf_termdict_intern_node( dict, librdf_statement_get_predicate(stmt), 0 );
+		quads[count][3] = rleaf_termdict_intern_node( dict, librdf_statement_get_object(stmt), 0 );
+
+		count++;
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	if ( count ) {
+		qsort( quads, count, sizeof(rleaf_QUAD), rleaf_quad_cmp );
+		for ( i = 1, unique = 1; i < count; i++ )
+			if ( rleaf_quad_cmp(quads[unique - 1], quads[i]) != 0 )
+				MEMCPY( quads[unique++], quads[i], uint32_t, 4 );
+	}
+
+	iostream = rleaf_new_ruby_iostream( &rubyio, target );
+
+	raptor_iostream_write_bytes( RLEAF_DUMP_MAGIC, 1, 8, iostream );
+	rleaf_dump_write_varint( iostream, RLEAF_DUMP_VERSION );
+	rleaf_dump_write_varint( iostream, with_contexts ? RLEAF_DUMP_CONTEXTS : 0 );
+
+	/* Terms are stored in the dictionary behind a scope byte, which isn't dumped */
+	rleaf_dump_write_varint( iostream, dict->count );
+	for ( id = 0; id < dict->count; id++ ) {
+		rleaf_dump_write_varint( iostream, dict->lengths[id] - 1 );
+		raptor_iostream_write_bytes( dict->arena + dict->offsets[id] + 1, 1,
+			dict->lengths[id] - 1, iostream );
+	}
+
+	rleaf_dump_write_varint( iostream, unique );
+	for ( i = 0; i < unique; i++ ) {
+		differs = 0;
+		for ( field = with_contexts ? 0 : 1; field < 4; field++ ) {
+			if ( differs ) {
+				rleaf_dump_write_varint( iostream, quads[i][field] );
+			} else {
+				rleaf_dump_write_varint( iostream, quads[i][field] - prev[field] );
+				differs = quads[i][field] != prev[field];
+			}
+		}
+		MEMCPY( prev, quads[i], uint32_t, 4 );
+	}
+
+	if ( quads ) xfree( quads );
+	rleaf_free_termdict( dict );
+	rleaf_finish_ruby_iostream( iostream, &rubyio );
+}
+
+
+/* --------------------------------------------------------------
+ * Reading
+ * -------------------------------------------------------------- */
+
+/*
+ * Make sure there are unread bytes in the reader's buffer, reading another chunk from its
+ * IO if necessary. Raises an error at the end of the input.
+ */
+static void
+rleaf_dump_fill( rleaf_DUMPREADER *reader ) {
+	if ( reader->pos < reader->len ) return;
+
+	if ( TYPE(reader->source) != T_STRING ) {
+		reader->chunk = rb_funcall( reader->source, rb_intern("read"), 1,
+			INT2FIX(RLEAF_DUMP_CHUNK_SIZE) );
+
+		if ( !NIL_P(reader->chunk) ) {
+			StringValue( reader->chunk );
+			reader->ptr = (const unsigned char *)RSTRING_PTR( reader->chunk );
+			reader->len = RSTRING_LEN( reader->chunk );
+			reader->pos = 0;
+		}
+	}
+
+	if ( reader->pos >= reader->len )
+		rb_raise( rleaf_eRedleafError, "malformed dump: unexpected end of input" );
+}
+
+
+/*
+ * Read an unsigned LEB128 varint.
+ */
+static uint64_t
+rleaf_dump_read_varint( rleaf_DUMPREADER *reader ) {
+	uint64_t value = 0;
+	int shift = 0;
+	unsigned char byte;
+
+	do {
+		if ( shift > 63 ) rb_raise( rleaf_eRedleafError, "malformed dump: varint too long" );
+		rleaf_dump_fill( reader );
+		byte = reader->ptr[ reader->pos++ ];
+		value |= (uint64_t)( byte & 0x7f ) << shift;
+		shift += 7;
+	} while ( byte & 0x80 );
+
+	return value;
+}
+
+
+/*
+ * Read +len+ bytes into +buf+.
+ */
+static void
+rleaf_dump_read_bytes( rleaf_DUMPREADER *reader, unsigned char *buf, size_t len ) {
+	size_t chunk;
+
+	while ( len ) {
+		rleaf_dump_fill( reader );
+		chunk = (size_t)( reader->len - reader->pos );
+		if ( chunk > len ) chunk = len;
+
+		memcpy( buf, reader->ptr + reader->pos, chunk );
+		reader->pos += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+
+/*
+ * Read an encoded term of +len+ bytes into the reader's term buffer. The buffer only grows
+ * as the bytes actually arrive, so a corrupt length can't make it allocate more than the
+ * input holds.
+ */
+static void
+rleaf_dump_read_term( rleaf_DUMPREADER *reader, size_t len ) {
+	size_t got = 0, chunk;
+
+	while ( got < len ) {
+		rleaf_dump_fill( reader );
+		chunk = (size_t)( reader->len - reader->pos );
+		if ( chunk > len - got ) chunk = len - got;
+
+		if ( got + chunk > reader->term_capa ) {
+			reader->term_capa = reader->term_capa * 2 > got + chunk ?
+				reader->term_capa * 2 : got + chunk;
+			if ( reader->term_capa > len ) reader->term_capa = len;
+			REALLOC_N( reader->term, unsigned char, reader->term_capa );
+		}
+
+		memcpy( reader->term + got, reader->ptr + reader->pos, chunk );
+		reader->pos += chunk;
+		got += chunk;
+	}
+}
+
+
+/*
+ * Read a term id, making sure it refers to a term in the dump.
+ */
+static uint32_t
+rleaf_dump_read_id( rleaf_DUMPREADER *reader, uint64_t value, uint64_t limit ) {
+	if ( value >= limit )
+		rb_raise( rleaf_eRedleafError, "malformed dump: term id %llu out of range",
+			(unsigned long long)value );
+	return (uint32_t)value;
+}
+
+
+/*
+ * librdf_stream is_end method for a run of loaded statements.
+ */
+static int
+rleaf_dumpcursor_is_end( void *context ) {
+	rleaf_DUMPCURSOR *cursor = (rleaf_DUMPCURSOR *)context;
+	return cursor->pos >= cursor->end;
+}
+
+
+/*
+ * Build the statement at the cursor's position.
+ */
+static void
+rleaf_dumpcursor_load( rleaf_DUMPCURSOR *cursor ) {
+	librdf_node **nodes = cursor->reader->nodes;
+	uint32_t *quad;
+
+	if ( cursor->statement ) librdf_free_statement( cursor->statement );
+	cursor->statement = NULL;
+	if ( cursor->pos >= cursor->end ) return;
+
+	quad = cursor->reader->quads[ cursor->pos ];
+	cursor->statement = librdf_new_statement_from_nodes( rleaf_rdf_world,
+		librdf_new_node_from_node(nodes[quad[1]]),
+		librdf_new_node_from_node(nodes[quad[2]]),
+		librdf_new_node_from_node(nodes[quad[3]]) );
+}
+
+
+/*
+ * librdf_stream next method for a run of loaded statements.
+ */
+static int
+rleaf_dumpcursor_next( void *context ) {
+	rleaf_DUMPCURSOR *cursor = (rleaf_DUMPCURSOR *)context;
+
+	cursor->pos++;
+	rleaf_dumpcursor_load( cursor );
+
+	return cursor->pos >= cursor->end;
+}
+
+
+/*
+ * librdf_stream get method for a run of loaded statements.
+ */
+static void *
+rleaf_dumpcursor_get( void *context, int flags ) {
+	rleaf_DUMPCURSOR *cursor = (rleaf_DUMPCURSOR *)context;
+
+	if ( flags == LIBRDF_STREAM_GET_METHOD_GET_OBJECT ) return cursor->statement;
+	return NULL;
+}
+
+
+/*
+ * librdf_stream finished method for a run of loaded statements.
+ */
+static void
+rleaf_dumpcursor_finished( void *context ) {
+	rleaf_DUMPCURSOR *cursor = (rleaf_DUMPCURSOR *)context;
+
+	if ( cursor->statement ) librdf_free_statement( cursor->statement );
+	xfree( cursor );
+}
+
+
+/*
+ * Add the loaded statements from +start+ up to +end+, which all have the same context, to
+ * the reader's model as a single batch.
+ */
+static void
+rleaf_dump_add_run( rleaf_DUMPREADER *reader, uint64_t start, uint64_t end ) {
+	rleaf_DUMPCURSOR *cursor = ALLOC( rleaf_DUMPCURSOR );
+	librdf_stream *stream;
+	uint32_t context = reader->quads[ start ][ 0 ];
+	int rval;
+
+	cursor->reader    = reader;
+	cursor->pos       = start;
+	cursor->end       = end;
+	cursor->statement = NULL;
+	rleaf_dumpcursor_load( cursor );
+
+	stream = librdf_new_stream( rleaf_rdf_world, cursor, rleaf_dumpcursor_is_end,
+		rleaf_dumpcursor_next, rleaf_dumpcursor_get, rleaf_dumpcursor_finished );
+	if ( !stream ) {
+		rleaf_dumpcursor_finished( cursor );
+		rb_raise( rleaf_eRedleafError, "couldn't create a stream for loading a dump" );
+	}
+
+	if ( context && reader->with_contexts )
+		rval = librdf_model_context_add_statements( reader->model,
+			reader->nodes[context - 1], stream );
+	else
+		rval = librdf_model_add_statements( reader->model, stream );
+	librdf_free_stream( stream );
+
+	if ( rval != 0 )
+		rb_raise( rleaf_eRedleafError, "failed to add the statements from a dump" );
+}
+
+
+/*
+ * Read the dump and add its statements to the model. Called through rb_ensure() so the
+ * reader's allocations are freed if the dump is malformed.
+ */
+static VALUE
+rleaf_dump_load_body( VALUE arg ) {
+	rleaf_DUMPREADER *reader = (rleaf_DUMPREADER *)arg;
+	unsigned char magic[ 8 ];
+	uint64_t version, flags, len, i, start, limit;
+	int field, first, differs;
+	uint32_t prev[ 4 ] = { 0, 0, 0, 0 };
+
+	rleaf_dump_read_bytes( reader, magic, 8 );
+	if ( memcmp(magic, RLEAF_DUMP_MAGIC, 8) != 0 )
+		rb_raise( rleaf_eRedleafError, "not a Redleaf dump" );
+	if ( (version = rleaf_dump_read_varint(reader)) != RLEAF_DUMP_VERSION )
+		rb_raise( rleaf_eRedleafError, "unsupported dump version %llu",
+			(unsigned long long)version );
+	flags = rleaf_dump_read_varint( reader );
+	first = ( flags & RLEAF_DUMP_CONTEXTS ) ? 0 : 1;
+
+	/* Terms; the counts in the dump aren't trusted to size anything up front, so the arrays
+	   grow as terms and statements are actually read. */
+	limit = rleaf_dump_read_varint( reader );
+	if ( limit >= RLEAF_NO_TERM )
+		rb_raise( rleaf_eRedleafError, "malformed dump: too many terms" );
+
+	for ( i = 0; i < limit; i++ ) {
+		len = rleaf_dump_read_varint( reader );
+		if ( len == 0 || len > (uint64_t)LONG_MAX )
+			rb_raise( rleaf_eRedleafError, "malformed dump: bad length for term %llu",
+				(unsigned long long)i );
+		rleaf_dump_read_term( reader, (size_t)len );
+
+		if ( reader->node_count == reader->node_capa ) {
+			reader->node_capa = reader->node_capa ? reader->node_capa * 2 : 1024;
+			if ( reader->node_capa > limit ) reader->node_capa = limit;
+			REALLOC_N( reader->nodes, librdf_node *, reader->node_capa );
+		}
+
+		reader->nodes[i] = librdf_node_decode( rleaf_rdf_world, NULL, reader->term, (size_t)len );
+		if ( !reader->nodes[i] )
+			rb_raise( rleaf_eRedleafError, "malformed dump: couldn't decode term %llu",
+				(unsigned long long)i );
+		reader->node_count++;
+	}
+
+	/* Statements */
+	len = rleaf_dump_read_varint( reader );
+	if ( len > (uint64_t)(SIZE_MAX / sizeof(rleaf_QUAD)) )
+		rb_raise( rleaf_eRedleafError, "malformed dump: too many statements" );
+
+	for ( i = 0; i < len; i++ ) {
+		if ( reader->quad_count == reader->quad_capa ) {
+			reader->quad_capa = reader->quad_capa ? reader->quad_capa * 2 : 1024;
+			if ( reader->quad_capa > len ) reader->quad_capa = len;
+			REALLOC_N( reader->quads, rleaf_QUAD, reader->quad_capa );
+		}
+
+		reader->quads[i][0] = 0;
+		differs = 0;
+
+		for ( field = first; field < 4; field++ ) {
+			uint64_t value = rleaf_dump_read_varint( reader );
+
+			if ( !differs ) {
+				differs = value != 0;
+				value += prev[ field ];
+			}
+			reader->quads[i][field] = rleaf_dump_read_id( reader, value,
+				field == 0 ? limit + 1 : limit );
+		}
+
+		MEMCPY( prev, reader->quads[i], uint32_t, 4 );
+		reader->quad_count++;
+	}
+
+	/* Add each run of statements with the same context as a batch */
+	for ( start = 0, i = 1; i <= reader->quad_count; i++ ) {
+		if ( i == reader->quad_count || reader->quads[i][0] != reader->quads[start][0] ) {
+			rleaf_dump_add_run( reader, start, i );
+			start = i;
+		}
+	}
+
+	return Qnil;
+}
+
+
+/*
+ * Free the nodes, statements, and term buffer read by a dump reader.
+ */
+static VALUE
+rleaf_dump_load_ensure( VALUE arg ) {
+	rleaf_DUMPREADER *reader = (rleaf_DUMPREADER *)arg;
+	uint64_t i;
+
+	for ( i = 0; i < reader->node_count; i++ ) librdf_free_node( reader->nodes[i] );
+	if ( reader->nodes ) xfree( reader->nodes );
+	if ( reader->quads ) xfree( reader->quads );
+	if ( reader->term ) xfree( reader->term );
+
+	return Qnil;
+}
+
+
+/*
+ * Read a dump from +source+ (a String or an object that responds to #read) and add its
+ * statements to the given +model+. If +with_contexts+ is zero, the statements are added
+ * without their contexts.
+ */
+void
+rleaf_load_dump( librdf_model *model, int with_contexts, VALUE source ) {
+	rleaf_DUMPREADER reader;
+
+	if ( TYPE(source) != T_STRING && !rb_respond_to(source, rb_intern("read")) )
+		rb_raise( rb_eArgError, "can't read a dump from a %s", rb_obj_classname(source) );
+
+	memset( &reader, 0, sizeof(reader) );
+	reader.source        = source;
+	reader.chunk         = Qnil;
+	reader.model         = model;
+	reader.with_contexts = with_contexts;
+
+	if ( TYPE(source) == T_STRING ) {
+		reader.ptr = (const unsigned char *)RSTRING_PTR( source );
+		reader.len = RSTRING_LEN( source );
+	}
+
+	rb_ensure( rleaf_dump_load_body, (VALUE)&reader, rleaf_dump_load_ensure, (VALUE)&reader );
+	RB_GC_GUARD( reader.chunk );
+}
+
@@ -26,6 +26,7 @@ find_header( 'redland.h' )  or abort( "missing redland.h" )
 have_header( 'stdio.h' )    or abort( "missing stdio.h" )
 have_header( 'string.h' )   or abort( "missing string.h" )
 have_header( 'inttypes.h' ) or abort( "missing inttypes.h" )
+have_header( 'sys/mman.h' )
 
 have_func( 'librdf_serializer_get_description' ) or
 	abort( "Your librdf is too old!" )
@@ -45,7 +45,9 @@ VALUE rleaf_cRedleafGraph;
 librdf_uri *rleaf_contexts_feature;
 
 static VALUE rleaf_set_serializer_ns( VALUE, VALUE );
+static VALUE rleaf_redleaf_graph_supports_contexts_p( VALUE );
 static VALUE rleaf_raptor_syntax_desc_to_hash( const raptor_syntax_description * );
+static int rleaf_graph_start_replacement( VALUE, rleaf_GRAPH * );
 
 static VALUE name_sym;
 static VALUE aliases_sym;
@@ -55,7 +57,19 @@ static VALUE uris_sym;
 static VALUE flags_sym;
 
 static ID graph_eq;
-static ID valid_format_p;
+
+static VALUE rleaf_graph_serializers = Qnil;
+
+/* A #serialize_matching in progress, so its librdf objects can be freed if it raises */
+typedef struct rleaf_serialization {
+	VALUE				self;
+	VALUE				target;
+	VALUE				nshash;
+	const char			*formatname;
+	librdf_serializer	*serializer;
+	librdf_statement	*search;
+	librdf_stream		*stream;
+} rleaf_SERIALIZATION;
 
 
 /* --------------------------------------------------
@@ -77,6 +91,7 @@ rleaf_graph_alloc( VALUE storeobj ) {
 
 	ptr->store = storeobj;
 	ptr->model = librdf_new_model( rleaf_rdf_world, store->storage, NULL );
+	ptr->in_transaction = 0;
 
 	rleaf_log( "debug", "initialized a rleaf_GRAPH <%p>", ptr );
 	return ptr;
@@ -143,6 +158,396 @@ rleaf_get_graph( VALUE self ) {
 
 
 
+/* --------------------------------------------------
+ *	Statement and fingerprint functions
+ * -------------------------------------------------- */
+
+/*
+ * Returns non-zero if the given +model+ contains +stmt+ in any context. According to the
+ * Redland docs, this is a better way to test this than librdf_model_contains_statement if
+ * the model has contexts.
+ */
+static int
+rleaf_model_has_statement( librdf_model *model, librdf_statement *stmt ) {
+	librdf_stream *stream = librdf_model_find_statements( model, stmt );
+	int rval = 0;
+
+	if ( stream != NULL ) {
+		rval = !librdf_stream_end( stream );
+		librdf_free_stream( stream );
+	}
+
+	return rval;
+}
+
+
+/*
+ * Returns non-zero if the given +model+ contains +stmt+ in the specified +context+.
+ */
+static int
+rleaf_model_context_has_statement( librdf_model *model, librdf_node *context,
+	librdf_statement *stmt )
+{
+	librdf_stream *stream = librdf_model_find_statements_in_context( model, stmt, context );
+	int rval = 0;
+
+	if ( stream != NULL ) {
+		rval = !librdf_stream_end( stream );
+		librdf_free_stream( stream );
+	}
+
+	return rval;
+}
+
+
+/*
+ * Mark the fingerprint of the statements in the given +graph+'s store as unknown, so it will
+ * be recalculated the next time it's needed. Call this after changing the store's contents
+ * other than through #append_statements or #remove. Any statement counts the store has kept,
+ * for the whole graph or for its contexts, are forgotten, too.
+ */
+void
+rleaf_graph_invalidate_fingerprint( VALUE graph ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( graph );
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+
+	store->fingerprint_valid = 0;
+	store->size_valid = 0;
+	store->context_sizes = Qnil;
+}
+
+
+/*
+ * Returns true if +store+ can't change: a Redleaf::SnapshotStore, or a read-only version of
+ * a Redleaf::DictionaryStore.
+ */
+static int
+rleaf_graph_store_is_immutable( VALUE store ) {
+	if ( rb_obj_is_kind_of(store, rleaf_cRedleafSnapshotStore) )
+		return 1;
+	if ( rb_obj_is_kind_of(store, rleaf_cRedleafDictionaryStore) )
+		return RTEST( rb_funcall(store, rb_intern("read_only?"), 0) );
+	return 0;
+}
+
+
+/*
+ * Returns true if +store+ is a Redleaf::OverlayStore that reads through to a base that can
+ * be changed without it, so its size and fingerprint can't be kept between calls.
+ */
+static int
+rleaf_graph_store_reads_through( VALUE store ) {
+	return rb_obj_is_kind_of( store, rleaf_cRedleafOverlayStore ) &&
+		!rleaf_graph_store_is_immutable( rb_iv_get(store, "@base") );
+}
+
+
+/*
+ * Return the number of statements in the given graph's store, only asking the store for it
+ * if it isn't already known, or -1 if the store can't say. Stores without contexts have
+ * their count kept up to date as statements are appended and removed through Redleaf; a
+ * store with contexts might count a statement once for each context it's in, so its count
+ * is only kept until the next change. Overlays of a mutable base are counted every time.
+ */
+static long
+rleaf_graph_statement_count( VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+	int size;
+
+	if ( store->size_valid ) return store->size;
+
+	if ( (size = librdf_model_size( ptr->model )) < 0 ) {
+		rleaf_log_with_context( self, "debug", "store can't count its statements" );
+		return -1;
+	}
+	if ( rleaf_graph_store_reads_through(ptr->store) ) return size;
+
+	store->size         = size;
+	store->size_valid   = 1;
+	store->size_tracked = !RTEST( rleaf_redleaf_graph_supports_contexts_p(self) );
+
+	return size;
+}
+
+
+/*
+ * Return a String that identifies +node+ in a Hash: its encoded form, so equal nodes have
+ * equal keys.
+ */
+static VALUE
+rleaf_node_key( librdf_node *node ) {
+	size_t length = librdf_node_encode( node, NULL, 0 );
+	VALUE key = rb_str_new( NULL, length );
+
+	librdf_node_encode( node, (unsigned char *)RSTRING_PTR(key), length );
+	return key;
+}
+
+
+/*
+ * Return the number of statements in +context+ that the store of the given graph has
+ * kept count of, or Qnil if it hasn't.
+ */
+static VALUE
+rleaf_graph_known_context_size( rleaf_GRAPH *ptr, librdf_node *context ) {
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+
+	if ( NIL_P(store->context_sizes) ) return Qnil;
+	return rb_hash_lookup( store->context_sizes, rleaf_node_key(context) );
+}
+
+
+/*
+ * Add +delta+ to the number of statements in +context+ the store of the given graph has
+ * kept count of, if it has.
+ */
+static void
+rleaf_graph_adjust_context_size( rleaf_GRAPH *ptr, librdf_node *context, long delta ) {
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+	VALUE key, size;
+
+	if ( NIL_P(store->context_sizes) ) return;
+
+	key = rleaf_node_key( context );
+	size = rb_hash_lookup( store->context_sizes, key );
+	if ( !NIL_P(size) )
+		rb_hash_aset( store->context_sizes, key, LONG2NUM(NUM2LONG(size) + delta) );
+}
+
+
+/*
+ * Recalculate the fingerprint of the statements in the graph's store from scratch. Stores
+ * with contexts can return the same statement once for each context it's in, so their
+ * statements are de-duplicated before their fingerprints are summed. That's done by their
+ * terms rather than by their fingerprints, since statements that differ only in their blank
+ * nodes have the same fingerprint but are still different statements.
+ */
+static void
+rleaf_graph_calculate_fingerprint( VALUE self, rleaf_GRAPH *ptr, rleaf_STORE *store ) {
+	librdf_stream *stream = librdf_model_as_stream( ptr->model );
+	int dedup = RTEST( rleaf_redleaf_graph_supports_contexts_p(self) );
+	rleaf_TERMDICT *dict = NULL;
+	rleaf_TRIPLEHASH seen;
+	uint64_t fingerprint[2];
+	size_t count = 0;
+
+	store->fingerprint[0] = store->fingerprint[1] = 0;
+	if ( !stream )
+		rb_raise( rleaf_eRedleafError, "could not create a stream to fingerprint the graph" );
+
+	if ( dedup ) {
+		dict = rleaf_new_termdict();
+		rleaf_init_triplehash( &seen );
+	}
+
+	while ( ! librdf_stream_end(stream) ) {
+		librdf_statement *stmt = librdf_stream_get_object( stream );
+		if ( !stmt ) break;
+
+		count++;
+		if ( dedup && !rleaf_triplehash_add(&seen,
+				rleaf_termdict_intern_node(dict, librdf_statement_get_subject(stmt), 1),
+				rleaf_termdict_intern_node(dict, librdf_statement_get_predicate(stmt), 1),
+				rleaf_termdict_intern_node(dict, librdf_statement_get_object(stmt), 1)) )
+		{
+			librdf_stream_next( stream );
+			continue;
+		}
+
+		rleaf_statement_fingerprint( stmt, fingerprint );
+		store->fingerprint[0] += fingerprint[0];
+		store->fingerprint[1] += fingerprint[1];
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	if ( dedup ) {
+		rleaf_clear_triplehash( &seen );
+		rleaf_free_termdict( dict );
+	}
+
+	rleaf_log_with_context( self, "debug", "calculated fingerprint of %d statements", count );
+
+	/* An overlay of a mutable base has to be fingerprinted again each time */
+	if ( rleaf_graph_store_reads_through(ptr->store) ) return;
+
+	/* Without contexts, every statement in the stream is a distinct one */
+	if ( !dedup && !store->size_valid ) {
+		store->size         = count;
+		store->size_valid   = 1;
+		store->size_tracked = 1;
+	}
+
+	store->fingerprint_valid = 1;
+}
+
+
+/*
+ * Add the given +stmt+ to the graph's model (in +context+ if it's non-NULL), keeping its
+ * store's fingerprint, statement count, and the count of statements in +context+ up to
+ * date. Returns non-zero if the statement couldn't be added.
+ */
+static int
+rleaf_graph_context_add_librdf_statement( rleaf_GRAPH *ptr, librdf_node *context,
+	librdf_statement *stmt )
+{
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+	uint64_t fingerprint[2];
+	int tracking = store->size_valid && store->size_tracked;
+	int is_new, new_in_context = 0, rval;
+
+	/* Only statements that weren't already in the graph change its fingerprint or size */
+	is_new = ( store->fingerprint_valid || tracking ) &&
+		!rleaf_model_has_statement( ptr->model, stmt );
+	if ( context && !NIL_P(rleaf_graph_known_context_size(ptr, context)) )
+		new_in_context = !rleaf_model_context_has_statement( ptr->model, context, stmt );
+
+	if ( context )
+		rval = librdf_model_context_add_statement( ptr->model, context, stmt );
+	else
+		rval = librdf_model_add_statement( ptr->model, stmt );
+	if ( rval != 0 ) return rval;
+
+	if ( is_new && store->fingerprint_valid ) {
+		rleaf_statement_fingerprint( stmt, fingerprint );
+		store->fingerprint[0] += fingerprint[0];
+		store->fingerprint[1] += fingerprint[1];
+	}
+	if ( is_new && tracking ) store->size++;
+	if ( !store->size_tracked ) store->size_valid = 0;
+	if ( new_in_context ) rleaf_graph_adjust_context_size( ptr, context, 1 );
+
+	return 0;
+}
+
+
+/*
+ * Add the given +stmt+ to the graph's model without a context.
+ */
+static int
+rleaf_graph_add_librdf_statement( rleaf_GRAPH *ptr, librdf_statement *stmt ) {
+	return rleaf_graph_context_add_librdf_statement( ptr, NULL, stmt );
+}
+
+
+/*
+ * Remove the given +stmt+ from the graph's model (only from +context+ if it's non-NULL),
+ * keeping its store's fingerprint and context counts up to date. The statement must not be
+ * one that belongs to a stream over the same model. Returns non-zero if the statement
+ * couldn't be removed.
+ */
+static int
+rleaf_graph_context_remove_librdf_statement( rleaf_GRAPH *ptr, librdf_node *context,
+	librdf_statement *stmt )
+{
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+	uint64_t fingerprint[2];
+	int tracking = store->size_valid && store->size_tracked;
+	int was_in_context = 0, rval;
+
+	if ( store->fingerprint_valid ) rleaf_statement_fingerprint( stmt, fingerprint );
+	if ( context && !NIL_P(rleaf_graph_known_context_size(ptr, context)) )
+		was_in_context = rleaf_model_context_has_statement( ptr->model, context, stmt );
+
+	if ( context )
+		rval = librdf_model_context_remove_statement( ptr->model, context, stmt );
+	else
+		rval = librdf_model_remove_statement( ptr->model, stmt );
+	if ( rval != 0 ) return rval;
+
+	/* Removing a statement from every context could change any of their counts */
+	if ( was_in_context )
+		rleaf_graph_adjust_context_size( ptr, context, -1 );
+	else if ( !context )
+		store->context_sizes = Qnil;
+
+	/* The statement might still be in the graph in another context */
+	if ( (store->fingerprint_valid || tracking) && !rleaf_model_has_statement(ptr->model, stmt) ) {
+		if ( store->fingerprint_valid ) {
+			store->fingerprint[0] -= fingerprint[0];
+			store->fingerprint[1] -= fingerprint[1];
+		}
+		if ( tracking ) store->size--;
+	}
+	if ( !store->size_tracked ) store->size_valid = 0;
+
+	return 0;
+}
+
+
+/*
+ * Remove the given +stmt+ from every context of the graph's model.
+ */
+static int
+rleaf_graph_remove_librdf_statement( rleaf_GRAPH *ptr, librdf_statement *stmt ) {
+	return rleaf_graph_context_remove_librdf_statement( ptr, NULL, stmt );
+}
+
+
+/*
+ * Return the store of the given graph after making sure its fingerprint is up to date.
+ */
+static rleaf_STORE *
+rleaf_graph_fingerprinted_store( VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+
+	if ( !store->fingerprint_valid )
+		rleaf_graph_calculate_fingerprint( self, ptr, store );
+
+	return store;
+}
+
+
+/*
+ * Return a new librdf_node for the :context in the given +opthash+, or NULL if +opthash+ is
+ * nil or doesn't have one. The caller is responsible for freeing it.
+ */
+static librdf_node *
+rleaf_context_option_node( VALUE opthash ) {
+	VALUE context;
+
+	if ( !RTEST(opthash) ) return NULL;
+
+	Check_Type( opthash, T_HASH );
+	context = rb_hash_lookup( opthash, ID2SYM(rb_intern("context")) );
+	if ( NIL_P(context) ) return NULL;
+
+	return rleaf_value_to_librdf_node( context );
+}
+
+
+/*
+ * Count the statements in +context+ and keep the count in the graph's store so it can be
+ * kept up to date as statements are added to and removed from the context.
+ */
+static long
+rleaf_graph_count_context( VALUE self, rleaf_GRAPH *ptr, librdf_node *context ) {
+	rleaf_STORE *store = rleaf_get_store( ptr->store );
+	librdf_stream *stream = librdf_model_context_as_stream( ptr->model, context );
+	long count = 0;
+
+	if ( !stream )
+		rb_raise( rleaf_eRedleafError, "could not create a stream to count the statements in a context" );
+
+	while ( ! librdf_stream_end(stream) ) {
+		count++;
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	rleaf_log_with_context( self, "debug", "counted %ld statements in context", count );
+
+	if ( NIL_P(store->context_sizes) ) store->context_sizes = rb_hash_new();
+	rb_hash_aset( store->context_sizes, rleaf_node_key(context), LONG2NUM(count) );
+
+	return count;
+}
+
+
+
 /* --------------------------------------------------------------
  * Class methods
  * -------------------------------------------------------------- */
@@ -193,7 +598,9 @@ static VALUE
  *   Redleaf::Graph.serializers   -> hash
  *
  * The serializers supported by the underlying Redland library.
- * Returns the hash describing the supported serializers, keyed by name.
+ * Returns the hash describing the supported serializers, keyed by name. The Hash is built
+ * once when the extension is loaded and is frozen; call Redleaf.refresh_capabilities to
+ * rebuild it.
  *
  *   Redleaf::Graph.serializers
  *   # => {
@@ -217,26 +624,55 @@ static VALUE
  */
 static VALUE
 rleaf_redleaf_graph_s_serializers( VALUE klass ) {
-	const raptor_syntax_description *desc;
-	unsigned int counter = 0, name = 0;
-	VALUE rhash = rb_hash_new();
-	VALUE deschash = Qnil;
+	_UNUSED( klass );
+	return rleaf_graph_serializers;
+}
 
+
+/*
+ * call-seq:
+ *   Redleaf::Graph.valid_format?( format )   -> true or false
+ *
+ * Returns +true+ if the specified +format+ is supported by the Redland backend.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_s_valid_format_p( VALUE klass, VALUE format ) {
 	_UNUSED( klass );
+	return rleaf_graph_serializer_supported( format ) ? Qtrue : Qfalse;
+}
+
+
+/*
+ * Returns non-zero if the given +format+ names one of the serializers in the cached
+ * serializer registry.
+ */
+int
+rleaf_graph_serializer_supported( VALUE format ) {
+	if ( TYPE(format) != T_STRING ) return 0;
+	return rb_hash_lookup( rleaf_graph_serializers, format ) != Qnil;
+}
+
+
+/*
+ * (Re)build the frozen registry of serializers that is returned from
+ * Redleaf::Graph.serializers.
+ */
+void
+rleaf_refresh_graph_serializers( void ) {
+	const raptor_syntax_description *desc;
+	unsigned int counter = 0;
+	VALUE rhash = rb_hash_new();
 
 	rleaf_log( "debug", "Enumerating serializers." );
 	while ( (desc = librdf_serializer_get_description(rleaf_rdf_world, counter)) != NULL ) {
-		deschash = rb_hash_new();
-
 		rleaf_log( "debug", "  serializer [%d]: name = '%s', desc = '%s'", counter, desc->names[0], desc->label );
-
-		deschash = rleaf_raptor_syntax_desc_to_hash( desc );
-		rb_hash_aset( rhash, rb_str_new2(desc->names[0]), deschash );
+		rb_hash_aset( rhash, rb_str_new2(desc->names[0]), rleaf_raptor_syntax_desc_to_hash(desc) );
 		counter++;
 	}
 	rleaf_log( "debug", "  got %d serializers.", counter );
 
-	return rhash;
+	rleaf_graph_serializers = rleaf_deep_freeze( rhash );
 }
 
 
@@ -326,36 +762,85 @@ rleaf_redleaf_graph_initialize( int argc, VALUE *argv, VALUE self ) {
 }
 
 
+/*
+ * Create a graph of the same class as +self+ backed by the given +store+, with the same
+ * statements as +self+. If +share_caches+ is set, the copy starts out with the receiver's
+ * cached fingerprint and size; that's only safe if +store+ reads through to an immutable
+ * base, since otherwise changes to the base would leave the copy's caches stale.
+ */
+static VALUE
+rleaf_graph_copy_with_store( VALUE self, VALUE store, int share_caches ) {
+	rleaf_STORE *orig = rleaf_get_store( rleaf_get_graph(self)->store ), *copy;
+	VALUE graph = rb_class_new_instance( 1, &store, CLASS_OF(self) );
+
+	if ( share_caches ) {
+		copy = rleaf_get_store( store );
+		copy->fingerprint[0]    = orig->fingerprint[0];
+		copy->fingerprint[1]    = orig->fingerprint[1];
+		copy->fingerprint_valid = orig->fingerprint_valid;
+		copy->size              = orig->size;
+		copy->size_valid        = orig->size_valid;
+		copy->size_tracked      = orig->size_tracked;
+	}
+
+	OBJ_INFECT( graph, self );
+	return graph;
+}
+
+
 /*
  * call-seq:
  *   graph.dup   -> graph
  *
- * Duplicate the receiver and return the copy.
+ * Duplicate the receiver and return the copy. Graphs backed by a Redleaf::OverlayStore or a
+ * read-only Redleaf::SnapshotStore are copied in constant time (plus the number of changes
+ * made to an overlay) by giving the copy its own overlay of the same base; other graphs are
+ * copied statement by statement into a clone of their store.
  *
  */
 static VALUE
 rleaf_redleaf_graph_dup( VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	VALUE dup = rleaf_redleaf_graph_s_allocate( CLASS_OF(self) );
-	rleaf_GRAPH *dup_ptr = ALLOC( rleaf_GRAPH );
-	librdf_stream *statements = librdf_model_as_stream( ptr->model );
+	VALUE dup, base;
+	rleaf_GRAPH *dup_ptr;
+	librdf_stream *statements;
 
 	rleaf_log_with_context( self, "debug", "Duping %s 0x%x", rb_obj_classname(self), self );
 
-	dup_ptr->store = ptr->store;
+	if ( rb_obj_is_kind_of(ptr->store, rleaf_cRedleafOverlayStore) ) {
+		base = rb_iv_get( ptr->store, "@base" );
+		return rleaf_graph_copy_with_store( self, rleaf_new_overlay_store(base, ptr->store),
+			rleaf_graph_store_is_immutable(base) );
+	}
+	else if ( rb_obj_is_kind_of(ptr->store, rleaf_cRedleafSnapshotStore) ) {
+		return rleaf_graph_copy_with_store( self, rleaf_new_overlay_store(ptr->store, Qnil), 1 );
+	}
+
+	dup = rleaf_redleaf_graph_s_allocate( CLASS_OF(self) );
+	dup_ptr = ALLOC( rleaf_GRAPH );
+	statements = librdf_model_as_stream( ptr->model );
+
 	dup_ptr->model = librdf_new_model_from_model( ptr->model );
+	dup_ptr->in_transaction = 0;
 	if ( ! dup_ptr->model ) {
 		librdf_free_stream( statements );
 		xfree( dup_ptr );
 		rb_raise( rleaf_eRedleafError, "couldn't create new model from model <%p>", ptr->model );
 	}
 
+	/* The new model has a clone of the store's storage; give it a store object of its own,
+	   so the two graphs' cached fingerprints and sizes stay apart. */
+	dup_ptr->store = rleaf_new_store_from_storage( ptr->store,
+		librdf_model_get_storage(dup_ptr->model) );
+	rleaf_get_store( dup_ptr->store )->graph = dup;
+
 	if ( (librdf_model_add_statements(dup_ptr->model, statements)) != 0 ) {
 		librdf_free_stream( statements );
 		librdf_free_model( dup_ptr->model );
 		xfree( dup_ptr );
 		rb_raise( rleaf_eRedleafError, "couldn't add statements from the original model" );
 	}
+	librdf_free_stream( statements );
 
 	DATA_PTR( dup ) = dup_ptr;
 	OBJ_INFECT( dup, self );
@@ -364,6 +849,60 @@ rleaf_redleaf_graph_dup( VALUE self ) {
 }
 
 
+/*
+ * call-seq:
+ *   graph.overlay   -> graph
+ *
+ * Return a new graph with the same statements as the receiver that records statements
+ * added to and removed from it in a Redleaf::OverlayStore without copying or changing the
+ * receiver, so creating one takes the same time no matter how big the receiver is. This
+ * makes it cheap to try out hypothetical changes to a large graph:
+ *
+ *   hypothetical = base.overlay
+ *   hypothetical.remove([ me, FOAF[:knows], nil ])
+ *   hypothetical << [ me, FOAF[:knows], you ]
+ *
+ * The overlay reads through to the receiver's statements, so changes made to the receiver
+ * while the overlay is in use will show through it.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_overlay( VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+
+	rleaf_log_with_context( self, "debug", "Creating an overlay of %s 0x%x",
+		rb_obj_classname(self), self );
+	return rleaf_graph_copy_with_store( self, rleaf_new_overlay_store(ptr->store, Qnil),
+		rleaf_graph_store_is_immutable(ptr->store) );
+}
+
+
+/*
+ * call-seq:
+ *   graph.version   -> graph
+ *
+ * Return a read-only graph with the statements the receiver has now, which stays the same
+ * while the receiver is changed. For a graph in a Redleaf::DictionaryStore, this shares the
+ * receiver's indexes copy-on-write (see Redleaf::DictionaryStore#version), so it's cheap to
+ * take one for each query while statements are being loaded:
+ *
+ *   view = graph.version
+ *   view.each_statement {|stmt| ... }   # unaffected by concurrent appends to +graph+
+ *
+ * Other graphs are copied with #dup, which isn't read-only.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_version( VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+
+	if ( !rb_obj_is_kind_of(ptr->store, rleaf_cRedleafDictionaryStore) )
+		return rleaf_redleaf_graph_dup( self );
+
+	return rleaf_graph_copy_with_store( self, rb_funcall(ptr->store, rb_intern("version"), 0), 1 );
+}
+
+
 /*
  * call-seq:
  *   graph.store   -> a_store
@@ -390,6 +929,9 @@ static VALUE
 rleaf_redleaf_graph_store_eq( VALUE self, VALUE storeobj ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
 
+	if ( ptr->in_transaction )
+		rb_raise( rleaf_eRedleafError, "can't change the store of a graph during a transaction" );
+
 	if ( storeobj == Qnil ) {
 		rleaf_log_with_context( self, "info",
 			"Graph <0x%x>'s store cleared. Setting it to a new %s.",
@@ -414,80 +956,260 @@ rleaf_redleaf_graph_store_eq( VALUE self, VALUE storeobj ) {
 
 /*
  * call-seq:
- *    graph.size   => fixnum
+ *    graph.size                  => fixnum or nil
+ *    graph.size( :context => uri )   => fixnum
  *
- * Return the number of statements in the graph. If the underlying store doesn't support
- * fetching the size of the graph, the return value will be negative.
+ * Return the number of statements in the graph, or +nil+ if the underlying store doesn't
+ * support fetching the size of the graph.
+ *
+ * The store is only asked for its size the first time; for stores without contexts, the
+ * count is then kept up to date as statements are appended and removed through Redleaf.
+ * Stores with contexts are asked again after the next change. Use #recount if the store
+ * might have been changed some other way, e.g., by another process.
+ *
+ * If a :context is given, return the number of statements in that context instead. The
+ * first call for a context counts its statements; the count is then kept up to date as
+ * statements are appended to and removed from the context through the graph.
  *
  */
 static VALUE
-rleaf_redleaf_graph_size( VALUE self ) {
+rleaf_redleaf_graph_size( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *graph = rleaf_get_graph( self );
-	int size = librdf_model_size( graph->model );
+	librdf_node *context;
+	VALUE opthash = Qnil, size;
+	long count;
+
+	rb_scan_args( argc, argv, "01", &opthash );
+
+	if ( (context = rleaf_context_option_node(opthash)) == NULL ) {
+		count = rleaf_graph_statement_count( self );
+		return count < 0 ? Qnil : LONG2NUM( count );
+	}
+
+	size = rleaf_graph_known_context_size( graph, context );
+	if ( NIL_P(size) ) size = LONG2NUM( rleaf_graph_count_context(self, graph, context) );
+	librdf_free_node( context );
 
-	return INT2FIX( size );
+	return size;
 }
 
 
 /*
  * call-seq:
- *   graph.statements   -> array
+ *    graph.cached_size   => fixnum or nil
  *
- * Return an Array of all the statements in the graph.
+ * Return the number of statements in the graph if it's already known, or +nil+ if finding
+ * out would mean asking the store (which for some stores means scanning every statement).
  *
  */
 static VALUE
-rleaf_redleaf_graph_statements( VALUE self ) {
-	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_stream *stream = librdf_model_as_stream( ptr->model );
-	VALUE statements = rb_ary_new();
-
-	rleaf_log_with_context( self, "debug",
-		"Creating statement objects for %d statements in Graph <0x%x>.",
-		librdf_model_size(ptr->model), self );
-	while ( ! librdf_stream_end(stream) ) {
-		librdf_statement *stmt = librdf_stream_get_object( stream );
-		VALUE stmt_obj = rleaf_librdf_statement_to_value( stmt );
-
-		rb_ary_push( statements, stmt_obj );
-		librdf_stream_next( stream );
-	}
-	librdf_free_stream( stream );
-
-	return statements;
+rleaf_redleaf_graph_cached_size( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( rleaf_get_graph(self)->store );
+	return store->size_valid ? LONG2NUM( store->size ) : Qnil;
 }
 
 
 /*
  * call-seq:
- *    graph.append_statements( *statements )   -> graph
+ *    graph.recount   => fixnum or nil
  *
- * Append one or more Redleaf::Statements to the graph.
+ * Forget the number of statements in the graph (and in each of its contexts) and its
+ * fingerprint, and ask the store for its size again. Call this after the store has been
+ * changed by something other than Redleaf, e.g., another process writing to the same
+ * database. Returns the new size, or +nil+ if the store can't say.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_recount( VALUE self ) {
+	long count;
+
+	rleaf_graph_invalidate_fingerprint( self );
+	count = rleaf_graph_statement_count( self );
+
+	return count < 0 ? Qnil : LONG2NUM( count );
+}
+
+
+/*
+ * call-seq:
+ *    graph.fingerprint   -> string
+ *
+ * Return a 128-bit fingerprint of the statements in the graph as a String of 32 hex digits.
+ * The fingerprint doesn't depend on the order in which statements were added or on the
+ * labels of blank nodes, so equivalent graphs have the same fingerprint, and a graph whose
+ * fingerprint has changed has changed. It is calculated once and then updated as statements
+ * are appended and removed, so checking it is cheap even for very large graphs.
+ *
+ * The same fingerprint doesn't mean the same statements, though: every blank node hashes
+ * alike, so graphs that differ only in how their blank nodes are connected (e.g., with two
+ * bnodes' statements swapped) have the same fingerprint. Use #is_equivalent_to? to compare
+ * graphs.
+ *
+ * Changes made to the underlying storage by something other than Redleaf (e.g., another
+ * process writing to the same database) aren't detected.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_fingerprint( VALUE self ) {
+	rleaf_STORE *store = rleaf_graph_fingerprinted_store( self );
+	char hex[ 33 ];
+
+	snprintf( hex, sizeof(hex), "%016" PRIx64 "%016" PRIx64,
+		store->fingerprint[1], store->fingerprint[0] );
+
+	return rb_str_new( hex, 32 );
+}
+
+
+/*
+ * call-seq:
+ *   graph.statements   -> array
+ *
+ * Return an Array of all the statements in the graph.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_statements( VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	librdf_stream *stream = librdf_model_as_stream( ptr->model );
+	VALUE statements = rb_ary_new();
+
+	while ( ! librdf_stream_end(stream) ) {
+		librdf_statement *stmt = librdf_stream_get_object( stream );
+		VALUE stmt_obj = rleaf_librdf_statement_to_value( stmt );
+
+		rb_ary_push( statements, stmt_obj );
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	rleaf_log_with_context( self, "debug",
+		"Created statement objects for %ld statements in Graph <0x%x>.",
+		RARRAY_LEN(statements), self );
+
+	return statements;
+}
+
+
+/*
+ * call-seq:
+ *    graph.append_statements( *statements )                      -> graph
+ *    graph.append_statements( *statements, :context => uri )     -> graph
+ *
+ * Append one or more Redleaf::Statements to the graph, in the given :context if there is
+ * one.
  *
  */
 static VALUE
 rleaf_redleaf_graph_append_statements( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
 	librdf_statement *stmt_ptr = NULL;
+	librdf_node *context = NULL;
 	VALUE statement = Qnil;
 	int i = 0;
 
-	rleaf_log_with_context( self, "debug", "Adding %d statements.", argc );
+	if ( argc && TYPE(argv[argc - 1]) == T_HASH )
+		context = rleaf_context_option_node( argv[--argc] );
+
+	rleaf_log_with_context( self, "debug", "Adding %d statements%s.", argc,
+		context ? " to a context" : "" );
 
 	for ( i = 0; i < argc; i++ ) {
 		statement = argv[i];
 		rleaf_log( "debug", "  adding statement %d: %s", i, RSTRING_PTR(rb_inspect(statement)) );
 		stmt_ptr = rleaf_get_statement( statement );
 
-		if ( librdf_model_add_statement(ptr->model, stmt_ptr) != 0 )
+		if ( rleaf_graph_context_add_librdf_statement(ptr, context, stmt_ptr) != 0 ) {
+			if ( context ) librdf_free_node( context );
 			rb_raise( rleaf_eRedleafError, "could not add statement %s to graph",
 			 	RSTRING_PTR(rb_inspect(statement)) );
+		}
 	}
 
+	if ( context ) librdf_free_node( context );
 	return self;
 }
 
 
+/*
+ * Remove every statement in the graph +self+ that matches +search+ (only from +context+ if
+ * it's non-NULL) and return how many were removed. The matches are copied into a buffer
+ * before any of them are removed, since removing statements while a stream over the same
+ * model is open isn't safe for all storage backends, and they're removed in a single
+ * transaction if the store supports them, or as part of the graph's #transaction if it's
+ * in one. If +removed+ is an Array, a Redleaf::Statement for each removed statement is
+ * appended to it. Frees +search+ and +context+.
+ */
+static long
+rleaf_graph_delete_matching( VALUE self, librdf_statement *search, librdf_node *context,
+	VALUE removed )
+{
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	librdf_statement **doomed = NULL, *stmt;
+	librdf_stream *stream;
+	long count = 0, capacity = 0, i;
+	int in_transaction = 0, failed = 0;
+
+	if ( context )
+		stream = librdf_model_find_statements_in_context( ptr->model, search, context );
+	else
+		stream = librdf_model_find_statements( ptr->model, search );
+	librdf_free_statement( search );
+
+	if ( !stream ) {
+		if ( context ) librdf_free_node( context );
+		rb_raise( rleaf_eRedleafError, "could not create a stream when removing statements from %s",
+			RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( (stmt = librdf_stream_get_object( stream )) == NULL ) break;
+
+		if ( count == capacity ) {
+			capacity = capacity ? capacity * 2 : 64;
+			REALLOC_N( doomed, librdf_statement *, capacity );
+		}
+		doomed[ count++ ] = librdf_new_statement_from_statement( stmt );
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	/* Build the return values before starting the transaction so an exception can't leave
+	   one open. */
+	if ( !NIL_P(removed) )
+		for ( i = 0; i < count; i++ )
+			rb_ary_push( removed, rleaf_librdf_statement_to_value(doomed[i]) );
+
+	if ( count ) in_transaction = rleaf_graph_start_replacement( self, ptr );
+
+	for ( i = 0; i < count; i++ ) {
+		if ( !failed && rleaf_graph_context_remove_librdf_statement(ptr, context, doomed[i]) != 0 )
+			failed = 1;
+		librdf_free_statement( doomed[i] );
+	}
+	xfree( doomed );
+	if ( context ) librdf_free_node( context );
+
+	if ( failed ) {
+		if ( in_transaction ) librdf_model_transaction_rollback( ptr->model );
+		rleaf_graph_invalidate_fingerprint( self );
+		rb_raise( rleaf_eRedleafError, "failed to remove statements from %s",
+			RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	if ( in_transaction && librdf_model_transaction_commit(ptr->model) != 0 ) {
+		rleaf_graph_invalidate_fingerprint( self );
+		rb_raise( rleaf_eRedleafError, "failed to commit removal from %s",
+			RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	rleaf_log_with_context( self, "debug", "removed %ld statements", count );
+
+	return count;
+}
+
+
 /*
  * call-seq:
  *   graph.remove( statement )   -> array
@@ -508,43 +1230,1244 @@ rleaf_redleaf_graph_append_statements( int argc, VALUE *argv, VALUE self ) {
  */
 static VALUE
 rleaf_redleaf_graph_remove( VALUE self, VALUE statement ) {
+	VALUE rval = rb_ary_new();
+
+	rleaf_log_with_context( self, "debug", "removing statements matching %s",
+		RSTRING_PTR(rb_inspect(statement)) );
+	rleaf_graph_delete_matching( self, rleaf_value_to_librdf_statement(statement), NULL, rval );
+
+	return rval;
+}
+
+
+/*
+ * Create a (partial) statement for searching from the given +subject+, +predicate+, and
+ * +object+, any of which may be nil to match any value. The caller is responsible for
+ * freeing it.
+ */
+static librdf_statement *
+rleaf_new_search_statement( VALUE subject, VALUE predicate, VALUE object ) {
+	librdf_node *subject_node, *predicate_node, *object_node;
+	librdf_statement *search_statement;
+
+	subject_node   = rleaf_value_to_subject_node( subject );
+	predicate_node = rleaf_value_to_predicate_node( predicate );
+	object_node    = rleaf_value_to_object_node( object );
+
+	search_statement = librdf_new_statement_from_nodes( rleaf_rdf_world, subject_node, predicate_node, object_node );
+	if ( !search_statement )
+		rb_raise( rleaf_eRedleafError, "could not create a statement from nodes [%s, %s, %s]",
+			RSTRING_PTR(rb_inspect(subject)),
+			RSTRING_PTR(rb_inspect(predicate)),
+			RSTRING_PTR(rb_inspect(object)) );
+
+	return search_statement;
+}
+
+
+/*
+ * call-seq:
+ *   graph.search( subject, predicate, object, options={} )   -> array
+ *   graph[ subject, predicate, object ]                     -> array
+ *
+ * Search for statements in the graph with the specified +subject+, +predicate+, and +object+ and
+ * return them. If +subject+, +predicate+, or +object+ are nil, they will match any value.
+ *
+ * Valid options are:
+ * [:context]
+ *   Only search the statements in the given context. This uses the store's context index
+ *   instead of fetching every match and checking its context.
+ *
+ *   # Match any statements about authors
+ *   graph.load( 'http://deveiant.livejournal.com/data/foaf' )
+ *
+ *   #
+ *   graph[ nil, FOAF[:knows], nil ]  # => [...]
+ *   graph.search( nil, FOAF[:knows], nil, :context => 'http://example.org/people' )
+ */
+static VALUE
+rleaf_redleaf_graph_search( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
 	librdf_statement *search_statement, *stmt;
+	librdf_node *context;
 	librdf_stream *stream;
 	int count = 0;
+	VALUE subject, predicate, object, opthash = Qnil;
 	VALUE rval = rb_ary_new();
 
-	rleaf_log_with_context( self, "debug", "removing statements matching %s",
-		RSTRING_PTR(rb_inspect(statement)) );
-	search_statement = rleaf_value_to_librdf_statement( statement );
- 	stream = librdf_model_find_statements( ptr->model, search_statement );
+	rb_scan_args( argc, argv, "31", &subject, &predicate, &object, &opthash );
+
+	rleaf_log_with_context( self, "debug", "searching for statements matching {%s, %s, %s}",
+		RSTRING_PTR(rb_inspect(subject)),
+		RSTRING_PTR(rb_inspect(predicate)),
+		RSTRING_PTR(rb_inspect(object)) );
+
+	search_statement = rleaf_new_search_statement( subject, predicate, object );
+	if ( (context = rleaf_context_option_node(opthash)) != NULL )
+		stream = librdf_model_find_statements_in_context( ptr->model, search_statement, context );
+	else
+		stream = librdf_model_find_statements( ptr->model, search_statement );
+	if ( !stream ) {
+		librdf_free_statement( search_statement );
+		if ( context ) librdf_free_node( context );
+		rb_raise( rleaf_eRedleafError, "could not create a stream when searching" );
+	}
+
+	while ( ! librdf_stream_end(stream) ) {
+		stmt = librdf_stream_get_object( stream );
+		if ( !stmt ) break;
+
+		count++;
+		rb_ary_push( rval, rleaf_librdf_statement_to_value(stmt) );
+		librdf_stream_next( stream );
+	}
+
+	rleaf_log_with_context( self, "debug", "found %d statements", count );
+
+	librdf_free_stream( stream );
+	librdf_free_statement( search_statement );
+	if ( context ) librdf_free_node( context );
+
+	return rval;
+}
+
+
+/*
+ * call-seq:
+ *   graph.delete_matching( subject, predicate, object, options={} )   -> integer or array
+ *
+ * Remove every statement in the graph that matches the specified +subject+, +predicate+,
+ * and +object+ (any of which can be +nil+ to match any value) and return how many there
+ * were. Unlike #remove, this doesn't create a Redleaf::Statement for each one unless asked
+ * to, so it's the one to use for purging large numbers of statements.
+ *
+ * Valid options are:
+ * [:context]
+ *   Only remove matching statements from the given context.
+ * [:return_statements]
+ *   If +true+, return an Array of the removed statements instead of a count.
+ *
+ *   # Purge all the expiry dates
+ *   graph.delete_matching( nil, EX[:expires], nil )  # => 1182
+ */
+static VALUE
+rleaf_redleaf_graph_delete_matching( int argc, VALUE *argv, VALUE self ) {
+	VALUE subject, predicate, object, opthash = Qnil, removed = Qnil;
+	librdf_statement *search_statement;
+	librdf_node *context_node = NULL;
+	long count;
+
+	rb_scan_args( argc, argv, "31", &subject, &predicate, &object, &opthash );
+
+	if ( RTEST(opthash) ) {
+		Check_Type( opthash, T_HASH );
+		if ( RTEST(rb_hash_lookup(opthash, ID2SYM(rb_intern("return_statements")))) )
+			removed = rb_ary_new();
+	}
+
+	rleaf_log_with_context( self, "debug", "deleting statements matching {%s, %s, %s}",
+		RSTRING_PTR(rb_inspect(subject)),
+		RSTRING_PTR(rb_inspect(predicate)),
+		RSTRING_PTR(rb_inspect(object)) );
+
+	search_statement = rleaf_new_search_statement( subject, predicate, object );
+	context_node = rleaf_context_option_node( opthash );
+
+	count = rleaf_graph_delete_matching( self, search_statement, context_node, removed );
+
+	return NIL_P(removed) ? LONG2NUM( count ) : removed;
+}
+
+
+/*
+ * Start a transaction on the graph's model for a change that should be seen all at once,
+ * unless the graph is already in one. Returns non-zero if a transaction was started.
+ */
+static int
+rleaf_graph_start_replacement( VALUE self, rleaf_GRAPH *ptr ) {
+	if ( ptr->in_transaction ) return 0;
+	if ( librdf_model_transaction_start(ptr->model) == 0 ) return 1;
+
+	rleaf_log_with_context( self, "info",
+		"store doesn't support transactions; replacing statements without one" );
+	return 0;
+}
+
+
+/*
+ * Finish a change started with rleaf_graph_start_replacement(), rolling it back and
+ * raising an error with the given +message+ if +failed+ is non-zero, and committing it
+ * otherwise.
+ */
+static void
+rleaf_graph_finish_replacement( VALUE self, rleaf_GRAPH *ptr, int in_transaction, int failed,
+	const char *message )
+{
+	rleaf_graph_invalidate_fingerprint( self );
+
+	if ( failed ) {
+		if ( in_transaction ) librdf_model_transaction_rollback( ptr->model );
+		rb_raise( rleaf_eRedleafError, "%s %s", message, RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	if ( in_transaction && librdf_model_transaction_commit(ptr->model) != 0 )
+		rb_raise( rleaf_eRedleafError, "failed to commit changes to %s",
+			RSTRING_PTR(rb_inspect(self)) );
+}
+
+
+/*
+ * call-seq:
+ *   graph.drop_context( context )   -> graph
+ *
+ * Remove every statement in the given +context+ from the graph at once, instead of finding
+ * and removing them one at a time. Statements that are also in other contexts stay in
+ * those.
+ *
+ *   graph.drop_context( 'http://example.org/feeds/tenant-1138' )
+ */
+static VALUE
+rleaf_redleaf_graph_drop_context( VALUE self, VALUE context ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	librdf_node *context_node = rleaf_value_to_librdf_node( context );
+	int in_transaction, failed;
+
+	rleaf_log_with_context( self, "debug", "dropping context %s",
+		RSTRING_PTR(rb_inspect(context)) );
+
+	in_transaction = rleaf_graph_start_replacement( self, ptr );
+	failed = librdf_model_context_remove_statements( ptr->model, context_node ) != 0;
+	librdf_free_node( context_node );
+
+	rleaf_graph_finish_replacement( self, ptr, in_transaction, failed,
+		"failed to drop context from" );
+
+	return self;
+}
+
+
+/*
+ * Convert the given +object+ to a new librdf_statement; used with rb_protect() by
+ * #replace_context.
+ */
+static VALUE
+rleaf_graph_convert_statement( VALUE object ) {
+	return (VALUE)rleaf_value_to_librdf_statement( object );
+}
+
+
+/*
+ * Copy the statements in the given +source+ (a Redleaf::Graph, or an object whose #to_a
+ * returns Redleaf::Statements or triples) into a new buffer, setting +count+ to how many
+ * there were. The caller is responsible for freeing the statements and the buffer.
+ */
+static librdf_statement **
+rleaf_graph_buffer_statements( VALUE source, long *count ) {
+	librdf_statement **buffer = NULL, *stmt;
+	librdf_stream *stream;
+	long capacity = 0, i;
+	VALUE statements;
+	int state = 0;
+
+	*count = 0;
+
+	if ( rb_obj_is_kind_of(source, rleaf_cRedleafGraph) ) {
+		if ( (stream = librdf_model_as_stream( rleaf_get_graph(source)->model )) == NULL )
+			rb_raise( rleaf_eRedleafError, "could not create a stream over %s",
+				RSTRING_PTR(rb_inspect(source)) );
+
+		while ( ! librdf_stream_end(stream) ) {
+			if ( (stmt = librdf_stream_get_object( stream )) == NULL ) break;
+
+			if ( *count == capacity ) {
+				capacity = capacity ? capacity * 2 : 1024;
+				REALLOC_N( buffer, librdf_statement *, capacity );
+			}
+			buffer[ (*count)++ ] = librdf_new_statement_from_statement( stmt );
+
+			librdf_stream_next( stream );
+		}
+		librdf_free_stream( stream );
+
+		return buffer;
+	}
+
+	statements = rb_funcall( source, rb_intern("to_a"), 0 );
+	Check_Type( statements, T_ARRAY );
+
+	buffer = ALLOC_N( librdf_statement *, RARRAY_LEN(statements) + 1 );
+	for ( i = 0; i < RARRAY_LEN(statements); i++ ) {
+		buffer[i] = (librdf_statement *)rb_protect( rleaf_graph_convert_statement,
+			RARRAY_PTR(statements)[i], &state );
+
+		if ( state ) {
+			while ( i-- ) librdf_free_statement( buffer[i] );
+			xfree( buffer );
+			rb_jump_tag( state );
+		}
+	}
+	*count = i;
+
+	return buffer;
+}
+
+
+/* A #replace_context source being buffered, so the context can be freed if it raises */
+typedef struct rleaf_statement_buffer {
+	VALUE				source;
+	long				count;
+} rleaf_STATEMENTBUFFER;
+
+
+/*
+ * Buffer the statements of the source described by +bufferptr+ (a pointer to an
+ * rleaf_STATEMENTBUFFER cast as a VALUE); used with rb_protect() by #replace_context.
+ */
+static VALUE
+rleaf_graph_buffer_statements_protected( VALUE bufferptr ) {
+	rleaf_STATEMENTBUFFER *buffer = (rleaf_STATEMENTBUFFER *)bufferptr;
+	return (VALUE)rleaf_graph_buffer_statements( buffer->source, &buffer->count );
+}
+
+
+/*
+ * call-seq:
+ *   graph.replace_context( context, source )   -> graph
+ *
+ * Replace the statements in the given +context+ with the statements in +source+, which can
+ * be another Redleaf::Graph, or an Array (or anything else that responds to #to_a) of
+ * Redleaf::Statements or triples. If the graph's store supports transactions the old
+ * statements are dropped and the new ones added in one of them, so readers see either the
+ * old version of the context or the new one, never a mix of the two.
+ *
+ *   fresh = Redleaf::Graph.new
+ *   fresh.load( feed_uri )
+ *   graph.replace_context( feed_uri, fresh )
+ */
+static VALUE
+rleaf_redleaf_graph_replace_context( VALUE self, VALUE context, VALUE source ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	rleaf_STATEMENTBUFFER buffer;
+	librdf_node *context_node;
+	librdf_statement **statements = NULL;
+	librdf_stream *stream = NULL;
+	long count = 0, i;
+	int from_stream, in_transaction, failed = 0, state = 0;
+
+	rleaf_log_with_context( self, "debug", "replacing context %s with %s",
+		RSTRING_PTR(rb_inspect(context)), RSTRING_PTR(rb_inspect(source)) );
+	if ( !(context_node = rleaf_value_to_librdf_node(context)) )
+		rb_raise( rb_eArgError, "can't replace the statements in a nil context" );
+
+	/* Statements from a graph with a different store are streamed straight into the
+	   context; anything else is copied first, since it might be reading from this graph's
+	   store. */
+	from_stream = rb_obj_is_kind_of( source, rleaf_cRedleafGraph ) &&
+		rleaf_get_graph( source )->store != ptr->store;
+	if ( !from_stream ) {
+		buffer.source = source;
+		buffer.count  = 0;
+		statements = (librdf_statement **)rb_protect( rleaf_graph_buffer_statements_protected,
+			(VALUE)&buffer, &state );
+		if ( state ) {
+			librdf_free_node( context_node );
+			rb_jump_tag( state );
+		}
+		count = buffer.count;
+	}
+
+	if ( from_stream &&
+	     (stream = librdf_model_as_stream( rleaf_get_graph(source)->model )) == NULL )
+	{
+		librdf_free_node( context_node );
+		rb_raise( rleaf_eRedleafError, "could not create a stream over %s",
+			RSTRING_PTR(rb_inspect(source)) );
+	}
+
+	in_transaction = rleaf_graph_start_replacement( self, ptr );
+	if ( librdf_model_context_remove_statements(ptr->model, context_node) != 0 )
+		failed = 1;
+
+	if ( stream ) {
+		if ( !failed && librdf_model_context_add_statements(ptr->model, context_node, stream) != 0 )
+			failed = 1;
+		librdf_free_stream( stream );
+	} else {
+		for ( i = 0; i < count; i++ ) {
+			if ( !failed &&
+			     librdf_model_context_add_statement(ptr->model, context_node, statements[i]) != 0 )
+				failed = 1;
+			librdf_free_statement( statements[i] );
+		}
+		xfree( statements );
+	}
+	librdf_free_node( context_node );
+
+	rleaf_graph_finish_replacement( self, ptr, in_transaction, failed,
+		"failed to replace context in" );
+
+	return self;
+}
+
+
+/*
+ * call-seq:
+ *   graph.include?( statement )    -> true or false
+ *   graph.contains?( statement )   -> true or false
+ *
+ * Return +true+ if the receiver contains the specified +statement+, which can be either a
+ * Redleaf::Statement object or a valid triple in an Array.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_include_p( VALUE self, VALUE statement ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	librdf_statement *stmt;
+	VALUE rval = Qfalse;
+
+	rleaf_log_with_context( self, "debug", "checking for statement matching %s",
+		RSTRING_PTR(rb_inspect(statement)) );
+	stmt = rleaf_value_to_librdf_statement( statement );
+
+	/* Since we want to support contexts, it's easier just to assume that they're always
+	   enabled. */
+	if ( rleaf_model_has_statement(ptr->model, stmt) ) rval = Qtrue;
+
+	librdf_free_statement( stmt );
+
+	return rval;
+}
+
+
+/*
+ * call-seq:
+ *    graph.is_equivalent_to?( other_graph )   -> true or false
+ *    graph.equivalent_to?( other_graph )      -> true or false
+ *    graph === other_graph                    -> true or false
+ *
+ * Equivalence method -- compare the receiving +graph+ with +other_graph+ according to
+ * the graph equivalency rules in:
+ *   http://www.w3.org/TR/rdf-concepts/#section-graph-equality
+ *
+ * Graphs of different sizes are rejected immediately. Otherwise both graphs' terms are
+ * interned into a shared term dictionary; ground triples are compared directly, and blank
+ * nodes are matched by colour refinement, backtracking only on ties. The graphs'
+ * #fingerprints aren't consulted, since they can't tell graphs apart by their blank nodes.
+ */
+static VALUE
+rleaf_redleaf_graph_is_equivalent_to_p( VALUE self, VALUE other_graph ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *other_ptr;
+	rleaf_TERMDICT *dict;
+	rleaf_TRIPLESET triples, other_triples;
+	librdf_stream *stream;
+	long size, other_size;
+	int result;
+
+	if ( !IsGraph(other_graph) ) return Qfalse;
+	if ( self == other_graph ) return Qtrue;
+	other_ptr = rleaf_get_graph( other_graph );
+
+	size = rleaf_graph_statement_count( self );
+	other_size = rleaf_graph_statement_count( other_graph );
+	if ( size >= 0 && other_size >= 0 && size != other_size ) {
+		rleaf_log_with_context( self, "debug", "Graphs differ in size (%ld vs. %ld)", size, other_size );
+		return Qfalse;
+	}
+
+	dict = rleaf_new_termdict();
+	rleaf_init_tripleset( &triples );
+	rleaf_init_tripleset( &other_triples );
+
+	if ( (stream = librdf_model_as_stream(ptr->model)) ) {
+		rleaf_tripleset_add_stream( &triples, dict, stream, 1 );
+		librdf_free_stream( stream );
+	}
+	if ( (stream = librdf_model_as_stream(other_ptr->model)) ) {
+		rleaf_tripleset_add_stream( &other_triples, dict, stream, 2 );
+		librdf_free_stream( stream );
+	}
+
+	rleaf_log_with_context( self, "debug", "comparing %d statements against %d with %u terms",
+		triples.count, other_triples.count, dict->count );
+	result = rleaf_triplesets_isomorphic( dict, &triples, &other_triples );
+
+	rleaf_clear_tripleset( &triples );
+	rleaf_clear_tripleset( &other_triples );
+	rleaf_free_termdict( dict );
+
+	return result ? Qtrue : Qfalse;
+}
+
+
+/*
+ * Set algebra
+ */
+
+typedef enum {
+	RLEAF_SET_UNION,
+	RLEAF_SET_INTERSECTION,
+	RLEAF_SET_DIFFERENCE
+} rleaf_set_operation;
+
+
+/* Membership test against a graph, either through its store's index or through a hashed set
+   of its triples for stores that would otherwise have to scan for every lookup. */
+typedef struct rleaf_graph_probe {
+	rleaf_GRAPH			*graph;
+	rleaf_TERMDICT		*dict;
+	rleaf_TRIPLEHASH	set;
+} rleaf_GRAPHPROBE;
+
+
+/*
+ * Returns non-zero if the graphs +a+ and +b+ read and write the same librdf storage, and so
+ * always contain the same statements.
+ */
+static int
+rleaf_graph_shares_storage( rleaf_GRAPH *a, rleaf_GRAPH *b ) {
+	return a->model == b->model ||
+		librdf_model_get_storage( a->model ) == librdf_model_get_storage( b->model );
+}
+
+
+/*
+ * Returns non-zero if the given graph's store can find statements through an index. Redland's
+ * 'memory' backend keeps a simple list of statements, so every lookup is a scan.
+ */
+static int
+rleaf_graph_is_indexed( rleaf_GRAPH *ptr ) {
+	VALUE backend = rb_funcall( CLASS_OF(ptr->store), rb_intern("backend"), 0 );
+	return !( SYMBOL_P(backend) && SYM2ID(backend) == rb_intern("memory") );
+}
+
+
+/*
+ * Set up a +probe+ for membership tests against the given +graph+.
+ */
+static void
+rleaf_graph_probe_init( rleaf_GRAPHPROBE *probe, rleaf_GRAPH *graph ) {
+	librdf_stream *stream;
+	librdf_statement *stmt;
+
+	probe->graph = graph;
+	probe->dict  = NULL;
+	rleaf_init_triplehash( &probe->set );
+
+	if ( rleaf_graph_is_indexed(graph) ) return;
+
+	rleaf_log( "debug", "hashing the statements of an unindexed graph for lookups" );
+	probe->dict = rleaf_new_termdict();
+	if ( !(stream = librdf_model_as_stream(graph->model)) ) return;
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+
+		rleaf_triplehash_add( &probe->set,
+			rleaf_termdict_intern_node(probe->dict, librdf_statement_get_subject(stmt), 1),
+			rleaf_termdict_intern_node(probe->dict, librdf_statement_get_predicate(stmt), 1),
+			rleaf_termdict_intern_node(probe->dict, librdf_statement_get_object(stmt), 1) );
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+}
+
+
+/*
+ * Returns non-zero if the graph the +probe+ was set up for contains +stmt+.
+ */
+static int
+rleaf_graph_probe_contains( rleaf_GRAPHPROBE *probe, librdf_statement *stmt ) {
+	uint32_t s, p, o;
+
+	if ( !probe->dict ) return rleaf_model_has_statement( probe->graph->model, stmt );
+
+	if ( (s = rleaf_termdict_lookup_node(probe->dict, librdf_statement_get_subject(stmt), 1))
+	       == RLEAF_NO_TERM ||
+	     (p = rleaf_termdict_lookup_node(probe->dict, librdf_statement_get_predicate(stmt), 1))
+	       == RLEAF_NO_TERM ||
+	     (o = rleaf_termdict_lookup_node(probe->dict, librdf_statement_get_object(stmt), 1))
+	       == RLEAF_NO_TERM )
+		return 0;
+
+	return rleaf_triplehash_contains( &probe->set, s, p, o );
+}
+
+
+/*
+ * Free the resources used by the +probe+.
+ */
+static void
+rleaf_graph_probe_free( rleaf_GRAPHPROBE *probe ) {
+	rleaf_clear_triplehash( &probe->set );
+	if ( probe->dict ) rleaf_free_termdict( probe->dict );
+}
+
+
+/*
+ * Add the statements from +source+ to the graph +target+. If +probe+ is non-NULL, only
+ * statements which +probe+ contains (if +keep+ is non-zero) or doesn't contain (if +keep+
+ * is zero) are added. Returns the number of statements added.
+ */
+static long
+rleaf_graph_add_filtered( rleaf_GRAPH *target, rleaf_GRAPH *source, rleaf_GRAPHPROBE *probe,
+	int keep )
+{
+	librdf_stream *stream = librdf_model_as_stream( source->model );
+	librdf_statement *stmt;
+	long count = 0;
+
+	if ( !stream )
+		rb_raise( rleaf_eRedleafError, "could not create a stream for a set operation" );
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+
+		if ( !probe || (rleaf_graph_probe_contains(probe, stmt) ? keep : !keep) ) {
+			if ( rleaf_graph_add_librdf_statement(target, stmt) != 0 ) {
+				librdf_free_stream( stream );
+				rb_raise( rleaf_eRedleafError, "could not add a statement to the result graph" );
+			}
+			count++;
+		}
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	return count;
+}
+
+
+/*
+ * Remove the statements from +target+ which +probe+ contains (if +matching+ is non-zero) or
+ * doesn't contain (if +matching+ is zero). The statements to remove are collected before
+ * any are removed, so the stream over +target+ isn't invalidated. Returns the number of
+ * statements removed.
+ */
+static long
+rleaf_graph_remove_filtered( rleaf_GRAPH *target, rleaf_GRAPHPROBE *probe, int matching ) {
+	librdf_stream *stream = librdf_model_as_stream( target->model );
+	librdf_statement *stmt, **doomed = NULL;
+	long i, count = 0, capa = 0;
+	int failed = 0;
+
+	if ( !stream )
+		rb_raise( rleaf_eRedleafError, "could not create a stream for a set operation" );
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+
+		if ( rleaf_graph_probe_contains(probe, stmt) ? matching : !matching ) {
+			if ( count == capa ) {
+				capa = capa ? capa * 2 : 256;
+				REALLOC_N( doomed, librdf_statement *, capa );
+			}
+			doomed[ count++ ] = librdf_new_statement_from_statement( stmt );
+		}
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	for ( i = 0; i < count; i++ ) {
+		if ( !failed && rleaf_graph_remove_librdf_statement(target, doomed[i]) != 0 ) failed = 1;
+		librdf_free_statement( doomed[i] );
+	}
+	if ( doomed ) xfree( doomed );
+
+	if ( failed )
+		rb_raise( rleaf_eRedleafError, "failed to remove statement from model" );
+
+	return count;
+}
+
+
+/* A filtered add or removal against a probe, so the probe can be freed if it raises */
+typedef struct rleaf_probed_filter {
+	rleaf_GRAPH			*target, *source;
+	rleaf_GRAPHPROBE	probe;
+	int					keep, removing;
+} rleaf_PROBEDFILTER;
+
+
+/*
+ * Run the filtered add or removal described by +filterptr+ (a pointer to an
+ * rleaf_PROBEDFILTER cast as a VALUE); used with rb_ensure() by rleaf_graph_probed_filter.
+ */
+static VALUE
+rleaf_graph_probed_filter_body( VALUE filterptr ) {
+	rleaf_PROBEDFILTER *filter = (rleaf_PROBEDFILTER *)filterptr;
+	long count;
+
+	if ( filter->removing )
+		count = rleaf_graph_remove_filtered( filter->target, &filter->probe, filter->keep );
+	else
+		count = rleaf_graph_add_filtered( filter->target, filter->source, &filter->probe,
+			filter->keep );
+
+	return LONG2NUM( count );
+}
+
+
+/*
+ * Free the probe of the filter described by +filterptr+; used with rb_ensure() by
+ * rleaf_graph_probed_filter.
+ */
+static VALUE
+rleaf_graph_probed_filter_ensure( VALUE filterptr ) {
+	rleaf_graph_probe_free( &((rleaf_PROBEDFILTER *)filterptr)->probe );
+	return Qnil;
+}
+
+
+/*
+ * Set up a probe for membership tests against +probed+, then either add the statements
+ * from +source+ to +target+ (if +source+ is non-NULL) or remove statements from +target+
+ * (if it's NULL) according to +keep+, as rleaf_graph_add_filtered and
+ * rleaf_graph_remove_filtered do. The probe is freed even if adding or removing raises.
+ * Returns the number of statements added or removed.
+ */
+static long
+rleaf_graph_probed_filter( rleaf_GRAPH *target, rleaf_GRAPH *source, rleaf_GRAPH *probed,
+	int keep )
+{
+	rleaf_PROBEDFILTER filter;
+
+	filter.target   = target;
+	filter.source   = source;
+	filter.keep     = keep;
+	filter.removing = ( source == NULL );
+	rleaf_graph_probe_init( &filter.probe, probed );
+
+	return NUM2LONG( rb_ensure(rleaf_graph_probed_filter_body, (VALUE)&filter,
+		rleaf_graph_probed_filter_ensure, (VALUE)&filter) );
+}
+
+
+/*
+ * Common implementation of #union, #intersection, and #difference.
+ */
+static VALUE
+rleaf_graph_set_operation( int argc, VALUE *argv, VALUE self, rleaf_set_operation op ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *other_ptr, *result_ptr;
+	VALUE other, store = Qnil, result;
+
+	rb_scan_args( argc, argv, "11", &other, &store );
+	other_ptr = rleaf_get_graph( other );
+
+	if ( NIL_P(store) )
+		result = rb_class_new_instance( 0, NULL, CLASS_OF(self) );
+	else
+		result = rb_class_new_instance( 1, &store, CLASS_OF(self) );
+	result_ptr = rleaf_get_graph( result );
+
+	switch ( op ) {
+		case RLEAF_SET_UNION:
+		rleaf_graph_add_filtered( result_ptr, ptr, NULL, 1 );
+		rleaf_graph_add_filtered( result_ptr, other_ptr, NULL, 1 );
+		break;
+
+		case RLEAF_SET_INTERSECTION:
+		case RLEAF_SET_DIFFERENCE:
+		rleaf_graph_probed_filter( result_ptr, ptr, other_ptr, op == RLEAF_SET_INTERSECTION );
+		break;
+	}
+
+	return result;
+}
+
+
+/*
+ * call-seq:
+ *    graph | other_graph                   -> new_graph
+ *    graph.union( other_graph, store=nil )  -> new_graph
+ *
+ * Return a new graph containing the statements that are in either the receiver or
+ * +other_graph+. If a +store+ is given, the new graph will use it for its statements;
+ * otherwise it gets a new default store.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_union( int argc, VALUE *argv, VALUE self ) {
+	return rleaf_graph_set_operation( argc, argv, self, RLEAF_SET_UNION );
+}
+
+
+/*
+ * call-seq:
+ *    graph & other_graph                          -> new_graph
+ *    graph.intersection( other_graph, store=nil )  -> new_graph
+ *
+ * Return a new graph containing the statements that are in both the receiver and
+ * +other_graph+. The receiver's statements are streamed and looked up in +other_graph+'s
+ * store. If a +store+ is given, the new graph will use it for its statements.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_intersection( int argc, VALUE *argv, VALUE self ) {
+	return rleaf_graph_set_operation( argc, argv, self, RLEAF_SET_INTERSECTION );
+}
+
+
+/*
+ * call-seq:
+ *    graph - other_graph                        -> new_graph
+ *    graph.difference( other_graph, store=nil )  -> new_graph
+ *
+ * Return a new graph containing the statements in the receiver that aren't in
+ * +other_graph+. The receiver's statements are streamed and looked up in +other_graph+'s
+ * store. If a +store+ is given, the new graph will use it for its statements.
+ *
+ *   public_graph = export_graph - redacted_graph
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_difference( int argc, VALUE *argv, VALUE self ) {
+	return rleaf_graph_set_operation( argc, argv, self, RLEAF_SET_DIFFERENCE );
+}
+
+
+/*
+ * call-seq:
+ *    graph.union!( other_graph )   -> graph
+ *
+ * Add all the statements from +other_graph+ to the receiver.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_union_bang( VALUE self, VALUE other ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *other_ptr = rleaf_get_graph( other );
+
+	if ( !rleaf_graph_shares_storage(ptr, other_ptr) )
+		rleaf_graph_add_filtered( ptr, other_ptr, NULL, 1 );
+
+	return self;
+}
+
+
+/*
+ * call-seq:
+ *    graph.intersect!( other_graph )   -> graph
+ *
+ * Remove all statements from the receiver that aren't also in +other_graph+.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_intersect_bang( VALUE self, VALUE other ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *other_ptr = rleaf_get_graph( other );
+	long count;
+
+	if ( rleaf_graph_shares_storage(ptr, other_ptr) ) return self;
+
+	count = rleaf_graph_probed_filter( ptr, NULL, other_ptr, 0 );
+	rleaf_log_with_context( self, "debug", "intersect! removed %ld statements", count );
+
+	return self;
+}
+
+
+/*
+ * call-seq:
+ *    graph.subtract!( other_graph )   -> graph
+ *
+ * Remove all statements from the receiver that are also in +other_graph+.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_subtract_bang( VALUE self, VALUE other ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *other_ptr = rleaf_get_graph( other );
+	long count;
+
+	count = rleaf_graph_probed_filter( ptr, NULL, other_ptr, 1 );
+	rleaf_log_with_context( self, "debug", "subtract! removed %ld statements", count );
+
+	return self;
+}
+
+
+/*
+ * call-seq:
+ *    graph.diff( other_graph )   -> [ added_graph, removed_graph ]
+ *
+ * Compare the receiver to +other_graph+ and return two new graphs: one containing the
+ * statements in +other_graph+ that aren't in the receiver, and one containing the statements
+ * in the receiver that aren't in +other_graph+. Applying them to the receiver with
+ * #apply_patch will make it contain the same statements as +other_graph+. Blank nodes are
+ * compared by their identifiers.
+ *
+ *   added, removed = replica.diff( primary )
+ *   replica.apply_patch( added, removed )
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_diff( VALUE self, VALUE other ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *other_ptr = rleaf_get_graph( other );
+	VALUE added   = rb_class_new_instance( 0, NULL, CLASS_OF(self) ),
+	      removed = rb_class_new_instance( 0, NULL, CLASS_OF(self) );
+	long added_count = 0, removed_count = 0;
+
+	if ( !rleaf_graph_shares_storage(ptr, other_ptr) ) {
+		added_count = rleaf_graph_probed_filter( rleaf_get_graph(added), other_ptr, ptr, 0 );
+		removed_count = rleaf_graph_probed_filter( rleaf_get_graph(removed), ptr, other_ptr, 0 );
+	}
+
+	rleaf_log_with_context( self, "debug", "diff: %ld statements added, %ld removed",
+		added_count, removed_count );
+
+	return rb_assoc_new( added, removed );
+}
+
+
+/*
+ * Add the given statement to the graph +ptr+ if +adding+ is non-zero, or remove it if it's
+ * present otherwise. +stmt+ must be a copy owned by the caller.
+ */
+static int
+rleaf_graph_apply_statement( rleaf_GRAPH *ptr, librdf_statement *stmt, int adding ) {
+	if ( adding ) return rleaf_graph_add_librdf_statement( ptr, stmt );
+	if ( !rleaf_model_has_statement(ptr->model, stmt) ) return 0;
+	return rleaf_graph_remove_librdf_statement( ptr, stmt );
+}
+
+
+/*
+ * Apply the statements in +statements+ (either a Redleaf::Graph or an Array of
+ * Redleaf::Statements) to the graph +ptr+, adding them if +adding+ is non-zero and removing
+ * them otherwise. Returns non-zero if one of them couldn't be applied.
+ */
+static int
+rleaf_graph_apply_statements( rleaf_GRAPH *ptr, VALUE statements, int adding ) {
+	librdf_stream *stream;
+	librdf_statement *stmt;
+	long i;
+	int rval = 0;
+
+	if ( TYPE(statements) == T_ARRAY ) {
+		for ( i = 0; i < RARRAY_LEN(statements) && rval == 0; i++ ) {
+			stmt = librdf_new_statement_from_statement(
+				rleaf_get_statement(RARRAY_PTR(statements)[i]) );
+			rval = rleaf_graph_apply_statement( ptr, stmt, adding );
+			librdf_free_statement( stmt );
+		}
+
+		return rval;
+	}
+
+	if ( !(stream = librdf_model_as_stream(rleaf_get_graph(statements)->model)) ) return 1;
+
+	while ( rval == 0 && ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+
+		stmt = librdf_new_statement_from_statement( stmt );
+		rval = rleaf_graph_apply_statement( ptr, stmt, adding );
+		librdf_free_statement( stmt );
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	return rval;
+}
+
+
+/*
+ * Convert a patch argument to either a Redleaf::Graph or an Array of Redleaf::Statements.
+ */
+static VALUE
+rleaf_patch_statements( VALUE statements ) {
+	if ( NIL_P(statements) ) return rb_ary_new();
+	if ( rb_obj_is_kind_of(statements, rleaf_cRedleafGraph) ) return statements;
+
+	return rb_funcall( rleaf_cRedleafStatement, rb_intern("create"), 1, statements );
+}
+
+
+/*
+ * call-seq:
+ *    graph.apply_patch( added, removed=nil )   -> graph
+ *
+ * Remove the +removed+ statements from the receiver and then append the +added+ ones. Each
+ * of them can be a Redleaf::Graph (like the ones returned from #diff), or anything
+ * Redleaf::Statement.create accepts. If the receiver's store supports transactions, the
+ * patch is applied in a single transaction which is rolled back if any part of it fails;
+ * inside a #transaction block, it's applied as part of that block's transaction instead.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_apply_patch( int argc, VALUE *argv, VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	VALUE added, removed = Qnil;
+	int in_transaction;
+
+	rb_scan_args( argc, argv, "11", &added, &removed );
+
+	/* Convert both sides before starting the transaction so that a bad statement can't
+	   leave one open. */
+	added   = rleaf_patch_statements( added );
+	removed = rleaf_patch_statements( removed );
+
+	in_transaction = rleaf_graph_start_replacement( self, ptr );
+
+	if ( rleaf_graph_apply_statements(ptr, removed, 0) != 0 ||
+	     rleaf_graph_apply_statements(ptr, added, 1) != 0 )
+	{
+		if ( in_transaction ) librdf_model_transaction_rollback( ptr->model );
+		rleaf_graph_invalidate_fingerprint( self );
+		rb_raise( rleaf_eRedleafError, "failed to apply patch to %s",
+			RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	if ( in_transaction && librdf_model_transaction_commit(ptr->model) != 0 ) {
+		rleaf_graph_invalidate_fingerprint( self );
+		rb_raise( rleaf_eRedleafError, "failed to commit patch to %s",
+			RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	return self;
+}
+
+
+/*
+ * Exchange the models and stores of the graphs +a+ and +b+.
+ */
+static void
+rleaf_graph_swap_models( rleaf_GRAPH *a, rleaf_GRAPH *b ) {
+	librdf_model *model = a->model;
+	VALUE store = a->store;
+
+	a->model = b->model;
+	a->store = b->store;
+	b->model = model;
+	b->store = store;
+}
+
+
+/*
+ * Yield the given +graph+ to the block; used with rb_protect() by #transaction.
+ */
+static VALUE
+rleaf_graph_yield( VALUE graph ) {
+	return rb_yield( graph );
+}
+
+
+/*
+ * Return a String that identifies the statement +stmt+ in +context+ (which can be NULL) in a
+ * Hash. Encoded nodes carry their own lengths, so the parts can't run into each other.
+ */
+static VALUE
+rleaf_quad_key( librdf_statement *stmt, librdf_node *context ) {
+	VALUE key = rleaf_node_key( librdf_statement_get_subject(stmt) );
+
+	rb_str_append( key, rleaf_node_key(librdf_statement_get_predicate(stmt)) );
+	rb_str_append( key, rleaf_node_key(librdf_statement_get_object(stmt)) );
+	if ( context ) rb_str_append( key, rleaf_node_key(context) );
+
+	return key;
+}
+
+
+/*
+ * Put the statements the graph +self+ had when #transaction started back from +backup+, a
+ * graph they were copied into along with their contexts. The statements that are missing
+ * are added back before any of the block's are removed, so a failure partway through
+ * leaves the backed-up statements in place along with some of the block's changes, rather
+ * than losing any of them. Raises an error if the graph couldn't be restored.
+ */
+static void
+rleaf_graph_restore_backup( VALUE self, VALUE backup ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *backup_ptr = rleaf_get_graph( backup );
+	VALUE current = rb_hash_new();
+	librdf_stream *stream = NULL;
+	librdf_statement *stmt, **doomed = NULL;
+	librdf_node *context, **doomed_contexts = NULL;
+	long count = 0, capacity = 0, restored = 0, remaining, i;
+	VALUE key;
+	int failed = 0;
+
+	rleaf_log_with_context( self, "debug", "restoring %s from its backup",
+		RSTRING_PTR(rb_inspect(self)) );
+
+	/* Note every statement in the graph now, in each of its contexts */
+	if ( !(stream = librdf_model_as_stream(ptr->model)) ) failed = 1;
+	while ( stream && ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+		context = (librdf_node *)librdf_stream_get_context( stream );
+		rb_hash_aset( current, rleaf_quad_key(stmt, context), Qtrue );
+		librdf_stream_next( stream );
+	}
+	if ( stream ) librdf_free_stream( stream );
+	stream = NULL;
+	remaining = RHASH_SIZE( current );
+
+	/* Add back the backed-up ones that are missing, and cross off the ones that aren't (not
+	   with rb_hash_delete(), which would yield to the transaction's block) */
+	if ( !failed && !(stream = librdf_model_as_stream(backup_ptr->model)) ) failed = 1;
+	while ( stream && !failed && ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+		context = (librdf_node *)librdf_stream_get_context( stream );
+
+		key = rleaf_quad_key( stmt, context );
+		if ( NIL_P(rb_hash_lookup(current, key)) ) {
+			if ( rleaf_graph_context_add_librdf_statement(ptr, context, stmt) != 0 )
+				failed = 1;
+			restored++;
+		} else {
+			rb_hash_aset( current, key, Qfalse );
+			remaining--;
+		}
+
+		librdf_stream_next( stream );
+	}
+	if ( stream ) librdf_free_stream( stream );
+	stream = NULL;
+
+	/* Then find the ones the block added... */
+	if ( !failed && remaining && !(stream = librdf_model_as_stream(ptr->model)) )
+		failed = 1;
+	while ( stream && remaining && ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+		context = (librdf_node *)librdf_stream_get_context( stream );
+
+		key = rleaf_quad_key( stmt, context );
+		if ( rb_hash_lookup(current, key) == Qtrue ) {
+			rb_hash_aset( current, key, Qfalse );
+			remaining--;
+			if ( count == capacity ) {
+				capacity = capacity ? capacity * 2 : 64;
+				REALLOC_N( doomed, librdf_statement *, capacity );
+				REALLOC_N( doomed_contexts, librdf_node *, capacity );
+			}
+			doomed[ count ] = librdf_new_statement_from_statement( stmt );
+			doomed_contexts[ count++ ] = context ? librdf_new_node_from_node( context ) : NULL;
+		}
+
+		librdf_stream_next( stream );
+	}
+	if ( stream ) librdf_free_stream( stream );
+
+	/* ...and remove them once the stream over the graph is finished */
+	for ( i = 0; i < count; i++ ) {
+		if ( !failed &&
+		     rleaf_graph_context_remove_librdf_statement(ptr, doomed_contexts[i], doomed[i]) != 0 )
+			failed = 1;
+		librdf_free_statement( doomed[i] );
+		if ( doomed_contexts[i] ) librdf_free_node( doomed_contexts[i] );
+	}
+	if ( doomed ) xfree( doomed );
+	if ( doomed_contexts ) xfree( doomed_contexts );
+
+	rleaf_graph_invalidate_fingerprint( self );
+
+	if ( failed )
+		rb_raise( rleaf_eRedleafError, "failed to restore %s from its backup",
+			RSTRING_PTR(rb_inspect(self)) );
+
+	rleaf_log_with_context( self, "debug", "restored %ld statements and removed %ld",
+		restored, count );
+}
+
 
-	if ( !stream ) {
-		librdf_free_statement( search_statement );
-		rb_raise( rleaf_eRedleafError, "could not create a stream when removing %s from %s",
-		 	RSTRING_PTR(rb_inspect(statement)),
-			RSTRING_PTR(rb_inspect(self)) );
+/*
+ * call-seq:
+ *    graph.transaction {|graph| block }   -> obj
+ *
+ * Make the changes in the block in a single transaction, committing them if the block
+ * returns normally, or discarding them and re-raising if it raises an exception. Returns
+ * the value of the block.
+ *
+ * If the receiver's store doesn't support transactions, the changes made in the block are
+ * collected in memory in a Redleaf::OverlayStore instead, and written to the store in a
+ * single pass when the block returns. The receiver sees its own changes either way, but
+ * other graphs that share its store won't see them until they're committed.
+ *
+ * An overlay can't hold contexts, though, so if such a store supports them, its statements
+ * are instead copied into an in-memory Redleaf::HashesStore with contexts before the block
+ * is called, and put back if it raises. Putting them back adds the missing statements
+ * before removing the block's, so if that fails partway, the block's changes are only
+ * partly undone rather than the store's statements being lost. The block's changes are then made to the store directly, so
+ * other graphs that share it see them straight away, and starting the transaction takes
+ * time in proportion to the size of the store.
+ *
+ * Transactions don't nest; calling #transaction in the block just makes the inner block's
+ * changes part of the outer transaction.
+ *
+ *   graph.transaction do
+ *       feed.each_entry {|entry| graph << [entry.uri, DC[:title], entry.title] }
+ *   end
+ */
+static VALUE
+rleaf_redleaf_graph_transaction( VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self ), *buffer_ptr = NULL;
+	VALUE buffer = Qnil, backup = Qnil, options, store, rval;
+	int state = 0;
+
+	if ( !rb_block_given_p() )
+		rb_raise( rb_eLocalJumpError, "no block given" );
+	if ( ptr->in_transaction )
+		return rb_yield( self );
+
+	/* Without native transactions, switch the graph over to an overlay of its store for
+	   the duration of the block, or back the store up if it has contexts the overlay
+	   would lose. */
+	if ( librdf_model_transaction_start(ptr->model) != 0 ) {
+		if ( RTEST(rleaf_redleaf_graph_supports_contexts_p(self)) ) {
+			rleaf_log_with_context( self, "info",
+				"store doesn't support transactions; backing up its statements" );
+			options = rb_hash_new();
+			rb_hash_aset( options, ID2SYM(rb_intern("contexts")), rb_str_new2("yes") );
+			store = rb_class_new_instance( 1, &options, rleaf_cRedleafHashesStore );
+			backup = rb_class_new_instance( 1, &store, rleaf_cRedleafGraph );
+			rb_funcall( ptr->store, rb_intern("copy_to"), 1, backup );
+		} else {
+			rleaf_log_with_context( self, "info",
+				"store doesn't support transactions; buffering changes in an overlay" );
+			buffer = rleaf_graph_copy_with_store( self,
+				rleaf_new_overlay_store(ptr->store, Qnil), 0 );
+			buffer_ptr = rleaf_get_graph( buffer );
+			rleaf_graph_swap_models( ptr, buffer_ptr );
+		}
 	}
 
-	while ( ! librdf_stream_end(stream) ) {
-		if ( (stmt = librdf_stream_get_object( stream )) == NULL ) break;
+	ptr->in_transaction = 1;
+	rval = rb_protect( rleaf_graph_yield, self, &state );
+	ptr->in_transaction = 0;
 
-		count++;
-		rb_ary_push( rval, rleaf_librdf_statement_to_value(stmt) );
+	if ( !NIL_P(backup) ) {
+		if ( state ) {
+			rleaf_graph_restore_backup( self, backup );
+			rb_jump_tag( state );
+		}
+
+		return rval;
+	}
 
-		if ( librdf_model_remove_statement(ptr->model, stmt) != 0 ) {
-			librdf_free_stream( stream );
-			librdf_free_statement( search_statement );
-			rb_raise( rleaf_eRedleafError, "failed to remove statement from model" );
+	if ( NIL_P(buffer) ) {
+		if ( state ) {
+			librdf_model_transaction_rollback( ptr->model );
+			rleaf_graph_invalidate_fingerprint( self );
+			rb_jump_tag( state );
 		}
 
-		librdf_stream_next( stream );
+		if ( librdf_model_transaction_commit(ptr->model) != 0 ) {
+			rleaf_graph_invalidate_fingerprint( self );
+			rb_raise( rleaf_eRedleafError, "failed to commit transaction on %s",
+				RSTRING_PTR(rb_inspect(self)) );
+		}
+
+		return rval;
 	}
 
-	rleaf_log_with_context( self, "debug", "removed %d statements", count );
+	rleaf_graph_swap_models( ptr, buffer_ptr );
+	if ( state ) rb_jump_tag( state );
 
-	librdf_free_stream( stream );
-	librdf_free_statement( search_statement );
+	if ( rleaf_overlay_store_apply_changes(buffer_ptr->store, ptr->model) != 0 ) {
+		rleaf_graph_invalidate_fingerprint( self );
+		rb_raise( rleaf_eRedleafError, "failed to write transaction to %s",
+			RSTRING_PTR(rb_inspect(self)) );
+	}
+
+	rleaf_graph_invalidate_fingerprint( self );
 
 	return rval;
 }
@@ -552,139 +2475,218 @@ rleaf_redleaf_graph_remove( VALUE self, VALUE statement ) {
 
 /*
  * call-seq:
- *   graph.search( subject, predicate, object )   -> array
- *   graph[ subject, predicate, object ]          -> array
- *
- * Search for statements in the graph with the specified +subject+, +predicate+, and +object+ and
- * return them. If +subject+, +predicate+, or +object+ are nil, they will match any value.
+ *   graph.each_statement( options={} ) {|statement| block }   -> graph
+ *   graph.each {|statement| block }                           -> graph
  *
- *   # Match any statements about authors
- *   graph.load( 'http://deveiant.livejournal.com/data/foaf' )
+ * Call +block+ once for each statement in the graph, or only for each statement in the
+ * given :context if there is one.
  *
- *   #
- *   graph[ nil, FOAF[:knows], nil ]  # => [...]
  */
 static VALUE
-rleaf_redleaf_graph_search( VALUE self, VALUE subject, VALUE predicate, VALUE object ) {
+rleaf_redleaf_graph_each_statement( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_node *subject_node, *predicate_node, *object_node;
-	librdf_statement *search_statement, *stmt;
 	librdf_stream *stream;
-	int count = 0;
-	VALUE rval = rb_ary_new();
-
-	rleaf_log_with_context( self, "debug", "searching for statements matching {%s, %s, %s}",
-		RSTRING_PTR(rb_inspect(subject)),
-		RSTRING_PTR(rb_inspect(predicate)),
-		RSTRING_PTR(rb_inspect(object)) );
-
-	subject_node   = rleaf_value_to_subject_node( subject );
-	predicate_node = rleaf_value_to_predicate_node( predicate );
-	object_node    = rleaf_value_to_object_node( object );
+	librdf_statement *stmt;
+	librdf_node *context;
+	VALUE opthash = Qnil;
 
-	search_statement = librdf_new_statement_from_nodes( rleaf_rdf_world, subject_node, predicate_node, object_node );
-	if ( !search_statement )
-		rb_raise( rleaf_eRedleafError, "could not create a statement from nodes [%s, %s, %s]",
-			RSTRING_PTR(rb_inspect(subject)),
-			RSTRING_PTR(rb_inspect(predicate)),
-			RSTRING_PTR(rb_inspect(object)) );
+	rb_scan_args( argc, argv, "01", &opthash );
 
- 	stream = librdf_model_find_statements( ptr->model, search_statement );
+	if ( (context = rleaf_context_option_node(opthash)) != NULL )
+		stream = librdf_model_context_as_stream( ptr->model, context );
+	else
+		stream = librdf_model_as_stream( ptr->model );
 	if ( !stream ) {
-		librdf_free_statement( search_statement );
-		rb_raise( rleaf_eRedleafError, "could not create a stream when searching" );
+		if ( context ) librdf_free_node( context );
+		rb_raise( rleaf_eRedleafError, "Failed to create stream for graph" );
 	}
 
 	while ( ! librdf_stream_end(stream) ) {
 		stmt = librdf_stream_get_object( stream );
 		if ( !stmt ) break;
 
-		count++;
-		rb_ary_push( rval, rleaf_librdf_statement_to_value(stmt) );
+		rb_yield( rleaf_librdf_statement_to_value(stmt) );
 		librdf_stream_next( stream );
 	}
 
-	rleaf_log_with_context( self, "debug", "found %d statements", count );
-
 	librdf_free_stream( stream );
-	librdf_free_statement( search_statement );
+	if ( context ) librdf_free_node( context );
 
-	return rval;
+	return self;
 }
 
 
 /*
- * call-seq:
- *   graph.include?( statement )    -> true or false
- *   graph.contains?( statement )   -> true or false
- *
- * Return +true+ if the receiver contains the specified +statement+, which can be either a
- * Redleaf::Statement object or a valid triple in an Array.
- *
+ * Convert the given +context+ node to a Ruby object, looking it up in and adding it to the
+ * +contexts+ Hash so each context is only converted once per scan. Returns nil for a NULL
+ * context.
  */
 static VALUE
-rleaf_redleaf_graph_include_p( VALUE self, VALUE statement ) {
+rleaf_graph_context_to_value( librdf_node *context, VALUE contexts ) {
+	VALUE key, rval;
+
+	if ( !context ) return Qnil;
+
+	key = rleaf_node_key( context );
+	if ( NIL_P(rval = rb_hash_lookup(contexts, key)) ) {
+		if ( librdf_node_is_resource(context) )
+			rval = rleaf_librdf_uri_node_to_object( context );
+		else
+			rval = rleaf_librdf_node_to_value( context );
+		rb_hash_aset( contexts, key, rval );
+	}
+
+	return rval;
+}
+
+
+/*
+ * Scan the statements in the graph in a single pass, and for each one that matches +search+
+ * (or every one, if +search+ is NULL) yield a [subject, predicate, object, context] quad, or
+ * push it onto +quads+ if it's an Array. If +in_context+ is non-NULL, +search+ is looked up
+ * in that context through the store's context index. Otherwise, since stores that index
+ * statements without their contexts don't return them from librdf_model_find_statements,
+ * stores with contexts are scanned in full and the statements matched here. Returns
+ * non-zero if the statements couldn't be streamed; neither +search+ nor +in_context+ is
+ * freed.
+ */
+static int
+rleaf_graph_scan_quads( VALUE self, librdf_statement *search, librdf_node *in_context,
+	VALUE quads )
+{
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_statement *stmt;
+	int with_contexts = RTEST( rleaf_redleaf_graph_supports_contexts_p(self) );
 	librdf_stream *stream;
-	VALUE rval = Qfalse;
+	librdf_statement *stmt;
+	librdf_node *context;
+	VALUE contexts = rb_hash_new(), quad;
+	long count = 0;
+
+	if ( search && in_context )
+		stream = librdf_model_find_statements_in_context( ptr->model, search, in_context );
+	else if ( search && !with_contexts )
+		stream = librdf_model_find_statements( ptr->model, search );
+	else
+		stream = librdf_model_as_stream( ptr->model );
+	if ( !stream ) return 1;
 
-	rleaf_log_with_context( self, "debug", "checking for statement matching %s",
-		RSTRING_PTR(rb_inspect(statement)) );
-	stmt = rleaf_value_to_librdf_statement( statement );
+	while ( ! librdf_stream_end(stream) ) {
+		if ( (stmt = librdf_stream_get_object( stream )) == NULL ) break;
 
-	/* According to the Redland docs, this is a better way to test this than
-	   librdf_model_contains_statement if the model has contexts. Since we want
-	   to support contexts, it's easier just to assume that they're always enabled.
-	 */
-	stream = librdf_model_find_statements( ptr->model, stmt );
-	if ( stream != NULL && !librdf_stream_end(stream) ) rval = Qtrue;
+		if ( !search || in_context || !with_contexts || librdf_statement_match(stmt, search) ) {
+			if ( in_context )
+				context = in_context;
+			else
+				context = with_contexts ? (librdf_node *)librdf_stream_get_context( stream ) : NULL;
+			quad = rb_ary_new3( 4,
+				rleaf_librdf_node_to_value(librdf_statement_get_subject(stmt)),
+				rleaf_librdf_node_to_value(librdf_statement_get_predicate(stmt)),
+				rleaf_librdf_node_to_value(librdf_statement_get_object(stmt)),
+				rleaf_graph_context_to_value(context, contexts) );
+
+			count++;
+			if ( NIL_P(quads) )
+				rb_yield( quad );
+			else
+				rb_ary_push( quads, quad );
+		}
 
+		librdf_stream_next( stream );
+	}
 	librdf_free_stream( stream );
-	librdf_free_statement( stmt );
 
-	return rval;
+	rleaf_log_with_context( self, "debug", "scanned %ld quads in %ld contexts",
+		count, RHASH_SIZE(contexts) );
+
+	return 0;
 }
 
 
 /*
  * call-seq:
- *   graph.each_statement {|statement| block }   -> graph
- *   graph.each {|statement| block }             -> graph
+ *   graph.each_quad {|subject, predicate, object, context| block }   -> graph
  *
- * Call +block+ once for each statement in the graph.
+ * Call +block+ once for each statement in the graph with its subject, predicate, and object
+ * nodes and the context it came from (+nil+ if it isn't in one, or if the graph's store
+ * doesn't support contexts). A statement that's in more than one context is yielded once
+ * for each of them.
  *
+ *   graph.each_quad do |subject, predicate, object, context|
+ *       audit.record( context, subject ) if predicate == DC[:source]
+ *   end
  */
 static VALUE
-rleaf_redleaf_graph_each_statement( VALUE self ) {
-	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_stream *stream;
-	librdf_statement *stmt;
-
-	stream = librdf_model_as_stream( ptr->model );
-	if ( !stream )
+rleaf_redleaf_graph_each_quad( VALUE self ) {
+	if ( rleaf_graph_scan_quads(self, NULL, NULL, Qnil) != 0 )
 		rb_raise( rleaf_eRedleafError, "Failed to create stream for graph" );
+	return self;
+}
 
-	while ( ! librdf_stream_end(stream) ) {
-		stmt = librdf_stream_get_object( stream );
-		if ( !stmt ) break;
 
-		rb_yield( rleaf_librdf_statement_to_value(stmt) );
-		librdf_stream_next( stream );
+/*
+ * Return the context node for the given +opthash+ like rleaf_context_option_node(); used
+ * with rb_protect() by #search_quads.
+ */
+static VALUE
+rleaf_graph_context_option_node( VALUE opthash ) {
+	return (VALUE)rleaf_context_option_node( opthash );
+}
+
+
+/*
+ * call-seq:
+ *   graph.search_quads( subject, predicate, object, options={} )   -> array
+ *
+ * Search for statements in the graph with the specified +subject+, +predicate+, and
+ * +object+ (any of which can be +nil+ to match any value) and return them as
+ * [subject, predicate, object, context] quads, like those #each_quad yields.
+ *
+ * Valid options are:
+ * [:context]
+ *   Only search the statements in the given context, through the store's context index.
+ *
+ * Without a :context, a graph whose store supports contexts has to be scanned in full,
+ * since the store's statement indexes don't say which contexts their statements are in, so
+ * the search takes time in proportion to the size of the whole graph however few
+ * statements match. Give a :context whenever the one you want is known.
+ *
+ *   graph.search_quads( nil, FOAF[:knows], nil )
+ *   # => [[#<URI:...>, #<URI:...>, :mahlon, #<URI:http://example.org/people>], ...]
+ *   graph.search_quads( nil, FOAF[:knows], nil, :context => 'http://example.org/people' )
+ */
+static VALUE
+rleaf_redleaf_graph_search_quads( int argc, VALUE *argv, VALUE self ) {
+	VALUE subject, predicate, object, opthash = Qnil, quads = rb_ary_new();
+	librdf_statement *search;
+	librdf_node *context;
+	int failed, state = 0;
+
+	rb_scan_args( argc, argv, "31", &subject, &predicate, &object, &opthash );
+
+	search = rleaf_new_search_statement( subject, predicate, object );
+	context = (librdf_node *)rb_protect( rleaf_graph_context_option_node, opthash, &state );
+	if ( state ) {
+		librdf_free_statement( search );
+		rb_jump_tag( state );
 	}
 
-	librdf_free_stream( stream );
+	failed = rleaf_graph_scan_quads( self, search, context, quads );
+	librdf_free_statement( search );
+	if ( context ) librdf_free_node( context );
 
-	return self;
+	if ( failed )
+		rb_raise( rleaf_eRedleafError, "Failed to create stream for graph" );
+
+	return quads;
 }
 
 
 /*
  * call-seq:
- *   graph.load( uri )   -> Fixnum
+ *   graph.load( uri )   -> Fixnum or nil
  *
  * Parse the RDF at the specified +uri+ into the receiving graph. Returns the number of statements
- * added to the graph (if the underlying store supports ).
+ * added to the graph, or +nil+ if the underlying store can't count its statements.
  *
  *   graph = Redleaf::Graph.new
  *   graph.load( "http://bigasterisk.com/foaf.rdf" )
@@ -698,18 +2700,20 @@ rleaf_redleaf_graph_load( VALUE self, VALUE uri ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
 	librdf_parser *parser = NULL;
 	librdf_uri *rdfuri = NULL;
-	int statement_count = librdf_model_size( ptr->model );
+	long before = rleaf_graph_statement_count( self ), after;
 
 	if ( (parser = librdf_new_parser( rleaf_rdf_world, NULL, NULL, NULL )) == NULL )
 		rb_raise( rleaf_eRedleafError, "failed to create a parser." );
 
 	rdfuri = rleaf_object_to_librdf_uri( uri );
 
+	rleaf_graph_invalidate_fingerprint( self );
 	if ( librdf_parser_parse_into_model(parser, rdfuri, NULL, ptr->model) != 0 )
 		rb_raise( rleaf_eRedleafError, "failed to load %s into %s",
 		librdf_uri_as_string(rdfuri), RSTRING_PTR(rb_inspect( self )) );
 
-	return INT2FIX( librdf_model_size(ptr->model) - statement_count );
+	after = rleaf_graph_statement_count( self );
+	return before < 0 || after < 0 ? Qnil : LONG2NUM( after - before );
 }
 
 
@@ -815,7 +2819,7 @@ rleaf_redleaf_graph_serialized_as( int argc, VALUE *argv, VALUE self ) {
 	formatname = StringValuePtr( format );
 	rleaf_log_with_context( self, "debug", "trying to serialize as '%s'", formatname );
 
-	if ( !RTEST(rb_funcall(CLASS_OF(self), valid_format_p, 1, format)) )
+	if ( !rleaf_graph_serializer_supported(format) )
 		rb_raise( rleaf_eRedleafFeatureError, "unsupported serialization format '%s'", formatname );
 
 	rleaf_log_with_context( self, "debug", "valid format '%s' specified.", formatname );
@@ -839,6 +2843,118 @@ rleaf_redleaf_graph_serialized_as( int argc, VALUE *argv, VALUE self ) {
 }
 
 
+/*
+ * Stream the statements matching the search statement of the given +job+ (a pointer to an
+ * rleaf_SERIALIZATION cast as a VALUE) into a serializer; used with rb_ensure() by
+ * #serialize_matching, since setting namespaces and writing to the target can raise.
+ */
+static VALUE
+rleaf_graph_serialize_matching_body( VALUE jobptr ) {
+	rleaf_SERIALIZATION *job = (rleaf_SERIALIZATION *)jobptr;
+	rleaf_GRAPH *ptr = rleaf_get_graph( job->self );
+	raptor_iostream *iostream;
+	rleaf_RUBYIO rubyio;
+	int result;
+
+	job->serializer = librdf_new_serializer( rleaf_rdf_world, job->formatname, NULL, NULL );
+	if ( !job->serializer )
+		rb_raise( rleaf_eRedleafError, "could not create a '%s' serializer", job->formatname );
+
+	if ( RTEST(job->nshash) )
+		rb_iterate( rb_each, job->nshash, rleaf_set_serializer_ns, (VALUE)job->serializer );
+
+	job->stream = librdf_model_find_statements( ptr->model, job->search );
+	if ( !job->stream )
+		rb_raise( rleaf_eRedleafError, "could not create a stream when searching" );
+
+	iostream = rleaf_new_ruby_iostream( &rubyio, job->target );
+	result = librdf_serializer_serialize_stream_to_iostream( job->serializer, NULL, job->stream,
+		iostream );
+	rleaf_finish_ruby_iostream( iostream, &rubyio );
+
+	if ( result != 0 )
+		rb_raise( rleaf_eRedleafError, "could not serialize matching statements as '%s'",
+			job->formatname );
+
+	return job->target;
+}
+
+
+/*
+ * Free the librdf objects of the given +job+; used with rb_ensure() by #serialize_matching.
+ */
+static VALUE
+rleaf_graph_serialize_matching_ensure( VALUE jobptr ) {
+	rleaf_SERIALIZATION *job = (rleaf_SERIALIZATION *)jobptr;
+
+	if ( job->stream ) librdf_free_stream( job->stream );
+	if ( job->search ) librdf_free_statement( job->search );
+	if ( job->serializer ) librdf_free_serializer( job->serializer );
+
+	return Qnil;
+}
+
+
+/*
+ * call-seq:
+ *    graph.serialize_matching( subject, predicate, object, format, options={} )  -> string or io
+ *
+ * Serialize only the statements in the graph which match the specified +subject+,
+ * +predicate+, and +object+ (any of which may be nil to match any value) in the specified
+ * +format+. The matching statements are streamed directly from the store into the
+ * serializer, so no intermediate Graph is built. Valid +format+s are keys of the Hash returned
+ * by ::serializers.
+ *
+ * Valid +options+ are:
+ * [:io]
+ *   An object that responds to #write to write the output to instead of returning it as a
+ *   String. The +io+ is returned.
+ * [:namespaces]
+ *   A namespace Hash, as for #serialized_as.
+ *
+ * Examples:
+ *    turtle = graph.serialize_matching( me, nil, nil, 'turtle' )
+ *    File.open( "knows.nt", "w" ) do |io|
+ *        graph.serialize_matching( nil, FOAF[:knows], nil, 'ntriples', :io => io )
+ *    end
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_serialize_matching( int argc, VALUE *argv, VALUE self ) {
+	rleaf_SERIALIZATION job;
+	VALUE subject, predicate, object, format, opthash = Qnil;
+
+	rb_scan_args( argc, argv, "41", &subject, &predicate, &object, &format, &opthash );
+
+	MEMZERO( &job, rleaf_SERIALIZATION, 1 );
+	job.self       = self;
+	job.target     = Qnil;
+	job.nshash     = Qnil;
+	job.formatname = StringValuePtr( format );
+	if ( !rleaf_graph_serializer_supported(format) )
+		rb_raise( rleaf_eRedleafFeatureError, "unsupported serialization format '%s'",
+			job.formatname );
+
+	if ( RTEST(opthash) ) {
+		Check_Type( opthash, T_HASH );
+		job.target = rb_hash_lookup( opthash, ID2SYM(rb_intern("io")) );
+		job.nshash = rb_hash_lookup( opthash, ID2SYM(rb_intern("namespaces")) );
+	}
+	if ( NIL_P(job.target) ) job.target = rb_str_new( 0, 0 );
+
+	rleaf_log_with_context( self, "debug", "serializing statements matching {%s, %s, %s} as '%s'",
+		RSTRING_PTR(rb_inspect(subject)),
+		RSTRING_PTR(rb_inspect(predicate)),
+		RSTRING_PTR(rb_inspect(object)),
+		job.formatname );
+
+	job.search = rleaf_new_search_statement( subject, predicate, object );
+
+	return rb_ensure( rleaf_graph_serialize_matching_body, (VALUE)&job,
+		rleaf_graph_serialize_matching_ensure, (VALUE)&job );
+}
+
+
 /*
  * Iterator function: map a [namespace, uri] tuple into a namespace registered with
  * the serializer_value, which is a librdf_serializer pointer cast as a VALUE.
@@ -949,20 +3065,71 @@ rleaf_redleaf_graph_execute_query( int argc, VALUE *argv, VALUE self ) {
 }
 
 
+/*
+ * Return an Array of the distinct nodes that +part+ returns for the statements in +context+
+ * that match +search+. Redland's source, arc, and target iterators can't be limited to a
+ * context, so this is what #subjects, #predicates, and #objects use when given one. Frees
+ * +search+ and +context+.
+ */
+static VALUE
+rleaf_graph_context_nodes( VALUE self, librdf_statement *search, librdf_node *context,
+	librdf_node *(*part)(librdf_statement *) )
+{
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	librdf_stream *stream;
+	librdf_statement *stmt;
+	librdf_node *node;
+	VALUE rval = rb_ary_new(), seen = rb_hash_new(), key;
+
+	stream = librdf_model_find_statements_in_context( ptr->model, search, context );
+	if ( !stream ) {
+		librdf_free_statement( search );
+		librdf_free_node( context );
+		rb_raise( rleaf_eRedleafError, "could not create a stream when searching a context" );
+	}
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( (stmt = librdf_stream_get_object( stream )) == NULL ) break;
+
+		node = part( stmt );
+		key = rleaf_node_key( node );
+		if ( !RTEST(rb_hash_lookup(seen, key)) ) {
+			rb_hash_aset( seen, key, Qtrue );
+			rb_ary_push( rval, rleaf_librdf_node_to_value(node) );
+		}
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+	librdf_free_statement( search );
+	librdf_free_node( context );
+
+	return rval;
+}
+
+
 /*
  * call-seq:
- *    graph.subjects( predicate, object )   -> [ nodes ]
+ *    graph.subjects( predicate, object, options={} )   -> [ nodes ]
  *
  * Return an Array of subject nodes from the graph that have the specified +predicate+ and +object+.
+ * If a :context option is given, only statements in that context are considered.
  *
  */
 static VALUE
-rleaf_redleaf_graph_subjects( VALUE self, VALUE predicate, VALUE object ) {
+rleaf_redleaf_graph_subjects( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_node *arc, *target;
+	librdf_node *arc, *target, *context;
 	librdf_iterator *iter;
+	VALUE predicate, object, opthash = Qnil;
 	VALUE rval = rb_ary_new();
 
+	rb_scan_args( argc, argv, "21", &predicate, &object, &opthash );
+	if ( (context = rleaf_context_option_node(opthash)) != NULL )
+		return rleaf_graph_context_nodes( self,
+			rleaf_new_search_statement(Qnil, predicate, object), context,
+			librdf_statement_get_subject );
+
 	arc = rleaf_value_to_predicate_node( predicate );
 	target = rleaf_value_to_object_node( object );
 
@@ -1021,18 +3188,26 @@ rleaf_redleaf_graph_subject( VALUE self, VALUE predicate, VALUE object ) {
 
 /*
  * call-seq:
- *    graph.predicates( subject, object )   -> [ nodes ]
+ *    graph.predicates( subject, object, options={} )   -> [ nodes ]
  *
  * Return an Array of predicate nodes from the graph that have the specified +subject+ and +object+.
+ * If a :context option is given, only statements in that context are considered.
  *
  */
 static VALUE
-rleaf_redleaf_graph_predicates( VALUE self, VALUE subject, VALUE object ) {
+rleaf_redleaf_graph_predicates( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_node *source, *target;
+	librdf_node *source, *target, *context;
 	librdf_iterator *iter;
+	VALUE subject, object, opthash = Qnil;
 	VALUE rval = rb_ary_new();
 
+	rb_scan_args( argc, argv, "21", &subject, &object, &opthash );
+	if ( (context = rleaf_context_option_node(opthash)) != NULL )
+		return rleaf_graph_context_nodes( self,
+			rleaf_new_search_statement(subject, Qnil, object), context,
+			librdf_statement_get_predicate );
+
 	source = rleaf_value_to_subject_node( subject );
 	target = rleaf_value_to_object_node( object );
 
@@ -1091,18 +3266,26 @@ rleaf_redleaf_graph_predicate( VALUE self, VALUE subject, VALUE object ) {
 
 /*
  * call-seq:
- *    graph.objects( subject, predicate )   -> [ nodes ]
+ *    graph.objects( subject, predicate, options={} )   -> [ nodes ]
  *
  * Return an Array of object nodes from the graph that have the specified +subject+ and +predicate+.
+ * If a :context option is given, only statements in that context are considered.
  *
  */
 static VALUE
-rleaf_redleaf_graph_objects( VALUE self, VALUE subject, VALUE predicate ) {
+rleaf_redleaf_graph_objects( int argc, VALUE *argv, VALUE self ) {
 	rleaf_GRAPH *ptr = rleaf_get_graph( self );
-	librdf_node *source, *arc;
+	librdf_node *source, *arc, *context;
 	librdf_iterator *iter;
+	VALUE subject, predicate, opthash = Qnil;
 	VALUE rval = rb_ary_new();
 
+	rb_scan_args( argc, argv, "21", &subject, &predicate, &opthash );
+	if ( (context = rleaf_context_option_node(opthash)) != NULL )
+		return rleaf_graph_context_nodes( self,
+			rleaf_new_search_statement(subject, predicate, Qnil), context,
+			librdf_statement_get_object );
+
 	source = rleaf_value_to_subject_node( subject );
 	arc = rleaf_value_to_predicate_node( predicate );
 
@@ -1381,6 +3564,126 @@ rleaf_redleaf_graph_include_object_p( VALUE self, VALUE object ) {
 }
 
 
+/*
+ * call-seq:
+ *    graph.write_snapshot( path )   -> graph
+ *
+ * Write the statements in the graph to a compact, read-only snapshot file at +path+, which
+ * can be loaded with Redleaf::SnapshotStore. A snapshot holds a dictionary of the graph's
+ * terms and sorted indexes of its statements, laid out so they can be searched directly
+ * from a memory mapping of the file. The file is replaced atomically if it already exists.
+ *
+ *   taxonomy.write_snapshot( 'taxonomy.snapshot' )
+ *   taxonomy = Redleaf::Graph.new( Redleaf::SnapshotStore.new('taxonomy.snapshot') )
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_write_snapshot( VALUE self, VALUE path ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+
+	FilePathValue( path );
+	rleaf_log_with_context( self, "debug", "writing a snapshot to %s", RSTRING_PTR(path) );
+	rleaf_write_snapshot( ptr->model, StringValueCStr(path) );
+
+	return self;
+}
+
+
+/*
+ * call-seq:
+ *    graph.dump( io=nil )   -> string or io
+ *
+ * Write the statements in the graph to +io+ (any object that responds to #write) in
+ * Redleaf's binary dump format, or return them as a String if no +io+ is given. A dump is a
+ * table of the graph's terms followed by its statements as delta-encoded term ids, so it's
+ * much more compact and faster to load than a text serialization. Statements keep their
+ * contexts if the graph supports them. Dumps can be loaded with Redleaf::Graph.load_dump.
+ *
+ *   File.open( 'people.dump', 'wb' ) {|io| people.dump(io) }
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_dump( int argc, VALUE *argv, VALUE self ) {
+	rleaf_GRAPH *ptr = rleaf_get_graph( self );
+	int with_contexts = RTEST( rleaf_redleaf_graph_supports_contexts_p(self) );
+	VALUE target = Qnil;
+
+	rb_scan_args( argc, argv, "01", &target );
+	if ( NIL_P(target) ) target = rb_str_new( 0, 0 );
+
+	rleaf_log_with_context( self, "debug", "dumping %s to a %s",
+		with_contexts ? "statements and contexts" : "statements", rb_obj_classname(target) );
+	rleaf_dump_model( ptr->model, with_contexts, target );
+
+	return target;
+}
+
+
+/*
+ * call-seq:
+ *    Redleaf::Graph.load_dump( io_or_string, options={} )   -> graph
+ *
+ * Create a new graph from a dump written by Redleaf::Graph#dump, read from a String or from
+ * +io+ (any object that responds to #read). The statements are added to the store given by
+ * the <tt>:store</tt> option, or to a new default store. Contexts in the dump are discarded
+ * if the store doesn't support them.
+ *
+ *   people = File.open( 'people.dump', 'rb' ) do |io|
+ *       Redleaf::Graph.load_dump( io, :store => Redleaf::HashesStore.new )
+ *   end
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_s_load_dump( int argc, VALUE *argv, VALUE klass ) {
+	VALUE source, opthash = Qnil, store = Qnil, graph;
+	rleaf_GRAPH *ptr;
+
+	rb_scan_args( argc, argv, "11", &source, &opthash );
+	if ( RTEST(opthash) ) {
+		Check_Type( opthash, T_HASH );
+		store = rb_hash_lookup( opthash, ID2SYM(rb_intern("store")) );
+	}
+
+	graph = NIL_P( store ) ?
+		rb_class_new_instance( 0, NULL, klass ) :
+		rb_class_new_instance( 1, &store, klass );
+	ptr = rleaf_get_graph( graph );
+
+	rleaf_log_with_context( graph, "debug", "loading a dump from a %s", rb_obj_classname(source) );
+	rleaf_load_dump( ptr->model, RTEST(rleaf_redleaf_graph_supports_contexts_p(graph)), source );
+	rleaf_graph_invalidate_fingerprint( graph );
+
+	return graph;
+}
+
+
+/*
+ * call-seq:
+ *    graph._dump( level )   -> string
+ *
+ * Marshal support: returns the graph in Redleaf's binary dump format.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph__dump( VALUE self, VALUE level ) {
+	_UNUSED( level );
+	return rleaf_redleaf_graph_dump( 0, NULL, self );
+}
+
+
+/*
+ * call-seq:
+ *    Redleaf::Graph._load( string )   -> graph
+ *
+ * Marshal support: load a graph with a default store from a binary dump.
+ *
+ */
+static VALUE
+rleaf_redleaf_graph_s__load( VALUE klass, VALUE string ) {
+	return rleaf_redleaf_graph_s_load_dump( 1, &string, klass );
+}
+
+
 /*
  * call-seq:
  *    model.sync
@@ -1415,7 +3718,6 @@ rleaf_init_redleaf_graph( void ) {
 	flags_sym          = ID2SYM( rb_intern("flags") );
 
 	graph_eq           = rb_intern( "graph=" );
-	valid_format_p     = rb_intern( "valid_format?" );
 
 #ifdef FOR_RDOC
 	rleaf_mRedleaf = rb_define_module( "Redleaf" );
@@ -1424,6 +3726,10 @@ rleaf_init_redleaf_graph( void ) {
 	rleaf_contexts_feature = librdf_new_uri( rleaf_rdf_world,
 		(unsigned char *)LIBRDF_MODEL_FEATURE_CONTEXTS );
 
+	/* Build the serializer registry */
+	rb_gc_register_address( &rleaf_graph_serializers );
+	rleaf_refresh_graph_serializers();
+
 	/* Class methods */
 	rleaf_cRedleafGraph = rb_define_class_under( rleaf_mRedleaf, "Graph", rb_cObject );
 	rb_define_alloc_func( rleaf_cRedleafGraph, rleaf_redleaf_graph_s_allocate );
@@ -1432,29 +3738,61 @@ rleaf_init_redleaf_graph( void ) {
 		rleaf_redleaf_graph_s_model_types, 0 );
 	rb_define_singleton_method( rleaf_cRedleafGraph, "serializers",
 		rleaf_redleaf_graph_s_serializers, 0 );
+	rb_define_singleton_method( rleaf_cRedleafGraph, "valid_format?",
+		rleaf_redleaf_graph_s_valid_format_p, 1 );
 
 	/* Public instance methods */
 	rb_define_method( rleaf_cRedleafGraph, "initialize", rleaf_redleaf_graph_initialize, -1 );
 	rb_define_method( rleaf_cRedleafGraph, "dup", rleaf_redleaf_graph_dup, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "overlay", rleaf_redleaf_graph_overlay, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "version", rleaf_redleaf_graph_version, 0 );
 
 	rb_define_method( rleaf_cRedleafGraph, "store", rleaf_redleaf_graph_store, 0 );
 	rb_define_method( rleaf_cRedleafGraph, "store=", rleaf_redleaf_graph_store_eq, 1 );
 
-	rb_define_method( rleaf_cRedleafGraph, "size", rleaf_redleaf_graph_size, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "size", rleaf_redleaf_graph_size, -1 );
 	rb_define_alias ( rleaf_cRedleafGraph, "length", "size" );
+	rb_define_method( rleaf_cRedleafGraph, "cached_size", rleaf_redleaf_graph_cached_size, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "recount", rleaf_redleaf_graph_recount, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "fingerprint", rleaf_redleaf_graph_fingerprint, 0 );
 	rb_define_method( rleaf_cRedleafGraph, "statements", rleaf_redleaf_graph_statements, 0 );
 
 	rb_define_method( rleaf_cRedleafGraph, "append_statements", rleaf_redleaf_graph_append_statements, -1 );
 	rb_define_method( rleaf_cRedleafGraph, "remove", rleaf_redleaf_graph_remove, 1 );
+	rb_define_method( rleaf_cRedleafGraph, "delete_matching",
+		rleaf_redleaf_graph_delete_matching, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "drop_context", rleaf_redleaf_graph_drop_context, 1 );
+	rb_define_method( rleaf_cRedleafGraph, "replace_context",
+		rleaf_redleaf_graph_replace_context, 2 );
 	rb_define_alias ( rleaf_cRedleafGraph, "delete", "remove" );
 
-	rb_define_method( rleaf_cRedleafGraph, "search", rleaf_redleaf_graph_search, 3 );
+	rb_define_method( rleaf_cRedleafGraph, "search", rleaf_redleaf_graph_search, -1 );
 	rb_define_alias ( rleaf_cRedleafGraph, "[]", "search" );
 	rb_define_method( rleaf_cRedleafGraph, "include?", rleaf_redleaf_graph_include_p, 1 );
 	rb_define_alias ( rleaf_cRedleafGraph, "contains?", "include?" );
 
-	rb_define_method( rleaf_cRedleafGraph, "each_statement", rleaf_redleaf_graph_each_statement, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "is_equivalent_to?",
+		rleaf_redleaf_graph_is_equivalent_to_p, 1 );
+	rb_define_alias ( rleaf_cRedleafGraph, "equivalent_to?", "is_equivalent_to?" );
+	rb_define_alias ( rleaf_cRedleafGraph, "===", "is_equivalent_to?" );
+
+	rb_define_method( rleaf_cRedleafGraph, "union", rleaf_redleaf_graph_union, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "|", rleaf_redleaf_graph_union, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "intersection", rleaf_redleaf_graph_intersection, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "&", rleaf_redleaf_graph_intersection, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "difference", rleaf_redleaf_graph_difference, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "-", rleaf_redleaf_graph_difference, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "union!", rleaf_redleaf_graph_union_bang, 1 );
+	rb_define_method( rleaf_cRedleafGraph, "intersect!", rleaf_redleaf_graph_intersect_bang, 1 );
+	rb_define_method( rleaf_cRedleafGraph, "subtract!", rleaf_redleaf_graph_subtract_bang, 1 );
+	rb_define_method( rleaf_cRedleafGraph, "diff", rleaf_redleaf_graph_diff, 1 );
+	rb_define_method( rleaf_cRedleafGraph, "apply_patch", rleaf_redleaf_graph_apply_patch, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "transaction", rleaf_redleaf_graph_transaction, 0 );
+
+	rb_define_method( rleaf_cRedleafGraph, "each_statement", rleaf_redleaf_graph_each_statement, -1 );
 	rb_define_alias ( rleaf_cRedleafGraph, "each", "each_statement" );
+	rb_define_method( rleaf_cRedleafGraph, "each_quad", rleaf_redleaf_graph_each_quad, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "search_quads", rleaf_redleaf_graph_search_quads, -1 );
 
 	rb_define_method( rleaf_cRedleafGraph, "load", rleaf_redleaf_graph_load, 1 );
 
@@ -1465,14 +3803,16 @@ rleaf_init_redleaf_graph( void ) {
 	rb_define_method( rleaf_cRedleafGraph, "contexts", rleaf_redleaf_graph_contexts, 0 );
 
 	rb_define_method( rleaf_cRedleafGraph, "serialized_as", rleaf_redleaf_graph_serialized_as, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "serialize_matching",
+		rleaf_redleaf_graph_serialize_matching, -1 );
 
 	rb_define_method( rleaf_cRedleafGraph, "execute_query", rleaf_redleaf_graph_execute_query, -1 );
 
-	rb_define_method( rleaf_cRedleafGraph, "subjects", rleaf_redleaf_graph_subjects, 2 );
+	rb_define_method( rleaf_cRedleafGraph, "subjects", rleaf_redleaf_graph_subjects, -1 );
 	rb_define_method( rleaf_cRedleafGraph, "subject", rleaf_redleaf_graph_subject, 2 );
-	rb_define_method( rleaf_cRedleafGraph, "predicates", rleaf_redleaf_graph_predicates, 2 );
+	rb_define_method( rleaf_cRedleafGraph, "predicates", rleaf_redleaf_graph_predicates, -1 );
 	rb_define_method( rleaf_cRedleafGraph, "predicate", rleaf_redleaf_graph_predicate, 2 );
-	rb_define_method( rleaf_cRedleafGraph, "objects", rleaf_redleaf_graph_objects, 2 );
+	rb_define_method( rleaf_cRedleafGraph, "objects", rleaf_redleaf_graph_objects, -1 );
 	rb_define_method( rleaf_cRedleafGraph, "object", rleaf_redleaf_graph_object, 2 );
 
 	rb_define_alias( rleaf_cRedleafGraph, "sources", "subjects" );
@@ -1506,22 +3846,17 @@ rleaf_init_redleaf_graph( void ) {
 		rleaf_redleaf_graph_include_object_p, 1 );
 
 	rb_define_method( rleaf_cRedleafGraph, "sync", rleaf_redleaf_graph_sync, 0 );
+	rb_define_method( rleaf_cRedleafGraph, "write_snapshot", rleaf_redleaf_graph_write_snapshot, 1 );
+
+	rb_define_method( rleaf_cRedleafGraph, "dump", rleaf_redleaf_graph_dump, -1 );
+	rb_define_method( rleaf_cRedleafGraph, "_dump", rleaf_redleaf_graph__dump, 1 );
+	rb_define_singleton_method( rleaf_cRedleafGraph, "load_dump", rleaf_redleaf_graph_s_load_dump, -1 );
+	rb_define_singleton_method( rleaf_cRedleafGraph, "_load", rleaf_redleaf_graph_s__load, 1 );
 
 	/*
 
 	FUTURE WORK (0.2.x):
 
-	--------------------------------------------------------------
-	Transactions
-	--------------------------------------------------------------
-	-- #transaction { block }
-	int librdf_model_transaction_commit( librdf_model *model );
-	void* librdf_model_transaction_get_handle( librdf_model *model );
-	int librdf_model_transaction_rollback( librdf_model *model );
-	int librdf_model_transaction_start( librdf_model *model );
-	int librdf_model_transaction_start_with_handle( librdf_model *model, void *handle );
-
-
 	--------------------------------------------------------------
 	Contexts
 	--------------------------------------------------------------
@@ -0,0 +1,1143 @@
+/*
+ * Redleaf copy-on-write overlay and write-behind storage
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#include "redleaf.h"
+
+#include <time.h>
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ * -------------------------------------------------------------- */
+
+VALUE rleaf_cRedleafOverlayStore;
+VALUE rleaf_cRedleafWriteBehindStore;
+
+#define RLEAF_OVERLAY_NAME          "overlay"
+#define RLEAF_OVERLAY_LABEL         "Copy-on-write overlay of another storage"
+#define RLEAF_WRITEBEHIND_NAME      "writebehind"
+#define RLEAF_WRITEBEHIND_LABEL     "Buffers writes to another storage in memory"
+
+/* How many changes a write-behind overlay buffers by default before flushing them */
+#define RLEAF_WRITEBEHIND_DEFAULT_MAX_PENDING 10000
+
+/* The storage module and options used for an overlay's added and removed statements */
+#define RLEAF_OVERLAY_DELTA_MODULE  "hashes"
+#define RLEAF_OVERLAY_DELTA_OPTIONS "hash-type='memory'"
+
+/*
+ * An overlay's state. The statements in the overlay are those in +base+ that aren't in
+ * +removed+, plus those in +added+. Adding and removing statements only changes +added+
+ * and +removed+, which are kept so that +added+ holds no statements that are in the base,
+ * and +removed+ holds only statements that are.
+ *
+ * +base_store+ is the Redleaf::Store of the base, whose cached size and fingerprint are
+ * forgotten whenever changes are flushed to it. It's only set while the Redleaf::OverlayStore
+ * that created the overlay is alive, since that's what keeps the base store from being
+ * garbage-collected.
+ *
+ * Write-behind overlays also flush their changes to the base once there are +max_pending+
+ * of them or, when another change is made, the oldest is +max_delay+ seconds old (if
+ * either is non-zero), and when they're synced. Flushing is put off while any streams over
+ * the overlay are open. Every flush adds the number of changes it wrote to +unreported+,
+ * which is handed to the Redleaf::WriteBehindStore +owner+ (set while it's alive, like
+ * +base_store+) for its after_flush callbacks. +flush_failed+ is set when a flush set off
+ * by a change fails, since the change itself was buffered and so can't fail.
+ */
+typedef struct rleaf_overlay {
+	librdf_storage	*base;
+	rleaf_STORE		*base_store;
+	librdf_storage	*added;
+	librdf_storage	*removed;
+	int				write_behind;
+	long			max_pending;
+	long			max_delay;
+	int				sync_on_flush;
+	time_t			pending_since;
+	int				open_streams;
+	int				flush_deferred;
+	VALUE			owner;
+	long			unreported;
+	int				flush_failed;
+} rleaf_OVERLAY;
+
+/* A stream over the base statements that haven't been removed, then the added ones */
+typedef struct rleaf_overlay_cursor {
+	librdf_storage	*storage;
+	rleaf_OVERLAY	*overlay;
+	librdf_stream	*streams[ 2 ];
+	int				current;
+} rleaf_OVERLAYCURSOR;
+
+
+/* --------------------------------------------------------------
+ * Overlay functions
+ * -------------------------------------------------------------- */
+
+/*
+ * Create one of the in-memory storages that hold an overlay's changes.
+ */
+static librdf_storage *
+rleaf_overlay_new_delta( librdf_world *world ) {
+	librdf_storage *delta = librdf_new_storage( world, RLEAF_OVERLAY_DELTA_MODULE,
+		RLEAF_OVERLAY_NAME, RLEAF_OVERLAY_DELTA_OPTIONS );
+
+	if ( delta && librdf_storage_open(delta, NULL) != 0 ) {
+		librdf_free_storage( delta );
+		delta = NULL;
+	}
+
+	return delta;
+}
+
+
+/*
+ * Free one of an overlay's change storages.
+ */
+static void
+rleaf_overlay_free_delta( librdf_storage *delta ) {
+	if ( !delta ) return;
+	librdf_storage_close( delta );
+	librdf_free_storage( delta );
+}
+
+
+/*
+ * Returns non-zero if the overlay's base storage contains +statement+.
+ */
+static int
+rleaf_overlay_base_contains( rleaf_OVERLAY *overlay, librdf_statement *statement ) {
+	return overlay->base && librdf_storage_contains_statement( overlay->base, statement );
+}
+
+
+/*
+ * Copy all the statements in the +from+ storage into the +to+ storage.
+ */
+static int
+rleaf_overlay_copy_delta( librdf_storage *to, librdf_storage *from ) {
+	librdf_stream *stream = librdf_storage_serialise( from );
+	int rval;
+
+	if ( !stream ) return 1;
+	rval = librdf_storage_add_statements( to, stream );
+	librdf_free_stream( stream );
+
+	return rval;
+}
+
+
+/*
+ * Set the +base+ storage of the given +overlay+ storage, which mustn't have any changes yet.
+ */
+static void
+rleaf_overlay_set_base( librdf_storage *storage, librdf_storage *base ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+
+	if ( base ) librdf_storage_add_reference( base );
+	if ( overlay->base ) librdf_free_storage( overlay->base );
+	overlay->base = base;
+}
+
+
+/*
+ * Return the number of changes the given +overlay+ has.
+ */
+static long
+rleaf_overlay_pending( rleaf_OVERLAY *overlay ) {
+	return librdf_storage_size( overlay->added ) + librdf_storage_size( overlay->removed );
+}
+
+
+/*
+ * Write the changes in the overlay +storage+ to its base and start a new, empty set of
+ * changes, then sync the base if the overlay is set to. Returns the number of changes
+ * written, or -1 if they couldn't all be written, in which case they're kept. If any
+ * streams over the overlay are open, the flush is put off until the last of them is
+ * finished, and 0 is returned.
+ */
+static long
+rleaf_overlay_flush( librdf_storage *storage ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+	librdf_world *world = librdf_storage_get_world( storage );
+	librdf_storage *added, *removed;
+	librdf_stream *stream;
+	librdf_statement *statement;
+	long count;
+	int rval = 0;
+
+	if ( overlay->open_streams ) {
+		overlay->flush_deferred = 1;
+		return 0;
+	}
+
+	overlay->flush_deferred = 0;
+	if ( !(count = rleaf_overlay_pending(overlay)) ) return 0;
+	if ( !overlay->base ) return -1;
+
+	/* Whatever happens below, the base's statements are about to change */
+	if ( overlay->base_store ) {
+		overlay->base_store->fingerprint_valid = 0;
+		overlay->base_store->size_valid        = 0;
+		overlay->base_store->context_sizes     = Qnil;
+	}
+
+	if ( !(stream = librdf_storage_serialise(overlay->removed)) ) return -1;
+	while ( rval == 0 && ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+		rval = librdf_storage_remove_statement( overlay->base, statement );
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+	if ( rval != 0 ) return -1;
+
+	if ( !(stream = librdf_storage_serialise(overlay->added)) ) return -1;
+	rval = librdf_storage_add_statements( overlay->base, stream );
+	librdf_free_stream( stream );
+	if ( rval != 0 ) return -1;
+
+	/* Start over with empty changes */
+	added   = rleaf_overlay_new_delta( world );
+	removed = rleaf_overlay_new_delta( world );
+	if ( !added || !removed ) {
+		rleaf_overlay_free_delta( added );
+		rleaf_overlay_free_delta( removed );
+		return -1;
+	}
+
+	rleaf_overlay_free_delta( overlay->added );
+	rleaf_overlay_free_delta( overlay->removed );
+	overlay->added   = added;
+	overlay->removed = removed;
+	overlay->pending_since = 0;
+	overlay->unreported += count;
+	overlay->flush_failed = 0;
+
+	if ( overlay->sync_on_flush && librdf_storage_sync(overlay->base) != 0 ) return -1;
+
+	return count;
+}
+
+
+/*
+ * Call the rleaf_overlay_report_protected() for the overlay given as a VALUE; used with
+ * rb_protect() by rleaf_overlay_report().
+ */
+static VALUE
+rleaf_overlay_report_protected( VALUE overlayptr ) {
+	rleaf_OVERLAY *overlay = (rleaf_OVERLAY *)overlayptr;
+	long count = overlay->unreported;
+
+	overlay->unreported = 0;
+	return rb_funcall( overlay->owner, rb_intern("flushed"), 1, LONG2NUM(count) );
+}
+
+
+/*
+ * Hand the number of changes flushed since the last report to the overlay's owner, which
+ * calls its after_flush callbacks with it. Every flush made while Ruby code is running
+ * ends up here; flushes put off until a stream is finished are reported with the next one.
+ * The callbacks are called under rb_protect(), since this can be called from inside a
+ * storage method, and exceptions they raise are logged rather than propagated.
+ */
+static void
+rleaf_overlay_report( rleaf_OVERLAY *overlay ) {
+	int state = 0;
+
+	if ( !overlay->owner || !overlay->unreported ) return;
+
+	rb_protect( rleaf_overlay_report_protected, (VALUE)overlay, &state );
+	if ( state )
+		rleaf_log( "error", "an after_flush callback raised an exception; ignoring it" );
+}
+
+
+/* --------------------------------------------------------------
+ * Overlay streams
+ * -------------------------------------------------------------- */
+
+/*
+ * Advance the cursor past any base statements that have been removed, and on to the added
+ * statements when the base ones run out.
+ */
+static void
+rleaf_overlaycursor_skip( rleaf_OVERLAYCURSOR *cursor ) {
+	librdf_stream *stream;
+	librdf_statement *statement;
+
+	for ( ; cursor->current < 2; cursor->current++ ) {
+		if ( !(stream = cursor->streams[cursor->current]) ) continue;
+
+		while ( ! librdf_stream_end(stream) ) {
+			if ( cursor->current == 1 ) return;
+
+			statement = librdf_stream_get_object( stream );
+			if ( statement &&
+			     !librdf_storage_contains_statement(cursor->overlay->removed, statement) )
+				return;
+
+			librdf_stream_next( stream );
+		}
+	}
+}
+
+
+/*
+ * librdf_stream is_end method.
+ */
+static int
+rleaf_overlaycursor_is_end( void *context ) {
+	rleaf_OVERLAYCURSOR *cursor = (rleaf_OVERLAYCURSOR *)context;
+	return cursor->current >= 2;
+}
+
+
+/*
+ * librdf_stream next method.
+ */
+static int
+rleaf_overlaycursor_next( void *context ) {
+	rleaf_OVERLAYCURSOR *cursor = (rleaf_OVERLAYCURSOR *)context;
+
+	if ( cursor->current >= 2 ) return 1;
+
+	librdf_stream_next( cursor->streams[cursor->current] );
+	rleaf_overlaycursor_skip( cursor );
+
+	return cursor->current >= 2;
+}
+
+
+/*
+ * librdf_stream get method. Contexts of statements from the base are passed through.
+ */
+static void *
+rleaf_overlaycursor_get( void *context, int flags ) {
+	rleaf_OVERLAYCURSOR *cursor = (rleaf_OVERLAYCURSOR *)context;
+	librdf_stream *stream;
+
+	if ( cursor->current >= 2 ) return NULL;
+	stream = cursor->streams[ cursor->current ];
+
+	switch ( flags ) {
+		case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+		return librdf_stream_get_object( stream );
+
+		case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+		return librdf_stream_get_context( stream );
+
+		default:
+		return NULL;
+	}
+}
+
+
+/*
+ * librdf_stream finished method.
+ */
+static void
+rleaf_overlaycursor_finished( void *context ) {
+	rleaf_OVERLAYCURSOR *cursor = (rleaf_OVERLAYCURSOR *)context;
+
+	if ( cursor->streams[0] ) librdf_free_stream( cursor->streams[0] );
+	if ( cursor->streams[1] ) librdf_free_stream( cursor->streams[1] );
+
+	if ( --cursor->overlay->open_streams == 0 && cursor->overlay->flush_deferred )
+		rleaf_overlay_flush( cursor->storage );
+
+	librdf_storage_remove_reference( cursor->storage );
+	xfree( cursor );
+}
+
+
+/*
+ * Return a new stream over the statements in the overlay +storage+ that match the given
+ * +statement+, or all of them if +statement+ is NULL.
+ */
+static librdf_stream *
+rleaf_overlay_new_stream( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+	rleaf_OVERLAYCURSOR *cursor = ALLOC( rleaf_OVERLAYCURSOR );
+	librdf_stream *stream;
+
+	cursor->storage = storage;
+	cursor->overlay = overlay;
+	cursor->current = 0;
+	cursor->streams[0] = cursor->streams[1] = NULL;
+
+	if ( statement ) {
+		if ( overlay->base )
+			cursor->streams[0] = librdf_storage_find_statements( overlay->base, statement );
+		cursor->streams[1] = librdf_storage_find_statements( overlay->added, statement );
+	} else {
+		if ( overlay->base )
+			cursor->streams[0] = librdf_storage_serialise( overlay->base );
+		cursor->streams[1] = librdf_storage_serialise( overlay->added );
+	}
+
+	overlay->open_streams++;
+	librdf_storage_add_reference( storage );
+	if ( ( overlay->base && !cursor->streams[0] ) || !cursor->streams[1] ) {
+		rleaf_overlaycursor_finished( cursor );
+		return NULL;
+	}
+
+	rleaf_overlaycursor_skip( cursor );
+	stream = librdf_new_stream( librdf_storage_get_world(storage), cursor,
+		rleaf_overlaycursor_is_end, rleaf_overlaycursor_next, rleaf_overlaycursor_get,
+		rleaf_overlaycursor_finished );
+
+	if ( !stream ) rleaf_overlaycursor_finished( cursor );
+	return stream;
+}
+
+
+/* --------------------------------------------------------------
+ * Storage module methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Storage init method. Overlays start out over an empty base; Redleaf::OverlayStore sets
+ * the real one after the storage is created.
+ */
+static int
+rleaf_overlay_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	rleaf_OVERLAY *overlay = ALLOC( rleaf_OVERLAY );
+	librdf_world *world = librdf_storage_get_world( storage );
+
+	_UNUSED( name );
+	if ( options ) librdf_free_hash( options );
+
+	overlay->base       = NULL;
+	overlay->base_store = NULL;
+	overlay->added   = rleaf_overlay_new_delta( world );
+	overlay->removed = rleaf_overlay_new_delta( world );
+
+	overlay->write_behind   = 0;
+	overlay->max_pending    = 0;
+	overlay->max_delay      = 0;
+	overlay->sync_on_flush  = 0;
+	overlay->pending_since  = 0;
+	overlay->open_streams   = 0;
+	overlay->flush_deferred = 0;
+	overlay->owner          = 0;
+	overlay->unreported     = 0;
+	overlay->flush_failed   = 0;
+
+	librdf_storage_set_instance( storage, overlay );
+
+	return ( overlay->added && overlay->removed ) ? 0 : 1;
+}
+
+
+/*
+ * Storage clone method. The clone shares the base, and gets a copy of the changes.
+ */
+static int
+rleaf_overlay_clone( librdf_storage *new_storage, librdf_storage *old_storage ) {
+	rleaf_OVERLAY *old = librdf_storage_get_instance( old_storage );
+	rleaf_OVERLAY *overlay;
+
+	if ( rleaf_overlay_init(new_storage, NULL, NULL) != 0 ) return 1;
+	overlay = librdf_storage_get_instance( new_storage );
+
+	if ( old->base ) librdf_storage_add_reference( old->base );
+	overlay->base = old->base;
+
+	if ( rleaf_overlay_copy_delta(overlay->added, old->added) != 0 ||
+	     rleaf_overlay_copy_delta(overlay->removed, old->removed) != 0 )
+		return 1;
+
+	return 0;
+}
+
+
+/*
+ * Storage terminate method.
+ */
+static void
+rleaf_overlay_terminate( librdf_storage *storage ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+
+	if ( !overlay ) return;
+
+	rleaf_overlay_free_delta( overlay->added );
+	rleaf_overlay_free_delta( overlay->removed );
+	if ( overlay->base ) librdf_free_storage( overlay->base );
+
+	xfree( overlay );
+	librdf_storage_set_instance( storage, NULL );
+}
+
+
+/*
+ * Storage open method.
+ */
+static int
+rleaf_overlay_open( librdf_storage *storage, librdf_model *model ) {
+	_UNUSED( storage );
+	_UNUSED( model );
+	return 0;
+}
+
+
+/*
+ * Storage close method.
+ */
+static int
+rleaf_overlay_close( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage size method.
+ */
+static int
+rleaf_overlay_size( librdf_storage *storage ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+	int base_size = overlay->base ? librdf_storage_size( overlay->base ) : 0;
+
+	if ( base_size < 0 ) return -1;
+	return base_size + librdf_storage_size( overlay->added ) -
+		librdf_storage_size( overlay->removed );
+}
+
+
+/*
+ * Storage add_statement method.
+ */
+static int
+rleaf_overlay_add_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+
+	if ( librdf_storage_contains_statement(overlay->removed, statement) )
+		return librdf_storage_remove_statement( overlay->removed, statement );
+	if ( rleaf_overlay_base_contains(overlay, statement) ||
+	     librdf_storage_contains_statement(overlay->added, statement) )
+		return 0;
+
+	return librdf_storage_add_statement( overlay->added, statement );
+}
+
+
+/*
+ * Storage add_statements method.
+ */
+static int
+rleaf_overlay_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	librdf_statement *statement;
+	int rval = 0;
+
+	while ( !rval && ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+		rval = rleaf_overlay_add_statement( storage, statement );
+		librdf_stream_next( stream );
+	}
+
+	return rval;
+}
+
+
+/*
+ * Storage remove_statement method.
+ */
+static int
+rleaf_overlay_remove_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+
+	if ( librdf_storage_contains_statement(overlay->added, statement) )
+		return librdf_storage_remove_statement( overlay->added, statement );
+	if ( !rleaf_overlay_base_contains(overlay, statement) ||
+	     librdf_storage_contains_statement(overlay->removed, statement) )
+		return 0;
+
+	return librdf_storage_add_statement( overlay->removed, statement );
+}
+
+
+/*
+ * Storage contains_statement method.
+ */
+static int
+rleaf_overlay_contains_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+
+	if ( librdf_storage_contains_statement(overlay->added, statement) ) return 1;
+	return rleaf_overlay_base_contains( overlay, statement ) &&
+		!librdf_storage_contains_statement( overlay->removed, statement );
+}
+
+
+/*
+ * Storage serialise method.
+ */
+static librdf_stream *
+rleaf_overlay_serialise( librdf_storage *storage ) {
+	return rleaf_overlay_new_stream( storage, NULL );
+}
+
+
+/*
+ * Storage find_statements method.
+ */
+static librdf_stream *
+rleaf_overlay_find_statements( librdf_storage *storage, librdf_statement *statement ) {
+	return rleaf_overlay_new_stream( storage, statement );
+}
+
+
+/*
+ * Storage sync method. An overlay never writes to its base, so there's nothing to do.
+ */
+static int
+rleaf_overlay_sync( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage factory registration function.
+ */
+static void
+rleaf_overlay_register_factory( librdf_storage_factory *factory ) {
+	factory->version            = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init               = rleaf_overlay_init;
+	factory->clone              = rleaf_overlay_clone;
+	factory->terminate          = rleaf_overlay_terminate;
+	factory->open               = rleaf_overlay_open;
+	factory->close              = rleaf_overlay_close;
+	factory->size               = rleaf_overlay_size;
+	factory->add_statement      = rleaf_overlay_add_statement;
+	factory->add_statements     = rleaf_overlay_add_statements;
+	factory->remove_statement   = rleaf_overlay_remove_statement;
+	factory->contains_statement = rleaf_overlay_contains_statement;
+	factory->serialise          = rleaf_overlay_serialise;
+	factory->find_statements    = rleaf_overlay_find_statements;
+	factory->sync               = rleaf_overlay_sync;
+}
+
+
+/* --------------------------------------------------------------
+ * Write-behind storage module methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Flush the changes of the write-behind overlay +storage+ if there are enough of them or
+ * they've been waiting long enough, after a write that returned +rval+. The write has been
+ * buffered by then, so a failed flush doesn't make it fail (which would have the caller
+ * make it again); it's logged and recorded in the overlay's +flush_failed+ instead, and the
+ * changes stay buffered for the next flush.
+ */
+static int
+rleaf_writebehind_written( librdf_storage *storage, int rval ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+	long pending;
+
+	if ( rval != 0 ) return rval;
+
+	if ( !(pending = rleaf_overlay_pending(overlay)) ) {
+		overlay->pending_since = 0;
+		return 0;
+	}
+	if ( !overlay->pending_since ) overlay->pending_since = time( NULL );
+
+	if ( (overlay->max_pending > 0 && pending >= overlay->max_pending) ||
+	     (overlay->max_delay > 0 &&
+	      difftime(time(NULL), overlay->pending_since) >= overlay->max_delay) )
+	{
+		if ( rleaf_overlay_flush(storage) < 0 ) {
+			overlay->flush_failed = 1;
+			rleaf_log( "error", "couldn't flush %ld buffered changes; keeping them", pending );
+		}
+		rleaf_overlay_report( overlay );
+	}
+
+	return 0;
+}
+
+
+/*
+ * Storage init method. The 'max-pending' option sets how many changes are buffered
+ * before they're flushed (default: 10000), 'max-delay' how many seconds old the oldest of
+ * them can be before the next change flushes them (default: no limit), and 'sync-on-flush'
+ * whether the base is synced after each flush.
+ */
+static int
+rleaf_writebehind_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	rleaf_OVERLAY *overlay;
+	long max_pending = RLEAF_WRITEBEHIND_DEFAULT_MAX_PENDING, max_delay = 0, value;
+	int sync_on_flush = 0, rval;
+
+	if ( options ) {
+		if ( (value = librdf_hash_get_as_long(options, "max-pending")) >= 0 )
+			max_pending = value;
+		if ( (value = librdf_hash_get_as_long(options, "max-delay")) >= 0 )
+			max_delay = value;
+		sync_on_flush = librdf_hash_get_as_boolean( options, "sync-on-flush" ) > 0;
+		librdf_free_hash( options );
+	}
+
+	rval = rleaf_overlay_init( storage, name, NULL );
+	overlay = librdf_storage_get_instance( storage );
+
+	overlay->write_behind  = 1;
+	overlay->max_pending   = max_pending;
+	overlay->max_delay     = max_delay;
+	overlay->sync_on_flush = sync_on_flush;
+
+	return rval;
+}
+
+
+/*
+ * Storage clone method.
+ */
+static int
+rleaf_writebehind_clone( librdf_storage *new_storage, librdf_storage *old_storage ) {
+	rleaf_OVERLAY *old = librdf_storage_get_instance( old_storage ), *overlay;
+	int rval = rleaf_overlay_clone( new_storage, old_storage );
+
+	overlay = librdf_storage_get_instance( new_storage );
+	overlay->write_behind  = 1;
+	overlay->max_pending   = old->max_pending;
+	overlay->max_delay     = old->max_delay;
+	overlay->sync_on_flush = old->sync_on_flush;
+	overlay->pending_since = old->pending_since;
+
+	return rval;
+}
+
+
+/*
+ * Storage terminate method. This is called when the store is garbage-collected, so it
+ * can't call back into Ruby to log, and it doesn't flush: writing to the base then would
+ * leave the base store's cached size and fingerprint stale with no safe way to reset them.
+ * Any changes that haven't been flushed are discarded with a warning on stderr instead.
+ */
+static void
+rleaf_writebehind_terminate( librdf_storage *storage ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+	long pending;
+
+	if ( overlay && (pending = rleaf_overlay_pending(overlay)) > 0 )
+		fprintf( stderr, "redleaf: discarding %ld write-behind changes that were never "
+			"flushed\n", pending );
+
+	rleaf_overlay_terminate( storage );
+}
+
+
+/*
+ * Storage add_statement method.
+ */
+static int
+rleaf_writebehind_add_statement( librdf_storage *storage, librdf_statement *statement ) {
+	return rleaf_writebehind_written( storage, rleaf_overlay_add_statement(storage, statement) );
+}
+
+
+/*
+ * Storage add_statements method.
+ */
+static int
+rleaf_writebehind_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	librdf_statement *statement;
+	int rval = 0;
+
+	while ( !rval && ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+		rval = rleaf_writebehind_add_statement( storage, statement );
+		librdf_stream_next( stream );
+	}
+
+	return rval;
+}
+
+
+/*
+ * Storage remove_statement method.
+ */
+static int
+rleaf_writebehind_remove_statement( librdf_storage *storage, librdf_statement *statement ) {
+	return rleaf_writebehind_written( storage,
+		rleaf_overlay_remove_statement(storage, statement) );
+}
+
+
+/*
+ * Storage sync method. Flushes the buffered changes and syncs the base.
+ */
+static int
+rleaf_writebehind_sync( librdf_storage *storage ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( storage );
+	long count = rleaf_overlay_flush( storage );
+
+	rleaf_overlay_report( overlay );
+	if ( count < 0 ) return 1;
+	if ( overlay->flush_deferred ) return 1;
+
+	return overlay->base ? librdf_storage_sync( overlay->base ) : 0;
+}
+
+
+/*
+ * Storage factory registration function.
+ */
+static void
+rleaf_writebehind_register_factory( librdf_storage_factory *factory ) {
+	rleaf_overlay_register_factory( factory );
+
+	factory->init               = rleaf_writebehind_init;
+	factory->clone              = rleaf_writebehind_clone;
+	factory->terminate          = rleaf_writebehind_terminate;
+	factory->add_statement      = rleaf_writebehind_add_statement;
+	factory->add_statements     = rleaf_writebehind_add_statements;
+	factory->remove_statement   = rleaf_writebehind_remove_statement;
+	factory->sync               = rleaf_writebehind_sync;
+}
+
+
+/*
+ * Register the 'overlay' storage module with the Redland world.
+ */
+void
+rleaf_register_overlay_storage_module( void ) {
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_OVERLAY_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_OVERLAY_NAME,
+		RLEAF_OVERLAY_LABEL, rleaf_overlay_register_factory );
+}
+
+
+/*
+ * Register the 'writebehind' storage module with the Redland world.
+ */
+void
+rleaf_register_writebehind_storage_module( void ) {
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_WRITEBEHIND_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_WRITEBEHIND_NAME,
+		RLEAF_WRITEBEHIND_LABEL, rleaf_writebehind_register_factory );
+}
+
+
+/*
+ * Create a new Redleaf::OverlayStore over the given +base+ store. If +changes_from+ is
+ * another OverlayStore over the same base, its changes are copied into the new one.
+ */
+VALUE
+rleaf_new_overlay_store( VALUE base, VALUE changes_from ) {
+	VALUE store = rb_class_new_instance( 1, &base, rleaf_cRedleafOverlayStore );
+	rleaf_OVERLAY *overlay, *other;
+
+	if ( rb_obj_is_kind_of(changes_from, rleaf_cRedleafOverlayStore) ) {
+		overlay = librdf_storage_get_instance( rleaf_get_store(store)->storage );
+		other = librdf_storage_get_instance( rleaf_get_store(changes_from)->storage );
+
+		if ( rleaf_overlay_copy_delta(overlay->added, other->added) != 0 ||
+		     rleaf_overlay_copy_delta(overlay->removed, other->removed) != 0 )
+			rb_raise( rleaf_eRedleafError, "couldn't copy the changes of %s",
+				RSTRING_PTR(rb_inspect(changes_from)) );
+	}
+
+	return store;
+}
+
+
+/*
+ * Apply the changes recorded in the given +overlay_store+ to +model+ (usually one over the
+ * overlay's base): the removed statements are removed from it, then the added ones are
+ * added in a single pass. Returns non-zero if they couldn't all be applied.
+ */
+int
+rleaf_overlay_store_apply_changes( VALUE overlay_store, librdf_model *model ) {
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( rleaf_get_store(overlay_store)->storage );
+	librdf_stream *stream;
+	librdf_statement *statement;
+	int rval = 0;
+
+	if ( !(stream = librdf_storage_serialise(overlay->removed)) ) return 1;
+	while ( rval == 0 && ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+		rval = librdf_model_remove_statement( model, statement );
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+	if ( rval != 0 ) return rval;
+
+	if ( !(stream = librdf_storage_serialise(overlay->added)) ) return 1;
+	rval = librdf_model_add_statements( model, stream );
+	librdf_free_stream( stream );
+
+	return rval;
+}
+
+
+/* --------------------------------------------------------------
+ * Memory-management functions
+ * -------------------------------------------------------------- */
+
+/*
+ * GC Free function. The overlay's storage can outlive the store object (in a stream that's
+ * still open, for instance), but its base store and owner might not, so the overlay stops
+ * forgetting the base store's caches and reporting to the owner when it's flushed.
+ */
+static void
+rleaf_overlaystore_gc_free( rleaf_STORE *ptr ) {
+	rleaf_OVERLAY *overlay;
+
+	if ( ptr && ptr->storage && (overlay = librdf_storage_get_instance(ptr->storage)) ) {
+		overlay->base_store = NULL;
+		overlay->owner = 0;
+	}
+
+	rleaf_store_gc_free( ptr );
+}
+
+
+/*
+ * Set up the given +copy+ of the overlay store +orig+, made around a clone of its storage:
+ * the clone shares +orig+'s base, and a write-behind copy reports its flushes to itself.
+ */
+void
+rleaf_overlay_store_init_copy( VALUE copy, VALUE orig ) {
+	rleaf_OVERLAY *old = librdf_storage_get_instance( rleaf_get_store(orig)->storage );
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( rleaf_get_store(copy)->storage );
+
+	overlay->base_store = old->base_store;
+	if ( overlay->write_behind ) overlay->owner = copy;
+}
+
+
+/* --------------------------------------------------------------
+ * Class methods
+ * -------------------------------------------------------------- */
+
+/*
+ *  call-seq:
+ *     Redleaf::OverlayStore.allocate   -> store
+ *
+ *  Allocate a new Redleaf::OverlayStore object.
+ *
+ */
+static VALUE
+rleaf_redleaf_overlaystore_s_allocate( VALUE klass ) {
+	return Data_Wrap_Struct( klass, rleaf_store_gc_mark, rleaf_overlaystore_gc_free, 0 );
+}
+
+
+/* --------------------------------------------------------------
+ * Instance methods
+ * -------------------------------------------------------------- */
+
+/*
+ *  call-seq:
+ *     Redleaf::OverlayStore.new( base, name=nil, config={} )   -> store
+ *
+ *  Create a new store that presents the statements of +base+ (a Redleaf::Store, or a
+ *  Redleaf::Graph whose store to use), and records statements added to or removed from it
+ *  without changing +base+. Creating one takes the same time no matter how big +base+ is.
+ *
+ */
+static VALUE
+rleaf_redleaf_overlaystore_initialize( int argc, VALUE *argv, VALUE self ) {
+	VALUE base = Qnil, name = Qnil, opthash = Qnil;
+	rleaf_STORE *base_store;
+	rleaf_OVERLAY *overlay;
+
+	rb_scan_args( argc, argv, "12", &base, &name, &opthash );
+
+	if ( IsGraph(base) ) base = rleaf_get_graph( base )->store;
+	if ( !IsStore(base) )
+		rb_raise( rb_eTypeError, "wrong argument type %s (expected a Redleaf::Store)",
+			rb_obj_classname(base) );
+	base_store = rleaf_get_store( base );
+
+	rb_call_super( argc - 1, argv + 1 );
+
+	rleaf_log_with_context( self, "debug", "overlaying %s", rb_obj_classname(base) );
+	rleaf_overlay_set_base( rleaf_get_store(self)->storage, base_store->storage );
+	overlay = librdf_storage_get_instance( rleaf_get_store(self)->storage );
+	overlay->base_store = base_store;
+	if ( overlay->write_behind ) overlay->owner = self;
+	rb_iv_set( self, "@base", base );
+
+	return self;
+}
+
+
+/*
+ *  call-seq:
+ *     store.changes   -> [ added_statements, removed_statements ]
+ *
+ *  Return the statements that have been added to the store and removed from it, compared
+ *  to its base, as two Arrays of Redleaf::Statements.
+ *
+ */
+static VALUE
+rleaf_redleaf_overlaystore_changes( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self );
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( store->storage );
+	librdf_storage *deltas[ 2 ];
+	librdf_stream *stream;
+	librdf_statement *statement;
+	VALUE rval = rb_ary_new2( 2 ), statements;
+	int i;
+
+	deltas[0] = overlay->added;
+	deltas[1] = overlay->removed;
+
+	for ( i = 0; i < 2; i++ ) {
+		statements = rb_ary_new();
+
+		if ( !(stream = librdf_storage_serialise(deltas[i])) )
+			rb_raise( rleaf_eRedleafError, "could not create a stream over the overlay's changes" );
+
+		while ( ! librdf_stream_end(stream) ) {
+			if ( !(statement = librdf_stream_get_object(stream)) ) break;
+			rb_ary_push( statements, rleaf_librdf_statement_to_value(statement) );
+			librdf_stream_next( stream );
+		}
+		librdf_free_stream( stream );
+
+		rb_ary_push( rval, statements );
+	}
+
+	return rval;
+}
+
+
+/*
+ *  call-seq:
+ *     store.flush_pending   -> integer
+ *
+ *  Write the changes buffered in the store to its base, call the #after_flush callbacks,
+ *  and return how many changes were written. If a search over the store is still being
+ *  read, the changes are written once it's done instead, and 0 is returned.
+ *
+ */
+static VALUE
+rleaf_redleaf_writebehindstore_flush_pending( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self );
+	long count = rleaf_overlay_flush( store->storage );
+
+	rleaf_overlay_report( librdf_storage_get_instance(store->storage) );
+
+	if ( count < 0 )
+		rb_raise( rleaf_eRedleafError, "couldn't write the buffered changes to %s",
+			RSTRING_PTR(rb_inspect(rb_iv_get(self, "@base"))) );
+
+	rleaf_log_with_context( self, "debug", "flushed %ld changes", count );
+	return LONG2NUM( count );
+}
+
+
+/*
+ *  call-seq:
+ *     store.pending_count   -> integer
+ *
+ *  Return the number of changes buffered in the store that haven't been written to its
+ *  base yet.
+ *
+ */
+static VALUE
+rleaf_redleaf_writebehindstore_pending_count( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self );
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( store->storage );
+
+	return LONG2NUM( rleaf_overlay_pending(overlay) );
+}
+
+
+/*
+ *  call-seq:
+ *     store.flush_failed?   -> true or false
+ *
+ *  Returns +true+ if the last flush the store made by itself (because enough changes were
+ *  buffered, or they'd been waiting too long) couldn't write them to its base. The changes
+ *  are still buffered; the next successful flush writes them and clears this.
+ *
+ */
+static VALUE
+rleaf_redleaf_writebehindstore_flush_failed_p( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self );
+	rleaf_OVERLAY *overlay = librdf_storage_get_instance( store->storage );
+
+	return overlay->flush_failed ? Qtrue : Qfalse;
+}
+
+
+/*
+ * Redleaf::OverlayStore and Redleaf::WriteBehindStore classes
+ */
+void
+rleaf_init_redleaf_overlay_store( void ) {
+	rleaf_log( "debug", "Initializing Redleaf::OverlayStore" );
+
+#ifdef FOR_RDOC
+	rleaf_mRedleaf = rb_define_module( "Redleaf" );
+	rleaf_cRedleafStore = rb_define_class_under( rleaf_mRedleaf, "Store", rb_cObject );
+#endif
+
+	rb_require( "redleaf/store/overlay" );
+	rleaf_cRedleafOverlayStore =
+		rb_define_class_under( rleaf_mRedleaf, "OverlayStore", rleaf_cRedleafStore );
+
+	rb_define_alloc_func( rleaf_cRedleafOverlayStore, rleaf_redleaf_overlaystore_s_allocate );
+
+	rb_define_method( rleaf_cRedleafOverlayStore, "initialize",
+		rleaf_redleaf_overlaystore_initialize, -1 );
+	rb_define_method( rleaf_cRedleafOverlayStore, "changes",
+		rleaf_redleaf_overlaystore_changes, 0 );
+
+	rb_require( "redleaf/store/writebehind" );
+	rleaf_cRedleafWriteBehindStore =
+		rb_define_class_under( rleaf_mRedleaf, "WriteBehindStore", rleaf_cRedleafOverlayStore );
+
+	rb_define_method( rleaf_cRedleafWriteBehindStore, "flush_pending",
+		rleaf_redleaf_writebehindstore_flush_pending, 0 );
+	rb_define_method( rleaf_cRedleafWriteBehindStore, "pending_count",
+		rleaf_redleaf_writebehindstore_pending_count, 0 );
+	rb_define_method( rleaf_cRedleafWriteBehindStore, "flush_failed?",
+		rleaf_redleaf_writebehindstore_flush_failed_p, 0 );
+}
+
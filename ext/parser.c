@@ -43,6 +43,8 @@
 
 VALUE rleaf_cRedleafParser;
 
+static VALUE rleaf_parser_features = Qnil;
+
 
 /* --------------------------------------------------
  *	Memory-management functions
@@ -132,7 +134,9 @@ rleaf_redleaf_parser_s_allocate( VALUE klass ) {
  *  call-seq:
  *     Redleaf::Parser.features   -> hash
  *
- *  Return a Hash of supported features from the underlying Redland library.
+ *  Return a Hash of supported features from the underlying Redland library. The Hash is
+ *  built once when the extension is loaded and is frozen; call
+ *  Redleaf.refresh_capabilities to rebuild it.
  *
  *     Redleaf::Parser.features
  *     # => {"raptor"       => "",
@@ -147,16 +151,24 @@ rleaf_redleaf_parser_s_allocate( VALUE klass ) {
  */
 static VALUE
 rleaf_redleaf_parser_s_features( VALUE klass ) {
+	_UNUSED( klass );
+	return rleaf_parser_features;
+}
+
+
+/*
+ * (Re)build the frozen registry of parsers that is returned from
+ * Redleaf::Parser.features.
+ */
+void
+rleaf_refresh_parser_features( void ) {
 	const raptor_syntax_description *syntax;
 	unsigned int counter = 0, name = 0;
 	VALUE features = rb_hash_new();
 
-	_UNUSED( klass );
-
 	rleaf_log( "debug", "Enumerating parsers." );
 	while( (syntax = librdf_parser_get_description(rleaf_rdf_world, counter)) ) {
 		for ( name = 0; name < syntax->names_count; name++ ) {
-			// rleaf_log( "debug", "  serializer [%d]: name = '%s', desc = '%s'", counter, name, desc );
 			rb_hash_aset( features, rb_str_new2(syntax->names[name]), rb_str_new2(syntax->label) );
 		}
 
@@ -164,7 +176,7 @@ rleaf_redleaf_parser_s_features( VALUE klass ) {
 	}
 	rleaf_log( "debug", "  got %d parsers.", counter );
 
-	return features;
+	rleaf_parser_features = rleaf_deep_freeze( features );
 }
 
 
@@ -306,6 +318,7 @@ rleaf_redleaf_parser_parse( int argc, VALUE *argv, VALUE self ) {
 		RSTRING_LEN(content), RSTRING_PTR(rb_obj_as_string(parser_type)) );
 	if ( (librdf_parser_parse_string_into_model(parser, string, baseuri, graph->model)) != 0 )
 		rb_raise( rleaf_eRedleafParseError, "failed to parse" );
+	rleaf_graph_invalidate_fingerprint( graphobj );
 
 	/* FIXME: I feel like there has to be a better way to do this, but I can't see what it
 	is currently. Need to ask dajobe for advice. */
@@ -342,6 +355,10 @@ void rleaf_init_redleaf_parser( void ) {
 
 	rleaf_cRedleafParser = rb_define_class_under( rleaf_mRedleaf, "Parser", rb_cObject );
 
+	/* Build the parser registry */
+	rb_gc_register_address( &rleaf_parser_features );
+	rleaf_refresh_parser_features();
+
 
 	/* Class methods */
 	rb_define_alloc_func( rleaf_cRedleafParser, rleaf_redleaf_parser_s_allocate );
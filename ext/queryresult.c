@@ -51,6 +51,8 @@ VALUE rleaf_cRedleafBooleanQueryResult;
 VALUE rleaf_cRedleafGraphQueryResult;
 VALUE rleaf_cRedleafSyntaxQueryResult;
 
+static VALUE rleaf_queryresult_formatters = Qnil;
+
 
 /*
  * GC Mark function
@@ -165,7 +167,8 @@ rleaf_redleaf_queryresult_s_allocate( VALUE klass ) {
  *     Redleaf::QueryResult.formatters   -> hash
  *
  *  Return a Hash of supported QueryResult formatters (the keys of which are valid)
- *  arguments to #format.
+ *  arguments to #format. The Hash is built once when the extension is loaded and is
+ *  frozen; call Redleaf.refresh_capabilities to rebuild it.
  *
  *     Redleaf::QueryResult.formatters
  *     # => {
@@ -183,6 +186,17 @@ rleaf_redleaf_queryresult_s_allocate( VALUE klass ) {
  */
 static VALUE
 rleaf_redleaf_queryresult_s_formatters( VALUE klass ) {
+	_UNUSED( klass );
+	return rleaf_queryresult_formatters;
+}
+
+
+/*
+ * (Re)build the frozen registry of result formatters that is returned from
+ * Redleaf::QueryResult.formatters.
+ */
+void
+rleaf_refresh_queryresult_formatters( void ) {
 	VALUE formatters = rb_hash_new();
 	int i = 0;
 	const char *name, *label, *mime_string;
@@ -217,7 +231,7 @@ rleaf_redleaf_queryresult_s_formatters( VALUE klass ) {
 	}
 	rleaf_log( "debug", "Done. Found %d result formatters.", i );
 
-	return formatters;
+	rleaf_queryresult_formatters = rleaf_deep_freeze( formatters );
 }
 
 
@@ -246,6 +260,69 @@ rleaf_redleaf_queryresult_each( VALUE self ) {
 }
 
 
+/*
+ *  call-seq:
+ *     queryresult.formatted_as_io( format, io )   -> io
+ *
+ *  Write the query results to the specified +io+ (or any other object that responds to
+ *  #write) in the specified +format+, which can be either a format URI or the name of a
+ *  formatter from the Redleaf::QueryResult.formatters hash. Results are written as they are
+ *  produced by the formatter rather than being accumulated into a String first.
+ *
+ *  Writing the results with a Redland formatter consumes them, so this can only be called
+ *  once, and only if the rows of a bindings result haven't been fetched already; after it's
+ *  been called, #rows (and the methods that use it) raise a Redleaf::Error.
+ *
+ *     File.open( "results.srx", "w" ) do |io|
+ *         result.formatted_as_io( 'xml', io )
+ *     end
+ */
+static VALUE
+rleaf_redleaf_queryresult_formatted_as_io( VALUE self, VALUE format, VALUE io ) {
+	librdf_query_results *res = rleaf_get_queryresult( self );
+	librdf_query_results_formatter *formatter;
+	librdf_uri *formaturi = NULL;
+	const char *formatname = NULL;
+	raptor_iostream *iostream;
+	rleaf_RUBYIO rubyio;
+	VALUE formatstr = rb_obj_as_string( format );
+	int result;
+
+	rleaf_log_with_context( self, "debug", "Serializing a %s as %s",
+		rb_obj_classname( self ), RSTRING_PTR(formatstr) );
+
+	if ( RTEST(rb_ivar_get( self, rb_intern("@consumed") )) )
+		rb_raise( rleaf_eRedleafError, "can't format %s: its results have already been read",
+			rb_obj_classname(self) );
+
+	iostream = rleaf_new_ruby_iostream( &rubyio, io );
+
+	if ( IsURI(format) ) {
+		formaturi = rleaf_object_to_librdf_uri( format );
+		formatter = librdf_new_query_results_formatter2( res, NULL, NULL, formaturi );
+		librdf_free_uri( formaturi );
+	} else {
+		formatname = RSTRING_PTR( formatstr );
+		formatter = librdf_new_query_results_formatter2( res, formatname, NULL, NULL );
+	}
+
+	if ( !formatter ) {
+		rleaf_finish_ruby_iostream( iostream, &rubyio );
+		rb_raise( rleaf_eRedleafFeatureError, "no result formatter for %s", RSTRING_PTR(formatstr) );
+	}
+
+	result = librdf_query_results_formatter_write( iostream, formatter, res, NULL );
+	librdf_free_query_results_formatter( formatter );
+	rb_ivar_set( self, rb_intern("@consumed"), Qtrue );
+	rleaf_finish_ruby_iostream( iostream, &rubyio );
+
+	if ( result != 0 )
+		rb_raise( rleaf_eRedleafError, "Could not fetch results as %s", RSTRING_PTR(formatstr) );
+
+	return io;
+}
+
+
 /*
  *  call-seq:
  *     queryresult.formatted_as( formaturi )   -> string
@@ -259,35 +336,463 @@ rleaf_redleaf_queryresult_each( VALUE self ) {
  */
 static VALUE
 rleaf_redleaf_queryresult_formatted_as( VALUE self, VALUE format ) {
-	librdf_query_results *res = rleaf_get_queryresult( self );
-	librdf_uri *formaturi = NULL;
-	unsigned char *result = NULL;
-	size_t length = 0;
-	VALUE rval;
-
 	if ( !IsURI(format) )
 		rb_raise( rb_eArgError, "cannot convert %s to a URI", rb_obj_classname( format ) );
 
-	rleaf_log_with_context( self, "debug", "Serializing a %s as %s",
-		rb_obj_classname( self ), RSTRING_PTR(rb_obj_as_string(format)) );
-	formaturi = rleaf_object_to_librdf_uri( format );
+	return rleaf_redleaf_queryresult_formatted_as_io( self, format, rb_str_new(0, 0) );
+}
 
-	rleaf_log_with_context( self, "debug", "Format URI is: %p (%s)",
-		formaturi, librdf_uri_as_string(formaturi) );
 
-	result = librdf_query_results_to_counted_string( res, formaturi, NULL, &length );
+/*
+ * Native SPARQL result writers
+ */
 
-	if ( !result ) {
-		unsigned char *msg = librdf_uri_as_string( formaturi );
-		librdf_free_uri( formaturi );
-		rb_raise( rleaf_eRedleafError, "Could not fetch results as %s", msg );
+typedef enum {
+	RLEAF_SPARQL_JSON,
+	RLEAF_SPARQL_CSV,
+	RLEAF_SPARQL_TSV
+} rleaf_sparql_format;
+
+/* The state of a native writer, shared between its body and its ensure function */
+typedef struct rleaf_sparql_writer {
+	VALUE					self, rows;
+	librdf_query_results	*res;
+	rleaf_sparql_format		format;
+	const char				**names;
+	librdf_node				**nodes;
+	VALUE					*keys;
+	int						bindcount;
+	raptor_iostream			*iostream;
+	rleaf_RUBYIO			rubyio;
+	long					rownum;
+} rleaf_SPARQLWRITER;
+
+
+/*
+ * Fetch the lexical form of the given +node+: the URI of a resource, the value of a literal,
+ * or the identifier of a blank node.
+ */
+static const unsigned char *
+rleaf_node_lexical_form( librdf_node *node, size_t *len ) {
+	if ( librdf_node_is_resource(node) )
+		return librdf_uri_as_counted_string( librdf_node_get_uri(node), len );
+	else if ( librdf_node_is_literal(node) )
+		return librdf_node_get_literal_value_as_counted_string( node, len );
+	else
+		return librdf_node_get_counted_blank_identifier( node, len );
+}
+
+
+/*
+ * Write the specified +str+ to +iostr+ as the body of a string, escaping characters
+ * according to the given +format+: JSON escapes for JSON, doubled quotes for CSV, and
+ * Turtle string escapes for TSV.
+ */
+static void
+rleaf_write_escaped( raptor_iostream *iostr, const unsigned char *str, size_t len,
+	rleaf_sparql_format format )
+{
+	size_t i, start = 0;
+	char escape[7];
+	const char *replacement;
+
+	for ( i = 0; i < len; i++ ) {
+		const unsigned char c = str[i];
+		replacement = NULL;
+
+		switch ( c ) {
+			case '"':  replacement = (format == RLEAF_SPARQL_CSV) ? "\"\"" : "\\\""; break;
+			case '\\': if ( format != RLEAF_SPARQL_CSV ) replacement = "\\\\"; break;
+			case '\n': if ( format != RLEAF_SPARQL_CSV ) replacement = "\\n"; break;
+			case '\r': if ( format != RLEAF_SPARQL_CSV ) replacement = "\\r"; break;
+			case '\t': if ( format != RLEAF_SPARQL_CSV ) replacement = "\\t"; break;
+			default:
+				if ( c < 0x20 && format == RLEAF_SPARQL_JSON ) {
+					snprintf( escape, sizeof(escape), "\\u%04x", c );
+					replacement = escape;
+				}
+		}
+
+		if ( replacement ) {
+			if ( i > start ) raptor_iostream_write_bytes( str + start, 1, i - start, iostr );
+			raptor_iostream_string_write( replacement, iostr );
+			start = i + 1;
+		}
 	}
 
-	librdf_free_uri( formaturi );
-	rval = rb_str_new( (char *)result, length );
-	xfree( result );
+	if ( len > start ) raptor_iostream_write_bytes( str + start, 1, len - start, iostr );
+}
+
 
-	return rval;
+/*
+ * Write a JSON string.
+ */
+static void
+rleaf_write_json_string( raptor_iostream *iostr, const unsigned char *str, size_t len ) {
+	raptor_iostream_write_byte( '"', iostr );
+	rleaf_write_escaped( iostr, str, len, RLEAF_SPARQL_JSON );
+	raptor_iostream_write_byte( '"', iostr );
+}
+
+
+/*
+ * Write a single RDF term as a SPARQL JSON results binding object.
+ */
+static void
+rleaf_write_json_node( raptor_iostream *iostr, librdf_node *node ) {
+	const unsigned char *value;
+	const char *lang;
+	librdf_uri *datatype;
+	size_t len = 0;
+
+	value = rleaf_node_lexical_form( node, &len );
+
+	if ( librdf_node_is_resource(node) )
+		raptor_iostream_string_write( "{\"type\":\"uri\",\"value\":", iostr );
+	else if ( librdf_node_is_literal(node) )
+		raptor_iostream_string_write( "{\"type\":\"literal\",\"value\":", iostr );
+	else
+		raptor_iostream_string_write( "{\"type\":\"bnode\",\"value\":", iostr );
+	rleaf_write_json_string( iostr, value, len );
+
+	if ( librdf_node_is_literal(node) ) {
+		if ( (lang = librdf_node_get_literal_value_language(node)) ) {
+			raptor_iostream_string_write( ",\"xml:lang\":", iostr );
+			rleaf_write_json_string( iostr, (const unsigned char *)lang, strlen(lang) );
+		}
+		else if ( (datatype = librdf_node_get_literal_value_datatype_uri(node)) ) {
+			value = librdf_uri_as_counted_string( datatype, &len );
+			raptor_iostream_string_write( ",\"datatype\":", iostr );
+			rleaf_write_json_string( iostr, value, len );
+		}
+	}
+
+	raptor_iostream_write_byte( '}', iostr );
+}
+
+
+/*
+ * Write a single RDF term as a SPARQL CSV field: the lexical form of URIs and literals, and
+ * '_:' plus the identifier for blank nodes, quoted only if necessary.
+ */
+static void
+rleaf_write_csv_node( raptor_iostream *iostr, librdf_node *node ) {
+	const unsigned char *value;
+	size_t len = 0;
+
+	value = rleaf_node_lexical_form( node, &len );
+
+	if ( librdf_node_is_blank(node) ) {
+		raptor_iostream_counted_string_write( "_:", 2, iostr );
+		raptor_iostream_write_bytes( value, 1, len, iostr );
+	}
+	else if ( memchr(value, '"', len) || memchr(value, ',', len) ||
+	          memchr(value, '\n', len) || memchr(value, '\r', len) )
+	{
+		raptor_iostream_write_byte( '"', iostr );
+		rleaf_write_escaped( iostr, value, len, RLEAF_SPARQL_CSV );
+		raptor_iostream_write_byte( '"', iostr );
+	}
+	else {
+		raptor_iostream_write_bytes( value, 1, len, iostr );
+	}
+}
+
+
+/*
+ * Write a single RDF term as a SPARQL TSV field, which uses Turtle syntax.
+ */
+static void
+rleaf_write_tsv_node( raptor_iostream *iostr, librdf_node *node ) {
+	const unsigned char *value;
+	const char *lang;
+	librdf_uri *datatype;
+	size_t len = 0;
+
+	value = rleaf_node_lexical_form( node, &len );
+
+	if ( librdf_node_is_resource(node) ) {
+		raptor_iostream_write_byte( '<', iostr );
+		raptor_iostream_write_bytes( value, 1, len, iostr );
+		raptor_iostream_write_byte( '>', iostr );
+	}
+	else if ( librdf_node_is_literal(node) ) {
+		raptor_iostream_write_byte( '"', iostr );
+		rleaf_write_escaped( iostr, value, len, RLEAF_SPARQL_TSV );
+		raptor_iostream_write_byte( '"', iostr );
+
+		if ( (lang = librdf_node_get_literal_value_language(node)) ) {
+			raptor_iostream_write_byte( '@', iostr );
+			raptor_iostream_string_write( lang, iostr );
+		}
+		else if ( (datatype = librdf_node_get_literal_value_datatype_uri(node)) ) {
+			raptor_iostream_counted_string_write( "^^<", 3, iostr );
+			raptor_iostream_string_write( librdf_uri_as_string(datatype), iostr );
+			raptor_iostream_write_byte( '>', iostr );
+		}
+	}
+	else {
+		raptor_iostream_counted_string_write( "_:", 2, iostr );
+		raptor_iostream_write_bytes( value, 1, len, iostr );
+	}
+}
+
+
+/*
+ * Write the header for a bindings result with the given binding +names+.
+ */
+static void
+rleaf_write_sparql_header( raptor_iostream *iostr, rleaf_sparql_format format,
+	const char **names, int bindcount )
+{
+	int i;
+
+	if ( format == RLEAF_SPARQL_JSON )
+		raptor_iostream_string_write( "{\"head\":{\"vars\":[", iostr );
+
+	for ( i = 0; i < bindcount; i++ ) {
+		switch ( format ) {
+			case RLEAF_SPARQL_JSON:
+			if ( i ) raptor_iostream_write_byte( ',', iostr );
+			rleaf_write_json_string( iostr, (const unsigned char *)names[i], strlen(names[i]) );
+			break;
+
+			case RLEAF_SPARQL_CSV:
+			if ( i ) raptor_iostream_write_byte( ',', iostr );
+			raptor_iostream_string_write( names[i], iostr );
+			break;
+
+			case RLEAF_SPARQL_TSV:
+			if ( i ) raptor_iostream_write_byte( '\t', iostr );
+			raptor_iostream_write_byte( '?', iostr );
+			raptor_iostream_string_write( names[i], iostr );
+			break;
+		}
+	}
+
+	switch ( format ) {
+		case RLEAF_SPARQL_JSON:
+		raptor_iostream_string_write( "]},\"results\":{\"bindings\":[", iostr );
+		break;
+
+		case RLEAF_SPARQL_CSV:
+		raptor_iostream_counted_string_write( "\r\n", 2, iostr );
+		break;
+
+		case RLEAF_SPARQL_TSV:
+		raptor_iostream_write_byte( '\n', iostr );
+		break;
+	}
+}
+
+
+/*
+ * Write one row of a bindings result. Unbound values are NULL in +nodes+.
+ */
+static void
+rleaf_write_sparql_row( raptor_iostream *iostr, rleaf_sparql_format format,
+	const char **names, librdf_node **nodes, int bindcount, long rownum )
+{
+	int i, written = 0;
+
+	if ( format == RLEAF_SPARQL_JSON )
+		raptor_iostream_string_write( rownum ? ",\n{" : "\n{", iostr );
+
+	for ( i = 0; i < bindcount; i++ ) {
+		switch ( format ) {
+			case RLEAF_SPARQL_JSON:
+			if ( !nodes[i] ) break;
+			if ( written++ ) raptor_iostream_write_byte( ',', iostr );
+			rleaf_write_json_string( iostr, (const unsigned char *)names[i], strlen(names[i]) );
+			raptor_iostream_write_byte( ':', iostr );
+			rleaf_write_json_node( iostr, nodes[i] );
+			break;
+
+			case RLEAF_SPARQL_CSV:
+			if ( i ) raptor_iostream_write_byte( ',', iostr );
+			if ( nodes[i] ) rleaf_write_csv_node( iostr, nodes[i] );
+			break;
+
+			case RLEAF_SPARQL_TSV:
+			if ( i ) raptor_iostream_write_byte( '\t', iostr );
+			if ( nodes[i] ) rleaf_write_tsv_node( iostr, nodes[i] );
+			break;
+		}
+	}
+
+	switch ( format ) {
+		case RLEAF_SPARQL_JSON:
+		raptor_iostream_write_byte( '}', iostr );
+		break;
+
+		case RLEAF_SPARQL_CSV:
+		raptor_iostream_counted_string_write( "\r\n", 2, iostr );
+		break;
+
+		case RLEAF_SPARQL_TSV:
+		raptor_iostream_write_byte( '\n', iostr );
+		break;
+	}
+}
+
+
+/*
+ * Make a row Hash for #rows out of the given binding +nodes+, keyed by +keys+.
+ */
+static VALUE
+rleaf_new_result_row( VALUE *keys, librdf_node **nodes, int bindcount ) {
+	VALUE row = rb_hash_new();
+	int i;
+
+	for ( i = 0; i < bindcount; i++ )
+		rb_hash_aset( row, keys[i], nodes[i] ? rleaf_librdf_node_to_value(nodes[i]) : Qnil );
+
+	return row;
+}
+
+
+/*
+ * Raise a Redleaf::Error if the rows of the result +self+ have been consumed without being
+ * cached (by #formatted_as_io, or by a writer that was interrupted).
+ */
+static void
+rleaf_check_result_rows( VALUE self ) {
+	if ( NIL_P(rb_ivar_get( self, rb_intern("@rows") )) &&
+	     RTEST(rb_ivar_get( self, rb_intern("@consumed") )) )
+		rb_raise( rleaf_eRedleafError, "the rows of this %s have already been read",
+			rb_obj_classname(self) );
+}
+
+
+/*
+ * Free the binding nodes of the current row that the +writer+ is holding.
+ */
+static void
+rleaf_sparql_writer_free_nodes( rleaf_SPARQLWRITER *writer ) {
+	int i;
+
+	for ( i = 0; i < writer->bindcount; i++ ) {
+		if ( writer->nodes[i] ) librdf_free_node( writer->nodes[i] );
+		writer->nodes[i] = NULL;
+	}
+}
+
+
+/*
+ * Write the rows of a bindings result with the given +writer+ (a rleaf_SPARQLWRITER cast to
+ * a VALUE). Called through rb_ensure() by rleaf_write_sparql_bindings(), since converting
+ * nodes to Ruby objects and writing to a Ruby IO can both raise.
+ */
+static VALUE
+rleaf_write_sparql_bindings_body( VALUE writerptr ) {
+	rleaf_SPARQLWRITER *writer = (rleaf_SPARQLWRITER *)writerptr;
+	int i;
+
+	rleaf_write_sparql_header( writer->iostream, writer->format, writer->names,
+		writer->bindcount );
+
+	/* Stream rows directly from the results if they haven't been fetched yet */
+	if ( NIL_P(writer->rows) ) {
+		VALUE rows = rb_ary_new();
+
+		rleaf_log_with_context( writer->self, "debug", "Streaming result rows." );
+		rb_ivar_set( writer->self, rb_intern("@consumed"), Qtrue );
+
+		while ( !librdf_query_results_finished(writer->res) && !writer->rubyio.state ) {
+			for ( i = 0; i < writer->bindcount; i++ )
+				writer->nodes[i] = librdf_query_results_get_binding_value( writer->res, i );
+
+			rleaf_write_sparql_row( writer->iostream, writer->format, writer->names,
+				writer->nodes, writer->bindcount, writer->rownum++ );
+			rb_ary_push( rows, rleaf_new_result_row(writer->keys, writer->nodes,
+				writer->bindcount) );
+
+			rleaf_sparql_writer_free_nodes( writer );
+			librdf_query_results_next( writer->res );
+		}
+
+		/* Only cache the rows if they were all read */
+		if ( librdf_query_results_finished(writer->res) )
+			rb_ivar_set( writer->self, rb_intern("@rows"), rows );
+	}
+
+	/* Otherwise write the cached rows */
+	else {
+		rleaf_log_with_context( writer->self, "debug", "Writing previously-fetched rows." );
+		for ( ; writer->rownum < RARRAY_LEN(writer->rows) && !writer->rubyio.state;
+		      writer->rownum++ )
+		{
+			VALUE row = rb_ary_entry( writer->rows, writer->rownum );
+
+			for ( i = 0; i < writer->bindcount; i++ ) {
+				VALUE value = rb_hash_lookup( row, writer->keys[i] );
+				writer->nodes[i] = NIL_P(value) ? NULL : rleaf_value_to_librdf_node( value );
+			}
+
+			rleaf_write_sparql_row( writer->iostream, writer->format, writer->names,
+				writer->nodes, writer->bindcount, writer->rownum );
+			rleaf_sparql_writer_free_nodes( writer );
+		}
+	}
+
+	if ( writer->format == RLEAF_SPARQL_JSON )
+		raptor_iostream_string_write( "\n]}}\n", writer->iostream );
+
+	rleaf_log_with_context( writer->self, "debug", "Wrote %ld rows.", writer->rownum );
+
+	return Qnil;
+}
+
+
+/*
+ * Release the nodes and the iostream of the given +writer+ (a rleaf_SPARQLWRITER cast to a
+ * VALUE), whether or not writing finished.
+ */
+static VALUE
+rleaf_write_sparql_bindings_ensure( VALUE writerptr ) {
+	rleaf_SPARQLWRITER *writer = (rleaf_SPARQLWRITER *)writerptr;
+
+	rleaf_sparql_writer_free_nodes( writer );
+	rleaf_finish_ruby_iostream( writer->iostream, &writer->rubyio );
+
+	return Qnil;
+}
+
+
+/*
+ * Write the bindings result +self+ to +target+ in the specified +format+. Rows are written as
+ * they are fetched from Redland, or from the cached rows if #rows has already been called.
+ * Rows fetched from Redland are cached as they're written, since fetching them consumes
+ * them, so the result can still be read again afterwards.
+ */
+static VALUE
+rleaf_write_sparql_bindings( VALUE self, VALUE target, rleaf_sparql_format format ) {
+	rleaf_SPARQLWRITER writer;
+	int i;
+
+	rleaf_check_result_rows( self );
+
+	writer.self      = self;
+	writer.rows      = rb_ivar_get( self, rb_intern("@rows") );
+	writer.res       = rleaf_get_queryresult( self );
+	writer.format    = format;
+	writer.bindcount = librdf_query_results_get_bindings_count( writer.res );
+	writer.names     = ALLOCA_N( const char *, writer.bindcount );
+	writer.nodes     = ALLOCA_N( librdf_node *, writer.bindcount );
+	writer.keys      = ALLOCA_N( VALUE, writer.bindcount );
+	writer.rownum    = 0;
+
+	for ( i = 0; i < writer.bindcount; i++ ) {
+		writer.names[i] = librdf_query_results_get_binding_name( writer.res, i );
+		writer.keys[i]  = ID2SYM( rb_intern(writer.names[i]) );
+		writer.nodes[i] = NULL;
+	}
+
+	writer.iostream = rleaf_new_ruby_iostream( &writer.rubyio, target );
+	rb_ensure( rleaf_write_sparql_bindings_body, (VALUE)&writer,
+		rleaf_write_sparql_bindings_ensure, (VALUE)&writer );
+
+	return target;
 }
 
 
@@ -333,11 +838,14 @@ static VALUE
 rleaf_redleaf_bindingsqueryresult_rows( VALUE self ) {
 	librdf_query_results *res = rleaf_get_queryresult( self );
 	VALUE rows = rb_ivar_get( self, rb_intern("@rows") );
+	int i;
+
+	rleaf_check_result_rows( self );
 
 	/* If @rows is nil and there are results to fetch, fetch each row from
 	   Redland, yield it, and cache it for later. */
 	if ( rows == Qnil ) {
-		int i;
+		rb_ivar_set( self, rb_intern("@consumed"), Qtrue );
 
 		rleaf_log_with_context( self, "debug", "Building result rows." );
 		rows = rb_ary_new();
@@ -389,6 +897,66 @@ rleaf_redleaf_bindingsqueryresult_length( VALUE self ) {
 }
 
 
+/*
+ *  call-seq:
+ *     result.to_json( io=nil )   -> string or io
+ *
+ *  Return the result as JSON in the SPARQL 1.1 Query Results JSON Format. If +io+ is given,
+ *  the result is streamed to it row by row and +io+ is returned instead. The rows are kept
+ *  as they're written, so the result can still be written again or read with #rows.
+ *
+ */
+static VALUE
+rleaf_redleaf_bindingsqueryresult_to_json( int argc, VALUE *argv, VALUE self ) {
+	VALUE io = Qnil;
+
+	rb_scan_args( argc, argv, "01", &io );
+	if ( NIL_P(io) ) io = rb_str_new( 0, 0 );
+
+	return rleaf_write_sparql_bindings( self, io, RLEAF_SPARQL_JSON );
+}
+
+
+/*
+ *  call-seq:
+ *     result.to_csv( io=nil )   -> string or io
+ *
+ *  Return the result in the SPARQL 1.1 Query Results CSV Format. If +io+ is given,
+ *  the result is streamed to it row by row and +io+ is returned instead. The rows are kept
+ *  as they're written, so the result can still be written again or read with #rows.
+ *
+ */
+static VALUE
+rleaf_redleaf_bindingsqueryresult_to_csv( int argc, VALUE *argv, VALUE self ) {
+	VALUE io = Qnil;
+
+	rb_scan_args( argc, argv, "01", &io );
+	if ( NIL_P(io) ) io = rb_str_new( 0, 0 );
+
+	return rleaf_write_sparql_bindings( self, io, RLEAF_SPARQL_CSV );
+}
+
+
+/*
+ *  call-seq:
+ *     result.to_tsv( io=nil )   -> string or io
+ *
+ *  Return the result in the SPARQL 1.1 Query Results TSV Format. If +io+ is given,
+ *  the result is streamed to it row by row and +io+ is returned instead. The rows are kept
+ *  as they're written, so the result can still be written again or read with #rows.
+ *
+ */
+static VALUE
+rleaf_redleaf_bindingsqueryresult_to_tsv( int argc, VALUE *argv, VALUE self ) {
+	VALUE io = Qnil;
+
+	rb_scan_args( argc, argv, "01", &io );
+	if ( NIL_P(io) ) io = rb_str_new( 0, 0 );
+
+	return rleaf_write_sparql_bindings( self, io, RLEAF_SPARQL_TSV );
+}
+
+
 /*
  * Redleaf::GraphQueryResult
  */
@@ -417,6 +985,7 @@ rleaf_redleaf_graphqueryresult_graph( VALUE self ) {
 		if ( (stream = librdf_query_results_as_stream(res)) ) {
 			librdf_model_add_statements( graph->model, stream );
 			librdf_free_stream( stream );
+			rleaf_graph_invalidate_fingerprint( graphobj );
 		} else {
 			rleaf_log_with_context( self, "info", "Query resulted in an empty graph." );
 		}
@@ -458,6 +1027,34 @@ rleaf_redleaf_booleanqueryresult_value( VALUE self ) {
 }
 
 
+/*
+ *  call-seq:
+ *     result.to_json( io=nil )   -> string or io
+ *
+ *  Return the result as JSON in the SPARQL 1.1 Query Results JSON Format. If +io+ is given,
+ *  the result is written to it and +io+ is returned instead.
+ *
+ */
+static VALUE
+rleaf_redleaf_booleanqueryresult_to_json( int argc, VALUE *argv, VALUE self ) {
+	raptor_iostream *iostream;
+	rleaf_RUBYIO rubyio;
+	VALUE io = Qnil;
+	VALUE value = rleaf_redleaf_booleanqueryresult_value( self );
+
+	rb_scan_args( argc, argv, "01", &io );
+	if ( NIL_P(io) ) io = rb_str_new( 0, 0 );
+
+	iostream = rleaf_new_ruby_iostream( &rubyio, io );
+	raptor_iostream_string_write( "{\"head\":{},\"boolean\":", iostream );
+	raptor_iostream_string_write( RTEST(value) ? "true" : "false", iostream );
+	raptor_iostream_counted_string_write( "}\n", 2, iostream );
+	rleaf_finish_ruby_iostream( iostream, &rubyio );
+
+	return io;
+}
+
+
 
 /*
  * Redleaf::SyntaxQueryResult
@@ -485,6 +1082,10 @@ rleaf_init_redleaf_queryresult( void ) {
 	rleaf_cRedleafSyntaxQueryResult = rb_define_class_under( rleaf_mRedleaf,
 		"SyntaxQueryResult", rleaf_cRedleafQueryResult );
 
+	/* Build the formatter registry */
+	rb_gc_register_address( &rleaf_queryresult_formatters );
+	rleaf_refresh_queryresult_formatters();
+
 	/* include Enumerable */
 	rb_include_module( rleaf_cRedleafQueryResult, rb_mEnumerable );
 
@@ -500,14 +1101,8 @@ rleaf_init_redleaf_queryresult( void ) {
 	/* Instance methods */
 	rb_define_method( rleaf_cRedleafQueryResult, "each", rleaf_redleaf_queryresult_each, 0 );
 	rb_define_method( rleaf_cRedleafQueryResult, "formatted_as", rleaf_redleaf_queryresult_formatted_as, 1 );
-
-	/*
-
-	-- #write( io )/#write( filename ) -- Blocking?
-	int librdf_query_results_to_file_handle( librdf_query_results *query_results, FILE *handle, librdf_uri *format_uri, librdf_uri *base_uri );
-	int librdf_query_results_to_file( librdf_query_results *query_results, const char *name, librdf_uri *format_uri, librdf_uri *base_uri );
-
-	*/
+	rb_define_method( rleaf_cRedleafQueryResult, "formatted_as_io",
+		rleaf_redleaf_queryresult_formatted_as_io, 2 );
 
 
 	/*
@@ -520,6 +1115,12 @@ rleaf_init_redleaf_queryresult( void ) {
 	rb_define_alias ( rleaf_cRedleafBindingQueryResult, "size", "length" );
 	rb_define_method( rleaf_cRedleafBindingQueryResult, "rows",
 		rleaf_redleaf_bindingsqueryresult_rows, 0 );
+	rb_define_method( rleaf_cRedleafBindingQueryResult, "to_json",
+		rleaf_redleaf_bindingsqueryresult_to_json, -1 );
+	rb_define_method( rleaf_cRedleafBindingQueryResult, "to_csv",
+		rleaf_redleaf_bindingsqueryresult_to_csv, -1 );
+	rb_define_method( rleaf_cRedleafBindingQueryResult, "to_tsv",
+		rleaf_redleaf_bindingsqueryresult_to_tsv, -1 );
 
 	/*
 	 * Redleaf::GraphQueryResult
@@ -535,6 +1136,8 @@ rleaf_init_redleaf_queryresult( void ) {
 	rb_define_method( rleaf_cRedleafBooleanQueryResult, "value",
 		rleaf_redleaf_booleanqueryresult_value, 0 );
 	rb_define_alias ( rleaf_cRedleafBooleanQueryResult, "to_bool", "value" );
+	rb_define_method( rleaf_cRedleafBooleanQueryResult, "to_json",
+		rleaf_redleaf_booleanqueryresult_to_json, -1 );
 
 	/*
 	 * Redleaf::SyntaxQueryResult
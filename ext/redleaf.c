@@ -159,6 +159,41 @@ rleaf_log( const char *level, const char *fmt, va_dcl )
  * Utility functions for LibRDF interaction
  * -------------------------------------------------------------- */
 
+/*
+ * Iterator function for rleaf_deep_freeze: freeze each key and value of a Hash.
+ */
+static int
+rleaf_deep_freeze_pair( VALUE key, VALUE value, VALUE unused ) {
+	rleaf_deep_freeze( key );
+	rleaf_deep_freeze( value );
+	return ST_CONTINUE;
+}
+
+
+/*
+ * Freeze the given +obj+ and everything it contains (for Hashes and Arrays), and return it.
+ */
+VALUE
+rleaf_deep_freeze( VALUE obj ) {
+	long i;
+
+	if ( SPECIAL_CONST_P(obj) || OBJ_FROZEN(obj) ) return obj;
+
+	switch ( TYPE(obj) ) {
+		case T_HASH:
+		rb_hash_foreach( obj, rleaf_deep_freeze_pair, 0 );
+		break;
+
+		case T_ARRAY:
+		for ( i = 0; i < RARRAY_LEN(obj); i++ )
+			rleaf_deep_freeze( RARRAY_PTR(obj)[i] );
+		break;
+	}
+
+	return rb_obj_freeze( obj );
+}
+
+
 /*
  * Give Redland a chance to clean up all of its stuff.
  */
@@ -174,6 +209,136 @@ rleaf_redleaf_finalizer( VALUE unused ) {
 }
 
 
+/*
+ * Protected body of rleaf_rubyio_flush: write the buffered data to the target.
+ */
+static VALUE
+rleaf_rubyio_write_buffer( VALUE ptr ) {
+	rleaf_RUBYIO *rubyio = (rleaf_RUBYIO *)ptr;
+	VALUE chunk = rb_str_new( rubyio->buf, rubyio->len );
+
+	if ( TYPE(rubyio->target) == T_STRING )
+		rb_str_buf_append( rubyio->target, chunk );
+	else
+		rb_funcall( rubyio->target, rb_intern("write"), 1, chunk );
+
+	return Qnil;
+}
+
+
+/*
+ * Flush any buffered output to the Ruby target. Exceptions raised by the target are caught
+ * and remembered so they don't unwind through raptor; rleaf_finish_ruby_iostream re-raises
+ * them. Returns non-zero if the write failed.
+ */
+static int
+rleaf_rubyio_flush( rleaf_RUBYIO *rubyio ) {
+	if ( rubyio->state ) return 1;
+	if ( rubyio->len == 0 ) return 0;
+
+	rb_protect( rleaf_rubyio_write_buffer, (VALUE)rubyio, &rubyio->state );
+	rubyio->len = 0;
+
+	return rubyio->state;
+}
+
+
+/*
+ * raptor_iostream write_bytes handler for Ruby targets.
+ */
+static int
+rleaf_rubyio_write_bytes( void *context, const void *ptr, size_t size, size_t nmemb ) {
+	rleaf_RUBYIO *rubyio = (rleaf_RUBYIO *)context;
+	const char *bytes = (const char *)ptr;
+	size_t remaining = size * nmemb, chunk;
+
+	while ( remaining ) {
+		if ( rubyio->len == BUFSIZ && rleaf_rubyio_flush(rubyio) != 0 ) return 0;
+
+		chunk = BUFSIZ - rubyio->len;
+		if ( chunk > remaining ) chunk = remaining;
+
+		memcpy( rubyio->buf + rubyio->len, bytes, chunk );
+		rubyio->len += chunk;
+		bytes += chunk;
+		remaining -= chunk;
+	}
+
+	return (int)nmemb;
+}
+
+
+/*
+ * raptor_iostream write_byte handler for Ruby targets.
+ */
+static int
+rleaf_rubyio_write_byte( void *context, const int byte ) {
+	const char c = (char)byte;
+	return rleaf_rubyio_write_bytes( context, &c, 1, 1 ) == 1 ? 0 : 1;
+}
+
+
+/*
+ * raptor_iostream write_end handler for Ruby targets.
+ */
+static int
+rleaf_rubyio_write_end( void *context ) {
+	return rleaf_rubyio_flush( (rleaf_RUBYIO *)context );
+}
+
+
+static const raptor_iostream_handler rleaf_rubyio_handler = {
+	2,                         /* version */
+	NULL,                      /* init */
+	NULL,                      /* finish */
+	rleaf_rubyio_write_byte,
+	rleaf_rubyio_write_bytes,
+	rleaf_rubyio_write_end,
+	NULL,                      /* read_bytes */
+	NULL                       /* read_eof */
+};
+
+
+/*
+ * Create a raptor_iostream that writes to the specified +target+, which can be a String
+ * (which will be appended to) or any object that responds to #write. The +rubyio+ struct
+ * holds the stream's state, and must outlive it; it's usually allocated on the caller's
+ * stack. The caller must finish the stream with rleaf_finish_ruby_iostream.
+ */
+raptor_iostream *
+rleaf_new_ruby_iostream( rleaf_RUBYIO *rubyio, VALUE target ) {
+	raptor_iostream *iostream;
+
+	if ( TYPE(target) != T_STRING && !rb_respond_to(target, rb_intern("write")) )
+		rb_raise( rb_eArgError, "can't write to a %s", rb_obj_classname(target) );
+
+	rubyio->target = target;
+	rubyio->state  = 0;
+	rubyio->len    = 0;
+
+	iostream = raptor_new_iostream_from_handler( librdf_world_get_raptor(rleaf_rdf_world),
+		rubyio, &rleaf_rubyio_handler );
+	if ( !iostream )
+		rb_raise( rleaf_eRedleafError, "couldn't create an iostream for a %s",
+			rb_obj_classname(target) );
+
+	return iostream;
+}
+
+
+/*
+ * Flush and free the given +iostream+, re-raising any exception that was raised by its
+ * Ruby target while writing.
+ */
+void
+rleaf_finish_ruby_iostream( raptor_iostream *iostream, rleaf_RUBYIO *rubyio ) {
+	raptor_free_iostream( iostream );
+	rleaf_rubyio_flush( rubyio );
+
+	if ( rubyio->state ) rb_jump_tag( rubyio->state );
+}
+
+
 /*
  * Log handler function for transforming rdflib log messages into Redleaf ones.
  */
@@ -217,6 +382,29 @@ rleaf_redleaf_generate_id( VALUE klass ) {
 }
 
 
+/*
+ *  call-seq:
+ *     Redleaf.refresh_capabilities   -> nil
+ *
+ *  Rebuild the registries returned by Redleaf::Graph.serializers,
+ *  Redleaf::QueryResult.formatters, Redleaf::Store.backends, and Redleaf::Parser.features.
+ *  They are built once when the extension is loaded, so this is only necessary if the
+ *  underlying Redland library gains new modules afterward.
+ */
+static VALUE
+rleaf_redleaf_refresh_capabilities( VALUE mod ) {
+	_UNUSED( mod );
+
+	rleaf_log( "debug", "Refreshing capability registries." );
+	rleaf_refresh_store_backends();
+	rleaf_refresh_graph_serializers();
+	rleaf_refresh_parser_features();
+	rleaf_refresh_queryresult_formatters();
+
+	return Qnil;
+}
+
+
 /*
  *
  */
@@ -319,6 +507,8 @@ void Init_redleaf_ext( void ) {
 	rb_define_module_function( rleaf_mRedleaf, "make_literal_string",
 		rleaf_redleaf_make_literal_string, 1 );
 	rb_define_module_function( rleaf_mRedleaf, "generate_id", rleaf_redleaf_generate_id, 0 );
+	rb_define_module_function( rleaf_mRedleaf, "refresh_capabilities",
+		rleaf_redleaf_refresh_capabilities, 0 );
 
 	rb_require( "redleaf" );
 	rb_require( "redleaf/exceptions" );
@@ -62,6 +62,13 @@ extern VALUE rleaf_cRedleafParser;
 extern VALUE rleaf_cRedleafStore;
 extern VALUE rleaf_cRedleafNamespace;
 extern VALUE rleaf_cRedleafHashesStore;
+extern VALUE rleaf_cRedleafDictionaryStore;
+extern VALUE rleaf_cRedleafSnapshotStore;
+extern VALUE rleaf_cRedleafOverlayStore;
+extern VALUE rleaf_cRedleafWriteBehindStore;
+extern VALUE rleaf_cRedleafCachingStore;
+extern VALUE rleaf_cRedleafShardedStore;
+extern VALUE rleaf_cRedleafWALStore;
 
 extern VALUE rleaf_mRedleafNodeUtils;
 
@@ -79,6 +86,7 @@ extern VALUE rleaf_eRedleafParseError;
 extern VALUE rleaf_rb_cURI;
 
 extern librdf_world *rleaf_rdf_world;
+extern librdf_uri *rleaf_contexts_feature;
 
 extern const librdf_uri *rleaf_xsd_string_typeuri;
 extern const librdf_uri *rleaf_xsd_float_typeuri;
@@ -97,13 +105,70 @@ extern ID rleaf_anon_bnodeid;
 typedef struct rleaf_store_object {
 	librdf_storage	*storage;
 	VALUE			graph;
+	uint64_t		fingerprint[2];
+	int				fingerprint_valid;
+	long			size;
+	int				size_valid;
+	int				size_tracked;
+	VALUE			context_sizes;
 } rleaf_STORE;
 
 
+/* State for a raptor_iostream that writes to a Ruby IO or String */
+typedef struct rleaf_rubyio_object {
+	VALUE	target;
+	int		state;
+	size_t	len;
+	char	buf[BUFSIZ];
+} rleaf_RUBYIO;
+
+
+/* Term dictionary: maps encoded RDF terms to dense integer ids. +refs+ counts the stores
+   sharing it; ids are never reused, so read-only sharers are safe while it grows. */
+typedef struct rleaf_termdict_object {
+	unsigned char	*arena;
+	size_t			arena_len, arena_capa;
+	uint64_t		*offsets;
+	uint32_t		*lengths;
+	uint64_t		*hashes;
+	unsigned char	*flags;
+	uint32_t		count, capa;
+	uint32_t		*buckets;
+	uint32_t		bucket_count;
+	unsigned long	refs;
+} rleaf_TERMDICT;
+
+#define RLEAF_TERM_BLANK 0x01
+#define RLEAF_NO_TERM    UINT32_MAX
+
+#define rleaf_termdict_is_blank( dict, id ) ( (dict)->flags[(id)] & RLEAF_TERM_BLANK )
+
+
+/* A triple of term ids */
+typedef struct rleaf_triple_object {
+	uint32_t s, p, o;
+} rleaf_TRIPLE;
+
+
+/* A growable array of id triples */
+typedef struct rleaf_tripleset_object {
+	rleaf_TRIPLE	*triples;
+	size_t			count, capa;
+} rleaf_TRIPLESET;
+
+
+/* An open-addressed hash set of id triples; empty slots have a subject of RLEAF_NO_TERM */
+typedef struct rleaf_triplehash_object {
+	rleaf_TRIPLE	*slots;
+	size_t			count, capa;
+} rleaf_TRIPLEHASH;
+
+
 /* Redleaf::Graph struct */
 typedef struct rleaf_graph_object {
 	librdf_model	*model;
 	VALUE			store;
+	int				in_transaction;
 } rleaf_GRAPH;
 
 
@@ -168,12 +233,75 @@ librdf_node * rleaf_value_to_object_node( VALUE );
 VALUE rleaf_librdf_statement_to_value( librdf_statement * );
 librdf_statement * rleaf_value_to_librdf_statement( VALUE );
 
+/* Ruby IO adapter functions from redleaf.c */
+raptor_iostream *rleaf_new_ruby_iostream( rleaf_RUBYIO *, VALUE );
+void rleaf_finish_ruby_iostream( raptor_iostream *, rleaf_RUBYIO * );
+
+/* Term dictionary and triple set functions from tripleset.c */
+uint64_t rleaf_mix64( uint64_t );
+uint64_t rleaf_hash_bytes( const void *, size_t, uint64_t );
+rleaf_TERMDICT *rleaf_new_termdict( void );
+rleaf_TERMDICT *rleaf_copy_termdict( rleaf_TERMDICT * );
+void rleaf_free_termdict( rleaf_TERMDICT * );
+size_t rleaf_termdict_memsize( rleaf_TERMDICT * );
+uint32_t rleaf_termdict_intern( rleaf_TERMDICT *, const unsigned char *, size_t, unsigned char );
+uint32_t rleaf_termdict_lookup( rleaf_TERMDICT *, const unsigned char *, size_t );
+uint32_t rleaf_termdict_intern_node( rleaf_TERMDICT *, librdf_node *, unsigned char );
+uint32_t rleaf_termdict_lookup_node( rleaf_TERMDICT *, librdf_node *, unsigned char );
+librdf_node *rleaf_termdict_get_node( rleaf_TERMDICT *, uint32_t );
+void rleaf_init_tripleset( rleaf_TRIPLESET * );
+void rleaf_clear_tripleset( rleaf_TRIPLESET * );
+void rleaf_tripleset_add( rleaf_TRIPLESET *, uint32_t, uint32_t, uint32_t );
+void rleaf_tripleset_sort( rleaf_TRIPLESET * );
+size_t rleaf_tripleset_add_stream( rleaf_TRIPLESET *, rleaf_TERMDICT *, librdf_stream *, unsigned char );
+int rleaf_triple_cmp( const void *, const void * );
+void rleaf_init_triplehash( rleaf_TRIPLEHASH * );
+void rleaf_clear_triplehash( rleaf_TRIPLEHASH * );
+int rleaf_triplehash_add( rleaf_TRIPLEHASH *, uint32_t, uint32_t, uint32_t );
+int rleaf_triplehash_contains( rleaf_TRIPLEHASH *, uint32_t, uint32_t, uint32_t );
+int rleaf_triplesets_isomorphic( rleaf_TERMDICT *, rleaf_TRIPLESET *, rleaf_TRIPLESET * );
+void rleaf_statement_fingerprint( librdf_statement *, uint64_t [2] );
+
+/* Capability registry functions */
+VALUE rleaf_deep_freeze( VALUE );
+void rleaf_refresh_graph_serializers( void );
+void rleaf_refresh_queryresult_formatters( void );
+void rleaf_refresh_store_backends( void );
+void rleaf_refresh_parser_features( void );
+int rleaf_graph_serializer_supported( VALUE );
+
 /* T_DATA fetcher functions */
 rleaf_STORE *rleaf_get_store( VALUE );
 rleaf_GRAPH *rleaf_get_graph( VALUE );
 librdf_statement *rleaf_get_statement( VALUE );
 librdf_parser *rleaf_get_parser( VALUE );
 
+/* Snapshot writer from dictstore.c */
+void rleaf_write_snapshot( librdf_model *, const char * );
+
+/* Store memory-management functions from store.c, for Store subclasses with their own */
+void rleaf_store_gc_mark( rleaf_STORE * );
+void rleaf_store_gc_free( rleaf_STORE * );
+VALUE rleaf_new_store_from_storage( VALUE, librdf_storage * );
+
+/* Caching store functions from cachestore.c */
+void rleaf_caching_store_init_copy( VALUE, VALUE );
+
+/* Sharded store functions from shardedstore.c */
+void rleaf_sharded_store_init_copy( VALUE, VALUE );
+
+/* Overlay store functions from overlaystore.c */
+VALUE rleaf_new_overlay_store( VALUE, VALUE );
+void rleaf_overlay_store_init_copy( VALUE, VALUE );
+int rleaf_overlay_store_apply_changes( VALUE, librdf_model * );
+
+/* Binary dumps from dump.c */
+void rleaf_dump_model( librdf_model *, int, VALUE );
+void rleaf_load_dump( librdf_model *, int, VALUE );
+
+/* Graph fingerprint maintenance from graph.c */
+void rleaf_graph_invalidate_fingerprint( VALUE );
+
 /* QueryResult special constructor */
 VALUE rleaf_new_queryresult( VALUE, librdf_query_results * );
 
@@ -188,6 +316,18 @@ void rleaf_init_redleaf_graph( void );
 void rleaf_init_redleaf_parser( void );
 void rleaf_init_redleaf_statement( void );
 void rleaf_init_redleaf_queryresult( void );
+void rleaf_init_redleaf_dictionary_store( void );
+void rleaf_init_redleaf_overlay_store( void );
+void rleaf_init_redleaf_caching_store( void );
+void rleaf_init_redleaf_sharded_store( void );
+void rleaf_init_redleaf_wal_store( void );
+
+void rleaf_register_storage_modules( void );
+void rleaf_register_overlay_storage_module( void );
+void rleaf_register_writebehind_storage_module( void );
+void rleaf_register_caching_storage_module( void );
+void rleaf_register_sharded_storage_module( void );
+void rleaf_register_wal_storage_module( void );
 
 #endif
 
@@ -0,0 +1,1158 @@
+/*
+ * Redleaf hash-partitioned sharded storage
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#include "redleaf.h"
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ * -------------------------------------------------------------- */
+
+VALUE rleaf_cRedleafShardedStore;
+
+#define RLEAF_SHARDED_NAME          "sharded"
+#define RLEAF_SHARDED_LABEL         "Statements partitioned across other storages by subject"
+
+/* How many statements to partition before handing them to the shards when bulk-adding */
+#define RLEAF_SHARDED_BATCH_SIZE    10000
+
+/*
+ * A sharded storage's state: the storages its statements are partitioned across. Which
+ * shard a statement belongs to depends only on its subject and the number of shards.
+ *
+ * +shard_stores+ are the Redleaf::Stores of the shards, whose cached sizes and fingerprints
+ * are forgotten whenever statements are written to them. They're only set while the
+ * Redleaf::ShardedStore that created the storage is alive, since that's what keeps the
+ * shard stores from being garbage-collected.
+ */
+typedef struct rleaf_sharded {
+	librdf_storage	**shards;
+	rleaf_STORE		**shard_stores;
+	int				count;
+} rleaf_SHARDED;
+
+/* What kind of stream a sharded stream is made of */
+typedef enum {
+	RLEAF_SHARDED_SERIALISE,
+	RLEAF_SHARDED_FIND,
+	RLEAF_SHARDED_CONTEXT_SERIALISE,
+	RLEAF_SHARDED_FIND_IN_CONTEXT
+} rleaf_SHARDEDSTREAMKIND;
+
+/* A stream over the same kind of stream from each of the shards from +shard+ up to +end+ */
+typedef struct rleaf_sharded_cursor {
+	librdf_storage				*storage;
+	rleaf_SHARDED				*sharded;
+	rleaf_SHARDEDSTREAMKIND		kind;
+	librdf_statement			*pattern;
+	librdf_node					*context;
+	librdf_stream				*stream;
+	int							shard, end;
+} rleaf_SHARDEDCURSOR;
+
+/* A stream over a batch of statements bound for one shard */
+typedef struct rleaf_sharded_batch {
+	librdf_statement	**statements;
+	long				count, capacity, index;
+} rleaf_SHARDEDBATCH;
+
+/* An iterator over the contexts of all the shards */
+typedef struct rleaf_sharded_contexts {
+	librdf_node		**contexts;
+	long			count, index;
+} rleaf_SHARDEDCONTEXTS;
+
+
+/* --------------------------------------------------------------
+ * Sharding functions
+ * -------------------------------------------------------------- */
+
+/*
+ * Return the index of the shard that statements with the given +subject+ belong to. The
+ * subject's encoded form is hashed so the same subject always goes to the same shard, even
+ * across processes.
+ */
+static int
+rleaf_sharded_shard_index( rleaf_SHARDED *sharded, librdf_node *subject ) {
+	unsigned char stackbuf[ 256 ], *buf = stackbuf;
+	unsigned long hash = 2166136261UL;
+	size_t length, i;
+
+	length = librdf_node_encode( subject, NULL, 0 );
+	if ( length > sizeof(stackbuf) ) buf = ALLOC_N( unsigned char, length );
+	librdf_node_encode( subject, buf, length );
+
+	for ( i = 0; i < length; i++ ) {
+		hash ^= buf[i];
+		hash *= 16777619UL;
+	}
+
+	if ( buf != stackbuf ) xfree( buf );
+	return (int)( hash % (unsigned long)sharded->count );
+}
+
+
+/*
+ * Return the shard that +statement+ belongs to.
+ */
+static librdf_storage *
+rleaf_sharded_shard_for( rleaf_SHARDED *sharded, librdf_statement *statement ) {
+	librdf_node *subject = librdf_statement_get_subject( statement );
+	return sharded->shards[ rleaf_sharded_shard_index(sharded, subject) ];
+}
+
+
+/*
+ * Forget the cached size and fingerprint of the store of the shard at +index+, if it has
+ * one, before writing to it.
+ */
+static void
+rleaf_sharded_shard_changing( rleaf_SHARDED *sharded, int index ) {
+	rleaf_STORE *store;
+
+	if ( !sharded->shard_stores || !(store = sharded->shard_stores[index]) ) return;
+
+	store->fingerprint_valid = 0;
+	store->size_valid        = 0;
+	store->context_sizes     = Qnil;
+}
+
+
+/*
+ * Return the shard that +statement+ belongs to, which it's about to be written to.
+ */
+static librdf_storage *
+rleaf_sharded_changing_shard_for( rleaf_SHARDED *sharded, librdf_statement *statement ) {
+	int index = rleaf_sharded_shard_index( sharded, librdf_statement_get_subject(statement) );
+
+	rleaf_sharded_shard_changing( sharded, index );
+	return sharded->shards[ index ];
+}
+
+
+/*
+ * Set the +shards+ of the given sharded +storage+, which mustn't have any yet.
+ */
+static void
+rleaf_sharded_set_shards( librdf_storage *storage, librdf_storage **shards, int count ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i;
+
+	sharded->shards = ALLOC_N( librdf_storage *, count );
+	for ( i = 0; i < count; i++ ) {
+		librdf_storage_add_reference( shards[i] );
+		sharded->shards[i] = shards[i];
+	}
+	sharded->count = count;
+}
+
+
+/* --------------------------------------------------------------
+ * Batches
+ * -------------------------------------------------------------- */
+
+/*
+ * librdf_stream is_end method.
+ */
+static int
+rleaf_shardedbatch_is_end( void *context ) {
+	rleaf_SHARDEDBATCH *batch = (rleaf_SHARDEDBATCH *)context;
+	return batch->index >= batch->count;
+}
+
+
+/*
+ * librdf_stream next method.
+ */
+static int
+rleaf_shardedbatch_next( void *context ) {
+	rleaf_SHARDEDBATCH *batch = (rleaf_SHARDEDBATCH *)context;
+
+	if ( batch->index < batch->count ) batch->index++;
+	return batch->index >= batch->count;
+}
+
+
+/*
+ * librdf_stream get method.
+ */
+static void *
+rleaf_shardedbatch_get( void *context, int flags ) {
+	rleaf_SHARDEDBATCH *batch = (rleaf_SHARDEDBATCH *)context;
+
+	if ( batch->index >= batch->count ) return NULL;
+	if ( flags == LIBRDF_STREAM_GET_METHOD_GET_OBJECT )
+		return batch->statements[ batch->index ];
+
+	return NULL;
+}
+
+
+/*
+ * librdf_stream finished method. Batches belong to the bulk-add that made them.
+ */
+static void
+rleaf_shardedbatch_finished( void *context ) {
+	_UNUSED( context );
+}
+
+
+/*
+ * Add a copy of +statement+ to the given +batch+.
+ */
+static void
+rleaf_shardedbatch_push( rleaf_SHARDEDBATCH *batch, librdf_statement *statement ) {
+	if ( batch->count == batch->capacity ) {
+		batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+		REALLOC_N( batch->statements, librdf_statement *, batch->capacity );
+	}
+
+	batch->statements[ batch->count++ ] = librdf_new_statement_from_statement( statement );
+}
+
+
+/*
+ * Add the statements in the given +batch+ to the +shard+ (in +context+ if it's non-NULL)
+ * as a single stream, then empty it. Returns non-zero if they couldn't be added.
+ */
+static int
+rleaf_shardedbatch_flush( rleaf_SHARDEDBATCH *batch, librdf_storage *shard,
+	librdf_node *context )
+{
+	librdf_stream *stream;
+	long i;
+	int rval = 1;
+
+	if ( !batch->count ) return 0;
+
+	batch->index = 0;
+	stream = librdf_new_stream( librdf_storage_get_world(shard), batch,
+		rleaf_shardedbatch_is_end, rleaf_shardedbatch_next, rleaf_shardedbatch_get,
+		rleaf_shardedbatch_finished );
+
+	if ( stream ) {
+		if ( context )
+			rval = librdf_storage_context_add_statements( shard, context, stream );
+		else
+			rval = librdf_storage_add_statements( shard, stream );
+		librdf_free_stream( stream );
+	}
+
+	for ( i = 0; i < batch->count; i++ ) librdf_free_statement( batch->statements[i] );
+	batch->count = 0;
+
+	return rval;
+}
+
+
+/*
+ * Partition the statements in +stream+ into per-shard batches, and hand each shard its
+ * batches (in +context+ if it's non-NULL) as whole streams, so each shard sees a few large
+ * writes instead of one per statement.
+ */
+static int
+rleaf_sharded_add_stream( librdf_storage *storage, librdf_node *context, librdf_stream *stream ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	rleaf_SHARDEDBATCH *batches = ALLOC_N( rleaf_SHARDEDBATCH, sharded->count );
+	librdf_statement *statement;
+	long pending = 0;
+	int i, shard, rval = 0;
+
+	MEMZERO( batches, rleaf_SHARDEDBATCH, sharded->count );
+
+	while ( !rval && ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+
+		shard = rleaf_sharded_shard_index( sharded, librdf_statement_get_subject(statement) );
+		rleaf_shardedbatch_push( &batches[shard], statement );
+
+		if ( ++pending >= RLEAF_SHARDED_BATCH_SIZE ) {
+			for ( i = 0; i < sharded->count && !rval; i++ ) {
+				if ( batches[i].count ) rleaf_sharded_shard_changing( sharded, i );
+				rval = rleaf_shardedbatch_flush( &batches[i], sharded->shards[i], context );
+			}
+			pending = 0;
+		}
+
+		librdf_stream_next( stream );
+	}
+
+	for ( i = 0; i < sharded->count; i++ ) {
+		if ( !rval && batches[i].count ) rleaf_sharded_shard_changing( sharded, i );
+		if ( !rval ) rval = rleaf_shardedbatch_flush( &batches[i], sharded->shards[i], context );
+		for ( ; batches[i].count > 0; batches[i].count-- )
+			librdf_free_statement( batches[i].statements[batches[i].count - 1] );
+		if ( batches[i].statements ) xfree( batches[i].statements );
+	}
+	xfree( batches );
+
+	return rval;
+}
+
+
+/* --------------------------------------------------------------
+ * Sharded streams
+ * -------------------------------------------------------------- */
+
+/*
+ * Open the cursor's kind of stream on the given +shard+.
+ */
+static librdf_stream *
+rleaf_shardedcursor_open( rleaf_SHARDEDCURSOR *cursor, librdf_storage *shard ) {
+	switch ( cursor->kind ) {
+		case RLEAF_SHARDED_SERIALISE:
+		return librdf_storage_serialise( shard );
+
+		case RLEAF_SHARDED_FIND:
+		return librdf_storage_find_statements( shard, cursor->pattern );
+
+		case RLEAF_SHARDED_CONTEXT_SERIALISE:
+		return librdf_storage_context_as_stream( shard, cursor->context );
+
+		case RLEAF_SHARDED_FIND_IN_CONTEXT:
+		return librdf_storage_find_statements_in_context( shard, cursor->pattern,
+			cursor->context );
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Move the cursor on to the next shard's stream while the current one is finished.
+ * Returns non-zero if a shard's stream couldn't be opened.
+ */
+static int
+rleaf_shardedcursor_skip( rleaf_SHARDEDCURSOR *cursor ) {
+	while ( cursor->shard < cursor->end ) {
+		if ( !cursor->stream ) {
+			cursor->stream = rleaf_shardedcursor_open( cursor,
+				cursor->sharded->shards[cursor->shard] );
+			if ( !cursor->stream ) return 1;
+		}
+
+		if ( ! librdf_stream_end(cursor->stream) ) return 0;
+
+		librdf_free_stream( cursor->stream );
+		cursor->stream = NULL;
+		cursor->shard++;
+	}
+
+	return 0;
+}
+
+
+/*
+ * librdf_stream is_end method.
+ */
+static int
+rleaf_shardedcursor_is_end( void *context ) {
+	rleaf_SHARDEDCURSOR *cursor = (rleaf_SHARDEDCURSOR *)context;
+	return cursor->shard >= cursor->end;
+}
+
+
+/*
+ * librdf_stream next method.
+ */
+static int
+rleaf_shardedcursor_next( void *context ) {
+	rleaf_SHARDEDCURSOR *cursor = (rleaf_SHARDEDCURSOR *)context;
+
+	if ( cursor->shard >= cursor->end ) return 1;
+
+	librdf_stream_next( cursor->stream );
+	if ( rleaf_shardedcursor_skip(cursor) != 0 ) cursor->shard = cursor->end;
+
+	return cursor->shard >= cursor->end;
+}
+
+
+/*
+ * librdf_stream get method. Contexts are passed through from the shards.
+ */
+static void *
+rleaf_shardedcursor_get( void *context, int flags ) {
+	rleaf_SHARDEDCURSOR *cursor = (rleaf_SHARDEDCURSOR *)context;
+
+	if ( cursor->shard >= cursor->end ) return NULL;
+
+	switch ( flags ) {
+		case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+		return librdf_stream_get_object( cursor->stream );
+
+		case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+		return librdf_stream_get_context( cursor->stream );
+
+		default:
+		return NULL;
+	}
+}
+
+
+/*
+ * librdf_stream finished method.
+ */
+static void
+rleaf_shardedcursor_finished( void *context ) {
+	rleaf_SHARDEDCURSOR *cursor = (rleaf_SHARDEDCURSOR *)context;
+
+	if ( cursor->stream ) librdf_free_stream( cursor->stream );
+	if ( cursor->pattern ) librdf_free_statement( cursor->pattern );
+	if ( cursor->context ) librdf_free_node( cursor->context );
+	librdf_storage_remove_reference( cursor->storage );
+	xfree( cursor );
+}
+
+
+/*
+ * Return a new stream of the given +kind+ over the shards of +storage+. If the +pattern+
+ * has a subject, only the shard that statements with that subject belong to is searched;
+ * otherwise each shard's stream is read in turn.
+ */
+static librdf_stream *
+rleaf_sharded_new_stream( librdf_storage *storage, rleaf_SHARDEDSTREAMKIND kind,
+	librdf_statement *pattern, librdf_node *context )
+{
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	rleaf_SHARDEDCURSOR *cursor = ALLOC( rleaf_SHARDEDCURSOR );
+	librdf_node *subject = pattern ? librdf_statement_get_subject( pattern ) : NULL;
+	librdf_stream *stream;
+
+	cursor->storage = storage;
+	cursor->sharded = sharded;
+	cursor->kind    = kind;
+	cursor->pattern = pattern ? librdf_new_statement_from_statement( pattern ) : NULL;
+	cursor->context = context ? librdf_new_node_from_node( context ) : NULL;
+	cursor->stream  = NULL;
+	cursor->shard   = 0;
+	cursor->end     = sharded->count;
+
+	/* Route subject-bound patterns to the one shard that can match them */
+	if ( subject && sharded->count ) {
+		cursor->shard = rleaf_sharded_shard_index( sharded, subject );
+		cursor->end   = cursor->shard + 1;
+	}
+
+	librdf_storage_add_reference( storage );
+	if ( rleaf_shardedcursor_skip(cursor) != 0 ) {
+		rleaf_shardedcursor_finished( cursor );
+		return NULL;
+	}
+
+	stream = librdf_new_stream( librdf_storage_get_world(storage), cursor,
+		rleaf_shardedcursor_is_end, rleaf_shardedcursor_next, rleaf_shardedcursor_get,
+		rleaf_shardedcursor_finished );
+
+	if ( !stream ) rleaf_shardedcursor_finished( cursor );
+	return stream;
+}
+
+
+/* --------------------------------------------------------------
+ * Context iterators
+ * -------------------------------------------------------------- */
+
+/*
+ * librdf_iterator is_end method.
+ */
+static int
+rleaf_shardedcontexts_is_end( void *context ) {
+	rleaf_SHARDEDCONTEXTS *contexts = (rleaf_SHARDEDCONTEXTS *)context;
+	return contexts->index >= contexts->count;
+}
+
+
+/*
+ * librdf_iterator next method.
+ */
+static int
+rleaf_shardedcontexts_next( void *context ) {
+	rleaf_SHARDEDCONTEXTS *contexts = (rleaf_SHARDEDCONTEXTS *)context;
+
+	if ( contexts->index < contexts->count ) contexts->index++;
+	return contexts->index >= contexts->count;
+}
+
+
+/*
+ * librdf_iterator get method.
+ */
+static void *
+rleaf_shardedcontexts_get( void *context, int flags ) {
+	rleaf_SHARDEDCONTEXTS *contexts = (rleaf_SHARDEDCONTEXTS *)context;
+
+	if ( contexts->index >= contexts->count ) return NULL;
+	if ( flags == LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT )
+		return contexts->contexts[ contexts->index ];
+
+	return NULL;
+}
+
+
+/*
+ * librdf_iterator finished method.
+ */
+static void
+rleaf_shardedcontexts_finished( void *context ) {
+	rleaf_SHARDEDCONTEXTS *contexts = (rleaf_SHARDEDCONTEXTS *)context;
+	long i;
+
+	for ( i = 0; i < contexts->count; i++ ) librdf_free_node( contexts->contexts[i] );
+	if ( contexts->contexts ) xfree( contexts->contexts );
+	xfree( contexts );
+}
+
+
+/*
+ * Add a copy of the context +node+ to +contexts+ unless it's already there. There are
+ * usually only a few contexts, so they're just compared one by one.
+ */
+static void
+rleaf_shardedcontexts_add( rleaf_SHARDEDCONTEXTS *contexts, librdf_node *node, long *capacity ) {
+	long i;
+
+	for ( i = 0; i < contexts->count; i++ )
+		if ( librdf_node_equals(contexts->contexts[i], node) ) return;
+
+	if ( contexts->count == *capacity ) {
+		*capacity = *capacity ? *capacity * 2 : 16;
+		REALLOC_N( contexts->contexts, librdf_node *, *capacity );
+	}
+
+	contexts->contexts[ contexts->count++ ] = librdf_new_node_from_node( node );
+}
+
+
+/* --------------------------------------------------------------
+ * Storage module methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Storage init method. Sharded storages start out without any shards; Redleaf::ShardedStore
+ * sets them after the storage is created.
+ */
+static int
+rleaf_sharded_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	rleaf_SHARDED *sharded = ALLOC( rleaf_SHARDED );
+
+	_UNUSED( name );
+	if ( options ) librdf_free_hash( options );
+
+	sharded->shards       = NULL;
+	sharded->shard_stores = NULL;
+	sharded->count        = 0;
+	librdf_storage_set_instance( storage, sharded );
+
+	return 0;
+}
+
+
+/*
+ * Storage clone method. The clone is sharded across clones of the shards.
+ */
+static int
+rleaf_sharded_clone( librdf_storage *new_storage, librdf_storage *old_storage ) {
+	rleaf_SHARDED *old = librdf_storage_get_instance( old_storage );
+	librdf_storage **shards;
+	int i, count = 0, rval = 0;
+
+	if ( rleaf_sharded_init(new_storage, NULL, NULL) != 0 ) return 1;
+	if ( !old->count ) return 0;
+
+	shards = ALLOCA_N( librdf_storage *, old->count );
+	for ( ; count < old->count; count++ ) {
+		if ( !(shards[count] = librdf_new_storage_from_storage(old->shards[count])) ) break;
+		if ( librdf_storage_open(shards[count], NULL) != 0 ) {
+			librdf_free_storage( shards[count] );
+			break;
+		}
+	}
+
+	/* The sharded storage takes its own references to the clones */
+	if ( count == old->count )
+		rleaf_sharded_set_shards( new_storage, shards, count );
+	else
+		rval = 1;
+	for ( i = 0; i < count; i++ ) librdf_free_storage( shards[i] );
+
+	return rval;
+}
+
+
+/*
+ * Storage terminate method.
+ */
+static void
+rleaf_sharded_terminate( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i;
+
+	if ( !sharded ) return;
+
+	for ( i = 0; i < sharded->count; i++ ) librdf_free_storage( sharded->shards[i] );
+	if ( sharded->shards ) xfree( sharded->shards );
+	if ( sharded->shard_stores ) xfree( sharded->shard_stores );
+
+	xfree( sharded );
+	librdf_storage_set_instance( storage, NULL );
+}
+
+
+/*
+ * Storage open method. The shards are opened by their own stores.
+ */
+static int
+rleaf_sharded_open( librdf_storage *storage, librdf_model *model ) {
+	_UNUSED( storage );
+	_UNUSED( model );
+	return 0;
+}
+
+
+/*
+ * Storage close method.
+ */
+static int
+rleaf_sharded_close( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage size method.
+ */
+static int
+rleaf_sharded_size( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i, size, total = 0;
+
+	for ( i = 0; i < sharded->count; i++ ) {
+		if ( (size = librdf_storage_size(sharded->shards[i])) < 0 ) return -1;
+		total += size;
+	}
+
+	return total;
+}
+
+
+/*
+ * Storage add_statement method.
+ */
+static int
+rleaf_sharded_add_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	return librdf_storage_add_statement( rleaf_sharded_changing_shard_for(sharded, statement),
+		statement );
+}
+
+
+/*
+ * Storage add_statements method.
+ */
+static int
+rleaf_sharded_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	return rleaf_sharded_add_stream( storage, NULL, stream );
+}
+
+
+/*
+ * Storage remove_statement method.
+ */
+static int
+rleaf_sharded_remove_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	return librdf_storage_remove_statement( rleaf_sharded_changing_shard_for(sharded, statement),
+		statement );
+}
+
+
+/*
+ * Storage contains_statement method.
+ */
+static int
+rleaf_sharded_contains_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	return librdf_storage_contains_statement( rleaf_sharded_shard_for(sharded, statement),
+		statement );
+}
+
+
+/*
+ * Storage serialise method.
+ */
+static librdf_stream *
+rleaf_sharded_serialise( librdf_storage *storage ) {
+	return rleaf_sharded_new_stream( storage, RLEAF_SHARDED_SERIALISE, NULL, NULL );
+}
+
+
+/*
+ * Storage find_statements method.
+ */
+static librdf_stream *
+rleaf_sharded_find_statements( librdf_storage *storage, librdf_statement *statement ) {
+	return rleaf_sharded_new_stream( storage, RLEAF_SHARDED_FIND, statement, NULL );
+}
+
+
+/*
+ * Storage context_add_statement method.
+ */
+static int
+rleaf_sharded_context_add_statement( librdf_storage *storage, librdf_node *context,
+	librdf_statement *statement )
+{
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	return librdf_storage_context_add_statement(
+		rleaf_sharded_changing_shard_for(sharded, statement), context, statement );
+}
+
+
+/*
+ * Storage context_add_statements method.
+ */
+static int
+rleaf_sharded_context_add_statements( librdf_storage *storage, librdf_node *context,
+	librdf_stream *stream )
+{
+	return rleaf_sharded_add_stream( storage, context, stream );
+}
+
+
+/*
+ * Storage context_remove_statement method.
+ */
+static int
+rleaf_sharded_context_remove_statement( librdf_storage *storage, librdf_node *context,
+	librdf_statement *statement )
+{
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	return librdf_storage_context_remove_statement(
+		rleaf_sharded_changing_shard_for(sharded, statement), context, statement );
+}
+
+
+/*
+ * Storage context_remove_statements method.
+ */
+static int
+rleaf_sharded_context_remove_statements( librdf_storage *storage, librdf_node *context ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i, rval = 0;
+
+	for ( i = 0; i < sharded->count; i++ ) {
+		rleaf_sharded_shard_changing( sharded, i );
+		if ( librdf_storage_context_remove_statements(sharded->shards[i], context) != 0 )
+			rval = 1;
+	}
+
+	return rval;
+}
+
+
+/*
+ * Storage context_serialise method.
+ */
+static librdf_stream *
+rleaf_sharded_context_serialise( librdf_storage *storage, librdf_node *context ) {
+	return rleaf_sharded_new_stream( storage, RLEAF_SHARDED_CONTEXT_SERIALISE, NULL, context );
+}
+
+
+/*
+ * Storage find_statements_in_context method.
+ */
+static librdf_stream *
+rleaf_sharded_find_statements_in_context( librdf_storage *storage, librdf_statement *statement,
+	librdf_node *context )
+{
+	return rleaf_sharded_new_stream( storage, RLEAF_SHARDED_FIND_IN_CONTEXT, statement, context );
+}
+
+
+/*
+ * Storage get_contexts method. Returns each context used in any of the shards once, or NULL
+ * if none of the shards supports contexts.
+ */
+static librdf_iterator *
+rleaf_sharded_get_contexts( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	rleaf_SHARDEDCONTEXTS *contexts = ALLOC( rleaf_SHARDEDCONTEXTS );
+	librdf_iterator *iterator;
+	librdf_node *node;
+	long capacity = 0;
+	int i, supported = 0;
+
+	contexts->contexts = NULL;
+	contexts->count = contexts->index = 0;
+
+	for ( i = 0; i < sharded->count; i++ ) {
+		if ( !(iterator = librdf_storage_get_contexts(sharded->shards[i])) ) continue;
+
+		supported = 1;
+		while ( ! librdf_iterator_end(iterator) ) {
+			if ( (node = librdf_iterator_get_object(iterator)) )
+				rleaf_shardedcontexts_add( contexts, node, &capacity );
+			librdf_iterator_next( iterator );
+		}
+		librdf_free_iterator( iterator );
+	}
+
+	if ( !supported ) {
+		rleaf_shardedcontexts_finished( contexts );
+		return NULL;
+	}
+
+	iterator = librdf_new_iterator( librdf_storage_get_world(storage), contexts,
+		rleaf_shardedcontexts_is_end, rleaf_shardedcontexts_next, rleaf_shardedcontexts_get,
+		rleaf_shardedcontexts_finished );
+
+	if ( !iterator ) rleaf_shardedcontexts_finished( contexts );
+	return iterator;
+}
+
+
+/*
+ * Storage get_feature method; a sharded storage has the features of its first shard.
+ */
+static librdf_node *
+rleaf_sharded_get_feature( librdf_storage *storage, librdf_uri *feature ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+
+	if ( !sharded->count ) return NULL;
+	return librdf_storage_get_feature( sharded->shards[0], feature );
+}
+
+
+/*
+ * Storage sync method.
+ */
+static int
+rleaf_sharded_sync( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i, rval = 0;
+
+	for ( i = 0; i < sharded->count; i++ )
+		if ( librdf_storage_sync(sharded->shards[i]) != 0 ) rval = 1;
+
+	return rval;
+}
+
+
+/*
+ * Storage transaction_start method. A transaction is started on every shard, or on none of
+ * them if any of them doesn't support transactions.
+ */
+static int
+rleaf_sharded_transaction_start( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i;
+
+	for ( i = 0; i < sharded->count; i++ ) {
+		if ( librdf_storage_transaction_start(sharded->shards[i]) != 0 ) {
+			while ( i-- > 0 ) librdf_storage_transaction_rollback( sharded->shards[i] );
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Storage transaction_commit method. Each shard's transaction is committed separately, so
+ * if one of them fails the others' changes are kept.
+ */
+static int
+rleaf_sharded_transaction_commit( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i, rval = 0;
+
+	for ( i = 0; i < sharded->count; i++ )
+		if ( librdf_storage_transaction_commit(sharded->shards[i]) != 0 ) rval = 1;
+
+	return rval;
+}
+
+
+/*
+ * Storage transaction_rollback method.
+ */
+static int
+rleaf_sharded_transaction_rollback( librdf_storage *storage ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i, rval = 0;
+
+	for ( i = 0; i < sharded->count; i++ ) {
+		rleaf_sharded_shard_changing( sharded, i );
+		if ( librdf_storage_transaction_rollback(sharded->shards[i]) != 0 ) rval = 1;
+	}
+
+	return rval;
+}
+
+
+/*
+ * Storage factory registration function.
+ */
+static void
+rleaf_sharded_register_factory( librdf_storage_factory *factory ) {
+	factory->version                    = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init                       = rleaf_sharded_init;
+	factory->clone                      = rleaf_sharded_clone;
+	factory->terminate                  = rleaf_sharded_terminate;
+	factory->open                       = rleaf_sharded_open;
+	factory->close                      = rleaf_sharded_close;
+	factory->size                       = rleaf_sharded_size;
+	factory->add_statement              = rleaf_sharded_add_statement;
+	factory->add_statements             = rleaf_sharded_add_statements;
+	factory->remove_statement           = rleaf_sharded_remove_statement;
+	factory->contains_statement         = rleaf_sharded_contains_statement;
+	factory->serialise                  = rleaf_sharded_serialise;
+	factory->find_statements            = rleaf_sharded_find_statements;
+	factory->context_add_statement      = rleaf_sharded_context_add_statement;
+	factory->context_add_statements     = rleaf_sharded_context_add_statements;
+	factory->context_remove_statement   = rleaf_sharded_context_remove_statement;
+	factory->context_remove_statements  = rleaf_sharded_context_remove_statements;
+	factory->context_serialise          = rleaf_sharded_context_serialise;
+	factory->find_statements_in_context = rleaf_sharded_find_statements_in_context;
+	factory->get_contexts               = rleaf_sharded_get_contexts;
+	factory->get_feature                = rleaf_sharded_get_feature;
+	factory->sync                       = rleaf_sharded_sync;
+	factory->transaction_start          = rleaf_sharded_transaction_start;
+	factory->transaction_commit         = rleaf_sharded_transaction_commit;
+	factory->transaction_rollback       = rleaf_sharded_transaction_rollback;
+}
+
+
+/*
+ * Register the 'sharded' storage module with the Redland world.
+ */
+void
+rleaf_register_sharded_storage_module( void ) {
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_SHARDED_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_SHARDED_NAME,
+		RLEAF_SHARDED_LABEL, rleaf_sharded_register_factory );
+}
+
+
+/* --------------------------------------------------------------
+ * Memory-management functions
+ * -------------------------------------------------------------- */
+
+/*
+ * Record the Redleaf::Stores in the +shards+ Array as the stores of the shards of the given
+ * sharded +storage+.
+ */
+static void
+rleaf_sharded_set_shard_stores( librdf_storage *storage, VALUE shards ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	int i;
+
+	if ( !sharded->shard_stores ) sharded->shard_stores = ALLOC_N( rleaf_STORE *, sharded->count );
+	for ( i = 0; i < sharded->count; i++ )
+		sharded->shard_stores[i] = rleaf_get_store( rb_ary_entry(shards, i) );
+}
+
+
+/*
+ * GC Free function. The sharded storage can outlive the store object (in a stream that's
+ * still open, for instance), but its shards' stores might not, so it stops forgetting their
+ * caches when it writes to them.
+ */
+static void
+rleaf_shardedstore_gc_free( rleaf_STORE *ptr ) {
+	rleaf_SHARDED *sharded;
+
+	if ( ptr && ptr->storage && (sharded = librdf_storage_get_instance(ptr->storage)) &&
+	     sharded->shard_stores )
+	{
+		xfree( sharded->shard_stores );
+		sharded->shard_stores = NULL;
+	}
+
+	rleaf_store_gc_free( ptr );
+}
+
+
+/*
+ * Set up the given +copy+ of the sharded store +orig+, made around a clone of its storage:
+ * each of the clone's shards is a clone of one of +orig+'s, which is wrapped in a new store
+ * of its own.
+ */
+void
+rleaf_sharded_store_init_copy( VALUE copy, VALUE orig ) {
+	librdf_storage *storage = rleaf_get_store( copy )->storage;
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( storage );
+	VALUE shards = rb_ary_new2( sharded->count ), orig_shards = rb_iv_get( orig, "@shards" );
+	int i;
+
+	for ( i = 0; i < sharded->count; i++ )
+		rb_ary_push( shards, rleaf_new_store_from_storage(rb_ary_entry(orig_shards, i),
+			sharded->shards[i]) );
+
+	rleaf_sharded_set_shard_stores( storage, shards );
+	rb_iv_set( copy, "@shards", rb_obj_freeze(shards) );
+}
+
+
+/* --------------------------------------------------------------
+ * Class methods
+ * -------------------------------------------------------------- */
+
+/*
+ *  call-seq:
+ *     Redleaf::ShardedStore.allocate   -> store
+ *
+ *  Allocate a new Redleaf::ShardedStore object.
+ *
+ */
+static VALUE
+rleaf_redleaf_shardedstore_s_allocate( VALUE klass ) {
+	return Data_Wrap_Struct( klass, rleaf_store_gc_mark, rleaf_shardedstore_gc_free, 0 );
+}
+
+
+/* --------------------------------------------------------------
+ * Instance methods
+ * -------------------------------------------------------------- */
+
+/*
+ *  call-seq:
+ *     Redleaf::ShardedStore.new( shards, name=nil, config={} )   -> store
+ *
+ *  Create a new store that partitions its statements across the Redleaf::Stores in the
+ *  +shards+ Array (Redleaf::Graphs can be given instead of their stores) by a hash of their
+ *  subjects. Searches with a subject only read the one shard it belongs to; other searches
+ *  read each shard in turn. Statements appended in bulk are partitioned into batches and
+ *  handed to each shard as whole streams.
+ *
+ *  The shard a subject belongs to depends on the number of shards, so persistent shards
+ *  must always be opened in the same order and number.
+ *
+ */
+static VALUE
+rleaf_redleaf_shardedstore_initialize( int argc, VALUE *argv, VALUE self ) {
+	VALUE shards = Qnil, name = Qnil, opthash = Qnil, shard;
+	librdf_storage **storages;
+	long i;
+
+	rb_scan_args( argc, argv, "12", &shards, &name, &opthash );
+
+	shards = rb_ary_dup( rb_Array(shards) );
+	if ( RARRAY_LEN(shards) == 0 )
+		rb_raise( rb_eArgError, "a sharded store needs at least one shard" );
+
+	for ( i = 0; i < RARRAY_LEN(shards); i++ ) {
+		shard = RARRAY_PTR(shards)[i];
+		if ( IsGraph(shard) ) shard = rleaf_get_graph( shard )->store;
+		if ( !IsStore(shard) )
+			rb_raise( rb_eTypeError, "wrong argument type %s (expected a Redleaf::Store)",
+				rb_obj_classname(shard) );
+		rb_ary_store( shards, i, shard );
+	}
+
+	rb_call_super( argc - 1, argv + 1 );
+
+	rleaf_log_with_context( self, "debug", "sharding across %ld stores", RARRAY_LEN(shards) );
+
+	storages = ALLOCA_N( librdf_storage *, RARRAY_LEN(shards) );
+	for ( i = 0; i < RARRAY_LEN(shards); i++ )
+		storages[i] = rleaf_get_store( RARRAY_PTR(shards)[i] )->storage;
+	rleaf_sharded_set_shards( rleaf_get_store(self)->storage, storages, (int)RARRAY_LEN(shards) );
+	rleaf_sharded_set_shard_stores( rleaf_get_store(self)->storage, shards );
+
+	rb_iv_set( self, "@shards", rb_obj_freeze(shards) );
+
+	return self;
+}
+
+
+/*
+ *  call-seq:
+ *     store.shard_for( subject )   -> store
+ *
+ *  Return the shard that statements about +subject+ are kept in.
+ *
+ */
+static VALUE
+rleaf_redleaf_shardedstore_shard_for( VALUE self, VALUE subject ) {
+	rleaf_SHARDED *sharded = librdf_storage_get_instance( rleaf_get_store(self)->storage );
+	librdf_node *node = rleaf_value_to_subject_node( subject );
+	int index;
+
+	if ( !node )
+		rb_raise( rb_eArgError, "can't convert %s to a subject",
+			RSTRING_PTR(rb_inspect(subject)) );
+
+	index = rleaf_sharded_shard_index( sharded, node );
+	librdf_free_node( node );
+
+	return rb_ary_entry( rb_iv_get(self, "@shards"), index );
+}
+
+
+/*
+ * Redleaf::ShardedStore class
+ */
+void
+rleaf_init_redleaf_sharded_store( void ) {
+	rleaf_log( "debug", "Initializing Redleaf::ShardedStore" );
+
+#ifdef FOR_RDOC
+	rleaf_mRedleaf = rb_define_module( "Redleaf" );
+	rleaf_cRedleafStore = rb_define_class_under( rleaf_mRedleaf, "Store", rb_cObject );
+#endif
+
+	rb_require( "redleaf/store/sharded" );
+	rleaf_cRedleafShardedStore =
+		rb_define_class_under( rleaf_mRedleaf, "ShardedStore", rleaf_cRedleafStore );
+
+	rb_define_alloc_func( rleaf_cRedleafShardedStore, rleaf_redleaf_shardedstore_s_allocate );
+
+	rb_define_method( rleaf_cRedleafShardedStore, "initialize",
+		rleaf_redleaf_shardedstore_initialize, -1 );
+	rb_define_method( rleaf_cRedleafShardedStore, "shard_for",
+		rleaf_redleaf_shardedstore_shard_for, 1 );
+}
+
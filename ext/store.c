@@ -49,6 +49,11 @@
 VALUE rleaf_cRedleafStore;
 VALUE rleaf_cRedleafHashesStore;
 
+static VALUE rleaf_store_backends = Qnil;
+
+/* How many statements Store#copy_to copies in each transaction by default */
+#define RLEAF_COPY_DEFAULT_BATCH_SIZE 10000
+
 static VALUE rleaf_redleaf_store_graph_eq( VALUE, VALUE );
 
 
@@ -56,33 +61,80 @@ static VALUE rleaf_redleaf_store_graph_eq( VALUE, VALUE );
  *	Memory-management functions
  * -------------------------------------------------- */
 
+/*
+ * Wrap the given +storage+ in a new rleaf_STORE with no cached fingerprint or size.
+ */
+static rleaf_STORE *
+rleaf_store_wrap( librdf_storage *storage ) {
+	rleaf_STORE *ptr = ALLOC( rleaf_STORE );
+
+	ptr->storage = storage;
+	ptr->graph   = Qnil;
+	ptr->fingerprint_valid = 0;
+	ptr->size_valid = 0;
+	ptr->size_tracked = 0;
+	ptr->context_sizes = Qnil;
+
+	return ptr;
+}
+
+
 /*
  * Allocation function
  */
 static rleaf_STORE *
 rleaf_store_alloc( const char *backend, const char *name, const char *optstring ) {
 	librdf_storage *storage = NULL;
-	rleaf_STORE *ptr = ALLOC( rleaf_STORE );
 
 	if ( (storage = librdf_new_storage( rleaf_rdf_world, backend, name, optstring )) == 0 )
 		rb_raise( rleaf_eRedleafStoreCreationError, 
 			"Could not create a new storage with: backend=\"%s\", name=\"%s\", optstring=\"%s\"", 
 			backend, name, optstring );
 
-	ptr->storage = storage;
-	ptr->graph   = Qnil;
+	/* rleaf_log( "debug", "alloc'ed a rleaf_STORE with storage <%p>", storage ); */
+	return rleaf_store_wrap( storage );
+}
 
-	/* rleaf_log( "debug", "alloc'ed a rleaf_STORE <%p> with storage <%p>", ptr, ptr->storage ); */
-	return ptr;
+
+/*
+ * Create a new store object of the same class as +orig+ around the given +storage+ (a
+ * clone of +orig+'s storage), taking a reference to it. The new store has its own cached
+ * fingerprint and size, so changes to one of the two don't spoil the other's.
+ */
+VALUE
+rleaf_new_store_from_storage( VALUE orig, librdf_storage *storage ) {
+	VALUE store = rb_obj_alloc( CLASS_OF(orig) );
+	VALUE ivars = rb_obj_instance_variables( orig );
+	long i;
+
+	librdf_storage_add_reference( storage );
+	DATA_PTR( store ) = rleaf_store_wrap( storage );
+
+	/* Carry over the name, options, and any subclass state kept in ivars */
+	for ( i = 0; i < RARRAY_LEN(ivars); i++ ) {
+		ID ivar = rb_to_id( RARRAY_PTR(ivars)[i] );
+		rb_ivar_set( store, ivar, rb_ivar_get(orig, ivar) );
+	}
+
+	/* Stores that read and write other stores clone those along with themselves */
+	if ( rb_obj_is_kind_of(orig, rleaf_cRedleafCachingStore) )
+		rleaf_caching_store_init_copy( store, orig );
+	else if ( rb_obj_is_kind_of(orig, rleaf_cRedleafShardedStore) )
+		rleaf_sharded_store_init_copy( store, orig );
+	else if ( rb_obj_is_kind_of(orig, rleaf_cRedleafOverlayStore) )
+		rleaf_overlay_store_init_copy( store, orig );
+
+	return store;
 }
 
 
 /*
  * GC Mark function
  */
-static void 
+void
 rleaf_store_gc_mark( rleaf_STORE *ptr ) {
 	if ( ptr && ptr->graph ) rb_gc_mark( ptr->graph );
+	if ( ptr ) rb_gc_mark( ptr->context_sizes );
 }
 
 
@@ -90,7 +142,7 @@ rleaf_store_gc_mark( rleaf_STORE *ptr ) {
 /*
  * GC Free function
  */
-static void
+void
 rleaf_store_gc_free( rleaf_STORE *ptr ) {
 	if ( ptr && rleaf_rdf_world ) {
 
@@ -159,6 +211,57 @@ rleaf_optstring_from_rubyhash( VALUE opthash ) {
 }
 
 
+/*
+ * Returns non-zero if the given +store+ supports contexts. Storages that don't report the
+ * contexts feature are asked for their contexts instead, which fails if they have none.
+ */
+static int
+rleaf_store_has_contexts( rleaf_STORE *store ) {
+	librdf_node *feature = librdf_storage_get_feature( store->storage, rleaf_contexts_feature );
+	librdf_iterator *contexts;
+	const char *value;
+	int rval;
+
+	if ( feature ) {
+		value = (const char *)librdf_node_get_literal_value( feature );
+		rval = value && strncmp( value, "1", 1 ) == 0;
+		librdf_free_node( feature );
+		return rval;
+	}
+
+	if ( !(contexts = librdf_storage_get_contexts(store->storage)) ) return 0;
+	librdf_free_iterator( contexts );
+	return 1;
+}
+
+
+/*
+ * Yield the number of statements copied so far to the block given to Store#copy_to.
+ */
+static VALUE
+rleaf_store_yield_progress( VALUE copied ) {
+	return rb_yield( copied );
+}
+
+
+/*
+ * Finish a batch of statements copied into +target+: commit the transaction if there is
+ * one, then call the progress block, if any, with the +copied+ total. Returns the state of
+ * any non-local exit from the block.
+ */
+static int
+rleaf_store_finish_copy_batch( rleaf_STORE *target, int in_transaction, long copied ) {
+	int state = 0;
+
+	if ( in_transaction && librdf_storage_transaction_commit(target->storage) != 0 )
+		return -1;
+	if ( rb_block_given_p() )
+		rb_protect( rleaf_store_yield_progress, LONG2NUM(copied), &state );
+
+	return state;
+}
+
+
 
 /* --------------------------------------------------------------
  * Class methods
@@ -181,7 +284,9 @@ rleaf_redleaf_store_s_allocate( VALUE klass ) {
  *  call-seq:
  *     Redleaf::Store.backends   -> hash
  *
- *  Return a Hash of supported backends from the underlying Redland library.
+ *  Return a Hash of supported backends from the underlying Redland library. The Hash is
+ *  built once when the extension is loaded and is frozen; call
+ *  Redleaf.refresh_capabilities to rebuild it.
  *
  *     Redleaf::Store.backends
  *     # => {"uri"=>"URI store (read-only)",
@@ -194,6 +299,17 @@ rleaf_redleaf_store_s_allocate( VALUE klass ) {
  */
 static VALUE
 rleaf_redleaf_store_s_backends( VALUE klass ) {
+	_UNUSED( klass );
+	return rleaf_store_backends;
+}
+
+
+/*
+ * (Re)build the frozen registry of storage backends that is returned from
+ * Redleaf::Store.backends.
+ */
+void
+rleaf_refresh_store_backends( void ) {
 	VALUE backends = rb_hash_new();
 	int i = 0;
 	const char *name, *label;
@@ -206,7 +322,7 @@ rleaf_redleaf_store_s_backends( VALUE klass ) {
 		i++;
 	}
 
-	return backends;
+	rleaf_store_backends = rleaf_deep_freeze( backends );
 }
 
 
@@ -375,6 +491,9 @@ rleaf_redleaf_store_graph_eq( VALUE self, VALUE graphobj ) {
 		rb_fatal( "librdf_storage_open failed on rleaf_STORE <%p> for rleaf_GRAPH <%p>", store, graph );
 
 	store->graph = graphobj;
+	store->fingerprint_valid = 0;
+	store->size_valid = 0;
+	store->context_sizes = Qnil;
 	graph->store = self;
 
 	return graphobj;
@@ -400,6 +519,124 @@ rleaf_redleaf_store_sync( VALUE self ) {
 }
 
 
+/*
+ *  call-seq:
+ *     store.copy_to( other_store, options={} )                  -> integer
+ *     store.copy_to( other_store, options={} ) {|copied| ... }  -> integer
+ *
+ *  Copy the receiver's statements into +other_store+ (a Redleaf::Store, or a Redleaf::Graph
+ *  whose store to use) straight from one storage to the other, and return the total number
+ *  of statements copied. Statements are copied in batches of <tt>:batch_size</tt> (default:
+ *  10000), each in its own transaction if +other_store+ supports them, and the block, if
+ *  given, is called with the total copied after each batch. Statements in a context are
+ *  added to the same context of +other_store+ unless <tt>:contexts</tt> is +false+ or
+ *  +other_store+ doesn't have contexts.
+ *
+ *  A copy that failed part-way can be resumed by passing the last total given to the
+ *  block as <tt>:skip</tt>; that many statements are skipped, which is only correct if the
+ *  receiver hasn't been changed in the meantime.
+ *
+ *     old_store.copy_to( new_store, :batch_size => 50_000 ) do |copied|
+ *         checkpoint.write( copied )
+ *     end
+ *
+ */
+static VALUE
+rleaf_redleaf_store_copy_to( int argc, VALUE *argv, VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self ), *target;
+	VALUE other, opthash = Qnil, val;
+	long batch_size = RLEAF_COPY_DEFAULT_BATCH_SIZE, skip = 0, copied, batched = 0;
+	int use_contexts = 1, in_transaction = 0, rval = 0, state;
+	librdf_stream *stream;
+	librdf_statement *statement;
+	librdf_node *context;
+
+	rb_scan_args( argc, argv, "11", &other, &opthash );
+
+	if ( IsGraph(other) ) other = rleaf_get_graph( other )->store;
+	if ( !IsStore(other) )
+		rb_raise( rb_eTypeError, "wrong argument type %s (expected a Redleaf::Store)",
+			rb_obj_classname(other) );
+	if ( other == self )
+		rb_raise( rb_eArgError, "can't copy a store into itself" );
+
+	if ( !NIL_P(opthash) ) {
+		Check_Type( opthash, T_HASH );
+		if ( RTEST(val = rb_hash_aref(opthash, ID2SYM(rb_intern("batch_size")))) )
+			batch_size = NUM2LONG( val );
+		if ( RTEST(val = rb_hash_aref(opthash, ID2SYM(rb_intern("skip")))) )
+			skip = NUM2LONG( val );
+		if ( rb_hash_aref(opthash, ID2SYM(rb_intern("contexts"))) == Qfalse )
+			use_contexts = 0;
+	}
+	if ( batch_size < 1 )
+		rb_raise( rb_eArgError, "batch size must be positive, not %ld", batch_size );
+	if ( skip < 0 )
+		rb_raise( rb_eArgError, "can't skip %ld statements", skip );
+
+	/* Storages are opened when they're associated with a graph */
+	rleaf_redleaf_store_graph( self );
+	rleaf_redleaf_store_graph( other );
+	target = rleaf_get_store( other );
+
+	if ( use_contexts ) use_contexts = rleaf_store_has_contexts( target );
+
+	if ( !(stream = librdf_storage_serialise(store->storage)) )
+		rb_raise( rleaf_eRedleafError, "could not create a stream over %s",
+			RSTRING_PTR(rb_inspect(self)) );
+
+	rleaf_log_with_context( self, "debug", "copying to %s in batches of %ld%s",
+		RSTRING_PTR(rb_inspect(other)), batch_size, use_contexts ? " with contexts" : "" );
+
+	for ( copied = 0; copied < skip && ! librdf_stream_end(stream); copied++ )
+		librdf_stream_next( stream );
+
+	target->fingerprint_valid = 0;
+	target->size_valid = 0;
+	target->context_sizes = Qnil;
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+
+		if ( !batched ) in_transaction = ( librdf_storage_transaction_start(target->storage) == 0 );
+
+		context = use_contexts ? (librdf_node *)librdf_stream_get_context( stream ) : NULL;
+		if ( context )
+			rval = librdf_storage_context_add_statement( target->storage, context, statement );
+		else
+			rval = librdf_storage_add_statement( target->storage, statement );
+		if ( rval != 0 ) break;
+
+		copied++;
+		if ( ++batched >= batch_size ) {
+			batched = 0;
+			if ( (state = rleaf_store_finish_copy_batch(target, in_transaction, copied)) != 0 ) {
+				librdf_free_stream( stream );
+				if ( state > 0 ) rb_jump_tag( state );
+				rb_raise( rleaf_eRedleafError, "failed to commit statements to %s after %ld",
+					RSTRING_PTR(rb_inspect(other)), copied - batch_size );
+			}
+			in_transaction = 0;
+		}
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	if ( rval != 0 ) {
+		if ( in_transaction ) librdf_storage_transaction_rollback( target->storage );
+		rb_raise( rleaf_eRedleafError, "failed to copy statements to %s after %ld",
+			RSTRING_PTR(rb_inspect(other)), copied - batched );
+	}
+
+	if ( batched && (state = rleaf_store_finish_copy_batch(target, in_transaction, copied)) != 0 ) {
+		if ( state > 0 ) rb_jump_tag( state );
+		rb_raise( rleaf_eRedleafError, "failed to commit statements to %s after %ld",
+			RSTRING_PTR(rb_inspect(other)), copied - batched );
+	}
+
+	return LONG2NUM( copied );
+}
+
 
 /*
  * Redleaf Store class
@@ -414,6 +651,17 @@ rleaf_init_redleaf_store( void ) {
 
 	rb_require( "redleaf/store" );
 
+	/* Build the backend registry before any concrete Store class declares its backend,
+	   including Redleaf's own storage modules */
+	rleaf_register_storage_modules();
+	rleaf_register_overlay_storage_module();
+	rleaf_register_writebehind_storage_module();
+	rleaf_register_caching_storage_module();
+	rleaf_register_sharded_storage_module();
+	rleaf_register_wal_storage_module();
+	rb_gc_register_address( &rleaf_store_backends );
+	rleaf_refresh_store_backends();
+
 	/* Redleaf::Store */
 	rleaf_cRedleafStore = rb_define_class_under( rleaf_mRedleaf, "Store", rb_cObject );
 	rb_define_alloc_func( rleaf_cRedleafStore, rleaf_redleaf_store_s_allocate );
@@ -431,6 +679,7 @@ rleaf_init_redleaf_store( void ) {
 	rb_define_method( rleaf_cRedleafStore, "graph", rleaf_redleaf_store_graph, 0 );
 	rb_define_method( rleaf_cRedleafStore, "graph=", rleaf_redleaf_store_graph_eq, 1 );
 	rb_define_method( rleaf_cRedleafStore, "sync", rleaf_redleaf_store_sync, 0 );
+	rb_define_method( rleaf_cRedleafStore, "copy_to", rleaf_redleaf_store_copy_to, -1 );
 
 	
 	/* Redleaf::HashesStore -- the default concrete Store class */
@@ -438,5 +687,21 @@ rleaf_init_redleaf_store( void ) {
 	rleaf_cRedleafHashesStore = 
 		rb_define_class_under( rleaf_mRedleaf, "HashesStore", rleaf_cRedleafStore );
 
+	/* Redleaf::DictionaryStore and Redleaf::SnapshotStore -- Redleaf's native stores */
+	rleaf_init_redleaf_dictionary_store();
+
+	/* Redleaf::OverlayStore and Redleaf::WriteBehindStore -- copy-on-write views and
+	   write-behind buffers over other stores */
+	rleaf_init_redleaf_overlay_store();
+
+	/* Redleaf::CachingStore -- read-through caches in front of other stores */
+	rleaf_init_redleaf_caching_store();
+
+	/* Redleaf::ShardedStore -- statements partitioned across other stores */
+	rleaf_init_redleaf_sharded_store();
+
+	/* Redleaf::WALStore -- in-memory stores made durable by an append-only log */
+	rleaf_init_redleaf_wal_store();
+
 }
 
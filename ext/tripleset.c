@@ -0,0 +1,996 @@
+/*
+ * Redleaf term dictionaries, id triple sets, and graph isomorphism
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#include "redleaf.h"
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ * -------------------------------------------------------------- */
+
+#define RLEAF_TERMDICT_INITIAL_CAPA 64
+#define RLEAF_ISO_SEED              0x5bd1e9955bd1e995ULL
+#define RLEAF_BNODE_HASH            0x2545f4914f6cdd1dULL
+
+/* State for an isomorphism search between the non-ground parts of two graphs */
+typedef struct rleaf_iso_state {
+	rleaf_TERMDICT	*dict;
+	rleaf_TRIPLE	*a, *b;        /* Sorted non-ground triples of each graph */
+	size_t			ntriples;
+	uint32_t		nbnodes;       /* Number of blank nodes in each graph */
+	uint32_t		*bnodes;       /* Term ids of blank nodes: graph a's, then graph b's */
+	uint32_t		*local;        /* Term id -> index into bnodes, or RLEAF_NO_TERM */
+	uint64_t		*colours;      /* Current colour of each blank node */
+	uint64_t		*scratch;      /* Per-bnode accumulator for a refinement round */
+	uint64_t		*sorted_a, *sorted_b;
+	uint32_t		distinct;      /* Number of distinct colours in graph a */
+	rleaf_TRIPLE	*mapped;
+
+	/* Individualization log: (a index, b index, colour) entries, grouped by search level */
+	uint32_t		*log_a, *log_b;
+	uint64_t		*log_colour;
+	size_t			log_len, log_capa;
+	size_t			*level_start;
+} rleaf_ISOSTATE;
+
+
+/* --------------------------------------------------------------
+ * Hashing
+ * -------------------------------------------------------------- */
+
+/*
+ * Finalizing mix function (from SplitMix64) -- spreads the bits of +x+ over all 64 bits
+ * of the result.
+ */
+uint64_t
+rleaf_mix64( uint64_t x ) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = ( x ^ (x >> 30) ) * 0xbf58476d1ce4e5b9ULL;
+	x = ( x ^ (x >> 27) ) * 0x94d049bb133111ebULL;
+	return x ^ ( x >> 31 );
+}
+
+
+/*
+ * Hash +len+ bytes at +ptr+ (64-bit FNV-1a, finalized with rleaf_mix64). Different +seed+s
+ * give independent hashes of the same bytes.
+ */
+uint64_t
+rleaf_hash_bytes( const void *ptr, size_t len, uint64_t seed ) {
+	const unsigned char *bytes = (const unsigned char *)ptr;
+	uint64_t hash = 0xcbf29ce484222325ULL ^ rleaf_mix64( seed );
+	size_t i;
+
+	for ( i = 0; i < len; i++ ) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return rleaf_mix64( hash ^ len );
+}
+
+
+/* --------------------------------------------------------------
+ * Term dictionary
+ * -------------------------------------------------------------- */
+
+/*
+ * Create a new, empty term dictionary.
+ */
+rleaf_TERMDICT *
+rleaf_new_termdict( void ) {
+	rleaf_TERMDICT *dict = ALLOC( rleaf_TERMDICT );
+
+	dict->arena_len    = 0;
+	dict->arena_capa   = RLEAF_TERMDICT_INITIAL_CAPA * 32;
+	dict->arena        = ALLOC_N( unsigned char, dict->arena_capa );
+
+	dict->count        = 0;
+	dict->capa         = RLEAF_TERMDICT_INITIAL_CAPA;
+	dict->offsets      = ALLOC_N( uint64_t, dict->capa );
+	dict->lengths      = ALLOC_N( uint32_t, dict->capa );
+	dict->hashes       = ALLOC_N( uint64_t, dict->capa );
+	dict->flags        = ALLOC_N( unsigned char, dict->capa );
+
+	dict->bucket_count = RLEAF_TERMDICT_INITIAL_CAPA * 2;
+	dict->buckets      = ALLOC_N( uint32_t, dict->bucket_count );
+	memset( dict->buckets, 0, sizeof(uint32_t) * dict->bucket_count );
+
+	dict->refs         = 1;
+
+	return dict;
+}
+
+
+/*
+ * Create a new term dictionary with the same terms and ids as +orig+.
+ */
+rleaf_TERMDICT *
+rleaf_copy_termdict( rleaf_TERMDICT *orig ) {
+	rleaf_TERMDICT *dict = ALLOC( rleaf_TERMDICT );
+
+	*dict = *orig;
+	dict->refs    = 1;
+	dict->arena   = ALLOC_N( unsigned char, dict->arena_capa );
+	dict->offsets = ALLOC_N( uint64_t, dict->capa );
+	dict->lengths = ALLOC_N( uint32_t, dict->capa );
+	dict->hashes  = ALLOC_N( uint64_t, dict->capa );
+	dict->flags   = ALLOC_N( unsigned char, dict->capa );
+	dict->buckets = ALLOC_N( uint32_t, dict->bucket_count );
+
+	MEMCPY( dict->arena, orig->arena, unsigned char, orig->arena_len );
+	MEMCPY( dict->offsets, orig->offsets, uint64_t, orig->count );
+	MEMCPY( dict->lengths, orig->lengths, uint32_t, orig->count );
+	MEMCPY( dict->hashes, orig->hashes, uint64_t, orig->count );
+	MEMCPY( dict->flags, orig->flags, unsigned char, orig->count );
+	MEMCPY( dict->buckets, orig->buckets, uint32_t, orig->bucket_count );
+
+	return dict;
+}
+
+
+/*
+ * Return the number of bytes of memory used by the given term dictionary.
+ */
+size_t
+rleaf_termdict_memsize( rleaf_TERMDICT *dict ) {
+	return sizeof(rleaf_TERMDICT) + dict->arena_capa +
+		dict->capa * ( sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + 1 ) +
+		dict->bucket_count * sizeof(uint32_t);
+}
+
+
+/*
+ * Free the given term dictionary.
+ */
+void
+rleaf_free_termdict( rleaf_TERMDICT *dict ) {
+	if ( !dict ) return;
+
+	xfree( dict->arena );
+	xfree( dict->offsets );
+	xfree( dict->lengths );
+	xfree( dict->hashes );
+	xfree( dict->flags );
+	xfree( dict->buckets );
+	xfree( dict );
+}
+
+
+/*
+ * Find the bucket for the key of the given +len+ and +hash+ in the dictionary, returning
+ * either the bucket which holds it or the empty bucket where it should be inserted.
+ */
+static uint32_t
+rleaf_termdict_find_bucket( rleaf_TERMDICT *dict, const unsigned char *key, size_t len,
+	uint64_t hash )
+{
+	uint32_t mask = dict->bucket_count - 1;
+	uint32_t i = (uint32_t)hash & mask;
+	uint32_t id;
+
+	while ( (id = dict->buckets[i]) ) {
+		id--;
+		if ( dict->hashes[id] == hash && dict->lengths[id] == len &&
+		     memcmp(dict->arena + dict->offsets[id], key, len) == 0 )
+			break;
+		i = ( i + 1 ) & mask;
+	}
+
+	return i;
+}
+
+
+/*
+ * Double the size of the dictionary's hash table and rehash its terms.
+ */
+static void
+rleaf_termdict_grow_buckets( rleaf_TERMDICT *dict ) {
+	uint32_t i, id, mask;
+
+	xfree( dict->buckets );
+	dict->bucket_count *= 2;
+	dict->buckets = ALLOC_N( uint32_t, dict->bucket_count );
+	memset( dict->buckets, 0, sizeof(uint32_t) * dict->bucket_count );
+	mask = dict->bucket_count - 1;
+
+	for ( id = 0; id < dict->count; id++ ) {
+		i = (uint32_t)dict->hashes[id] & mask;
+		while ( dict->buckets[i] ) i = ( i + 1 ) & mask;
+		dict->buckets[i] = id + 1;
+	}
+}
+
+
+/*
+ * Look up the id of the term with the given encoded +key+ in the dictionary, returning
+ * RLEAF_NO_TERM if it hasn't been interned.
+ */
+uint32_t
+rleaf_termdict_lookup( rleaf_TERMDICT *dict, const unsigned char *key, size_t len ) {
+	uint64_t hash = rleaf_hash_bytes( key, len, 0 );
+	uint32_t bucket = rleaf_termdict_find_bucket( dict, key, len, hash );
+
+	return dict->buckets[bucket] ? dict->buckets[bucket] - 1 : RLEAF_NO_TERM;
+}
+
+
+/*
+ * Return the id of the term with the given encoded +key+, adding it to the dictionary
+ * with the specified +flags+ if it isn't already present.
+ */
+uint32_t
+rleaf_termdict_intern( rleaf_TERMDICT *dict, const unsigned char *key, size_t len,
+	unsigned char flags )
+{
+	uint64_t hash = rleaf_hash_bytes( key, len, 0 );
+	uint32_t bucket = rleaf_termdict_find_bucket( dict, key, len, hash );
+	uint32_t id;
+
+	if ( dict->buckets[bucket] ) return dict->buckets[bucket] - 1;
+
+	if ( dict->count == dict->capa ) {
+		dict->capa *= 2;
+		REALLOC_N( dict->offsets, uint64_t, dict->capa );
+		REALLOC_N( dict->lengths, uint32_t, dict->capa );
+		REALLOC_N( dict->hashes, uint64_t, dict->capa );
+		REALLOC_N( dict->flags, unsigned char, dict->capa );
+	}
+
+	while ( dict->arena_len + len > dict->arena_capa ) {
+		dict->arena_capa *= 2;
+		REALLOC_N( dict->arena, unsigned char, dict->arena_capa );
+	}
+
+	id = dict->count++;
+	memcpy( dict->arena + dict->arena_len, key, len );
+	dict->offsets[id] = dict->arena_len;
+	dict->lengths[id] = (uint32_t)len;
+	dict->hashes[id]  = hash;
+	dict->flags[id]   = flags;
+	dict->arena_len  += len;
+	dict->buckets[bucket] = id + 1;
+
+	if ( dict->count * 10 > dict->bucket_count * 7 )
+		rleaf_termdict_grow_buckets( dict );
+
+	return id;
+}
+
+
+/*
+ * Encode the given +node+ into +buf+ (which is +size+ bytes long) after +prefix+ bytes,
+ * setting +len+ to the length of the encoding. If +buf+ is too small, a new buffer is
+ * allocated and returned instead, and the caller must xfree() it.
+ */
+static unsigned char *
+rleaf_encode_node( librdf_node *node, unsigned char *buf, size_t size, size_t prefix,
+	size_t *len )
+{
+	*len = librdf_node_encode( node, NULL, 0 );
+	if ( *len + prefix > size ) buf = ALLOC_N( unsigned char, *len + prefix );
+
+	librdf_node_encode( node, buf + prefix, *len );
+	return buf;
+}
+
+
+/*
+ * Return the id of the given +node+, interning it if necessary. Keys are a single scope byte
+ * followed by the node's librdf encoding; blank nodes are interned under the given +scope+ and
+ * everything else under scope 0, so the blank nodes of different graphs get distinct ids while
+ * their ground terms are shared.
+ */
+uint32_t
+rleaf_termdict_intern_node( rleaf_TERMDICT *dict, librdf_node *node, unsigned char scope ) {
+	unsigned char stackbuf[ 512 ];
+	int is_blank = librdf_node_is_blank( node );
+	size_t len;
+	unsigned char *key = rleaf_encode_node( node, stackbuf, sizeof(stackbuf), 1, &len );
+	uint32_t id;
+
+	key[0] = is_blank ? scope : 0;
+	id = rleaf_termdict_intern( dict, key, len + 1, is_blank ? RLEAF_TERM_BLANK : 0 );
+
+	if ( key != stackbuf ) xfree( key );
+
+	return id;
+}
+
+
+/*
+ * Return the id of the given +node+ if it's already in the dictionary under the given
+ * blank node +scope+, or RLEAF_NO_TERM if it isn't.
+ */
+uint32_t
+rleaf_termdict_lookup_node( rleaf_TERMDICT *dict, librdf_node *node, unsigned char scope ) {
+	unsigned char stackbuf[ 512 ];
+	size_t len;
+	unsigned char *key = rleaf_encode_node( node, stackbuf, sizeof(stackbuf), 1, &len );
+	uint32_t id;
+
+	key[0] = librdf_node_is_blank( node ) ? scope : 0;
+	id = rleaf_termdict_lookup( dict, key, len + 1 );
+
+	if ( key != stackbuf ) xfree( key );
+
+	return id;
+}
+
+
+/*
+ * Return a new librdf_node for the term with the specified +id+. The caller is responsible
+ * for freeing it.
+ */
+librdf_node *
+rleaf_termdict_get_node( rleaf_TERMDICT *dict, uint32_t id ) {
+	if ( id >= dict->count )
+		rb_raise( rb_eIndexError, "no term with id %u", id );
+
+	return librdf_node_decode( rleaf_rdf_world, NULL, dict->arena + dict->offsets[id] + 1,
+		dict->lengths[id] - 1 );
+}
+
+
+/* --------------------------------------------------------------
+ * Fingerprints
+ * -------------------------------------------------------------- */
+
+/*
+ * Compute the 128-bit hash of a single +node+. All blank nodes hash to the same value, so
+ * fingerprints don't depend on how a graph's blank nodes happen to be labelled. That also
+ * means they don't depend on how the blank nodes are connected: graphs that differ only in
+ * which bnode is which have the same fingerprint. Hashing each bnode by its neighbourhood
+ * would tell them apart, but then a statement's hash would change with the other statements
+ * about its bnodes, and the fingerprint couldn't be kept up to date one statement at a time.
+ */
+static void
+rleaf_node_hash128( librdf_node *node, uint64_t hash[2] ) {
+	unsigned char stackbuf[ 512 ];
+	unsigned char *encoded;
+	size_t len;
+
+	if ( librdf_node_is_blank(node) ) {
+		hash[0] = RLEAF_BNODE_HASH;
+		hash[1] = ~RLEAF_BNODE_HASH;
+		return;
+	}
+
+	encoded = rleaf_encode_node( node, stackbuf, sizeof(stackbuf), 0, &len );
+	hash[0] = rleaf_hash_bytes( encoded, len, 1 );
+	hash[1] = rleaf_hash_bytes( encoded, len, 2 );
+	if ( encoded != stackbuf ) xfree( encoded );
+}
+
+
+/*
+ * Compute the 128-bit fingerprint of a single statement into +fingerprint+. A graph's
+ * fingerprint is the sum of the fingerprints of its statements, so it can be updated
+ * incrementally as statements are added and removed.
+ */
+void
+rleaf_statement_fingerprint( librdf_statement *stmt, uint64_t fingerprint[2] ) {
+	uint64_t s[2], p[2], o[2];
+	int i;
+
+	rleaf_node_hash128( librdf_statement_get_subject(stmt), s );
+	rleaf_node_hash128( librdf_statement_get_predicate(stmt), p );
+	rleaf_node_hash128( librdf_statement_get_object(stmt), o );
+
+	for ( i = 0; i < 2; i++ )
+		fingerprint[i] = rleaf_mix64( s[i] + rleaf_mix64(p[i] + rleaf_mix64(o[i] + i)) );
+}
+
+
+/* --------------------------------------------------------------
+ * Triple sets
+ * -------------------------------------------------------------- */
+
+/*
+ * Initialize an empty triple set.
+ */
+void
+rleaf_init_tripleset( rleaf_TRIPLESET *set ) {
+	set->triples = NULL;
+	set->count   = 0;
+	set->capa    = 0;
+}
+
+
+/*
+ * Free the triples in the given set and reset it to empty.
+ */
+void
+rleaf_clear_tripleset( rleaf_TRIPLESET *set ) {
+	if ( set->triples ) xfree( set->triples );
+	rleaf_init_tripleset( set );
+}
+
+
+/*
+ * Append a triple to the set.
+ */
+void
+rleaf_tripleset_add( rleaf_TRIPLESET *set, uint32_t s, uint32_t p, uint32_t o ) {
+	if ( set->count == set->capa ) {
+		set->capa = set->capa ? set->capa * 2 : 64;
+		REALLOC_N( set->triples, rleaf_TRIPLE, set->capa );
+	}
+
+	set->triples[ set->count ].s = s;
+	set->triples[ set->count ].p = p;
+	set->triples[ set->count ].o = o;
+	set->count++;
+}
+
+
+/*
+ * qsort comparison function for rleaf_TRIPLEs, in subject, predicate, object order.
+ */
+int
+rleaf_triple_cmp( const void *a, const void *b ) {
+	const rleaf_TRIPLE *x = (const rleaf_TRIPLE *)a, *y = (const rleaf_TRIPLE *)b;
+
+	if ( x->s != y->s ) return x->s < y->s ? -1 : 1;
+	if ( x->p != y->p ) return x->p < y->p ? -1 : 1;
+	if ( x->o != y->o ) return x->o < y->o ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * Sort the triples in the set and remove any duplicates.
+ */
+void
+rleaf_tripleset_sort( rleaf_TRIPLESET *set ) {
+	size_t i, j = 0;
+
+	if ( set->count < 2 ) return;
+	qsort( set->triples, set->count, sizeof(rleaf_TRIPLE), rleaf_triple_cmp );
+
+	for ( i = 1; i < set->count; i++ ) {
+		if ( rleaf_triple_cmp(&set->triples[j], &set->triples[i]) != 0 )
+			set->triples[ ++j ] = set->triples[ i ];
+	}
+	set->count = j + 1;
+}
+
+
+/*
+ * Add the statements from the given +stream+ to the +set+, interning their nodes in +dict+
+ * with the given blank node +scope+. Returns the number of statements read. The stream is
+ * exhausted but not freed.
+ */
+size_t
+rleaf_tripleset_add_stream( rleaf_TRIPLESET *set, rleaf_TERMDICT *dict, librdf_stream *stream,
+	unsigned char scope )
+{
+	librdf_statement *stmt;
+	size_t count = 0;
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(stmt = librdf_stream_get_object(stream)) ) break;
+
+		rleaf_tripleset_add( set,
+			rleaf_termdict_intern_node(dict, librdf_statement_get_subject(stmt), scope),
+			rleaf_termdict_intern_node(dict, librdf_statement_get_predicate(stmt), scope),
+			rleaf_termdict_intern_node(dict, librdf_statement_get_object(stmt), scope) );
+
+		count++;
+		librdf_stream_next( stream );
+	}
+
+	return count;
+}
+
+
+/* --------------------------------------------------------------
+ * Triple hash sets
+ * -------------------------------------------------------------- */
+
+#define RLEAF_TRIPLE_HASH( s, p, o ) \
+	rleaf_mix64( (uint64_t)(s) * 0x9e3779b97f4a7c15ULL ^ rleaf_mix64(((uint64_t)(p) << 32) | (o)) )
+
+/*
+ * Initialize an empty triple hash set.
+ */
+void
+rleaf_init_triplehash( rleaf_TRIPLEHASH *set ) {
+	set->slots = NULL;
+	set->count = 0;
+	set->capa  = 0;
+}
+
+
+/*
+ * Free the slots of the given hash set and reset it to empty.
+ */
+void
+rleaf_clear_triplehash( rleaf_TRIPLEHASH *set ) {
+	if ( set->slots ) xfree( set->slots );
+	rleaf_init_triplehash( set );
+}
+
+
+/*
+ * Return the slot which holds the specified triple, or the empty slot where it would go.
+ */
+static rleaf_TRIPLE *
+rleaf_triplehash_slot( rleaf_TRIPLEHASH *set, uint32_t s, uint32_t p, uint32_t o ) {
+	size_t mask = set->capa - 1;
+	size_t i = (size_t)RLEAF_TRIPLE_HASH( s, p, o ) & mask;
+	rleaf_TRIPLE *slot;
+
+	for ( slot = &set->slots[i]; slot->s != RLEAF_NO_TERM; slot = &set->slots[i] ) {
+		if ( slot->s == s && slot->p == p && slot->o == o ) break;
+		i = ( i + 1 ) & mask;
+	}
+
+	return slot;
+}
+
+
+/*
+ * Double the capacity of the hash set and rehash its triples.
+ */
+static void
+rleaf_triplehash_grow( rleaf_TRIPLEHASH *set ) {
+	rleaf_TRIPLE *old = set->slots, *slot;
+	size_t i, old_capa = set->capa;
+
+	set->capa  = old_capa ? old_capa * 2 : 256;
+	set->slots = ALLOC_N( rleaf_TRIPLE, set->capa );
+	for ( i = 0; i < set->capa; i++ ) set->slots[i].s = RLEAF_NO_TERM;
+
+	for ( i = 0; i < old_capa; i++ ) {
+		if ( old[i].s == RLEAF_NO_TERM ) continue;
+		slot = rleaf_triplehash_slot( set, old[i].s, old[i].p, old[i].o );
+		*slot = old[i];
+	}
+
+	if ( old ) xfree( old );
+}
+
+
+/*
+ * Add a triple to the hash set. Returns 1 if it was added, or 0 if it was already present.
+ */
+int
+rleaf_triplehash_add( rleaf_TRIPLEHASH *set, uint32_t s, uint32_t p, uint32_t o ) {
+	rleaf_TRIPLE *slot;
+
+	if ( (set->count + 1) * 10 > set->capa * 7 ) rleaf_triplehash_grow( set );
+
+	slot = rleaf_triplehash_slot( set, s, p, o );
+	if ( slot->s != RLEAF_NO_TERM ) return 0;
+
+	slot->s = s;
+	slot->p = p;
+	slot->o = o;
+	set->count++;
+
+	return 1;
+}
+
+
+/*
+ * Returns 1 if the hash set contains the specified triple.
+ */
+int
+rleaf_triplehash_contains( rleaf_TRIPLEHASH *set, uint32_t s, uint32_t p, uint32_t o ) {
+	if ( set->count == 0 ) return 0;
+	return rleaf_triplehash_slot( set, s, p, o )->s != RLEAF_NO_TERM;
+}
+
+
+/* --------------------------------------------------------------
+ * Isomorphism
+ *
+ * Ground triples are compared directly as sorted id arrays, since ground terms share ids
+ * between the two graphs. Blank nodes are partitioned by iterative colour refinement:
+ * each round, a bnode's new colour is a hash of its old colour and the commutative sum of
+ * hashes of the (role, colours of the other terms) of every triple it appears in. When the
+ * partition stops getting finer, a tied colour class is broken by individualizing nodes
+ * and refining again, backtracking only if the resulting mapping doesn't verify.
+ * -------------------------------------------------------------- */
+
+/* The colour of a term: its refined colour if it's a bnode, or a hash of its id otherwise */
+#define RLEAF_ISO_COLOUR( st, id ) \
+	( (st)->local[(id)] == RLEAF_NO_TERM ? rleaf_mix64((uint64_t)(id) + 1) : \
+	  (st)->colours[ (st)->local[(id)] ] )
+
+#define RLEAF_ISO_EDGE( role, x, y ) rleaf_mix64( rleaf_mix64((x) + (role)) ^ (y) )
+
+
+/*
+ * qsort comparison function for uint64_t colours.
+ */
+static int
+rleaf_iso_colour_cmp( const void *a, const void *b ) {
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : ( x > y ? 1 : 0 );
+}
+
+
+/*
+ * Add the contribution of each of the given +triples+ to the accumulators of the bnodes
+ * in them.
+ */
+static void
+rleaf_iso_accumulate( rleaf_ISOSTATE *st, rleaf_TRIPLE *triples ) {
+	size_t i;
+
+	for ( i = 0; i < st->ntriples; i++ ) {
+		const rleaf_TRIPLE *t = &triples[i];
+		const uint64_t cs = RLEAF_ISO_COLOUR( st, t->s );
+		const uint64_t cp = RLEAF_ISO_COLOUR( st, t->p );
+		const uint64_t co = RLEAF_ISO_COLOUR( st, t->o );
+
+		if ( st->local[t->s] != RLEAF_NO_TERM )
+			st->scratch[ st->local[t->s] ] += RLEAF_ISO_EDGE( 1, cp, co );
+		if ( st->local[t->p] != RLEAF_NO_TERM )
+			st->scratch[ st->local[t->p] ] += RLEAF_ISO_EDGE( 2, cs, co );
+		if ( st->local[t->o] != RLEAF_NO_TERM )
+			st->scratch[ st->local[t->o] ] += RLEAF_ISO_EDGE( 3, cs, cp );
+	}
+}
+
+
+/*
+ * Sort the colours of both graphs' bnodes and count the distinct colours in the first one.
+ * Returns 1 if the two graphs have the same multiset of colours.
+ */
+static int
+rleaf_iso_compare_colours( rleaf_ISOSTATE *st ) {
+	uint32_t i, n = st->nbnodes;
+
+	memcpy( st->sorted_a, st->colours, sizeof(uint64_t) * n );
+	memcpy( st->sorted_b, st->colours + n, sizeof(uint64_t) * n );
+	qsort( st->sorted_a, n, sizeof(uint64_t), rleaf_iso_colour_cmp );
+	qsort( st->sorted_b, n, sizeof(uint64_t), rleaf_iso_colour_cmp );
+
+	st->distinct = n ? 1 : 0;
+	for ( i = 1; i < n; i++ )
+		if ( st->sorted_a[i] != st->sorted_a[i - 1] ) st->distinct++;
+
+	return memcmp( st->sorted_a, st->sorted_b, sizeof(uint64_t) * n ) == 0;
+}
+
+
+/*
+ * Refine the bnode colours of both graphs until the partition of the first graph stops
+ * getting finer. Returns 0 if the graphs' colourings diverge, which means they can't be
+ * isomorphic under the current individualization.
+ */
+static int
+rleaf_iso_refine( rleaf_ISOSTATE *st ) {
+	uint32_t i, previous;
+
+	if ( !rleaf_iso_compare_colours(st) ) return 0;
+
+	do {
+		previous = st->distinct;
+
+		memset( st->scratch, 0, sizeof(uint64_t) * st->nbnodes * 2 );
+		rleaf_iso_accumulate( st, st->a );
+		rleaf_iso_accumulate( st, st->b );
+
+		for ( i = 0; i < st->nbnodes * 2; i++ )
+			st->colours[i] = rleaf_mix64( st->colours[i] ^ rleaf_mix64(st->scratch[i]) );
+
+		if ( !rleaf_iso_compare_colours(st) ) return 0;
+	} while ( st->distinct > previous );
+
+	return 1;
+}
+
+
+/*
+ * Check the mapping implied by a discrete colouring: map each bnode in the first graph to
+ * the bnode of the same colour in the second, and compare the translated triples.
+ */
+static int
+rleaf_iso_verify( rleaf_ISOSTATE *st ) {
+	uint32_t i, j, n = st->nbnodes;
+	uint32_t *mapping = ALLOC_N( uint32_t, n );
+	size_t k;
+	int result;
+
+	/* Discrete colourings are permutations of the same sorted colours, so a binary search
+	   of graph b's sorted colours finds each node's counterpart. */
+	for ( i = 0; i < n; i++ ) {
+		uint64_t *found = bsearch( &st->colours[i], st->sorted_b, n, sizeof(uint64_t),
+			rleaf_iso_colour_cmp );
+		mapping[ found - st->sorted_b ] = i;
+	}
+	for ( j = 0; j < n; j++ ) {
+		uint64_t *found = bsearch( &st->colours[n + j], st->sorted_b, n, sizeof(uint64_t),
+			rleaf_iso_colour_cmp );
+		st->scratch[ mapping[found - st->sorted_b] ] = st->bnodes[ n + j ];
+	}
+
+	for ( k = 0; k < st->ntriples; k++ ) {
+		const rleaf_TRIPLE *t = &st->a[k];
+		rleaf_TRIPLE *m = &st->mapped[k];
+
+		m->s = st->local[t->s] == RLEAF_NO_TERM ? t->s : (uint32_t)st->scratch[ st->local[t->s] ];
+		m->p = st->local[t->p] == RLEAF_NO_TERM ? t->p : (uint32_t)st->scratch[ st->local[t->p] ];
+		m->o = st->local[t->o] == RLEAF_NO_TERM ? t->o : (uint32_t)st->scratch[ st->local[t->o] ];
+	}
+
+	qsort( st->mapped, st->ntriples, sizeof(rleaf_TRIPLE), rleaf_triple_cmp );
+	result = memcmp( st->mapped, st->b, sizeof(rleaf_TRIPLE) * st->ntriples ) == 0;
+
+	xfree( mapping );
+	return result;
+}
+
+
+/*
+ * Append an individualization of bnode +a+ of the first graph and bnode +b+ of the second
+ * to the log, giving both the specified +colour+.
+ */
+static void
+rleaf_iso_individualize( rleaf_ISOSTATE *st, uint32_t a, uint32_t b, uint64_t colour ) {
+	if ( st->log_len == st->log_capa ) {
+		st->log_capa = st->log_capa ? st->log_capa * 2 : 64;
+		REALLOC_N( st->log_a, uint32_t, st->log_capa );
+		REALLOC_N( st->log_b, uint32_t, st->log_capa );
+		REALLOC_N( st->log_colour, uint64_t, st->log_capa );
+	}
+
+	st->log_a[ st->log_len ] = a;
+	st->log_b[ st->log_len ] = b;
+	st->log_colour[ st->log_len ] = colour;
+	st->log_len++;
+
+	st->colours[ a ] = colour;
+	st->colours[ st->nbnodes + b ] = colour;
+}
+
+
+/*
+ * Restore the colouring at the start of the search at +level+ by replaying the
+ * refinements and individualizations of the levels above it. Only needed when
+ * backtracking, so the search doesn't have to keep a copy of the colours per level.
+ */
+static void
+rleaf_iso_replay( rleaf_ISOSTATE *st, size_t level ) {
+	size_t l, k;
+
+	for ( k = 0; k < st->nbnodes * 2; k++ ) st->colours[k] = RLEAF_ISO_SEED;
+
+	for ( l = 0; l < level; l++ ) {
+		rleaf_iso_refine( st );
+		for ( k = st->level_start[l]; k < st->level_start[l + 1]; k++ ) {
+			st->colours[ st->log_a[k] ] = st->log_colour[k];
+			st->colours[ st->nbnodes + st->log_b[k] ] = st->log_colour[k];
+		}
+	}
+
+	st->log_len = st->level_start[ level ];
+}
+
+
+/*
+ * Search for an isomorphism at the given +level+ of individualization.
+ */
+static int
+rleaf_iso_search( rleaf_ISOSTATE *st, size_t level ) {
+	uint32_t i, j, k, n = st->nbnodes, run, best_run = 0;
+	uint64_t tied = 0, salt;
+
+	if ( !rleaf_iso_refine(st) ) return 0;
+	if ( st->distinct == n ) return rleaf_iso_verify( st );
+
+	/* Pick the smallest tied colour class to break */
+	for ( i = 0; i < n; i += run ) {
+		for ( run = 1; i + run < n && st->sorted_a[i + run] == st->sorted_a[i]; run++ ) ;
+		if ( run > 1 && (best_run == 0 || run < best_run) ) {
+			best_run = run;
+			tied = st->sorted_a[i];
+		}
+	}
+
+	st->level_start[ level ] = st->log_len;
+
+	/* First try pairing every member of the class in order, which succeeds immediately for
+	   the common case of interchangeable bnodes. */
+	for ( i = 0, j = 0, k = 0; i < n; i++ ) {
+		if ( st->colours[i] != tied ) continue;
+		while ( st->colours[n + j] != tied ) j++;
+		salt = rleaf_mix64( ((uint64_t)level << 32) + k++ + 1 );
+		rleaf_iso_individualize( st, i, j++, rleaf_mix64(tied ^ salt) );
+	}
+	st->level_start[ level + 1 ] = st->log_len;
+	if ( rleaf_iso_search(st, level + 1) ) return 1;
+
+	/* Otherwise, try the first member of the class against each candidate in turn */
+	rleaf_iso_replay( st, level );
+	rleaf_iso_refine( st );
+	for ( i = 0; st->colours[i] != tied; i++ ) ;
+	salt = rleaf_mix64( ((uint64_t)level << 32) | 0x80000000UL );
+
+	for ( j = 0; j < n; j++ ) {
+		if ( st->colours[n + j] != tied ) continue;
+
+		rleaf_iso_individualize( st, i, j, rleaf_mix64(tied ^ salt) );
+		st->level_start[ level + 1 ] = st->log_len;
+		if ( rleaf_iso_search(st, level + 1) ) return 1;
+
+		rleaf_iso_replay( st, level );
+		rleaf_iso_refine( st );
+	}
+
+	return 0;
+}
+
+
+/*
+ * Split the sorted triples in +set+ into ground triples and triples with at least one blank
+ * node.
+ */
+static void
+rleaf_iso_partition( rleaf_TERMDICT *dict, rleaf_TRIPLESET *set, rleaf_TRIPLESET *ground,
+	rleaf_TRIPLESET *nonground )
+{
+	size_t i;
+
+	for ( i = 0; i < set->count; i++ ) {
+		const rleaf_TRIPLE *t = &set->triples[i];
+
+		if ( rleaf_termdict_is_blank(dict, t->s) || rleaf_termdict_is_blank(dict, t->p) ||
+		     rleaf_termdict_is_blank(dict, t->o) )
+			rleaf_tripleset_add( nonground, t->s, t->p, t->o );
+		else
+			rleaf_tripleset_add( ground, t->s, t->p, t->o );
+	}
+}
+
+
+/*
+ * Assign a local index to each of the bnodes in the given +triples+, starting at +next+.
+ * Returns the next unassigned index.
+ */
+static uint32_t
+rleaf_iso_index_bnodes( rleaf_ISOSTATE *st, rleaf_TRIPLESET *triples, uint32_t next ) {
+	size_t i;
+	int k;
+
+	for ( i = 0; i < triples->count; i++ ) {
+		const uint32_t terms[3] = {
+			triples->triples[i].s, triples->triples[i].p, triples->triples[i].o
+		};
+
+		for ( k = 0; k < 3; k++ ) {
+			if ( rleaf_termdict_is_blank(st->dict, terms[k]) && st->local[terms[k]] == RLEAF_NO_TERM ) {
+				st->local[ terms[k] ] = next;
+				st->bnodes[ next++ ] = terms[k];
+			}
+		}
+	}
+
+	return next;
+}
+
+
+/*
+ * Returns 1 if the triple sets +a+ and +b+, whose terms are both interned in +dict+ (with
+ * different blank node scopes) are isomorphic, that is, if they are equal under some
+ * one-to-one mapping between their blank nodes. Both sets are sorted as a side-effect.
+ */
+int
+rleaf_triplesets_isomorphic( rleaf_TERMDICT *dict, rleaf_TRIPLESET *a, rleaf_TRIPLESET *b ) {
+	rleaf_TRIPLESET ground_a, ground_b, nonground_a, nonground_b;
+	rleaf_ISOSTATE st;
+	uint32_t i, total;
+	int result = 0;
+
+	rleaf_tripleset_sort( a );
+	rleaf_tripleset_sort( b );
+	if ( a->count != b->count ) return 0;
+
+	rleaf_init_tripleset( &ground_a );
+	rleaf_init_tripleset( &ground_b );
+	rleaf_init_tripleset( &nonground_a );
+	rleaf_init_tripleset( &nonground_b );
+	rleaf_iso_partition( dict, a, &ground_a, &nonground_a );
+	rleaf_iso_partition( dict, b, &ground_b, &nonground_b );
+
+	/* Ground triples must match exactly */
+	if ( ground_a.count != ground_b.count || nonground_a.count != nonground_b.count ||
+	     (ground_a.count &&
+	      memcmp(ground_a.triples, ground_b.triples, sizeof(rleaf_TRIPLE) * ground_a.count) != 0) )
+		goto done;
+
+	if ( nonground_a.count == 0 ) {
+		result = 1;
+		goto done;
+	}
+
+	memset( &st, 0, sizeof(st) );
+	st.dict     = dict;
+	st.a        = nonground_a.triples;
+	st.b        = nonground_b.triples;
+	st.ntriples = nonground_a.count;
+	st.local    = ALLOC_N( uint32_t, dict->count );
+	st.bnodes   = ALLOC_N( uint32_t, dict->count );
+	for ( i = 0; i < dict->count; i++ ) st.local[i] = RLEAF_NO_TERM;
+
+	st.nbnodes = rleaf_iso_index_bnodes( &st, &nonground_a, 0 );
+	total = rleaf_iso_index_bnodes( &st, &nonground_b, st.nbnodes );
+
+	if ( total == st.nbnodes * 2 ) {
+		st.colours     = ALLOC_N( uint64_t, total );
+		st.scratch     = ALLOC_N( uint64_t, total );
+		st.sorted_a    = ALLOC_N( uint64_t, st.nbnodes );
+		st.sorted_b    = ALLOC_N( uint64_t, st.nbnodes );
+		st.mapped      = ALLOC_N( rleaf_TRIPLE, st.ntriples );
+		st.level_start = ALLOC_N( size_t, st.nbnodes + 2 );
+		for ( i = 0; i < total; i++ ) st.colours[i] = RLEAF_ISO_SEED;
+
+		result = rleaf_iso_search( &st, 0 );
+
+		xfree( st.colours );
+		xfree( st.scratch );
+		xfree( st.sorted_a );
+		xfree( st.sorted_b );
+		xfree( st.mapped );
+		xfree( st.level_start );
+		if ( st.log_a ) {
+			xfree( st.log_a );
+			xfree( st.log_b );
+			xfree( st.log_colour );
+		}
+	}
+
+	xfree( st.local );
+	xfree( st.bnodes );
+
+  done:
+	rleaf_clear_tripleset( &ground_a );
+	rleaf_clear_tripleset( &ground_b );
+	rleaf_clear_tripleset( &nonground_a );
+	rleaf_clear_tripleset( &nonground_b );
+
+	return result;
+}
+
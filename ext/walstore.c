@@ -0,0 +1,979 @@
+/*
+ * Redleaf write-ahead log storage
+ * $Id$
+ * --
+ * Authors
+ *
+ * - Michael Granger <ged@FaerieMUD.org>
+ *
+ * Copyright (c) 2008, 2009 Michael Granger
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice, this
+ *    list of conditions and the following disclaimer in the documentation and/or
+ *    other materials provided with the distribution.
+ *
+ *  * Neither the name of the authors, nor the names of its contributors may be used to
+ *    endorse or promote products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+
+#include "redleaf.h"
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/* --------------------------------------------------------------
+ * Declarations
+ * -------------------------------------------------------------- */
+
+VALUE rleaf_cRedleafWALStore;
+
+#define RLEAF_WAL_NAME              "wal"
+#define RLEAF_WAL_LABEL             "Indexes in memory made durable by an append-only log"
+
+#define RLEAF_WAL_LOG_MAGIC         "RLEAFWAL"
+#define RLEAF_WAL_SNAPSHOT_MAGIC    "RLEAFWSN"
+#define RLEAF_WAL_VERSION           1
+
+/* The length of the header at the start of log and snapshot files: the magic, the
+   version, and four reserved bytes */
+#define RLEAF_WAL_HEADER_LEN        16
+
+/* The length of the header in front of each record: the length of its payload and the
+   CRC-32 of it. The payload is the operation byte followed by the encoded statement. */
+#define RLEAF_WAL_RECORD_HEADER_LEN 8
+
+/* Records that claim to be longer than this are taken to be corrupt */
+#define RLEAF_WAL_MAX_RECORD_LEN    ( 64 * 1024 * 1024 )
+
+/* How many bytes of records are collected before they're written while making a snapshot */
+#define RLEAF_WAL_WRITE_CHUNK       ( 256 * 1024 )
+
+/* The defaults for how many records are written to the log with each fsync(), and how
+   many records the log can hold before a snapshot is made and the log is started over */
+#define RLEAF_WAL_DEFAULT_GROUP_COMMIT   64
+#define RLEAF_WAL_DEFAULT_SNAPSHOT_EVERY 100000
+
+/* Record operations */
+#define RLEAF_WAL_OP_ADD            'A'
+#define RLEAF_WAL_OP_REMOVE         'R'
+
+/*
+ * A WAL store's state. Its statements live in +data+, a 'dictionary' storage. Each change
+ * is appended to +buffer+ as a log record, and the buffer is written to the log file open
+ * on +fd+ and fsync()ed once it holds +group_commit+ records, or when the store is synced.
+ * Once the log holds +snapshot_every+ records, the statements are written to the snapshot
+ * file and the log is truncated. Clones of a store have no log (+fd+ is -1).
+ */
+typedef struct rleaf_walstore {
+	librdf_storage	*data;
+	char			*path;
+	char			*snapshot_path;
+	int				fd;
+	unsigned char	*buffer;
+	size_t			buffer_len, buffer_capa;
+	long			buffered;
+	long			group_commit;
+	long			snapshot_every;
+	long			log_records;
+	long			log_bytes;
+	long			commits;
+	long			snapshots;
+} rleaf_WALSTORE;
+
+static uint32_t rleaf_wal_crc_table[ 256 ];
+static int rleaf_wal_crc_table_ready = 0;
+
+
+/* --------------------------------------------------------------
+ * Log functions
+ * -------------------------------------------------------------- */
+
+/*
+ * Return the CRC-32 of the +len+ bytes at +buf+.
+ */
+static uint32_t
+rleaf_wal_crc32( const unsigned char *buf, size_t len ) {
+	uint32_t crc = 0xFFFFFFFFUL, c;
+	size_t i;
+	int k;
+
+	if ( !rleaf_wal_crc_table_ready ) {
+		for ( i = 0; i < 256; i++ ) {
+			c = (uint32_t)i;
+			for ( k = 0; k < 8; k++ )
+				c = ( c & 1 ) ? 0xEDB88320UL ^ ( c >> 1 ) : c >> 1;
+			rleaf_wal_crc_table[ i ] = c;
+		}
+		rleaf_wal_crc_table_ready = 1;
+	}
+
+	for ( i = 0; i < len; i++ )
+		crc = rleaf_wal_crc_table[ (crc ^ buf[i]) & 0xFF ] ^ ( crc >> 8 );
+
+	return crc ^ 0xFFFFFFFFUL;
+}
+
+
+/*
+ * Store +val+ at +ptr+ in little-endian order, so logs can be read on any platform.
+ */
+static void
+rleaf_wal_put_u32( unsigned char *ptr, uint32_t val ) {
+	ptr[0] = val & 0xFF;
+	ptr[1] = ( val >> 8 ) & 0xFF;
+	ptr[2] = ( val >> 16 ) & 0xFF;
+	ptr[3] = ( val >> 24 ) & 0xFF;
+}
+
+
+/*
+ * Fetch the little-endian 32-bit value at +ptr+.
+ */
+static uint32_t
+rleaf_wal_get_u32( const unsigned char *ptr ) {
+	return (uint32_t)ptr[0] | ( (uint32_t)ptr[1] << 8 ) |
+		( (uint32_t)ptr[2] << 16 ) | ( (uint32_t)ptr[3] << 24 );
+}
+
+
+/*
+ * Write the file header with the given +magic+ to +header+.
+ */
+static void
+rleaf_wal_make_header( unsigned char *header, const char *magic ) {
+	memcpy( header, magic, 8 );
+	rleaf_wal_put_u32( header + 8, RLEAF_WAL_VERSION );
+	rleaf_wal_put_u32( header + 12, 0 );
+}
+
+
+/*
+ * Write all +len+ bytes at +buf+ to +fd+. Returns non-zero and leaves errno set if they
+ * couldn't all be written.
+ */
+static int
+rleaf_wal_write_all( int fd, const unsigned char *buf, size_t len ) {
+	ssize_t written;
+
+	while ( len ) {
+		if ( (written = write(fd, buf, len)) < 0 ) {
+			if ( errno == EINTR ) continue;
+			return 1;
+		}
+		buf += written;
+		len -= (size_t)written;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Append a record of the operation +op+ on +statement+ to the buffer at +buffer+, which
+ * holds +len+ bytes and has room for +capa+, growing it if necessary.
+ */
+static int
+rleaf_wal_encode_record( unsigned char **buffer, size_t *len, size_t *capa, int op,
+                         librdf_statement *statement )
+{
+	size_t statement_len = librdf_statement_encode( statement, NULL, 0 );
+	size_t record_len = RLEAF_WAL_RECORD_HEADER_LEN + 1 + statement_len;
+	unsigned char *record;
+
+	if ( !statement_len ) return 1;
+
+	if ( *len + record_len > *capa ) {
+		*capa = ( *len + record_len ) * 2;
+		REALLOC_N( *buffer, unsigned char, *capa );
+	}
+
+	record = *buffer + *len;
+	record[ RLEAF_WAL_RECORD_HEADER_LEN ] = (unsigned char)op;
+	if ( librdf_statement_encode(statement, record + RLEAF_WAL_RECORD_HEADER_LEN + 1,
+	                             statement_len) != statement_len )
+		return 1;
+
+	rleaf_wal_put_u32( record, (uint32_t)(statement_len + 1) );
+	rleaf_wal_put_u32( record + 4,
+		rleaf_wal_crc32(record + RLEAF_WAL_RECORD_HEADER_LEN, statement_len + 1) );
+	*len += record_len;
+
+	return 0;
+}
+
+
+/*
+ * Write the buffered records to the log and fsync() it. If that fails, the log is cut
+ * back to where it was so that no partial record is left in it, the records are kept in
+ * the buffer to be tried again, and the errno of the failure is returned. This doesn't
+ * log anything, so it's safe to call while the store is being garbage-collected.
+ */
+static int
+rleaf_wal_write_buffer( rleaf_WALSTORE *wal ) {
+	int saved_errno;
+
+	if ( wal->fd < 0 || !wal->buffer_len ) return 0;
+
+	if ( rleaf_wal_write_all(wal->fd, wal->buffer, wal->buffer_len) != 0 ||
+	     fsync(wal->fd) != 0 )
+	{
+		saved_errno = errno ? errno : EIO;
+		if ( ftruncate(wal->fd, (off_t)wal->log_bytes) != 0 ) { /* nothing more to do */ }
+		return saved_errno;
+	}
+
+	wal->log_bytes += (long)wal->buffer_len;
+	wal->buffer_len = 0;
+	wal->buffered = 0;
+	wal->commits++;
+
+	return 0;
+}
+
+
+/*
+ * Write the buffered records to the log like rleaf_wal_write_buffer(), logging any
+ * failure. Returns non-zero if they couldn't be written.
+ */
+static int
+rleaf_wal_commit( rleaf_WALSTORE *wal ) {
+	int err = rleaf_wal_write_buffer( wal );
+
+	if ( err ) {
+		rleaf_log( "error", "couldn't write %ld records to the log %s: %s",
+			wal->buffered, wal->path, strerror(err) );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * fsync() the directory that the file at +path+ is in, so that a file renamed into it is
+ * there after a crash. Returns non-zero and leaves errno set on failure.
+ */
+static int
+rleaf_wal_sync_dir( const char *path ) {
+	const char *slash = strrchr( path, '/' );
+	size_t len = slash ? (size_t)( slash - path ) : 0;
+	char *dir = ALLOCA_N( char, len + 2 );
+	int fd, rval = 0, saved_errno;
+
+	if ( !slash )
+		strcpy( dir, "." );
+	else if ( len == 0 )
+		strcpy( dir, "/" );
+	else {
+		memcpy( dir, path, len );
+		dir[ len ] = '\0';
+	}
+
+	if ( (fd = open(dir, O_RDONLY)) < 0 ) return 1;
+	if ( fsync(fd) != 0 ) rval = 1;
+	saved_errno = errno;
+	close( fd );
+	errno = saved_errno;
+
+	return rval;
+}
+
+
+/*
+ * Write the statements in the store to a new snapshot file and then start the log over,
+ * since the snapshot has all of the changes in it. The snapshot is written to a temporary
+ * file and renamed, and the directory is synced before the log is truncated, so a crash
+ * leaves either the old snapshot and the whole log or the new snapshot; replaying the log
+ * over the new snapshot just makes the same changes again.
+ */
+static int
+rleaf_wal_checkpoint( rleaf_WALSTORE *wal ) {
+	size_t pathlen, len = 0, capa = 0;
+	char *tmppath;
+	unsigned char header[ RLEAF_WAL_HEADER_LEN ], *buffer = NULL;
+	librdf_stream *stream;
+	librdf_statement *statement;
+	int fd, failed, saved_errno;
+
+	if ( wal->fd < 0 ) {
+		rleaf_log( "error", "can't make a snapshot of a store without a log" );
+		return 1;
+	}
+	if ( rleaf_wal_commit(wal) != 0 ) return 1;
+
+	pathlen = strlen( wal->snapshot_path );
+	tmppath = ALLOCA_N( char, pathlen + 5 );
+	memcpy( tmppath, wal->snapshot_path, pathlen );
+	memcpy( tmppath + pathlen, ".tmp", 5 );
+
+	if ( (fd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0 ) {
+		rleaf_log( "error", "couldn't create the snapshot %s: %s", tmppath, strerror(errno) );
+		return 1;
+	}
+	if ( !(stream = librdf_storage_serialise(wal->data)) ) {
+		close( fd );
+		unlink( tmppath );
+		rleaf_log( "error", "couldn't create a stream for the snapshot" );
+		return 1;
+	}
+
+	rleaf_wal_make_header( header, RLEAF_WAL_SNAPSHOT_MAGIC );
+	failed = rleaf_wal_write_all( fd, header, RLEAF_WAL_HEADER_LEN );
+
+	while ( !failed && ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+
+		failed = rleaf_wal_encode_record( &buffer, &len, &capa, RLEAF_WAL_OP_ADD, statement );
+		if ( !failed && len >= RLEAF_WAL_WRITE_CHUNK ) {
+			failed = rleaf_wal_write_all( fd, buffer, len );
+			len = 0;
+		}
+
+		librdf_stream_next( stream );
+	}
+	librdf_free_stream( stream );
+
+	if ( !failed && len ) failed = rleaf_wal_write_all( fd, buffer, len );
+	if ( buffer ) xfree( buffer );
+	if ( !failed && fsync(fd) != 0 ) failed = 1;
+	saved_errno = errno;
+	if ( close(fd) != 0 && !failed ) {
+		failed = 1;
+		saved_errno = errno;
+	}
+
+	if ( failed || rename(tmppath, wal->snapshot_path) != 0 ) {
+		if ( !failed ) saved_errno = errno;
+		unlink( tmppath );
+		rleaf_log( "error", "couldn't write the snapshot %s: %s", wal->snapshot_path,
+			strerror(saved_errno) );
+		return 1;
+	}
+
+	/* Until the rename is on disk, the log is the only record of its changes */
+	if ( rleaf_wal_sync_dir(wal->snapshot_path) != 0 ) {
+		rleaf_log( "error", "couldn't sync the directory of the snapshot %s: %s",
+			wal->snapshot_path, strerror(errno) );
+		return 1;
+	}
+
+	if ( ftruncate(wal->fd, RLEAF_WAL_HEADER_LEN) != 0 || fsync(wal->fd) != 0 ) {
+		rleaf_log( "error", "couldn't truncate the log %s: %s", wal->path, strerror(errno) );
+		return 1;
+	}
+
+	rleaf_log( "debug", "wrote a snapshot of %d statements to %s; started %s over",
+		librdf_storage_size(wal->data), wal->snapshot_path, wal->path );
+	wal->log_records = 0;
+	wal->log_bytes = RLEAF_WAL_HEADER_LEN;
+	wal->snapshots++;
+
+	return 0;
+}
+
+
+/*
+ * Log the operation +op+ on +statement+, committing the buffered records if there are
+ * enough of them. If the record can't be encoded or committed, it's taken back out of the
+ * buffer (any earlier records stay buffered to be tried again) and non-zero is returned.
+ */
+static int
+rleaf_wal_log( rleaf_WALSTORE *wal, int op, librdf_statement *statement ) {
+	size_t old_len = wal->buffer_len;
+
+	if ( wal->fd < 0 ) return 0;
+
+	if ( rleaf_wal_encode_record(&wal->buffer, &wal->buffer_len, &wal->buffer_capa,
+	                             op, statement) != 0 )
+	{
+		wal->buffer_len = old_len;
+		rleaf_log( "error", "couldn't encode a statement for the log %s", wal->path );
+		return 1;
+	}
+	wal->buffered++;
+	wal->log_records++;
+
+	if ( wal->buffered >= wal->group_commit && rleaf_wal_commit(wal) != 0 ) {
+		wal->buffer_len = old_len;
+		wal->buffered--;
+		wal->log_records--;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Make the change +op+ to +statement+: log it first, then apply it to the statements in
+ * memory, so a change that can't be logged is never made. If applying it fails, its record
+ * is taken back out of the buffer, or if it's already been committed, a record undoing it is
+ * logged. Makes a snapshot afterwards if the log is long enough.
+ */
+static int
+rleaf_wal_change( rleaf_WALSTORE *wal, int op, librdf_statement *statement ) {
+	size_t old_len = wal->buffer_len;
+	int rval;
+
+	if ( rleaf_wal_log(wal, op, statement) != 0 ) return 1;
+
+	if ( op == RLEAF_WAL_OP_ADD )
+		rval = librdf_storage_add_statement( wal->data, statement );
+	else
+		rval = librdf_storage_remove_statement( wal->data, statement );
+
+	if ( rval != 0 ) {
+		if ( wal->buffer_len > old_len ) {
+			wal->buffer_len = old_len;
+			wal->buffered--;
+			wal->log_records--;
+		} else {
+			rleaf_wal_log( wal, op == RLEAF_WAL_OP_ADD ? RLEAF_WAL_OP_REMOVE : RLEAF_WAL_OP_ADD,
+				statement );
+		}
+		return 1;
+	}
+
+	/* A failed snapshot leaves the log as it was, so it's not an error for the change */
+	if ( wal->fd >= 0 && wal->snapshot_every > 0 && wal->log_records >= wal->snapshot_every &&
+	     rleaf_wal_checkpoint(wal) != 0 )
+		rleaf_log( "warn", "couldn't make a snapshot; the log %s will keep growing", wal->path );
+
+	return 0;
+}
+
+
+/*
+ * Apply the records in the file open on +fh+, which should start with a header with the
+ * given +magic+, to the store. Returns the number of records applied, and sets +good_len+
+ * to the length of the file up to the end of the last whole, intact record. Returns -1 if
+ * the file doesn't start with a valid header.
+ */
+static long
+rleaf_wal_replay( rleaf_WALSTORE *wal, FILE *fh, const char *magic, long *good_len ) {
+	librdf_world *world = librdf_storage_get_world( wal->data );
+	unsigned char header[ RLEAF_WAL_HEADER_LEN ], *payload = NULL;
+	librdf_statement *statement;
+	uint32_t len;
+	size_t capa = 0;
+	long count = 0;
+
+	*good_len = 0;
+	if ( fread(header, 1, RLEAF_WAL_HEADER_LEN, fh) != RLEAF_WAL_HEADER_LEN ||
+	     memcmp(header, magic, 8) != 0 ||
+	     rleaf_wal_get_u32(header + 8) != RLEAF_WAL_VERSION )
+		return -1;
+	*good_len = RLEAF_WAL_HEADER_LEN;
+
+	while ( fread(header, 1, RLEAF_WAL_RECORD_HEADER_LEN, fh) == RLEAF_WAL_RECORD_HEADER_LEN ) {
+		len = rleaf_wal_get_u32( header );
+		if ( len < 2 || len > RLEAF_WAL_MAX_RECORD_LEN ) break;
+
+		if ( len > capa ) {
+			capa = len;
+			REALLOC_N( payload, unsigned char, capa );
+		}
+		if ( fread(payload, 1, len, fh) != len ) break;
+		if ( rleaf_wal_crc32(payload, len) != rleaf_wal_get_u32(header + 4) ) break;
+		if ( payload[0] != RLEAF_WAL_OP_ADD && payload[0] != RLEAF_WAL_OP_REMOVE ) break;
+
+		if ( !(statement = librdf_new_statement(world)) ) break;
+		if ( !librdf_statement_decode(statement, payload + 1, len - 1) ) {
+			librdf_free_statement( statement );
+			break;
+		}
+
+		/* Adding a statement that's there or removing one that isn't does nothing, so
+		   records can safely be replayed more than once */
+		if ( payload[0] == RLEAF_WAL_OP_ADD )
+			librdf_storage_add_statement( wal->data, statement );
+		else
+			librdf_storage_remove_statement( wal->data, statement );
+		librdf_free_statement( statement );
+
+		*good_len += RLEAF_WAL_RECORD_HEADER_LEN + len;
+		count++;
+	}
+
+	if ( payload ) xfree( payload );
+	return count;
+}
+
+
+/*
+ * Start a new, empty log.
+ */
+static int
+rleaf_wal_start_log( rleaf_WALSTORE *wal ) {
+	unsigned char header[ RLEAF_WAL_HEADER_LEN ];
+
+	rleaf_wal_make_header( header, RLEAF_WAL_LOG_MAGIC );
+	if ( ftruncate(wal->fd, 0) != 0 ||
+	     rleaf_wal_write_all(wal->fd, header, RLEAF_WAL_HEADER_LEN) != 0 ||
+	     fsync(wal->fd) != 0 )
+	{
+		rleaf_log( "error", "couldn't start the log %s: %s", wal->path, strerror(errno) );
+		return 1;
+	}
+
+	wal->log_records = 0;
+	wal->log_bytes = RLEAF_WAL_HEADER_LEN;
+	return 0;
+}
+
+
+/*
+ * Load the store's statements from its snapshot, then replay its log over them. Records
+ * at the end of the log that were only partly written or are corrupt (e.g., because of a
+ * crash in the middle of a commit) are discarded. If +is_new+ is set, the snapshot and
+ * log are discarded instead.
+ */
+static int
+rleaf_wal_recover( rleaf_WALSTORE *wal, int is_new ) {
+	struct stat st;
+	long count, good_len;
+	FILE *fh;
+
+	if ( is_new ) {
+		if ( unlink(wal->snapshot_path) != 0 && errno != ENOENT ) {
+			rleaf_log( "error", "couldn't remove the snapshot %s: %s", wal->snapshot_path,
+				strerror(errno) );
+			return 1;
+		}
+	}
+	else if ( (fh = fopen(wal->snapshot_path, "rb")) ) {
+		count = rleaf_wal_replay( wal, fh, RLEAF_WAL_SNAPSHOT_MAGIC, &good_len );
+		if ( fstat(fileno(fh), &st) != 0 ) count = -1;
+		fclose( fh );
+
+		if ( count < 0 || good_len != (long)st.st_size ) {
+			rleaf_log( "error", "%s isn't a valid snapshot for this version of Redleaf",
+				wal->snapshot_path );
+			return 1;
+		}
+		rleaf_log( "debug", "loaded %ld statements from %s", count, wal->snapshot_path );
+	}
+	else if ( errno != ENOENT ) {
+		rleaf_log( "error", "couldn't open the snapshot %s: %s", wal->snapshot_path,
+			strerror(errno) );
+		return 1;
+	}
+
+	if ( (wal->fd = open(wal->path, O_RDWR|O_CREAT|O_APPEND, 0644)) < 0 ) {
+		rleaf_log( "error", "couldn't open the log %s: %s", wal->path, strerror(errno) );
+		return 1;
+	}
+	if ( is_new || fstat(wal->fd, &st) != 0 || st.st_size < RLEAF_WAL_HEADER_LEN )
+		return rleaf_wal_start_log( wal );
+
+	if ( !(fh = fopen(wal->path, "rb")) ) {
+		rleaf_log( "error", "couldn't read the log %s: %s", wal->path, strerror(errno) );
+		return 1;
+	}
+	count = rleaf_wal_replay( wal, fh, RLEAF_WAL_LOG_MAGIC, &good_len );
+	fclose( fh );
+
+	if ( count < 0 ) {
+		rleaf_log( "error", "%s isn't a Redleaf write-ahead log", wal->path );
+		return 1;
+	}
+	if ( good_len < (long)st.st_size ) {
+		rleaf_log( "warn", "discarding %ld bytes of incomplete records at the end of %s",
+			(long)st.st_size - good_len, wal->path );
+		if ( ftruncate(wal->fd, (off_t)good_len) != 0 || fsync(wal->fd) != 0 ) {
+			rleaf_log( "error", "couldn't truncate the log %s: %s", wal->path,
+				strerror(errno) );
+			return 1;
+		}
+	}
+
+	rleaf_log( "debug", "replayed %ld records from %s", count, wal->path );
+	wal->log_records = count;
+	wal->log_bytes = good_len;
+
+	return 0;
+}
+
+
+/*
+ * Allocate a WAL store's state with no log and the default settings.
+ */
+static rleaf_WALSTORE *
+rleaf_new_walstore( void ) {
+	rleaf_WALSTORE *wal = ALLOC( rleaf_WALSTORE );
+
+	MEMZERO( wal, rleaf_WALSTORE, 1 );
+	wal->fd = -1;
+	wal->group_commit = RLEAF_WAL_DEFAULT_GROUP_COMMIT;
+	wal->snapshot_every = RLEAF_WAL_DEFAULT_SNAPSHOT_EVERY;
+
+	return wal;
+}
+
+
+/* --------------------------------------------------------------
+ * Storage module methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Storage init method; the storage name is the path of the log, and the snapshot is kept
+ * next to it with '.snapshot' appended. The 'group-commit' option sets how many records
+ * are written with each fsync() (default: 64), 'snapshot-every' how many records the log
+ * holds before a snapshot is made (default: 100000; 0 turns automatic snapshots off),
+ * and 'new' discards any existing log and snapshot.
+ *
+ * Changes are acknowledged as soon as they're buffered, so with the default group commit,
+ * up to 63 acknowledged changes that haven't been fsync()ed yet are lost if the process or
+ * machine dies; a 'group-commit' of 1 makes every change durable before it returns.
+ */
+static int
+rleaf_wal_init( librdf_storage *storage, const char *name, librdf_hash *options ) {
+	rleaf_WALSTORE *wal = rleaf_new_walstore();
+	size_t pathlen;
+	long value;
+	int is_new = 0;
+
+	librdf_storage_set_instance( storage, wal );
+
+	if ( options ) {
+		if ( (value = librdf_hash_get_as_long(options, "group-commit")) > 0 )
+			wal->group_commit = value;
+		if ( (value = librdf_hash_get_as_long(options, "snapshot-every")) >= 0 )
+			wal->snapshot_every = value;
+		is_new = librdf_hash_get_as_boolean( options, "new" ) > 0;
+		librdf_free_hash( options );
+	}
+
+	if ( !name ) {
+		rleaf_log( "error", "the '%s' storage module needs the path of its log", RLEAF_WAL_NAME );
+		return 1;
+	}
+
+	pathlen = strlen( name );
+	wal->path = ALLOC_N( char, pathlen + 1 );
+	memcpy( wal->path, name, pathlen + 1 );
+	wal->snapshot_path = ALLOC_N( char, pathlen + 10 );
+	memcpy( wal->snapshot_path, name, pathlen );
+	memcpy( wal->snapshot_path + pathlen, ".snapshot", 10 );
+
+	wal->data = librdf_new_storage( librdf_storage_get_world(storage), "dictionary",
+		RLEAF_WAL_NAME, NULL );
+	if ( !wal->data || librdf_storage_open(wal->data, NULL) != 0 ) {
+		rleaf_log( "error", "couldn't create the in-memory storage for %s", name );
+		return 1;
+	}
+
+	return rleaf_wal_recover( wal, is_new );
+}
+
+
+/*
+ * Storage clone method. The clone has a copy of the statements, but no log of its own.
+ */
+static int
+rleaf_wal_clone( librdf_storage *new_storage, librdf_storage *old_storage ) {
+	rleaf_WALSTORE *old = librdf_storage_get_instance( old_storage );
+	rleaf_WALSTORE *wal = rleaf_new_walstore();
+
+	librdf_storage_set_instance( new_storage, wal );
+	if ( !(wal->data = librdf_new_storage_from_storage(old->data)) ) return 1;
+
+	return librdf_storage_open( wal->data, NULL );
+}
+
+
+/*
+ * Storage terminate method. Any buffered records are committed first. This is called when
+ * the store is garbage-collected, so failures are reported on stderr rather than through
+ * rleaf_log(), which calls into Ruby.
+ */
+static void
+rleaf_wal_terminate( librdf_storage *storage ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+	int err;
+
+	if ( !wal ) return;
+
+	if ( wal->fd >= 0 ) {
+		if ( (err = rleaf_wal_write_buffer(wal)) != 0 )
+			fprintf( stderr, "redleaf: %ld changes weren't written to %s: %s\n",
+				wal->buffered, wal->path, strerror(err) );
+		close( wal->fd );
+	}
+
+	if ( wal->data ) {
+		librdf_storage_close( wal->data );
+		librdf_free_storage( wal->data );
+	}
+	if ( wal->buffer ) xfree( wal->buffer );
+	if ( wal->path ) xfree( wal->path );
+	if ( wal->snapshot_path ) xfree( wal->snapshot_path );
+
+	xfree( wal );
+	librdf_storage_set_instance( storage, NULL );
+}
+
+
+/*
+ * Storage open method.
+ */
+static int
+rleaf_wal_open( librdf_storage *storage, librdf_model *model ) {
+	_UNUSED( storage );
+	_UNUSED( model );
+	return 0;
+}
+
+
+/*
+ * Storage close method.
+ */
+static int
+rleaf_wal_close( librdf_storage *storage ) {
+	_UNUSED( storage );
+	return 0;
+}
+
+
+/*
+ * Storage size method.
+ */
+static int
+rleaf_wal_size( librdf_storage *storage ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+	return librdf_storage_size( wal->data );
+}
+
+
+/*
+ * Storage add_statement method. The statement is logged before it's added; adding a
+ * statement that's already in the store isn't logged.
+ */
+static int
+rleaf_wal_add_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+
+	if ( librdf_storage_contains_statement(wal->data, statement) ) return 0;
+	return rleaf_wal_change( wal, RLEAF_WAL_OP_ADD, statement );
+}
+
+
+/*
+ * Storage add_statements method.
+ */
+static int
+rleaf_wal_add_statements( librdf_storage *storage, librdf_stream *stream ) {
+	librdf_statement *statement;
+
+	while ( ! librdf_stream_end(stream) ) {
+		if ( !(statement = librdf_stream_get_object(stream)) ) break;
+		if ( rleaf_wal_add_statement(storage, statement) != 0 ) return 1;
+		librdf_stream_next( stream );
+	}
+
+	return 0;
+}
+
+
+/*
+ * Storage remove_statement method. The removal is logged before it's made; removing a
+ * statement that isn't in the store isn't logged.
+ */
+static int
+rleaf_wal_remove_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+
+	if ( !librdf_storage_contains_statement(wal->data, statement) ) return 0;
+	return rleaf_wal_change( wal, RLEAF_WAL_OP_REMOVE, statement );
+}
+
+
+/*
+ * Storage contains_statement method.
+ */
+static int
+rleaf_wal_contains_statement( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+	return librdf_storage_contains_statement( wal->data, statement );
+}
+
+
+/*
+ * Storage serialise method.
+ */
+static librdf_stream *
+rleaf_wal_serialise( librdf_storage *storage ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+	return librdf_storage_serialise( wal->data );
+}
+
+
+/*
+ * Storage find_statements method.
+ */
+static librdf_stream *
+rleaf_wal_find_statements( librdf_storage *storage, librdf_statement *statement ) {
+	rleaf_WALSTORE *wal = librdf_storage_get_instance( storage );
+	return librdf_storage_find_statements( wal->data, statement );
+}
+
+
+/*
+ * Storage sync method. Commits any buffered records.
+ */
+static int
+rleaf_wal_sync( librdf_storage *storage ) {
+	return rleaf_wal_commit( librdf_storage_get_instance(storage) );
+}
+
+
+/*
+ * Storage factory registration function.
+ */
+static void
+rleaf_wal_register_factory( librdf_storage_factory *factory ) {
+	factory->version            = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init               = rleaf_wal_init;
+	factory->clone              = rleaf_wal_clone;
+	factory->terminate          = rleaf_wal_terminate;
+	factory->open               = rleaf_wal_open;
+	factory->close              = rleaf_wal_close;
+	factory->size               = rleaf_wal_size;
+	factory->add_statement      = rleaf_wal_add_statement;
+	factory->add_statements     = rleaf_wal_add_statements;
+	factory->remove_statement   = rleaf_wal_remove_statement;
+	factory->contains_statement = rleaf_wal_contains_statement;
+	factory->serialise          = rleaf_wal_serialise;
+	factory->find_statements    = rleaf_wal_find_statements;
+	factory->sync               = rleaf_wal_sync;
+}
+
+
+/*
+ * Register the 'wal' storage module with the Redland world.
+ */
+void
+rleaf_register_wal_storage_module( void ) {
+	rleaf_log( "debug", "Registering the '%s' storage module", RLEAF_WAL_NAME );
+	librdf_storage_register_factory( rleaf_rdf_world, RLEAF_WAL_NAME, RLEAF_WAL_LABEL,
+		rleaf_wal_register_factory );
+}
+
+
+/* --------------------------------------------------------------
+ * Instance methods
+ * -------------------------------------------------------------- */
+
+/*
+ * Fetch the WAL store state behind the given Redleaf::WALStore.
+ */
+static rleaf_WALSTORE *
+rleaf_get_walstore( VALUE self ) {
+	rleaf_STORE *store = rleaf_get_store( self );
+	rleaf_WALSTORE *wal;
+
+	if ( !(wal = librdf_storage_get_instance(store->storage)) )
+		rb_raise( rleaf_eRedleafError, "%s isn't backed by '%s' storage",
+			RSTRING_PTR(rb_inspect(self)), RLEAF_WAL_NAME );
+
+	return wal;
+}
+
+
+/*
+ *  call-seq:
+ *     store.checkpoint   -> store
+ *
+ *  Write the store's statements to its snapshot file and start its log over. This happens
+ *  by itself once the log holds the number of records set by the <tt>:snapshot_every</tt>
+ *  option.
+ *
+ */
+static VALUE
+rleaf_redleaf_walstore_checkpoint( VALUE self ) {
+	rleaf_WALSTORE *wal = rleaf_get_walstore( self );
+
+	if ( rleaf_wal_checkpoint(wal) != 0 )
+		rb_raise( rleaf_eRedleafError, "couldn't make a snapshot of %s",
+			RSTRING_PTR(rb_inspect(self)) );
+
+	return self;
+}
+
+
+/*
+ *  call-seq:
+ *     store.statistics   -> hash
+ *
+ *  Return a Hash describing the store's log: the number of records in it since the last
+ *  snapshot (:log_records) and its length in bytes (:log_bytes), the number of records
+ *  waiting to be written (:buffered_records), and the number of group commits
+ *  (:commits) and snapshots (:snapshots) made since the store was opened.
+ *
+ */
+static VALUE
+rleaf_redleaf_walstore_statistics( VALUE self ) {
+	rleaf_WALSTORE *wal = rleaf_get_walstore( self );
+	VALUE stats = rb_hash_new();
+
+	rb_hash_aset( stats, ID2SYM(rb_intern("log_records")), LONG2NUM(wal->log_records) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("log_bytes")),
+		LONG2NUM(wal->log_bytes + (long)wal->buffer_len) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("buffered_records")), LONG2NUM(wal->buffered) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("commits")), LONG2NUM(wal->commits) );
+	rb_hash_aset( stats, ID2SYM(rb_intern("snapshots")), LONG2NUM(wal->snapshots) );
+
+	return stats;
+}
+
+
+/*
+ * Redleaf::WALStore class
+ */
+void
+rleaf_init_redleaf_wal_store( void ) {
+	rleaf_log( "debug", "Initializing Redleaf::WALStore" );
+
+#ifdef FOR_RDOC
+	rleaf_mRedleaf = rb_define_module( "Redleaf" );
+	rleaf_cRedleafStore = rb_define_class_under( rleaf_mRedleaf, "Store", rb_cObject );
+#endif
+
+	rb_require( "redleaf/store/wal" );
+	rleaf_cRedleafWALStore =
+		rb_define_class_under( rleaf_mRedleaf, "WALStore", rleaf_cRedleafStore );
+
+	rb_define_method( rleaf_cRedleafWALStore, "checkpoint",
+		rleaf_redleaf_walstore_checkpoint, 0 );
+	rb_define_method( rleaf_cRedleafWALStore, "statistics",
+		rleaf_redleaf_walstore_statistics, 0 );
+}
+
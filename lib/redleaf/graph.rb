@@ -15,14 +15,6 @@ require 'redleaf/mixins'
 # 
 # == Authors
 # 
-# Portions of this file (namely the graph-equivalence stuff) were ported to Ruby from 
-# the Test::RDF Perl module written by Michael Hendricks. His copyright is:
-# 
-#   Copyright (C) 2006 Michael Hendricks <michael@palmcluster.org>
-#   
-#   This program is free software; you can redistribute it and/or modify it
-#   under the same terms as Perl itself.
-#   
 # * Michael Granger <ged@FaerieMUD.org>
 # 
 # :include: LICENSE
@@ -36,53 +28,6 @@ class Redleaf::Graph
 	        Enumerable
 
 
-	### A convenience class for keeping track of node mappings between two graphs while
-	### testing for equivalence.
-	### The ideas in this class were modelled after concepts in Michael Hendricks's Test::RDF 
-	### Perl module.
-	class BnodeMap # :nodoc:
-
-		### Create a new Bnode map
-		def initialize
-			@a_to_b = {}
-			@b_to_a = {}
-		end
-
-		### Look up a mapping for the specified +node+
-		def []( node )
-			return @a_to_b[ node ]
-		end
-
-		### Returns +true+ if there isn't already a mapping in either direction for
-		### the two nodes specified.
-		def valid?( node_a, node_b )
-			return false if @a_to_b.key?( node_a ) ||
-			                @b_to_a.key?( node_b )
-        	return true
-		end
-
-        ### Create a new mapping for the specified nodes.
-		def create( node_a, node_b )
-			raise "invalid mapping" unless self.valid?( node_a, node_b )
-			@a_to_b[ node_a ] = node_b
-			@b_to_a[ node_b ] = node_a
-		end
-		alias_method :[]=, :create
-
-	end # class BnodeMap
-
-
-	#################################################################
-	###	C L A S S   M E T H O D S
-	#################################################################
-
-	### Returns +true+ if the specified +format+ is supported by the Redland backend.
-	def self::valid_format?( format )
-		Redleaf.logger.debug "Checking validity of format %p" % [ format ]
-		return self.serializers.key?( format )
-	end
-
-
 	#################################################################
 	###	I N S T A N C E   M E T H O D S
 	#################################################################
@@ -93,7 +38,12 @@ class Redleaf::Graph
 
 	### Returns +true+ if the graph does not contain any statements.
 	def empty?
-		return self.size.zero?
+		size = self.size
+		return size.zero? if size
+
+		# The store can't count its statements, so see if it has a first one
+		self.each_statement { return false }
+		return true
 	end
 	alias_method :is_empty?, :empty?
 
@@ -124,7 +74,13 @@ class Redleaf::Graph
 	#         FOAF[:family_name] => "Smith",
 	#       }
 	#     }
+	#
+	# If the last argument is a Hash with only a <tt>:context</tt> key, the statements are
+	# added to that context.
+	#
+	#   graph.append( statement1, statement2, :context => 'http://deveiate.org/foaf.xml' )
 	def append( *objects )
+		options = self.extract_context_option( objects )
 		statements = objects.collect do |obj|
 			Redleaf.log.debug "Appending object %p" % [ obj ]
 			stmt = obj.is_a?( Redleaf::Statement ) ? obj : Redleaf::Statement.create( obj )
@@ -132,6 +88,7 @@ class Redleaf::Graph
 			stmt
 		end.flatten
 
+		statements << options if options
 		return self.append_statements( *statements )
 	end
 	alias_method :<<, :append
@@ -168,57 +125,15 @@ class Redleaf::Graph
 	end
 
 
-	### call-seq:
-	###    graph.is_equivalent_to?( other_graph )   -> true or false
-	###    graph === other_graph                    -> true or false
-	### 
-	### Equivalence method -- compare the receiving +graph+ with +other_graph+ according to
-	### the graph equivalency rules in:
-	###   http://www.w3.org/TR/rdf-concepts/#section-graph-equality
-	def is_equivalent_to?( other_graph )
-		unless other_graph.size == self.size
-			self.log.debug "Graphs differ in size (%d vs. %d)" % [ self.size, other_graph.size ]
-			return false
-		end
-
-		other = other_graph.dup
-		bnode_map = BnodeMap.new
-		difference = nil
-
-		difference = self.find do |stmt|
-			# If the copy of the other graph has an equivalent statement, remove it
-			# and move on to the next one.
-			if other.remove_equivalent_statement( stmt, bnode_map )
-				next
-
-			# Otherwise, we've found a difference
-			else
-				stmt
-			end
-		end
-
-		buf = ''
-		PP.pp( bnode_map, buf )
-		self.log.debug "Bnode map after comparison:\n%s" % [ buf ]
-
-		if difference
-			self.log.debug "%p is not equivalent to %p because it does not contain %p" %
-				[ self, other_graph, difference ]
-			return false
-		else
-			return true
-		end
-	end
-	alias_method :equivalent_to?, :is_equivalent_to?
-	alias_method :===, :is_equivalent_to?
-
-
-	### Return a human-readable representation of the object suitable for debugging.
+	### Return a human-readable representation of the object suitable for debugging. Only
+	### shows the number of statements if it's already known, since counting them can mean
+	### scanning the whole store.
 	def inspect
-		return "#<%s:0x%x %d statements, %s>" % [
+		size = self.cached_size
+		return "#<%s:0x%x %s statements, %s>" % [
 			self.class.name,
 			self.object_id * 2,
-			self.size,
+			size ? size.to_s : 'uncounted',
 			self.context_info
 		]
 	end
@@ -269,96 +184,14 @@ class Redleaf::Graph
 	end
 
 
-	### Given the specified +bnode_map+ (a BnodeMap object which contains an equivalence 
-	### mapping between blank nodes in the receiver and +statement+), remove the given 
-	### +statement+ from the receiver if an equivalent one exists. If an equivalent exists, 
-	### return it, otherwise return +nil+. This was ported from Michael Hendricks's 
-	### Test::RDF Perl module.
-	### :TODO: Refactor into multiple methods
-	def remove_equivalent_statement( statement, bnode_map )
-		subject	  = statement.subject
-		predicate = statement.predicate
-		object	  = statement.object
-
-		subject_is_floating = false
-		object_is_floating  = false
-
-		# anchor the subject if possible
-		if subject.is_a?( Symbol )
-			subject_is_floating = true
-			if mapped = bnode_map[ subject ]
-				subject = mapped
-				subject_is_floating = false
-			end
-		end
-
-		# anchor the object if possible
-		if object.is_a?( Symbol )
-			object_is_floating = true
-			if mapped = bnode_map[ object ]
-				object = mapped
-				object_is_floating = false
-			end
-		end
-
-		# If both the subject and object are unmapped bnodes, select the first
-		# triple with the same predicate and unmapped bnode subject and objects
-		if subject_is_floating && object_is_floating
-			self.log.debug "Anchoring a subject (%p) and an object (%p)" %
-				[ subject, object ]
-			equivalent = self[ nil, predicate, nil ].find do |stmt|
-				self.log.debug "  examining %p" % [ stmt ]
-				if stmt.subject.is_a?( Symbol ) &&
-				   stmt.object.is_a?( Symbol ) &&
-				   bnode_map.valid?( subject, stmt.subject ) &&
-				   bnode_map.valid?( object, stmt.object )
-
-					bnode_map[ subject ] = stmt.subject
-					bnode_map[ object ] = stmt.object
-
-					stmt
-				end
-			end
-
-		# If the subject is an unanchored bnode, select the first
-		# triple with the same predicate and object and an unmapped subject
-		elsif subject_is_floating
-			self.log.debug "Anchoring a subject (%p)" % [ subject ]
-			equivalent = self[ nil, predicate, object ].find do |stmt|
-				self.log.debug "  examining %p" % [ stmt ]
-				if stmt.subject.is_a?( Symbol ) &&
-				   bnode_map.valid?( subject, stmt.subject )
-
-					bnode_map[ subject ] = stmt.subject
-					stmt
-				end
-			end
-
-		# Do the same for an unanchored object
-		elsif object_is_floating
-			self.log.debug "Anchoring an object (%p)" % [ object ]
-			equivalent = self[ subject, predicate, nil ].find do |stmt|
-				self.log.debug "  examining %p" % [ stmt ]
-				if stmt.object.is_a?( Symbol ) &&
-				   bnode_map.valid?( object, stmt.object )
-
-					bnode_map[ object ] = stmt.object
-					stmt
-				end
-			end
-
-		# If the statement's nodes are all either mapped or not bnodes, just
-		# search for an equivalent
-		else
-			self.log.debug "Searching for an anchored statement {%p, %p, %p}" %
-				[ subject, predicate, object ]
-			equivalent = self[ subject, predicate, object ].first
-		end
-
-		self.log.debug "Equivalent is: %p" % [ equivalent ]
-
-		return self.remove( equivalent ).first if equivalent
-		return nil
+	### Remove and return a trailing options Hash from +args+ if its only key is
+	### <tt>:context</tt> (so it can't be mistaken for a subgraph Hash); returns +nil+ if
+	### there isn't one.
+	def extract_context_option( args )
+		last = args.last
+		return nil unless last.is_a?( Hash ) && last.keys == [ :context ] &&
+			!last[:context].is_a?( Hash )
+		return args.pop
 	end
 
 
@@ -53,11 +53,9 @@ class Redleaf::QueryResult
 
 	### Return the query result as JSON in the format specified by 
 	### http://www.w3.org/2001/sw/DataAccess/json-sparql/.
+	### Binding and boolean results override this with a native writer.
 	def to_json
-		json = self.formatted_as( self.class.formatters['json'][:uri] )
-
-		# Work around the doubled-quotes bug
-		return json.gsub( %r{""(ordered|distinct)}, %{"\\1} )
+		return self.formatted_as( self.class.formatters['json'][:uri] )
 	end
 
 
@@ -77,7 +75,7 @@ class Redleaf::QueryResult
 		formatters = self.class.formatters
 		unless formatters.key?( format )
 			raise Redleaf::FeatureError,
-				"local Redland installation does not have a '%s' formatter"
+				"local Redland installation does not have a '%s' formatter" % [ format ]
 		end
 
 		return self.formatted_as( formatters[format][:uri] )
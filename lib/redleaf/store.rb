@@ -162,6 +162,14 @@ class Redleaf::Store
 	end
 
 
+	### Returns +true+ if the Store is ready to be searched at full speed. Stores that warm up
+	### in the background after they're opened (e.g., Redleaf::HashesStore#preload) return
+	### +false+ until they're done.
+	def warm?
+		return true
+	end
+
+
 	### Return a human-readable representation of the object suitable for debugging.
 	def inspect
 		return "#<%s:0x%x name: %s, options: %p, graph: %p>" % [
@@ -0,0 +1,50 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+
+# An RDF triplestore that caches the answers to searches and statement lookups made on
+# another store (uses Redleaf's 'caching' storage module). Answers are kept in memory and
+# evicted least-recently-used first, and statements added or removed through the cache are
+# written straight through to the base store, dropping any cached answers they affect.
+#
+#   store = Redleaf::CachingStore.new( Redleaf::PostgreSQLStore.load('catalog'),
+#       nil, :capacity => 4096 )
+#   graph = Redleaf::Graph.new( store )
+#   graph[ book, nil, nil ]  # reads from the database
+#   graph[ book, nil, nil ]  # answered from memory
+#   store.cache_stats[:hit_rate]  # => 0.5
+#
+# Changes made to the base store other than through the cache aren't seen until the
+# answers they affect are evicted or #clear_cache is called.
+# 
+# == Version-Control Id
+#
+#  $Id$
+# 
+# == Authors
+# 
+# * Michael Granger <ged@FaerieMUD.org>
+# 
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::CachingStore < Redleaf::Store
+
+	# Use Redleaf's 'caching' storage module
+	backend :caching
+
+
+	######
+	public
+	######
+
+	# The Redleaf::Store the cache reads through to
+	attr_reader :base
+
+end # class Redleaf::CachingStore
+
+# vim: set nosta noet ts=4 sw=4:
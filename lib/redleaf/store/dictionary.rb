@@ -0,0 +1,47 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+
+# An in-memory RDF triplestore that uses Redleaf's own 'dictionary' storage module. Every
+# term is interned once in a dictionary, and statements are kept as triples of 32-bit term
+# ids in three sorted indexes (subject-predicate-object, predicate-object-subject, and
+# object-subject-predicate), so a search with any combination of bound nodes is a single
+# range of one of them. Each statement takes 12 bytes in each index plus some block
+# overhead, and each distinct term is stored once in the dictionary however many statements
+# use it, so graphs that reuse their terms take much less memory than in
+# Redleaf::HashesStore. #statistics reports the actual figures, with and without the
+# dictionary.
+#
+# Index blocks are copy-on-write, which gives the store multi-version concurrency: a
+# stream over the store keeps returning the statements it had when the stream was opened
+# while other code adds and removes statements, and #version returns a read-only copy of
+# the store as it is now for a fraction of the cost of copying it. Superseded blocks are
+# freed when the last stream or version using them goes away.
+#
+# Terms stay in the dictionary after the last statement that uses them is removed. The
+# store doesn't support contexts.
+# 
+# == Version-Control Id
+#
+#  $Id$
+# 
+# == Authors
+# 
+# * Michael Granger <ged@FaerieMUD.org>
+# 
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::DictionaryStore < Redleaf::Store
+
+	# Use Redleaf's 'dictionary' storage module
+	backend :dictionary
+
+end # class Redleaf::DictionaryStore
+
+# vim: set nosta noet ts=4 sw=4:
+
@@ -36,6 +36,13 @@ class Redleaf::HashesStore < Redleaf::Store
 	}
 
 
+	# The names of the hashes that hold the statement indexes of a bdb store
+	INDEX_HASHES = %w[ sp2o po2s so2p ]
+
+	# How many bytes the preloader reads from a bdb file at a time
+	PRELOAD_CHUNK_SIZE = 1 << 20
+
+
 	# Use the 'hashes' Redland backend
 	backend :hashes
 
@@ -44,10 +51,12 @@ class Redleaf::HashesStore < Redleaf::Store
 	###	C L A S S   M E T H O D S
 	#################################################################
 
-	### Load the BDB-backed Redleaf::HashesStore from the specified +path+.
-	def self::load( path, options={} )
+	### Load the BDB-backed Redleaf::HashesStore from the specified +path+. If the
+	### <tt>:preload</tt> option is set, the store's files are read into the OS's cache in the
+	### background (see #preload), and the +progress+ block, if given, is called as they are.
+	def self::load( path, options={}, &progress )
 		options.merge!( :new => false )
-		return new( path, options )
+		return new( path, options, &progress )
 	end
 
 	### Normalize +options+ into a options hash that is appropriate for Redland
@@ -82,14 +91,22 @@ class Redleaf::HashesStore < Redleaf::Store
 	###	I N S T A N C E   M E T H O D S
 	#################################################################
 
-	### Create a new Redleaf::HashesStore, optionally enabling contexts.
-	def initialize( name=nil, options={} )
+	### Create a new Redleaf::HashesStore, optionally enabling contexts. If the
+	### <tt>:preload</tt> option is set to <tt>:indexes</tt> or <tt>:all</tt>, #preload is
+	### called with it and the +progress+ block once the store is open, if it's persistent.
+	def initialize( name=nil, options={}, &progress )
 		name, opts = self.class.normalize_options( name, options )
 		opthash = DEFAULT_OPTIONS.merge( opts )
+		preload = opthash.delete( :preload )
 
 		@hash_type = opthash[:hash_type]
+		@preloader = nil
+		@preload_progress = nil
+
+		rval = super( name.to_s, opthash )
+		self.preload( preload, &progress ) if preload && self.persistent?
 
-		return super( name.to_s, opthash )
+		return rval
 	end
 
 
@@ -107,6 +124,93 @@ class Redleaf::HashesStore < Redleaf::Store
 	end
 
 
+	### Return the paths of the BDB files that hold the store's hashes, or only those of its
+	### statement indexes if +which+ is <tt>:indexes</tt>. Stores that aren't persistent
+	### don't have any.
+	def bdb_files( which=:all )
+		return [] unless self.persistent?
+
+		dir = Pathname.new( self.opthash[:dir] || '.' )
+		files = Dir.glob( (dir + "#{self.name}-*.db").to_s )
+		files = files.select {|path| INDEX_HASHES.include?(path[/-(\w+)\.db$/, 1]) } if
+			which == :indexes
+
+		return files.sort
+	end
+
+
+	### Start a thread that reads the BDB files of the store's statement indexes (if +which+
+	### is <tt>:indexes</tt>) or all of its hashes (<tt>:all</tt>) from start to finish, so
+	### they're in the OS's cache before the first searches need them. The +progress+ block,
+	### if given, is called from the thread with the number of bytes read so far and the
+	### total after each chunk. Returns the thread; #warm? returns +true+ once it's done.
+	def preload( which=:indexes, &progress )
+		raise ArgumentError, "can't preload %p; expected :indexes or :all" % [ which ] unless
+			[ :indexes, :all ].include?( which.to_s.to_sym )
+
+		files = self.bdb_files( which.to_s.to_sym )
+		total = files.inject( 0 ) {|sum, path| sum + File.size(path) }
+		@preload_progress = [ 0, total ]
+
+		@preloader = Thread.new do
+			Thread.current.abort_on_exception = false
+			files.each do |path|
+				begin
+					self.preload_file( path, total, &progress )
+				rescue SystemCallError, IOError => err
+					self.log.error "couldn't preload %s: %s" % [ path, err.message ]
+				end
+			end
+			self.log.info "preloaded %d bytes of %s" % [ @preload_progress.first, self.name ]
+			@preload_progress.first
+		end
+
+		return @preloader
+	end
+
+
+	### Returns +true+ unless #preload is still reading the store's files.
+	def warm?
+		return @preloader ? !@preloader.alive? : true
+	end
+
+
+	### Return the number of bytes #preload has read so far and the total it's going to read,
+	### or +nil+ if the store hasn't been preloaded.
+	def preload_progress
+		return @preload_progress && @preload_progress.dup
+	end
+
+
+	### Wait up to +timeout+ seconds (or forever, if +timeout+ is +nil+) for #preload to
+	### finish, then return #warm?.
+	def wait_until_warm( timeout=nil )
+		@preloader.join( timeout ) if @preloader
+		return self.warm?
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Read the file at +path+ into the OS's cache for #preload.
+	def preload_file( path, total, &progress )
+		File.open( path, 'rb' ) do |io|
+			io.advise( :willneed ) if io.respond_to?( :advise )
+			begin
+				loop do
+					chunk = io.sysread( PRELOAD_CHUNK_SIZE )
+					@preload_progress = [ @preload_progress.first + chunk.length, total ]
+					progress.call( *@preload_progress ) if progress
+				end
+			rescue EOFError
+				# Done
+			end
+		end
+	end
+
+
 end # class Redleaf::MemoryStore
 
 # vim: set nosta noet ts=4 sw=4:
@@ -0,0 +1,48 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+
+# A copy-on-write RDF triplestore layered over another store (uses Redleaf's 'overlay'
+# storage module). It presents the statements of its base store, and keeps statements
+# added to or removed from it in small in-memory indexes of its own instead of changing
+# the base, so creating one is cheap no matter how big the base is.
+#
+#   base = Redleaf::Graph.load( 'taxonomy.rdf' )
+#   hypothetical = Redleaf::Graph.new( Redleaf::OverlayStore.new(base.store) )
+#   hypothetical << [ :new_genus, RDF[:type], TAXO[:Genus] ]
+#
+# The overlay reads through to its base, so changes made to the base while the overlay is
+# in use show through it. Graph#dup of a graph in an OverlayStore or a Redleaf::SnapshotStore
+# makes a new overlay of the same base. The store doesn't support contexts of its own.
+# 
+# == Version-Control Id
+#
+#  $Id$
+# 
+# == Authors
+# 
+# * Michael Granger <ged@FaerieMUD.org>
+# 
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::OverlayStore < Redleaf::Store
+
+	# Use Redleaf's 'overlay' storage module
+	backend :overlay
+
+
+	######
+	public
+	######
+
+	# The Redleaf::Store the overlay's statements are layered over
+	attr_reader :base
+
+end # class Redleaf::OverlayStore
+
+# vim: set nosta noet ts=4 sw=4:
@@ -0,0 +1,46 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+
+# An RDF triplestore that partitions its statements across several other stores by a hash
+# of their subjects (uses Redleaf's 'sharded' storage module), so that storage and writes
+# can be spread across several databases or disks.
+#
+#   shards = (0...4).collect {|i| Redleaf::SQLiteStore.new("/data#{i}/catalog.db") }
+#   graph = Redleaf::Graph.new( Redleaf::ShardedStore.new(shards) )
+#
+# Searches with a subject only go to the shard that holds it; others read every shard in
+# turn. Which shard a subject belongs to depends on the number of shards, so persistent
+# shards must always be opened in the same order and number.
+# 
+# == Version-Control Id
+#
+#  $Id$
+# 
+# == Authors
+# 
+# * Michael Granger <ged@FaerieMUD.org>
+# 
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::ShardedStore < Redleaf::Store
+
+	# Use Redleaf's 'sharded' storage module
+	backend :sharded
+
+
+	######
+	public
+	######
+
+	# The Array of Redleaf::Stores the statements are partitioned across
+	attr_reader :shards
+
+end # class Redleaf::ShardedStore
+
+# vim: set nosta noet ts=4 sw=4:
@@ -0,0 +1,56 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+
+# A read-only RDF triplestore backed by a snapshot file written by
+# Redleaf::Graph#write_snapshot (uses Redleaf's 'snapshot' storage module).
+#
+# The snapshot's term dictionary and statement indexes are searched directly from a
+# memory mapping of the file, so opening one takes about the same time regardless of its
+# size, and processes that map the same snapshot share its pages through the OS page
+# cache. Attempts to add or remove statements raise a Redleaf::Error.
+#
+#   graph = Redleaf::Graph.new( Redleaf::SnapshotStore.new('taxonomy.snapshot') )
+# 
+# == Version-Control Id
+#
+#  $Id$
+# 
+# == Authors
+# 
+# * Michael Granger <ged@FaerieMUD.org>
+# 
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::SnapshotStore < Redleaf::Store
+
+	# Use Redleaf's 'snapshot' storage module
+	backend :snapshot
+
+
+	### Load the snapshot at the specified +path+.
+	def self::load( path )
+		return new( path )
+	end
+
+
+	### Create a new Redleaf::SnapshotStore that maps the snapshot file at +path+.
+	def initialize( path )
+		super( File.expand_path(path.to_s) )
+	end
+
+
+	### Returns +true+, as the store's statements live in its snapshot file.
+	def persistent?
+		return true
+	end
+
+end # class Redleaf::SnapshotStore
+
+# vim: set nosta noet ts=4 sw=4:
+
@@ -28,6 +28,12 @@ class Redleaf::SQLiteStore < Redleaf::Store
 		:new => true,
 	}
 
+	# Options for the connection used by #bulk_load; they're merged with the store's own
+	BULK_LOAD_OPTIONS = {
+		:new         => false,
+		:synchronous => 'off',
+	}
+
 
 	# Use the 'sqlite' Redland backend
 	backend :sqlite
@@ -59,7 +65,33 @@ class Redleaf::SQLiteStore < Redleaf::Store
 	def persistent?
 		return true
 	end
-	
+
+
+	### Load statements into the store's database in bulk. A Redleaf::Graph that uses a
+	### separate connection to the database with synchronous writes turned off is yielded to
+	### the block, and everything added to it is inserted in a single transaction that's
+	### committed when the block returns (or rolled back if it raises). The connection is
+	### then synced, so the receiver's own durability settings are never relaxed, and the
+	### receiver's graph is recounted, since it can't see the changes made through the other
+	### connection. Returns the number of statements added.
+	###
+	###   store.bulk_load do |graph|
+	###       graph.parse( dump_uri )
+	###   end
+	def bulk_load
+		self.sync
+		store = self.class.new( self.name, self.opthash.merge(BULK_LOAD_OPTIONS) )
+		graph = Redleaf::Graph.new( store )
+		count = graph.size
+
+		self.log.debug "Bulk-loading into %s" % [ self.name ]
+		graph.transaction { yield(graph) }
+		store.sync
+		self.graph.recount
+
+		return graph.size - count
+	end
+
 
 end # class Redleaf::MemoryStore
 
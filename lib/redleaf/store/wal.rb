@@ -0,0 +1,75 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+
+# An RDF triplestore that keeps its statements in memory and makes them durable with an
+# append-only log (uses Redleaf's 'wal' storage module). Every statement added or removed
+# is appended to the log as a checksummed record, and the records are written with one
+# fsync() for each group of <tt>:group_commit</tt> of them (64 by default) and whenever the
+# store is synced. Once the log holds <tt>:snapshot_every</tt> records (100000 by default),
+# the statements are written to a snapshot file next to it, and the log is started over.
+#
+# Opening the store loads the snapshot and replays the log. Records at the end of the log
+# that were only partly written when the process died are discarded.
+#
+#   store = Redleaf::WALStore.new( 'annotations.wal', :group_commit => 256 )
+#   graph = Redleaf::Graph.new( store )
+#   graph << [ doc, DC[:subject], topic ]
+#   store.sync        # the statement is on disk now
+#
+# *Note:* a change is acknowledged (the append or remove returns) as soon as its record is
+# buffered, not once it's on disk. With the default <tt>:group_commit</tt> of 64, up to 63
+# acknowledged changes can be lost if the process or the machine dies before the next
+# fsync(). Call #sync after changes that have to be durable, or use a
+# <tt>:group_commit</tt> of 1 to fsync() every change before it returns. Each change is
+# logged before it's applied, so a change that couldn't be logged is never made in memory.
+# The store doesn't support contexts.
+# 
+# == Version-Control Id
+#
+#  $Id$
+# 
+# == Authors
+# 
+# * Michael Granger <ged@FaerieMUD.org>
+# 
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::WALStore < Redleaf::Store
+
+	# Use Redleaf's 'wal' storage module
+	backend :wal
+
+
+	### Load the store whose log is at the specified +path+.
+	def self::load( path, options={} )
+		return new( path, options )
+	end
+
+
+	### Create a new Redleaf::WALStore that logs to the file at +path+, loading the
+	### statements already logged there unless <tt>:new</tt> is set in the +options+.
+	def initialize( path, options={} )
+		super( File.expand_path(path.to_s), options )
+	end
+
+
+	### Returns +true+, as the store's statements live in its log and snapshot files.
+	def persistent?
+		return true
+	end
+
+
+	### Return the path of the store's snapshot file.
+	def snapshot_path
+		return self.name + '.snapshot'
+	end
+
+end # class Redleaf::WALStore
+
+# vim: set nosta noet ts=4 sw=4:
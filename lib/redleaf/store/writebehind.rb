@@ -0,0 +1,127 @@
+#!/usr/bin/env ruby
+ 
+require 'redleaf'
+require 'redleaf/store'
+require 'redleaf/store/overlay'
+
+# An RDF triplestore that buffers statements added to or removed from another store in
+# memory, and writes them to it in batches (uses Redleaf's 'writebehind' storage module).
+# Readers see the buffered changes right away; the base store only sees them when they're
+# flushed, which happens once there are +max_pending+ of them (10000 by default), when a
+# change is made after the oldest has waited +max_delay+ seconds, when the store is synced,
+# or when #flush is called. Since +max_delay+ is only checked when changes are made, use
+# #flush_every to flush buffered changes that would otherwise wait for the next one.
+#
+#   base  = Redleaf::SQLiteStore.load( 'catalog.db' )
+#   store = Redleaf::WriteBehindStore.new( base, nil, :max_pending => 50_000,
+#       :sync_on_flush => true )
+#   store.flush_every( 5 )
+#   graph = Redleaf::Graph.new( store )
+#   records.each {|rec| graph << rec.to_triples }
+#   store.stop_flushing
+#   store.sync
+#
+# Flushes are done by the thread that adds or removes the statement that sets them off, or
+# by the flusher thread started by #flush_every; a flush isn't started while a search over
+# the store is still being read, but is done as soon as it is. Every flush that writes any
+# changes calls the #after_flush callbacks, whatever set it off. A flush set off by adding or
+# removing a statement doesn't make that change fail if it can't write to the base store:
+# the change stays buffered, the error is logged, and #flush_failed? returns +true+ until a
+# later flush succeeds.
+#
+# *Note:* the store doesn't flush itself when it's terminated. Buffered changes that haven't
+# been flushed when the store is garbage-collected (or the program exits) are *discarded*,
+# with only a warning on STDERR, so always call #sync or #flush once you're done making
+# changes, and before dropping the last reference to the store.
+#
+# == Version-Control Id
+#
+#  $Id$
+#
+# == Authors
+#
+# * Michael Granger <ged@FaerieMUD.org>
+#
+# :include: LICENSE
+#
+#--
+#
+# Please see the file LICENSE in the BASE directory for licensing details.
+#
+class Redleaf::WriteBehindStore < Redleaf::OverlayStore
+
+	# Use Redleaf's 'writebehind' storage module
+	backend :writebehind
+
+
+	######
+	public
+	######
+
+	### Write the buffered changes to the base store, and call any #after_flush callbacks
+	### with the number of changes written. Returns the number of changes written.
+	def flush
+		return self.flush_pending
+	end
+
+
+	### Register a +callback+ to be called with the number of changes written after each
+	### flush that writes any, whether it's done by #flush, #sync, or by the store itself.
+	### Exceptions raised by the callback are logged and ignored.
+	def after_flush( &callback )
+		raise ArgumentError, "no block given" unless callback
+		( @after_flush_callbacks ||= [] ) << callback
+	end
+
+
+	### Start a thread that calls #flush every +interval+ seconds until #stop_flushing is
+	### called. Errors raised while flushing are logged, and don't stop the thread.
+	def flush_every( interval )
+		raise ArgumentError, "interval must be positive" unless interval.to_f > 0
+		self.stop_flushing
+
+		@flusher = Thread.new do
+			Thread.current.abort_on_exception = false
+			loop do
+				sleep( interval )
+				begin
+					self.flush
+				rescue Redleaf::Error => err
+					self.log.error "background flush failed: %s" % [ err.message ]
+				end
+			end
+		end
+
+		return @flusher
+	end
+
+
+	### Stop the thread started by #flush_every, if it's running.
+	def stop_flushing
+		return unless @flusher
+		@flusher.kill
+		@flusher.join
+		@flusher = nil
+	end
+
+
+	### Returns +true+ if the background thread started by #flush_every is running.
+	def flushing?
+		return @flusher ? @flusher.alive? : false
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Call the #after_flush callbacks with the +count+ of changes written by a flush.
+	### Called by the storage module after every flush that writes any changes.
+	def flushed( count )
+		return unless @after_flush_callbacks
+		@after_flush_callbacks.each {|callback| callback.call(count) }
+	end
+
+end # class Redleaf::WriteBehindStore
+
+# vim: set nosta noet ts=4 sw=4:
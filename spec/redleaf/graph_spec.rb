@@ -14,6 +14,7 @@ BEGIN {
 }
 
 require 'rspec'
+require 'stringio'
 
 require 'spec/lib/helpers'
 
@@ -67,6 +68,16 @@ describe Redleaf::Graph do
 		result.should include( "rdfxml", "turtle" )
 	end
 
+	it "caches its serializer registry" do
+		Redleaf::Graph.serializers.should equal( Redleaf::Graph.serializers )
+		Redleaf::Graph.serializers.should be_frozen()
+	end
+
+	it "knows whether a serialization format is supported" do
+		Redleaf::Graph.valid_format?( 'rdfxml' ).should be_true()
+		Redleaf::Graph.valid_format?( 'zebras' ).should be_false()
+	end
+
 
 	describe "with no nodes" do
 		before( :each ) do
@@ -78,8 +89,11 @@ describe Redleaf::Graph do
 			@graph.should be_empty()
 		end
 
-		it "has the same store as duplicates of itself" do
-			@graph.dup.store.should equal( @graph.store )
+		it "gives duplicates of itself their own store of the same class" do
+			copy = @graph.dup
+			copy.store.should_not equal( @graph.store )
+			copy.store.should be_an_instance_of( @graph.store.class )
+			copy.store.graph.should equal( copy )
 		end
 
 		it "assigns an anonymous bnode when given the special token :_ as a subject" do
@@ -114,6 +128,115 @@ describe Redleaf::Graph do
 			@graph.should === other_graph
 		end
 
+		it "is equivalent to a graph whose bnodes are only distinguishable by their neighbors" do
+			graph = Redleaf::Graph.new
+			graph.append(
+				[ :_a, FOAF[:knows], :_b ], [ :_b, FOAF[:name], "Bob" ],
+				[ :_c, FOAF[:knows], :_d ], [ :_d, FOAF[:name], "Dave" ]
+			  )
+			other_graph = Redleaf::Graph.new
+			other_graph.append(
+				[ :_w, FOAF[:knows], :_x ], [ :_x, FOAF[:name], "Dave" ],
+				[ :_y, FOAF[:knows], :_z ], [ :_z, FOAF[:name], "Bob" ]
+			  )
+
+			graph.should === other_graph
+		end
+
+		it "is not equivalent to a graph with the same shape but differently-connected bnodes" do
+			graph = Redleaf::Graph.new
+			graph.append(
+				[ :_a, FOAF[:knows], :_b ], [ :_b, FOAF[:knows], :_c ], [ :_c, FOAF[:knows], :_a ],
+				[ :_d, FOAF[:knows], :_e ], [ :_e, FOAF[:knows], :_f ], [ :_f, FOAF[:knows], :_d ]
+			  )
+			other_graph = Redleaf::Graph.new
+			other_graph.append(
+				[ :_a, FOAF[:knows], :_b ], [ :_b, FOAF[:knows], :_c ], [ :_c, FOAF[:knows], :_d ],
+				[ :_d, FOAF[:knows], :_e ], [ :_e, FOAF[:knows], :_f ], [ :_f, FOAF[:knows], :_a ]
+			  )
+
+			graph.should_not === other_graph
+		end
+
+		it "has a fingerprint" do
+			@graph.fingerprint.should =~ /\A[0-9a-f]{32}\z/
+		end
+
+		it "has the same fingerprint as a graph with the same statements added in a different order" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES.reverse )
+
+			@graph.fingerprint.should == other_graph.fingerprint
+		end
+
+		it "updates its fingerprint when statements are appended and removed" do
+			original = @graph.fingerprint
+			triple = [ :clumpy, FOAF[:knows], :throaty ]
+
+			@graph << triple
+			@graph.fingerprint.should_not == original
+			@graph << triple
+			changed = @graph.fingerprint
+
+			@graph.remove( triple )
+			@graph.fingerprint.should == original
+			changed.should_not == original
+		end
+
+		it "doesn't change its cached size or fingerprint when a duplicate of it is changed" do
+			size = @graph.size
+			fingerprint = @graph.fingerprint
+
+			copy = @graph.dup
+			copy.size.should == size
+			copy << [ :clumpy, FOAF[:knows], :throaty ]
+
+			copy.size.should == size + 1
+			copy.fingerprint.should_not == fingerprint
+			@graph.size.should == size
+			@graph.fingerprint.should == fingerprint
+		end
+
+		it "has the same fingerprint as a graph which differs only in its bnode labels" do
+			graph = Redleaf::Graph.new
+			graph << [ :_a, FOAF[:knows], :_b ] << [ :_b, FOAF[:name], "Bob" ]
+			other_graph = Redleaf::Graph.new
+			other_graph << [ :_x, FOAF[:knows], :_y ] << [ :_y, FOAF[:name], "Bob" ]
+
+			graph.fingerprint.should == other_graph.fingerprint
+		end
+
+		it "can have the same fingerprint as a graph whose bnodes are connected differently" do
+			graph = Redleaf::Graph.new
+			graph << [ :_a, FOAF[:name], "Bob" ] << [ :_b, FOAF[:name], "Alice" ]
+			graph << [ :_a, FOAF[:knows], :_b ]
+			other_graph = Redleaf::Graph.new
+			other_graph << [ :_a, FOAF[:name], "Bob" ] << [ :_b, FOAF[:name], "Alice" ]
+			other_graph << [ :_b, FOAF[:knows], :_a ]
+
+			graph.fingerprint.should == other_graph.fingerprint
+			graph.should_not === other_graph
+		end
+
+		it "counts statements with different bnodes in different contexts as different statements" do
+			people = 'http://example.org/people'
+			work   = 'http://example.org/work'
+
+			recalculated = Redleaf::Graph.new( Redleaf::HashesStore.new(:contexts => 'yes') )
+			recalculated.append( [:_a, FOAF[:name], "Bob"], :context => people )
+			recalculated.append( [:_b, FOAF[:name], "Bob"], :context => work )
+
+			incremental = Redleaf::Graph.new( Redleaf::HashesStore.new(:contexts => 'yes') )
+			incremental.fingerprint
+			incremental.append( [:_a, FOAF[:name], "Bob"], :context => people )
+			incremental.append( [:_b, FOAF[:name], "Bob"], :context => work )
+
+			recalculated.fingerprint.should == incremental.fingerprint
+			recalculated.recount
+			recalculated.fingerprint.should == incremental.fingerprint
+			recalculated.should be_equivalent_to( incremental )
+		end
+
 		it "has a default store" do
 			@graph.store.should be_an_instance_of( Redleaf::DEFAULT_STORE_CLASS )
 		end
@@ -184,6 +307,33 @@ describe Redleaf::Graph do
 			@graph.load( uri.to_s ).should == TEST_FOAF_TRIPLES.length
 		end
 
+		it "can serialize only the statements matching a pattern" do
+			ntriples = @graph.serialize_matching( ME, nil, nil, 'ntriples' )
+			expected = TEST_FOAF_TRIPLES.select {|s,p,o| s == ME }
+
+			ntriples.split( /\n/ ).should have( expected.length ).members
+		end
+
+		it "can serialize the statements matching a pattern to an IO" do
+			io = StringIO.new
+			@graph.serialize_matching( nil, FOAF[:phone], nil, 'ntriples', :io => io ).
+				should equal( io )
+			io.string.should =~ /#{Regexp.escape FOAF[:phone].to_s}/
+		end
+
+		it "raises an error and can serialize again if the target can't be written to" do
+			expect {
+				@graph.serialize_matching( nil, nil, nil, 'ntriples', :io => Object.new )
+			}.to raise_error( ArgumentError, /can't write/i )
+			@graph.serialize_matching( nil, nil, nil, 'ntriples' ).should be_a( String )
+		end
+
+		it "raises a FeatureError if asked to serialize matching statements to an unsupported format" do
+			expect {
+				@graph.serialize_matching( ME, nil, nil, 'zebras' )
+			}.to raise_error( Redleaf::FeatureError, /unsupported/i )
+		end
+
 		it "can sync itself to the underlying store" do
 			@graph.sync.should be_true()
 		end
@@ -285,6 +435,52 @@ describe Redleaf::Graph do
 			}.to raise_error( ArgumentError, /can't convert a Redleaf::Graph to a statement/i )
 		end
 
+		it "can delete matching statements without returning them" do
+			@graph.delete_matching( ME, nil, nil ).should == 9
+
+			@graph.size.should == 3
+			@graph[ ME, nil, nil ].should be_empty()
+		end
+
+		it "can return the statements it deletes if asked to" do
+			stmts = @graph.delete_matching( nil, FOAF[:phone], nil, :return_statements => true )
+
+			stmts.should have(1).members
+			stmts[0].should be_an_instance_of( Redleaf::Statement )
+			stmts[0].object.should == URI('tel:303.555.1212')
+			@graph[ nil, FOAF[:phone], nil ].should be_empty()
+		end
+
+		it "returns zero if no statements match a deletion" do
+			@graph.delete_matching( nil, FOAF[:weblog], nil ).should == 0
+			@graph.size.should == 12
+		end
+
+		it "keeps its fingerprint up to date when deleting matching statements" do
+			expected = Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES.reject {|t| t[0] == ME } )
+			@graph.fingerprint
+
+			@graph.delete_matching( ME, nil, nil )
+
+			@graph.fingerprint.should == expected.fingerprint
+		end
+
+		it "remembers its size until its statements change" do
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.cached_size.should == TEST_FOAF_TRIPLES.length
+			@graph.inspect.should =~ /#{TEST_FOAF_TRIPLES.length} statements/
+		end
+
+		it "doesn't count its statements when inspected" do
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+			@graph.inspect.should =~ /(uncounted|#{TEST_FOAF_TRIPLES.length + 1}) statements/
+		end
+
+		it "can be told to recount its statements" do
+			@graph.recount.should == TEST_FOAF_TRIPLES.length
+			@graph.cached_size.should == TEST_FOAF_TRIPLES.length
+		end
+
 		it "can find statements which contain nodes that match specified ones" do
 			stmts = @graph[ ME, nil, nil ]
 
@@ -434,6 +630,437 @@ describe Redleaf::Graph do
 			oldstore.graph.statements.should have( TEST_FOAF_TRIPLES.length ).members
 		end
 
+		it "can return the union of itself and another graph" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[0..3] )
+			other_graph << [ ME, FOAF[:nick], 'ged' ]
+
+			union = @graph | other_graph
+			union.should be_an_instance_of( Redleaf::Graph )
+			union.size.should == TEST_FOAF_TRIPLES.length + 1
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+		it "can return the intersection of itself and another graph" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[0..3] )
+			other_graph << [ ME, FOAF[:nick], 'ged' ]
+
+			intersection = @graph & other_graph
+			intersection.size.should == 4
+			intersection.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES[0..3] )
+		end
+
+		it "can return the difference between itself and another graph" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[0..3] )
+
+			difference = @graph - other_graph
+			difference.size.should == TEST_FOAF_TRIPLES.length - 4
+			difference.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES[4..-1] )
+		end
+
+		it "can put the results of a set operation into a specified store" do
+			store = Redleaf::Store.create( :hashes )
+			result = @graph.difference( Redleaf::Graph.new, store )
+			result.store.should == store
+			result.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+		it "can subtract another graph's statements from itself in place" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[0..3] )
+
+			@graph.subtract!( other_graph ).should equal( @graph )
+			@graph.size.should == TEST_FOAF_TRIPLES.length - 4
+		end
+
+		it "can intersect itself with another graph in place" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[0..3] )
+
+			@graph.intersect!( other_graph ).should equal( @graph )
+			@graph.size.should == 4
+		end
+
+		it "can merge in and intersect with a changed duplicate of itself in place" do
+			copy = @graph.dup
+			copy << [ ME, FOAF[:nick], 'ged' ]
+			@graph.remove( TEST_FOAF_TRIPLES.first )
+
+			@graph.union!( copy ).should equal( @graph )
+			@graph.size.should == TEST_FOAF_TRIPLES.length + 1
+			@graph.should include( [ME, FOAF[:nick], 'ged'] )
+
+			copy.remove( TEST_FOAF_TRIPLES.last )
+			@graph.intersect!( copy )
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should_not include( TEST_FOAF_TRIPLES.last )
+		end
+
+		it "can compute the statements added and removed relative to another graph" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[2..-1] )
+			other_graph << [ ME, FOAF[:nick], 'ged' ]
+
+			added, removed = @graph.diff( other_graph )
+			added.statements.should == [ Redleaf::Statement.new(ME, FOAF[:nick], 'ged') ]
+			removed.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES[0..1] )
+		end
+
+		it "can apply the delta from a diff to make itself the same as another graph" do
+			other_graph = Redleaf::Graph.new
+			other_graph.append( *TEST_FOAF_TRIPLES[2..-1] )
+			other_graph << [ ME, FOAF[:nick], 'ged' ]
+
+			@graph.apply_patch( *@graph.diff(other_graph) ).should equal( @graph )
+			@graph.should === other_graph
+			@graph.fingerprint.should == other_graph.fingerprint
+		end
+
+		it "can apply a patch specified as triples" do
+			@graph.apply_patch( [[ME, FOAF[:nick], 'ged']], [TEST_FOAF_TRIPLES.first] )
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should include( [ME, FOAF[:nick], 'ged'] )
+			@graph.should_not include( TEST_FOAF_TRIPLES.first )
+		end
+
+		it "commits the changes made in a transaction block" do
+			rval = @graph.transaction do |graph|
+				graph.should equal( @graph )
+				@graph.remove( TEST_FOAF_TRIPLES.first )
+				@graph << [ ME, FOAF[:nick], 'ged' ]
+				@graph.should include( [ME, FOAF[:nick], 'ged'] )
+				:done
+			end
+
+			rval.should == :done
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should include( [ME, FOAF[:nick], 'ged'] )
+			@graph.should_not include( TEST_FOAF_TRIPLES.first )
+			@graph.fingerprint.should ==
+				Redleaf::Graph.new.append( *@graph.statements ).fingerprint
+		end
+
+		it "discards the changes made in a transaction block that raises" do
+			original = @graph.fingerprint
+
+			expect {
+				@graph.transaction do
+					@graph << [ ME, FOAF[:nick], 'ged' ]
+					@graph.remove([ ME, nil, nil ])
+					raise "oops"
+				end
+			}.to raise_error( RuntimeError, "oops" )
+
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+			@graph.fingerprint.should == original
+		end
+
+		it "makes the changes of a nested transaction part of the outer one" do
+			@graph.transaction do
+				@graph.transaction { @graph << [ME, FOAF[:nick], 'ged'] }
+				@graph.should include( [ME, FOAF[:nick], 'ged'] )
+			end
+
+			@graph.should include( [ME, FOAF[:nick], 'ged'] )
+		end
+
+		it "discards a patch applied in a transaction block that raises" do
+			expect {
+				@graph.transaction do
+					@graph.apply_patch( [[ME, FOAF[:nick], 'ged']], [TEST_FOAF_TRIPLES.first] )
+					raise "oops"
+				end
+			}.to raise_error( RuntimeError, "oops" )
+
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should include( TEST_FOAF_TRIPLES.first )
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+		end
+
+		it "discards statements deleted in a transaction block that raises" do
+			expect {
+				@graph.transaction do
+					@graph.delete_matching( ME, nil, nil )
+					raise "oops"
+				end
+			}.to raise_error( RuntimeError, "oops" )
+
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should include( TEST_FOAF_TRIPLES.first )
+		end
+
+		it "doesn't allow its store to be changed during a transaction" do
+			expect {
+				@graph.transaction { @graph.store = Redleaf::HashesStore.new }
+			}.to raise_error( Redleaf::Error, /transaction/i )
+		end
+
+		it "can make an overlay of itself for trying out changes" do
+			overlay = @graph.overlay
+			overlay.store.should be_an_instance_of( Redleaf::OverlayStore )
+			overlay.fingerprint.should == @graph.fingerprint
+
+			overlay.remove( TEST_FOAF_TRIPLES.first )
+			overlay << [ ME, FOAF[:nick], 'ged' ]
+			overlay.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should include( TEST_FOAF_TRIPLES.first )
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+		end
+
+		it "duplicates an overlay by making another overlay of the same base" do
+			overlay = @graph.overlay
+			overlay << [ ME, FOAF[:nick], 'ged' ]
+
+			copy = overlay.dup
+			copy.store.should_not equal( overlay.store )
+			copy.store.base.should equal( @graph.store )
+			copy.should === overlay
+
+			copy.remove([ ME, FOAF[:nick], 'ged' ])
+			overlay.should include( [ME, FOAF[:nick], 'ged'] )
+		end
+
+		it "doesn't keep stale copies of its base's fingerprint and size in an overlay" do
+			@graph.fingerprint
+			@graph.size
+			overlay = @graph.overlay
+
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+			overlay.size.should == TEST_FOAF_TRIPLES.length + 1
+			overlay.should === @graph
+		end
+
+		it "can be dumped to a String and loaded again" do
+			dump = @graph.dump
+			dump.should =~ /\ARLEAFDMP/
+
+			loaded = Redleaf::Graph.load_dump( dump )
+			loaded.should_not equal( @graph )
+			loaded.should === @graph
+			loaded.fingerprint.should == @graph.fingerprint
+		end
+
+		it "can be dumped to and loaded from an IO" do
+			io = StringIO.new
+			@graph.dump( io ).should equal( io )
+
+			io.rewind
+			Redleaf::Graph.load_dump( io ).should === @graph
+		end
+
+		it "loads a dump into the store given as the :store option" do
+			store = Redleaf::HashesStore.new
+			loaded = Redleaf::Graph.load_dump( @graph.dump, :store => store )
+			loaded.store.should equal( store )
+			loaded.should === @graph
+		end
+
+		it "can be round-tripped through Marshal" do
+			Marshal.load( Marshal.dump(@graph) ).should === @graph
+		end
+
+		it "raises an error when loading a truncated dump whose header claims huge counts" do
+			many_terms = "RLEAFDMP\x01\x00\x80\x80\x80\x80\x08"
+			huge_term  = "RLEAFDMP\x01\x00\x01\x80\x80\x80\x80\x80\x20"
+
+			[ many_terms, huge_term ].each do |dump|
+				expect {
+					Redleaf::Graph.load_dump( dump )
+				}.to raise_error( Redleaf::Error, /unexpected end of input/i )
+			end
+		end
+
+		it "raises an error when loading something that isn't a dump" do
+			expect {
+				Redleaf::Graph.load_dump( "not a dump" )
+			}.to raise_error( Redleaf::Error, /not a redleaf dump/i )
+		end
+
+	end
+
+
+	describe "with statements in named contexts" do
+		before( :each ) do
+			@people = 'http://example.org/people'
+			@work   = 'http://example.org/work'
+
+			# The default store doesn't have contexts
+			@graph = Redleaf::Graph.new( Redleaf::HashesStore.new(:contexts => 'yes') )
+			@graph.append( *(TEST_FOAF_TRIPLES[0,4] + [{ :context => @people }]) )
+			@graph.append( *(TEST_FOAF_TRIPLES[4..-1] + [{ :context => @work }]) )
+		end
+
+		it "is on a store that supports contexts" do
+			@graph.should be_supports_contexts()
+		end
+
+
+		it "can search only the statements in one context" do
+			stmts = @graph.search( ME, nil, nil, :context => @people )
+			stmts.should_not be_empty()
+			stmts.should have_at_most(4).members
+			stmts.all? {|stmt| stmt.subject == ME }.should be_true()
+			@graph.search( nil, nil, nil, :context => @people ).should have(4).members
+		end
+
+		it "can iterate over the statements in one context" do
+			stmts = []
+			@graph.each_statement( :context => @work ) {|stmt| stmts << stmt }
+			stmts.should have( TEST_FOAF_TRIPLES.length - 4 ).members
+		end
+
+		it "can find the subjects and objects in one context" do
+			subjects = @graph.subjects( nil, nil, :context => @people )
+			subjects.should == subjects.uniq
+			subjects.should include( ME )
+
+			objects = @graph.objects( nil, nil, :context => @work )
+			objects.should == objects.uniq
+			objects.should_not be_empty()
+		end
+
+		it "knows how many statements are in each context" do
+			@graph.size( :context => @people ).should == 4
+			@graph.size( :context => @work ).should == TEST_FOAF_TRIPLES.length - 4
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+		it "keeps its context sizes up to date as statements are appended and removed" do
+			@graph.size( :context => @people ).should == 4
+
+			@graph.append( [ME, FOAF[:nick], 'ged'], :context => @people )
+			@graph.append( [ME, FOAF[:nick], 'ged'], :context => @people )
+			@graph.size( :context => @people ).should == 5
+
+			@graph.delete_matching( ME, FOAF[:nick], nil, :context => @people ).should == 1
+			@graph.size( :context => @people ).should == 4
+
+			@graph.remove([ nil, nil, nil ])
+			@graph.size( :context => @people ).should == 0
+		end
+
+		it "doesn't count statements added without a context in any context" do
+			@graph.size( :context => @people ).should == 4
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+			@graph.size( :context => @people ).should == 4
+		end
+
+		it "can iterate over its statements along with their contexts" do
+			quads = []
+			@graph.each_quad {|*quad| quads << quad }
+
+			quads.should have( TEST_FOAF_TRIPLES.length ).members
+			quads.select {|quad| quad[3] == URI(@people) }.should have(4).members
+			quads.should include([ ME, FOAF[:name], 'Michael Granger', URI(@people) ])
+		end
+
+		it "can find statements along with their contexts" do
+			quads = @graph.search_quads( ME, FOAF[:homepage], nil )
+			quads.should == [[ ME, FOAF[:homepage], URI('http://deveiate.org/'), URI(@work) ]]
+		end
+
+		it "can find statements in one context along with it" do
+			@graph.append( [ME, FOAF[:nick], 'ged'], :context => @work )
+			@graph.append( [ME, FOAF[:nick], 'ged'], :context => @people )
+
+			quads = @graph.search_quads( ME, FOAF[:nick], nil, :context => @work )
+			quads.should == [[ ME, FOAF[:nick], 'ged', URI(@work) ]]
+			@graph.search_quads( ME, FOAF[:homepage], nil, :context => @people ).should be_empty()
+		end
+
+		it "returns nil as the context of statements that aren't in one" do
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+			@graph.search_quads( nil, FOAF[:nick], nil ).should ==
+				[[ ME, FOAF[:nick], 'ged', nil ]]
+		end
+
+		it "keeps the contexts of the changes made in a transaction block" do
+			@graph.transaction do
+				@graph.append( [ME, FOAF[:nick], 'ged'], :context => @people )
+				@graph.drop_context( @work )
+			end
+
+			@graph.size( :context => @people ).should == 5
+			@graph.size( :context => @work ).should == 0
+		end
+
+		it "puts its contexts back when a transaction block raises" do
+			original = @graph.fingerprint
+
+			expect {
+				@graph.transaction do
+					@graph.append( [ME, FOAF[:nick], 'ged'], :context => @people )
+					@graph.drop_context( @work )
+					raise "oops"
+				end
+			}.to raise_error( RuntimeError, "oops" )
+
+			@graph.size( :context => @people ).should == 4
+			@graph.size( :context => @work ).should == TEST_FOAF_TRIPLES.length - 4
+			@graph.search_quads( ME, FOAF[:homepage], nil ).should ==
+				[[ ME, FOAF[:homepage], URI('http://deveiate.org/'), URI(@work) ]]
+			@graph.fingerprint.should == original
+		end
+
+		it "puts statements back in the contexts they were in when a transaction block raises" do
+			homepage = [ ME, FOAF[:homepage], URI('http://deveiate.org/') ]
+
+			expect {
+				@graph.transaction do
+					@graph.remove( homepage )
+					@graph.append( homepage, :context => @people )
+					raise "oops"
+				end
+			}.to raise_error( RuntimeError, "oops" )
+
+			@graph.search_quads( *homepage ).should == [ homepage + [URI(@work)] ]
+			@graph.size( :context => @people ).should == 4
+		end
+
+		it "can drop all the statements in a context at once" do
+			@graph.drop_context( @people ).should equal( @graph )
+			@graph.size( :context => @people ).should == 0
+			@graph.size( :context => @work ).should == TEST_FOAF_TRIPLES.length - 4
+			@graph.search( ME, FOAF[:name], nil ).should be_empty()
+		end
+
+		it "can replace the statements in a context with those in another graph" do
+			fresh = Redleaf::Graph.new
+			fresh << [ ME, FOAF[:nick], 'ged' ] << [ ME, FOAF[:name], 'Michael Granger' ]
+			old_fingerprint = @graph.fingerprint
+
+			@graph.replace_context( @people, fresh ).should equal( @graph )
+
+			@graph.size( :context => @people ).should == 2
+			@graph.search( ME, FOAF[:givenname], nil ).should be_empty()
+			@graph.search( ME, FOAF[:nick], nil, :context => @people ).should have(1).member
+			@graph.size( :context => @work ).should == TEST_FOAF_TRIPLES.length - 4
+			@graph.fingerprint.should_not == old_fingerprint
+		end
+
+		it "can replace the statements in a context with an Array of triples" do
+			@graph.replace_context( @work, [[ME, FOAF[:nick], 'ged']] )
+			@graph.size( :context => @work ).should == 1
+			@graph.objects( ME, FOAF[:nick], :context => @work ).should == [ 'ged' ]
+		end
+
+		it "leaves the context alone if a replacement statement is invalid" do
+			expect {
+				@graph.replace_context( @people, [[ME, FOAF[:nick], 'ged'], [ME]] )
+			}.to raise_error( ArgumentError )
+			@graph.size( :context => @people ).should == 4
+		end
+
+		it "refuses to replace the statements in a nil context" do
+			expect {
+				@graph.replace_context( nil, [[ME, FOAF[:nick], 'ged']] )
+			}.to raise_error( ArgumentError, /nil context/ )
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
 	end
 
 
@@ -14,6 +14,7 @@ BEGIN {
 }
 
 require 'rspec'
+require 'stringio'
 
 require 'spec/lib/helpers'
 
@@ -65,4 +66,49 @@ describe Redleaf::BindingQueryResult do
 		end
 	end
 
+	it "can write itself as SPARQL JSON" do
+		json = @result.to_json
+		json.should =~ /\A\{"head":\{"vars":\["s","p","o"\]\},"results":\{"bindings":\[/
+		json.scan( /"s":\{"type":/ ).should have( 12 ).members
+	end
+
+	it "can write itself as SPARQL CSV" do
+		lines = @result.to_csv.split( "\r\n" )
+		lines.first.should == 's,p,o'
+		lines.should have( 13 ).members
+	end
+
+	it "can write itself as SPARQL TSV" do
+		lines = @result.to_tsv.split( "\n" )
+		lines.first.should == "?s\t?p\t?o"
+		lines[1..-1].each {|line| line.should =~ /\A(<[^>]+>|_:\S+)\t<[^>]+>\t/ }
+	end
+
+	it "can stream itself to an IO" do
+		io = StringIO.new
+		@result.to_csv( io ).should equal( io )
+		io.string.split( "\r\n" ).should have( 13 ).members
+	end
+
+	it "writes the same output from cached rows as when streaming" do
+		other = @graph.query( SELECT_SPARQL_QUERY )
+		other.rows
+		other.to_tsv.split( "\n" ).sort.should == @result.to_tsv.split( "\n" ).sort
+	end
+
+	it "can still be read after it's been streamed" do
+		csv = @result.to_csv
+		@result.to_csv.should == csv
+		@result.length.should == 12
+		@result.rows.should have(12).members
+	end
+
+	it "raises an error instead of returning no rows after being written by a formatter" do
+		@result.formatted_as_io( 'xml', StringIO.new )
+		expect { @result.rows }.to raise_error( Redleaf::Error, /already been read/i )
+		expect {
+			@result.formatted_as_io( 'xml', StringIO.new )
+		}.to raise_error( Redleaf::Error, /already been read/i )
+	end
+
 end
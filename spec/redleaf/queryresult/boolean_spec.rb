@@ -58,5 +58,9 @@ describe Redleaf::BooleanQueryResult do
 		@result.value.should equal( true )
 	end
 
+	it "can write itself as SPARQL JSON" do
+		@result.to_json.should == %Q{{"head":{},"boolean":true}\n}
+	end
+
 end
 
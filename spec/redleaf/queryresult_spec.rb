@@ -49,5 +49,10 @@ describe Redleaf::QueryResult do
 		res.keys.should include( 'xml' )
 	end
 
+	it "caches its formatter registry" do
+		Redleaf::QueryResult.formatters.should equal( Redleaf::QueryResult.formatters )
+		Redleaf::QueryResult.formatters.should be_frozen()
+	end
+
 end
 
@@ -0,0 +1,154 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/caching'
+require 'redleaf/behavior/store'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::CachingStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	before( :each ) do
+		@base_graph = Redleaf::Graph.new
+		@base_graph.append( *TEST_FOAF_TRIPLES )
+		@store = Redleaf::CachingStore.new( @base_graph.store )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it_should_behave_like "a Redleaf::Store"
+
+
+	it "is registered as a supported backend" do
+		Redleaf::Store.backends.should include( 'caching' )
+	end
+
+	it "knows what store it reads through to" do
+		@store.base.should equal( @base_graph.store )
+	end
+
+	it "raises an error if its base isn't a store" do
+		expect {
+			Redleaf::CachingStore.new( :a_store )
+		}.to raise_error( TypeError, /expected a Redleaf::Store/i )
+	end
+
+
+	context "with an associated Redleaf::Graph" do
+
+		before( :each ) do
+			@graph = Redleaf::Graph.new( @store )
+		end
+
+		it "has the statements of its base" do
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.search( ME, nil, nil ).should have( 9 ).members
+		end
+
+		it "answers a repeated search from its cache" do
+			@graph.search( ME, nil, nil )
+			misses = @store.cache_stats[:misses]
+
+			@graph.search( ME, nil, nil ).should have( 9 ).members
+			@store.cache_stats[:misses].should == misses
+			@store.cache_stats[:hits].should >= 1
+			@store.cache_stats[:hit_rate].should > 0
+		end
+
+		it "caches negative answers" do
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+			hits = @store.cache_stats[:hits]
+
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+			@store.cache_stats[:hits].should == hits + 1
+		end
+
+		it "drops cached answers affected by statements appended through it" do
+			@graph.search( ME, FOAF[:nick], nil ).should be_empty()
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+
+			@graph.search( ME, FOAF[:nick], nil ).should have( 1 ).member
+			@base_graph.should include( [ME, FOAF[:nick], 'ged'] )
+			@store.cache_stats[:invalidations].should >= 1
+		end
+
+		it "drops cached answers affected by statements removed through it" do
+			@graph.search( ME, FOAF[:phone], nil ).should have( 1 ).member
+			@graph.remove([ ME, FOAF[:phone], nil ])
+
+			@graph.search( ME, FOAF[:phone], nil ).should be_empty()
+			@base_graph.search( ME, FOAF[:phone], nil ).should be_empty()
+		end
+
+		it "evicts the least recently used answers when it's full" do
+			store = Redleaf::CachingStore.new( @base_graph.store, nil, :capacity => 2 )
+			graph = Redleaf::Graph.new( store )
+
+			graph.search( ME, nil, nil )
+			graph.search( :mahlon, nil, nil )
+			graph.search( nil, FOAF[:name], nil )
+
+			store.cache_stats[:entries].should == 2
+			store.cache_stats[:evictions].should == 1
+		end
+
+		it "can have its cache cleared" do
+			@graph.search( ME, nil, nil )
+			@store.clear_cache.should equal( @store )
+			@store.cache_stats[:entries].should == 0
+		end
+
+		it "keeps the cached size and fingerprint of its base's graph current" do
+			size = @base_graph.size
+			fingerprint = @base_graph.fingerprint
+
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+
+			@base_graph.size.should == size + 1
+			@base_graph.fingerprint.should_not == fingerprint
+		end
+
+		it "is duplicated along with a copy of its base" do
+			copy = @graph.dup
+			copy.store.should be_an_instance_of( Redleaf::CachingStore )
+			copy.store.base.should_not equal( @base_graph.store )
+
+			copy << [ ME, FOAF[:nick], 'ged' ]
+			copy.should include( [ME, FOAF[:nick], 'ged'] )
+			copy.store.base.graph.should be_nil()
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+			@base_graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
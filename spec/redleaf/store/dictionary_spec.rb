@@ -0,0 +1,165 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/dictionary'
+require 'redleaf/behavior/store'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::DictionaryStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	before( :each ) do
+		@store = Redleaf::DictionaryStore.new
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it_should_behave_like "a Redleaf::Store"
+
+
+	it "is registered as a supported backend" do
+		Redleaf::Store.backends.should include( 'dictionary' )
+		Redleaf::Store.create( :dictionary ).should be_an_instance_of( Redleaf::DictionaryStore )
+	end
+
+	it "doesn't have contexts" do
+		@store.graph = Redleaf::Graph.new
+		@store.should_not have_contexts()
+	end
+
+
+	context "with an associated Redleaf::Graph" do
+
+		before( :each ) do
+			@graph = Redleaf::Graph.new( @store )
+			@graph.append( *TEST_FOAF_TRIPLES )
+		end
+
+		it "stores each statement once" do
+			@graph.append( *TEST_FOAF_TRIPLES )
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+		it "can search for statements with any combination of bound nodes" do
+			@graph.search( ME, nil, nil ).should have( 9 ).members
+			@graph.search( nil, FOAF[:name], nil ).should have( 2 ).members
+			@graph.search( nil, nil, FOAF[:Person] ).should have( 2 ).members
+			@graph.search( ME, FOAF[:name], nil ).should have( 1 ).member
+			@graph.search( nil, RDF[:type], FOAF[:Person] ).should have( 2 ).members
+			@graph.search( ME, nil, "Michael" ).should have( 1 ).member
+			@graph.search( ME, FOAF[:name], "Michael Granger" ).should have( 1 ).member
+			@graph.search( nil, nil, nil ).should have( TEST_FOAF_TRIPLES.length ).members
+			@graph.search( ME, FOAF[:nick], nil ).should be_empty()
+		end
+
+		it "keeps its graph's size up to date without asking the store again" do
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.append( [ME, FOAF[:nick], 'ged'], TEST_FOAF_TRIPLES.first )
+			@graph.cached_size.should == TEST_FOAF_TRIPLES.length + 1
+			@graph.delete_matching( ME, nil, nil )
+			@graph.cached_size.should == 3
+			@graph.recount.should == 3
+		end
+
+		it "can remove statements" do
+			@graph.remove([ ME, nil, nil ]).should have( 9 ).members
+			@graph.size.should == 3
+			@graph.should_not include( TEST_FOAF_TRIPLES.first )
+		end
+
+		it "can be queried with SPARQL" do
+			sparql = %{
+				PREFIX foaf: <#{FOAF}>
+				SELECT ?name WHERE { ?person foaf:name ?name }
+			}
+			@graph.query( sparql ).rows.length.should == 2
+		end
+
+		it "is equivalent to the same graph in the default store" do
+			@graph.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES )
+		end
+
+		it "reports its memory use" do
+			stats = @store.statistics
+			stats[:statements].should == TEST_FOAF_TRIPLES.length
+			stats[:terms].should > 0
+			stats[:index_bytes].should > 0
+			stats[:bytes_per_statement].should ==
+				( stats[:index_bytes] + stats[:dictionary_bytes] ).to_f / stats[:statements]
+			stats[:index_bytes_per_statement].should < stats[:bytes_per_statement]
+		end
+
+		it "keeps iterating over the statements it had when an iteration started" do
+			seen = []
+			@graph.each_statement do |stmt|
+				seen << stmt
+				@graph << [ ME, FOAF[:nick], "nick #{seen.length}" ]
+				@graph.remove( stmt )
+			end
+
+			seen.length.should == TEST_FOAF_TRIPLES.length
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+		it "can make read-only versions of itself that don't change with it" do
+			version = @store.version
+			version.should be_read_only()
+			@store.should_not be_read_only()
+
+			@graph.remove([ ME, nil, nil ])
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+
+			view = Redleaf::Graph.new( version )
+			view.size.should == TEST_FOAF_TRIPLES.length
+			view.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES )
+			expect {
+				view << [ ME, FOAF[:nick], 'ged' ]
+			}.to raise_error( Redleaf::Error, /could not add/i )
+		end
+
+		it "is wrapped in a read-only graph by Graph#version" do
+			view = @graph.version
+			view.store.should be_read_only()
+			@graph.append( [ME, FOAF[:nick], 'ged'] )
+			view.size.should == TEST_FOAF_TRIPLES.length
+			view.fingerprint.should_not == @graph.fingerprint
+		end
+
+		it "keeps its statements when compacted" do
+			@graph.remove([ :mahlon, nil, nil ])
+			@store.compact.should equal( @store )
+			@graph.size.should == TEST_FOAF_TRIPLES.length - 3
+		end
+
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
@@ -14,10 +14,12 @@ BEGIN {
 }
 
 require 'rspec'
+require 'tmpdir'
 
 require 'spec/lib/helpers'
 
 require 'redleaf'
+require 'redleaf/graph'
 require 'redleaf/store/hashes'
 require 'redleaf/behavior/store'
 
@@ -113,6 +115,109 @@ describe Redleaf::HashesStore do
 
 	end
 
+
+	context "loaded with preloading" do
+
+		before( :all ) do
+			@path = File.join( Dir.tmpdir, "redleaf-spec-#{Process.pid}" )
+			store = Redleaf::HashesStore.new( @path, :new => true )
+			Redleaf::Graph.new( store ).append( *TEST_FOAF_TRIPLES )
+			store.sync
+		end
+
+		after( :all ) do
+			Dir.glob( @path + '-*.db' ).each {|path| File.unlink(path) }
+		end
+
+		it "reads the store's files in the background" do
+			totals = []
+			store = Redleaf::HashesStore.load( @path, :preload => :all ) {|read, total| totals << read }
+
+			store.wait_until_warm( 10 ).should be_true()
+			store.should be_warm()
+			store.bdb_files.should_not be_empty()
+
+			read, total = store.preload_progress
+			read.should == total
+			total.should == store.bdb_files.inject( 0 ) {|sum, path| sum + File.size(path) }
+			totals.last.should == total
+		end
+
+		it "can preload only the store's statement indexes" do
+			store = Redleaf::HashesStore.load( @path )
+			store.bdb_files( :indexes ).length.should == Redleaf::HashesStore::INDEX_HASHES.length
+			store.preload( :indexes ).join
+			store.should be_warm()
+		end
+
+		it "doesn't pass the preload option on to Redland" do
+			store = Redleaf::HashesStore.load( @path, :preload => :indexes )
+			store.opthash.should_not have_key( :preload )
+		end
+
+		it "rejects unknown preload targets" do
+			store = Redleaf::HashesStore.load( @path )
+			expect {
+				store.preload( :everything )
+			}.to raise_error( ArgumentError, /expected :indexes or :all/ )
+		end
+
+	end
+
+
+	context "in memory" do
+
+		it "is always warm" do
+			store = Redleaf::HashesStore.new( :preload => :all )
+			store.bdb_files.should be_empty()
+			store.should be_warm()
+		end
+
+	end
+
+
+	context "with statements in it" do
+
+		before( :each ) do
+			@store = Redleaf::HashesStore.new
+			Redleaf::Graph.new( @store ).append( *TEST_FOAF_TRIPLES )
+			@target = Redleaf::HashesStore.new
+		end
+
+		it "can copy them to another store" do
+			@store.copy_to( @target ).should == TEST_FOAF_TRIPLES.length
+			@target.graph.size.should == TEST_FOAF_TRIPLES.length
+			@target.graph.should be_equivalent_to( @store.graph )
+		end
+
+		it "can copy them to another graph's store" do
+			graph = Redleaf::Graph.new( @target )
+			@store.copy_to( graph )
+			graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+		it "reports its progress after each batch of statements it copies" do
+			totals = []
+			@store.copy_to( @target, :batch_size => 5 ) {|copied| totals << copied }
+			totals.should == [ 5, 10, TEST_FOAF_TRIPLES.length ]
+		end
+
+		it "can resume an interrupted copy" do
+			@store.copy_to( @target, :batch_size => 5 ) {|copied| break }
+			@target.graph.size.should == 5
+
+			@store.copy_to( @target, :skip => 5 ).should == TEST_FOAF_TRIPLES.length
+			@target.graph.should be_equivalent_to( @store.graph )
+		end
+
+		it "refuses to copy them into something other than a store" do
+			expect {
+				@store.copy_to( :a_store )
+			}.to raise_error( TypeError, /expected a Redleaf::Store/i )
+		end
+
+	end
+
 end
 
 # vim: set nosta noet ts=4 sw=4:
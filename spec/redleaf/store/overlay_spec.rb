@@ -0,0 +1,124 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/overlay'
+require 'redleaf/store/snapshot'
+require 'redleaf/behavior/store'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::OverlayStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	before( :each ) do
+		@base_graph = Redleaf::Graph.new
+		@base_graph.append( *TEST_FOAF_TRIPLES )
+		@store = Redleaf::OverlayStore.new( @base_graph.store )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it_should_behave_like "a Redleaf::Store"
+
+
+	it "is registered as a supported backend" do
+		Redleaf::Store.backends.should include( 'overlay' )
+	end
+
+	it "knows what store it's layered over" do
+		@store.base.should equal( @base_graph.store )
+	end
+
+	it "can be created from a graph instead of a store" do
+		Redleaf::OverlayStore.new( @base_graph ).base.should equal( @base_graph.store )
+	end
+
+	it "raises an error if its base isn't a store" do
+		expect {
+			Redleaf::OverlayStore.new( :a_store )
+		}.to raise_error( TypeError, /expected a Redleaf::Store/i )
+	end
+
+
+	context "with an associated Redleaf::Graph" do
+
+		before( :each ) do
+			@graph = Redleaf::Graph.new( @store )
+		end
+
+		it "has the statements of its base" do
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should === @base_graph
+			@graph.search( ME, nil, nil ).should have( 9 ).members
+		end
+
+		it "records added statements without changing its base" do
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+			@graph.size.should == TEST_FOAF_TRIPLES.length + 1
+			@graph.should include( [ME, FOAF[:nick], 'ged'] )
+			@base_graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+			@store.changes.should == [ [Redleaf::Statement.new(ME, FOAF[:nick], 'ged')], [] ]
+		end
+
+		it "records removed statements without changing its base" do
+			@graph.remove([ ME, nil, nil ]).should have( 9 ).members
+			@graph.size.should == 3
+			@graph.should_not include( TEST_FOAF_TRIPLES.first )
+			@base_graph.size.should == TEST_FOAF_TRIPLES.length
+			@store.changes.last.should have( 9 ).members
+		end
+
+		it "doesn't record adding a statement that's already in its base" do
+			@graph.append( *TEST_FOAF_TRIPLES )
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@store.changes.should == [ [], [] ]
+		end
+
+		it "forgets the removal of a statement that's added back" do
+			@graph.remove( TEST_FOAF_TRIPLES.first )
+			@graph << TEST_FOAF_TRIPLES.first
+			@graph.should === @base_graph
+			@store.changes.should == [ [], [] ]
+		end
+
+		it "sees changes made to its base after it was counted" do
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.fingerprint
+
+			@base_graph << [ ME, FOAF[:nick], 'ged' ]
+
+			@graph.size.should == TEST_FOAF_TRIPLES.length + 1
+			@graph.should === @base_graph
+		end
+
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
@@ -0,0 +1,144 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/sharded'
+require 'redleaf/behavior/store'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::ShardedStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	before( :each ) do
+		@shards = (0...3).collect { Redleaf::HashesStore.new }
+		@store = Redleaf::ShardedStore.new( @shards )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it_should_behave_like "a Redleaf::Store"
+
+
+	it "is registered as a supported backend" do
+		Redleaf::Store.backends.should include( 'sharded' )
+	end
+
+	it "knows what stores it's partitioned across" do
+		@store.shards.should == @shards
+	end
+
+	it "raises an error if it isn't given any shards" do
+		expect {
+			Redleaf::ShardedStore.new( [] )
+		}.to raise_error( ArgumentError, /at least one shard/i )
+	end
+
+	it "raises an error if one of its shards isn't a store" do
+		expect {
+			Redleaf::ShardedStore.new([ @shards.first, :a_store ])
+		}.to raise_error( TypeError, /expected a Redleaf::Store/i )
+	end
+
+
+	it "can be copied into from a store with contexts when its shards have none" do
+		source = Redleaf::Graph.new( Redleaf::HashesStore.new(:contexts => 'yes') )
+		source.append( *(TEST_FOAF_TRIPLES + [{ :context => 'http://example.org/people' }]) )
+		source.should be_supports_contexts()
+
+		source.store.copy_to( @store ).should == TEST_FOAF_TRIPLES.length
+		Redleaf::Graph.new( @store ).size.should == TEST_FOAF_TRIPLES.length
+	end
+
+
+	context "with an associated Redleaf::Graph" do
+
+		before( :each ) do
+			@graph = Redleaf::Graph.new( @store )
+			@graph.append( *TEST_FOAF_TRIPLES )
+		end
+
+		it "has all the statements appended to it" do
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+			@graph.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES )
+			@graph[ nil, RDF[:type], FOAF[:Person] ].should have( 2 ).members
+		end
+
+		it "keeps all the statements about a subject in the same shard" do
+			shard = @store.shard_for( ME )
+			shard_graph = Redleaf::Graph.new( shard )
+
+			shard_graph[ ME, nil, nil ].should have( 9 ).members
+			@graph[ ME, nil, nil ].should have( 9 ).members
+		end
+
+		it "spreads different subjects across its shards" do
+			subjects = (1..30).collect {|i| URI("http://example.org/item#{i}") }
+			subjects.each {|subject| @graph << [subject, RDF[:type], FOAF[:Document]] }
+
+			subjects.collect {|subject| @store.shard_for(subject) }.uniq.length.should > 1
+			@graph[ nil, RDF[:type], FOAF[:Document] ].should have( 30 ).members
+		end
+
+		it "removes statements from the right shard" do
+			@graph.remove([ ME, FOAF[:phone], nil ]).should have( 1 ).member
+			@graph.should_not include( [ME, FOAF[:phone], URI('tel:303.555.1212')] )
+			@graph.size.should == TEST_FOAF_TRIPLES.length - 1
+		end
+
+		it "keeps the cached sizes and fingerprints of its shards' graphs current" do
+			shard_graph = Redleaf::Graph.new( @store.shard_for(ME) )
+			size = shard_graph.size
+			fingerprint = shard_graph.fingerprint
+
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+
+			shard_graph.size.should == size + 1
+			shard_graph.fingerprint.should_not == fingerprint
+		end
+
+		it "is duplicated along with copies of its shards" do
+			copy = @graph.dup
+			copy.store.should be_an_instance_of( Redleaf::ShardedStore )
+			copy.store.shards.should have( @shards.length ).members
+			copy.store.shards.each do |shard|
+				@shards.should_not include( shard )
+			end
+
+			copy << [ ME, FOAF[:nick], 'ged' ]
+			copy.should include( [ME, FOAF[:nick], 'ged'] )
+			copy.store.shard_for( ME ).should_not equal( @store.shard_for(ME) )
+			@graph.should_not include( [ME, FOAF[:nick], 'ged'] )
+			@graph.size.should == TEST_FOAF_TRIPLES.length
+		end
+
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
@@ -0,0 +1,88 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+require 'tmpdir'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/snapshot'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::SnapshotStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+		@snapshot = File.join( Dir.tmpdir, "redleaf-spec-#{Process.pid}.snapshot" )
+		graph = Redleaf::Graph.new
+		graph.append( *TEST_FOAF_TRIPLES )
+		graph.write_snapshot( @snapshot )
+	end
+
+	before( :each ) do
+		@store = Redleaf::SnapshotStore.new( @snapshot )
+		@graph = Redleaf::Graph.new( @store )
+	end
+
+	after( :all ) do
+		File.unlink( @snapshot ) if File.exist?( @snapshot )
+		reset_logging()
+	end
+
+
+	it "is persistent" do
+		@store.should be_persistent()
+	end
+
+	it "contains the statements of the graph the snapshot was written from" do
+		@graph.size.should == TEST_FOAF_TRIPLES.length
+		@graph.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES )
+	end
+
+	it "can search for statements with any combination of bound nodes" do
+		@graph.search( ME, nil, nil ).should have( 9 ).members
+		@graph.search( nil, FOAF[:name], nil ).should have( 2 ).members
+		@graph.search( nil, RDF[:type], FOAF[:Person] ).should have( 2 ).members
+		@graph.should include( TEST_FOAF_TRIPLES.last )
+	end
+
+	it "is read-only" do
+		expect {
+			@graph << [ ME, FOAF[:nick], 'ged' ]
+		}.to raise_error( Redleaf::Error, /could not add/i )
+	end
+
+	it "is duplicated into a writable overlay of the snapshot" do
+		copy = @graph.dup
+		copy.store.should be_an_instance_of( Redleaf::OverlayStore )
+		copy << [ ME, FOAF[:nick], 'ged' ]
+		copy.size.should == TEST_FOAF_TRIPLES.length + 1
+		@graph.size.should == TEST_FOAF_TRIPLES.length
+	end
+
+	it "raises an error if the file isn't a snapshot" do
+		expect {
+			Redleaf::SnapshotStore.new( __FILE__ )
+		}.to raise_error( Redleaf::StoreCreationError )
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
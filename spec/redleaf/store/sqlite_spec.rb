@@ -67,6 +67,43 @@ describe Redleaf::SQLiteStore do
 
 	end
 
+	it "can bulk-load statements through a separate connection" do
+		graph = Redleaf::Graph.new( @store )
+
+		count = @store.bulk_load do |bulkgraph|
+			bulkgraph.should_not equal( graph )
+			bulkgraph.store.opthash[:synchronous].should == 'off'
+			bulkgraph.append( *TEST_FOAF_TRIPLES )
+		end
+
+		count.should == TEST_FOAF_TRIPLES.length
+		graph.size.should == TEST_FOAF_TRIPLES.length
+	end
+
+	it "updates the size of its own graph after a bulk-load" do
+		graph = Redleaf::Graph.new( @store )
+		graph.size.should == 0
+		graph.fingerprint
+
+		@store.bulk_load {|bulkgraph| bulkgraph.append(*TEST_FOAF_TRIPLES) }
+
+		graph.size.should == TEST_FOAF_TRIPLES.length
+		graph.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES )
+	end
+
+	it "doesn't keep the statements from a bulk-load that raises" do
+		graph = Redleaf::Graph.new( @store )
+
+		expect {
+			@store.bulk_load do |bulkgraph|
+				bulkgraph.append( *TEST_FOAF_TRIPLES )
+				raise "oops"
+			end
+		}.to raise_error( RuntimeError, "oops" )
+
+		graph.size.should == 0
+	end
+
 end
 
 # vim: set nosta noet ts=4 sw=4:
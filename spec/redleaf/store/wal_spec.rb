@@ -0,0 +1,126 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+require 'tmpdir'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/wal'
+require 'redleaf/behavior/store'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::WALStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+		@log = File.join( Dir.tmpdir, "redleaf-spec-#{Process.pid}.wal" )
+	end
+
+	before( :each ) do
+		@store = Redleaf::WALStore.new( @log, :new => true )
+		@graph = Redleaf::Graph.new( @store )
+	end
+
+	after( :all ) do
+		[ @log, @log + '.snapshot' ].each {|path| File.unlink(path) if File.exist?(path) }
+		reset_logging()
+	end
+
+
+	it_should_behave_like "a Redleaf::Store"
+
+
+	it "is registered as a supported backend" do
+		Redleaf::Store.backends.should include( 'wal' )
+	end
+
+	it "is persistent" do
+		@store.should be_persistent()
+	end
+
+	it "keeps its snapshot next to its log" do
+		@store.snapshot_path.should == File.expand_path( @log ) + '.snapshot'
+	end
+
+	it "recovers its statements from its log" do
+		@graph.append( *TEST_FOAF_TRIPLES )
+		@graph.remove([ ME, FOAF[:name], nil ])
+		@store.sync
+
+		graph = Redleaf::Graph.new( Redleaf::WALStore.load(@log) )
+		graph.size.should == TEST_FOAF_TRIPLES.length - 1
+		graph.should_not include([ ME, FOAF[:name], nil ])
+	end
+
+	it "writes buffered records in groups" do
+		store = Redleaf::WALStore.new( @log, :new => true, :group_commit => 5 )
+		graph = Redleaf::Graph.new( store )
+		graph.append( *TEST_FOAF_TRIPLES )
+
+		store.statistics[:commits].should == 2
+		store.statistics[:buffered_records].should == 2
+		store.sync
+		store.statistics[:buffered_records].should == 0
+	end
+
+	it "discards a partly-written record at the end of its log" do
+		@graph.append( *TEST_FOAF_TRIPLES )
+		@store.sync
+		length = File.size( @log )
+		File.open( @log, 'ab' ) {|log| log.print "\x40\x00\x00\x00trunc" }
+
+		graph = Redleaf::Graph.new( Redleaf::WALStore.load(@log) )
+		graph.size.should == TEST_FOAF_TRIPLES.length
+		File.size( @log ).should == length
+	end
+
+	it "writes a snapshot and starts its log over when checkpointed" do
+		@graph.append( *TEST_FOAF_TRIPLES )
+		@store.checkpoint
+
+		@store.statistics[:log_records].should == 0
+		@store.statistics[:snapshots].should == 1
+		File.exist?( @store.snapshot_path ).should be_true()
+
+		@graph.remove([ ME, FOAF[:name], nil ])
+		@store.sync
+
+		graph = Redleaf::Graph.new( Redleaf::WALStore.load(@log) )
+		graph.size.should == TEST_FOAF_TRIPLES.length - 1
+	end
+
+	it "writes a snapshot by itself once its log is long enough" do
+		store = Redleaf::WALStore.new( @log, :new => true, :snapshot_every => 10 )
+		Redleaf::Graph.new( store ).append( *TEST_FOAF_TRIPLES )
+
+		store.statistics[:snapshots].should == 1
+		store.statistics[:log_records].should == TEST_FOAF_TRIPLES.length - 10
+	end
+
+	it "doesn't log adding statements it already has" do
+		@graph.append( *TEST_FOAF_TRIPLES )
+		@graph.append( *TEST_FOAF_TRIPLES )
+		@store.statistics[:log_records].should == TEST_FOAF_TRIPLES.length
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
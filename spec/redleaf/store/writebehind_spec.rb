@@ -0,0 +1,177 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'rbconfig'
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = libdir + Config::CONFIG['sitearch']
+
+	$LOAD_PATH.unshift( basedir ) unless $LOAD_PATH.include?( basedir )
+	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir ) unless $LOAD_PATH.include?( extdir )
+}
+
+require 'rspec'
+
+require 'spec/lib/helpers'
+
+require 'redleaf'
+require 'redleaf/graph'
+require 'redleaf/store/writebehind'
+require 'redleaf/behavior/store'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+describe Redleaf::WriteBehindStore do
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	before( :each ) do
+		@base_graph = Redleaf::Graph.new
+		@base_graph.append( *TEST_FOAF_TRIPLES[0,6] )
+		@store = Redleaf::WriteBehindStore.new( @base_graph.store )
+		@graph = Redleaf::Graph.new( @store )
+	end
+
+	after( :each ) do
+		@store.stop_flushing
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it_should_behave_like "a Redleaf::Store"
+
+
+	it "is registered as a supported backend" do
+		Redleaf::Store.backends.should include( 'writebehind' )
+	end
+
+	it "is a kind of overlay" do
+		@store.should be_a_kind_of( Redleaf::OverlayStore )
+		@store.base.should equal( @base_graph.store )
+	end
+
+	it "shows buffered changes to its readers before they're written to the base" do
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+		@graph.remove([ ME, FOAF[:name], nil ])
+
+		@graph.size.should == TEST_FOAF_TRIPLES.length - 1
+		@base_graph.size.should == 6
+		@store.pending_count.should == 7
+	end
+
+	it "writes buffered changes to the base when flushed" do
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+		@graph.remove([ ME, FOAF[:name], nil ])
+
+		@store.flush.should == 7
+
+		@store.pending_count.should == 0
+		@base_graph.size.should == TEST_FOAF_TRIPLES.length - 1
+		@base_graph.should_not include([ ME, FOAF[:name], nil ])
+		@graph.size.should == TEST_FOAF_TRIPLES.length - 1
+	end
+
+	it "calls its after_flush callbacks with the number of changes written" do
+		counts = []
+		@store.after_flush {|count| counts << count }
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+
+		@store.flush
+		@store.flush
+
+		counts.should == [ 6 ]
+	end
+
+	it "calls its after_flush callbacks when it's synced" do
+		counts = []
+		@store.after_flush {|count| counts << count }
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+
+		@store.sync
+
+		counts.should == [ 6 ]
+	end
+
+	it "calls its after_flush callbacks when it flushes by itself" do
+		store = Redleaf::WriteBehindStore.new( @base_graph.store, nil, :max_pending => 4 )
+		graph = Redleaf::Graph.new( store )
+		counts = []
+		store.after_flush {|count| counts << count }
+
+		graph.append( *TEST_FOAF_TRIPLES[6,4] )
+
+		counts.should == [ 4 ]
+		store.should_not be_flush_failed()
+	end
+
+	it "writes buffered changes to the base when synced" do
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+		@store.sync
+		@base_graph.size.should == TEST_FOAF_TRIPLES.length
+		@store.pending_count.should == 0
+	end
+
+	it "makes its base count its statements again when it flushes" do
+		@base_graph.size.should == 6
+		@base_graph.fingerprint
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+		@base_graph.size.should == 6
+
+		@store.flush
+
+		@base_graph.size.should == TEST_FOAF_TRIPLES.length
+		@base_graph.should === Redleaf::Graph.new.append( *TEST_FOAF_TRIPLES )
+	end
+
+	it "flushes by itself once max_pending changes are buffered" do
+		store = Redleaf::WriteBehindStore.new( @base_graph.store, nil, :max_pending => 4 )
+		graph = Redleaf::Graph.new( store )
+
+		graph.append( *TEST_FOAF_TRIPLES[6,3] )
+		@base_graph.size.should == 6
+		graph.append( TEST_FOAF_TRIPLES[9] )
+
+		store.pending_count.should == 0
+		@base_graph.size.should == 10
+	end
+
+	it "puts off flushing while a search over it is being read" do
+		store = Redleaf::WriteBehindStore.new( @base_graph.store, nil, :max_pending => 1 )
+		graph = Redleaf::Graph.new( store )
+		seen = []
+
+		graph.each_statement do |stmt|
+			seen << stmt
+			graph.append( TEST_FOAF_TRIPLES[6] ) if seen.length == 1
+			store.pending_count.should == 1
+		end
+
+		store.pending_count.should == 0
+		@base_graph.size.should == 7
+	end
+
+	it "can flush in the background" do
+		@graph.append( *TEST_FOAF_TRIPLES[6..-1] )
+		@store.flush_every( 0.05 )
+		@store.should be_flushing
+
+		sleep 0.5 until @store.pending_count.zero?
+
+		@base_graph.size.should == TEST_FOAF_TRIPLES.length
+		@store.stop_flushing
+		@store.should_not be_flushing
+	end
+
+end
+
+# vim: set nosta noet ts=4 sw=4:
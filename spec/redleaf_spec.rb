@@ -76,6 +76,15 @@ describe Redleaf do
 	end
 
 
+	it "can rebuild its capability registries" do
+		old_serializers = Redleaf::Graph.serializers
+		Redleaf.refresh_capabilities
+		Redleaf::Graph.serializers.should_not equal( old_serializers )
+		Redleaf::Graph.serializers.should == old_serializers
+		Redleaf::Store.backends.should be_frozen()
+	end
+
+
 	it "can generate a unique anonymous node ID" do
 		id = Redleaf.generate_id
 		id.should be_a( Symbol )